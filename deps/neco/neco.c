@@ -2300,7 +2300,7 @@ static size_t stack_align_size(size_t size, size_t boundary) {
 // allocate memory using mmap. Used primarily for stack group memory.
 static void *stack_mmap_alloc(size_t size) {
     void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
-        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (addr == MAP_FAILED || addr == NULL) {
         return NULL;
     }
@@ -628,6 +628,7 @@ struct client *createFakeClient(void)
     c->fd = -1;
     c->name = NULL;
     c->querybuf = sdsempty();
+    c->qb_pos = 0;
     c->querybuf_peak = 0;
     c->argc = 0;
     c->argv = NULL;
@@ -642,6 +643,7 @@ struct client *createFakeClient(void)
     c->obuf_soft_limit_reached_time = 0;
     c->watched_keys = listCreate();
     c->peerid = NULL;
+    c->qel = &server.qel;
     listSetFreeMethod(c->reply, decrRefCountVoid);
     listSetDupMethod(c->reply, dupClientReplyValue);
     initClientMultiState(c);
@@ -697,7 +699,7 @@ int loadAppendOnlyFile(char *filename)
     server.aof_state = AOF_OFF;
 
     fakeClient = createFakeClient();
-    startLoading(fp);
+    startLoadingFile(fp);
 
     while (1) {
         int argc, j;
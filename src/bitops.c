@@ -517,22 +517,31 @@ int getBitfieldTypeFromArgument(client *c, robj *o, int *sign, int *bits)
  * bits to a string object. The command creates or pad with zeroes the string
  * so that the 'maxbit' bit can be addressed. The object is finally
  * returned. Otherwise if the key holds a wrong type NULL is returned and
- * an error is sent to the client. */
-robj *lookupStringForBitCommand(client *c, size_t maxbit)
+ * an error is sent to the client.
+ *
+ * Worker threads may be reading the value meanwhile. When '*inplace' is set
+ * the caller only changes the byte holding 'maxbit', and stores it back with
+ * dbWriteStringValue() in a single store as SETBIT does: if the value already
+ * holds that byte and isn't shared the object in the keyspace is returned.
+ * Otherwise '*inplace' is cleared and the object returned is a copy that isn't
+ * in the keyspace yet: once written the caller stores it with dbOverwrite(),
+ * or dbAdd() when '*exists' is set to 0. */
+robj *lookupStringForBitCommand(client *c,
+                                size_t maxbit,
+                                int *exists,
+                                int *inplace)
 {
     size_t byte = maxbit >> 3;
     robj *o = lookupKeyWrite(c->db, c->argv[1]);
 
-    if (o == NULL) {
-        o = createObject(OBJ_STRING, sdsnewlen(NULL, byte + 1));
-        dbAdd(c->db, c->argv[1], o);
-    } else {
-        if (checkType(c, o, OBJ_STRING))
-            return NULL;
-        o = dbUnshareStringValue(c->db, c->argv[1], o);
-        o->ptr = sdsgrowzero(o->ptr, byte + 1);
-    }
-    return o;
+    if (o != NULL && checkType(c, o, OBJ_STRING))
+        return NULL;
+    *exists = o != NULL;
+    if (*inplace && o != NULL && o->refcount == 1 &&
+        o->encoding == OBJ_ENCODING_RAW && byte < sdslen(o->ptr))
+        return o;
+    *inplace = 0;
+    return dbCopyStringValue(o, byte + 1);
 }
 
 /* Return a pointer to the string object content, and stores its length
@@ -575,10 +584,13 @@ void setbitCommand(client *c)
 {
     robj *o;
     char *err = "bit is not an integer or out of range";
+    char llbuf[LONG_STR_SIZE];
+    unsigned char *p;
     size_t bitoffset;
     ssize_t byte, bit;
-    int byteval, bitval;
-    long on;
+    int byteval = 0, bitval;
+    long on, len;
+    char newval;
 
     if (getBitOffsetFromArgument(c, c->argv[2], &bitoffset, 0, 0) != C_OK)
         return;
@@ -592,19 +604,33 @@ void setbitCommand(client *c)
         return;
     }
 
-    if ((o = lookupStringForBitCommand(c, bitoffset)) == NULL)
+    o = lookupKeyWrite(c->db, c->argv[1]);
+    if (o != NULL && checkType(c, o, OBJ_STRING))
         return;
 
     /* Get current values */
     byte = bitoffset >> 3;
-    byteval = ((uint8_t *) o->ptr)[byte];
+    if (o != NULL) {
+        p = getObjectReadOnlyString(o, &len, llbuf);
+        if (byte < len)
+            byteval = p[byte];
+    }
     bit = 7 - (bitoffset & 0x7);
     bitval = byteval & (1 << bit);
 
-    /* Update byte with new bit value and return original value */
+    /* Update byte with new bit value and return original value. The string
+     * is padded with zeroes up to the byte, which is written in place when
+     * possible, see dbWriteStringValue(). */
     byteval &= ~(1 << bit);
     byteval |= ((on & 0x1) << bit);
-    ((uint8_t *) o->ptr)[byte] = byteval;
+    newval = (char) byteval;
+    if (o == NULL) {
+        o = createObject(OBJ_STRING, sdsnewlen(NULL, byte + 1));
+        ((char *) o->ptr)[byte] = newval;
+        dbAdd(c->db, c->argv[1], o);
+    } else {
+        dbWriteStringValue(c->db, c->argv[1], o, byte, &newval, 1);
+    }
     signalModifiedKey(c->db, c->argv[1]);
     notifyKeyspaceEvent(NOTIFY_STRING, "setbit", c->argv[1], c->db->id);
     server.dirty++;
@@ -995,8 +1021,11 @@ void bitfieldCommand(client *c)
     int j, numops = 0, changes = 0;
     struct bitfieldOp *ops = NULL; /* Array of ops to execute at end. */
     int owtype = BFOVERFLOW_WRAP;  /* Overflow type. */
-    int readonly = 1;
+    int readonly = 1, exists = 0, inplace = 0;
     size_t higest_write_offset = 0;
+    size_t lowest_offset = SIZE_MAX, highest_offset = 0; /* Of all the ops. */
+    size_t base = 0;         /* First bit of the byte written in place. */
+    unsigned char inbyte[1]; /* That byte, while the ops are executed. */
 
     for (j = 2; j < c->argc; j++) {
         int remargs = c->argc - j - 1;  /* Remaining args other than current. */
@@ -1046,6 +1075,10 @@ void bitfieldCommand(client *c)
             return;
         }
 
+        if (lowest_offset > bitoffset)
+            lowest_offset = bitoffset;
+        if (highest_offset < bitoffset + bits - 1)
+            highest_offset = bitoffset + bits - 1;
         if (opcode != BITFIELDOP_GET) {
             readonly = 0;
             if (higest_write_offset < bitoffset + bits - 1)
@@ -1079,9 +1112,16 @@ void bitfieldCommand(client *c)
             return;
     } else {
         /* Lookup by making room up to the farest bit reached by
-         * this operation. */
-        if ((o = lookupStringForBitCommand(c, higest_write_offset)) == NULL)
+         * this operation. When all the ops are within a single byte
+         * they are executed on a copy of it, written back in place. */
+        inplace = (lowest_offset >> 3) == (highest_offset >> 3);
+        if ((o = lookupStringForBitCommand(c, higest_write_offset, &exists,
+                                           &inplace)) == NULL)
             return;
+        if (inplace) {
+            base = lowest_offset & ~(size_t) 7;
+            inbyte[0] = ((unsigned char *) o->ptr)[base >> 3];
+        }
     }
 
     addReplyMultiBulkLen(c, numops);
@@ -1089,6 +1129,8 @@ void bitfieldCommand(client *c)
     /* Actually process the operations. */
     for (j = 0; j < numops; j++) {
         struct bitfieldOp *thisop = ops + j;
+        uint64_t offset = thisop->offset - base;
+        unsigned char *target = inplace ? inbyte : NULL;
 
         /* Execute the operation. */
         if (thisop->opcode == BITFIELDOP_SET ||
@@ -1104,8 +1146,9 @@ void bitfieldCommand(client *c)
                 int64_t oldval, newval, wrapped, retval;
                 int overflow;
 
-                oldval =
-                    getSignedBitfield(o->ptr, thisop->offset, thisop->bits);
+                if (target == NULL)
+                    target = o->ptr;
+                oldval = getSignedBitfield(target, offset, thisop->bits);
 
                 if (thisop->opcode == BITFIELDOP_INCRBY) {
                     newval = oldval + thisop->i64;
@@ -1128,8 +1171,7 @@ void bitfieldCommand(client *c)
                  * NULL to signal the condition. */
                 if (!(overflow && thisop->owtype == BFOVERFLOW_FAIL)) {
                     addReplyLongLong(c, retval);
-                    setSignedBitfield(o->ptr, thisop->offset, thisop->bits,
-                                      newval);
+                    setSignedBitfield(target, offset, thisop->bits, newval);
                 } else {
                     addReply(c, shared.nullbulk);
                 }
@@ -1137,8 +1179,9 @@ void bitfieldCommand(client *c)
                 uint64_t oldval, newval, wrapped, retval;
                 int overflow;
 
-                oldval =
-                    getUnsignedBitfield(o->ptr, thisop->offset, thisop->bits);
+                if (target == NULL)
+                    target = o->ptr;
+                oldval = getUnsignedBitfield(target, offset, thisop->bits);
 
                 if (thisop->opcode == BITFIELDOP_INCRBY) {
                     newval = oldval + thisop->i64;
@@ -1160,8 +1203,7 @@ void bitfieldCommand(client *c)
                  * NULL to signal the condition. */
                 if (!(overflow && thisop->owtype == BFOVERFLOW_FAIL)) {
                     addReplyLongLong(c, retval);
-                    setUnsignedBitfield(o->ptr, thisop->offset, thisop->bits,
-                                        newval);
+                    setUnsignedBitfield(target, offset, thisop->bits, newval);
                 } else {
                     addReply(c, shared.nullbulk);
                 }
@@ -1174,8 +1216,12 @@ void bitfieldCommand(client *c)
             unsigned char *src = NULL;
             char llbuf[LONG_STR_SIZE];
 
-            if (o != NULL)
+            if (target != NULL) {
+                src = target;
+                strlen = 1;
+            } else if (o != NULL) {
                 src = getObjectReadOnlyString(o, &strlen, llbuf);
+            }
 
             /* For GET we use a trick: before executing the operation
              * copy up to 9 bytes to a local buffer, so that we can easily
@@ -1183,7 +1229,7 @@ void bitfieldCommand(client *c)
              * object boundaries. */
             memset(buf, 0, 9);
             int i;
-            size_t byte = thisop->offset >> 3;
+            size_t byte = offset >> 3;
             for (i = 0; i < 9; i++) {
                 if (src == NULL || i + byte >= (size_t) strlen)
                     break;
@@ -1193,17 +1239,28 @@ void bitfieldCommand(client *c)
             /* Now operate on the copied buffer which is guaranteed
              * to be zero-padded. */
             if (thisop->sign) {
-                int64_t val = getSignedBitfield(
-                    buf, thisop->offset - (byte * 8), thisop->bits);
+                int64_t val =
+                    getSignedBitfield(buf, offset - (byte * 8), thisop->bits);
                 addReplyLongLong(c, val);
             } else {
-                uint64_t val = getUnsignedBitfield(
-                    buf, thisop->offset - (byte * 8), thisop->bits);
+                uint64_t val = getUnsignedBitfield(buf, offset - (byte * 8),
+                                                   thisop->bits);
                 addReplyLongLong(c, val);
             }
         }
     }
 
+    /* Publish the value written, see lookupStringForBitCommand(). */
+    if (inplace) {
+        dbWriteStringValue(c->db, c->argv[1], o, base >> 3, (char *) inbyte,
+                           1);
+    } else if (!readonly) {
+        if (exists)
+            dbOverwrite(c->db, c->argv[1], o);
+        else
+            dbAdd(c->db, c->argv[1], o);
+    }
+
     if (changes) {
         signalModifiedKey(c->db, c->argv[1]);
         notifyKeyspaceEvent(NOTIFY_STRING, "setbit", c->argv[1], c->db->id);
@@ -72,6 +72,11 @@ void resetManualFailover(void);
 void clusterCloseAllSlots(void);
 void clusterSetNodeAsMaster(clusterNode *n);
 void clusterDelNode(clusterNode *delnode);
+void clusterReplyRedirect(client *c,
+                          const char *ip,
+                          int port,
+                          int hashslot,
+                          int error_code);
 sds representClusterNodeFlags(sds ci, uint16_t flags);
 uint64_t clusterGetMaxEpoch(void);
 int clusterBumpConfigEpochWithoutConsensus(void);
@@ -439,6 +444,10 @@ void clusterInit(void)
     server.cluster->stats_bus_messages_sent = 0;
     server.cluster->stats_bus_messages_received = 0;
     memset(server.cluster->slots, 0, sizeof(server.cluster->slots));
+    memset(server.cluster->slot_migrations, 0,
+           sizeof(server.cluster->slot_migrations));
+    server.cluster->slot_migrations_active = 0;
+    server.cluster->routing = NULL;
     clusterCloseAllSlots();
 
     /* Lock the cluster config file to make sure every node uses
@@ -491,13 +500,19 @@ void clusterInit(void)
         }
     }
 
-    /* The slots -> keys map is a sorted set. Init it. */
-    server.cluster->slots_to_keys = zslCreate();
+    /* The slots -> keys map is a list of keys per slot, kept in sync by
+     * the db 0 keyspace hooks. Init it. */
+    memset(server.cluster->slots_to_keys, 0,
+           sizeof(server.cluster->slots_to_keys));
+    pthread_mutex_init(&server.cluster->slots_to_keys_lock, NULL);
 
     /* Set myself->port to my listening port, we'll just need to discover
      * the IP address via MEET messages. */
     myself->port = server.port;
 
+    /* Workers need a routing snapshot before serving the first read. */
+    clusterUpdateRouting();
+
     server.cluster->mf_end = 0;
     resetManualFailover();
 }
@@ -916,19 +931,25 @@ int clusterAddNode(clusterNode *node)
  */
 void clusterDelNode(clusterNode *delnode)
 {
-    int j;
+    int j, changed = 0;
     dictIterator *di;
     dictEntry *de;
 
     /* 1) Mark slots as unassigned. */
     for (j = 0; j < CLUSTER_SLOTS; j++) {
-        if (server.cluster->importing_slots_from[j] == delnode)
+        if (server.cluster->importing_slots_from[j] == delnode) {
             server.cluster->importing_slots_from[j] = NULL;
-        if (server.cluster->migrating_slots_to[j] == delnode)
+            changed = 1;
+        }
+        if (server.cluster->migrating_slots_to[j] == delnode) {
             server.cluster->migrating_slots_to[j] = NULL;
+            changed = 1;
+        }
         if (server.cluster->slots[j] == delnode)
-            clusterDelSlot(j);
+            changed |= clusterDelSlot(j) == C_OK;
     }
+    if (changed)
+        clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_ROUTING);
 
     /* 2) Remove failure reports. */
     di = dictGetSafeIterator(server.cluster->nodes);
@@ -3428,6 +3449,15 @@ void clusterCron(void)
     /* Abourt a manual failover if the timeout is reached. */
     manualFailoverCheckTimeout();
 
+    /* Abort slot migrations that timed out or were closed. */
+    clusterMigrationCron();
+
+    /* Node addresses and roles are updated by many code paths handling
+     * gossip: refresh the routing snapshot every second so that workers
+     * eventually see them. Nothing is published if nothing changed. */
+    if (!(iteration % 10))
+        clusterUpdateRouting();
+
     if (nodeIsSlave(myself)) {
         clusterHandleManualFailover();
         clusterHandleSlaveFailover();
@@ -3460,6 +3490,10 @@ void clusterBeforeSleep(void)
     if (server.cluster->todo_before_sleep & CLUSTER_TODO_UPDATE_STATE)
         clusterUpdateState();
 
+    /* Publish the new routing to the worker threads. */
+    if (server.cluster->todo_before_sleep & CLUSTER_TODO_UPDATE_ROUTING)
+        clusterUpdateRouting();
+
     /* Save the config, possibly using fsync. */
     if (server.cluster->todo_before_sleep & CLUSTER_TODO_SAVE_CONFIG) {
         int fsync =
@@ -3577,6 +3611,7 @@ int clusterAddSlot(clusterNode *n, int slot)
         return C_ERR;
     clusterNodeSetSlotBit(n, slot);
     server.cluster->slots[slot] = n;
+    clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_ROUTING);
     return C_OK;
 }
 
@@ -3591,6 +3626,7 @@ int clusterDelSlot(int slot)
         return C_ERR;
     serverAssert(clusterNodeClearSlotBit(n, slot) == 1);
     server.cluster->slots[slot] = NULL;
+    clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_ROUTING);
     return C_OK;
 }
 
@@ -3617,6 +3653,77 @@ void clusterCloseAllSlots(void)
            sizeof(server.cluster->migrating_slots_to));
     memset(server.cluster->importing_slots_from, 0,
            sizeof(server.cluster->importing_slots_from));
+    clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_ROUTING);
+}
+
+/* -----------------------------------------------------------------------------
+ * Routing snapshot for the worker threads
+ * -------------------------------------------------------------------------- */
+
+static void clusterFreeRoutingRcu(struct rcu_head *head)
+{
+    zfree(caa_container_of(head, clusterRouting, rcu_head));
+}
+
+static void clusterRoutingSetNode(clusterRouting *rt, clusterNode *n)
+{
+    n->routing_id = rt->numnodes++;
+    /* Copy up to the terminator only: the snapshots are compared with
+     * memcmp(), stale bytes after it must not look like a change. */
+    memcpy(rt->nodes[n->routing_id].ip, n->ip,
+           strnlen(n->ip, NET_IP_STR_LEN - 1));
+    rt->nodes[n->routing_id].port = n->port;
+}
+
+/* Build a new clusterRouting from the current cluster state and publish
+ * it to the worker threads, unless it is identical to the current one.
+ * The old snapshot is released after a grace period. */
+void clusterUpdateRouting(void)
+{
+    clusterRouting *rt, *old = server.cluster->routing;
+    dictIterator *di;
+    dictEntry *de;
+    size_t len;
+    int j;
+
+    server.cluster->todo_before_sleep &= ~CLUSTER_TODO_UPDATE_ROUTING;
+
+    len = sizeof(*rt) +
+          sizeof(clusterRoutingNode) * dictSize(server.cluster->nodes);
+    rt = zcalloc(len);
+    clusterRoutingSetNode(rt, myself);
+    di = dictGetIterator(server.cluster->nodes);
+    while ((de = dictNext(di)) != NULL) {
+        clusterNode *n = dictGetVal(de);
+
+        if (n != myself)
+            clusterRoutingSetNode(rt, n);
+    }
+    dictReleaseIterator(di);
+
+    rt->state = server.cluster->state;
+    rt->master = (nodeIsSlave(myself) && myself->slaveof)
+                     ? myself->slaveof->routing_id
+                     : CLUSTER_ROUTING_NONE;
+    for (j = 0; j < CLUSTER_SLOTS; j++) {
+        clusterNode *n = server.cluster->slots[j];
+        clusterNode *m = server.cluster->migrating_slots_to[j];
+        clusterNode *i = server.cluster->importing_slots_from[j];
+
+        rt->slots[j] = n ? n->routing_id : CLUSTER_ROUTING_NONE;
+        rt->migrating[j] = m ? m->routing_id : CLUSTER_ROUTING_NONE;
+        rt->importing[j] = i ? i->routing_id : CLUSTER_ROUTING_NONE;
+    }
+
+    if (old && old->numnodes == rt->numnodes &&
+        memcmp(&old->state, &rt->state,
+               len - offsetof(clusterRouting, state)) == 0) {
+        zfree(rt);
+        return;
+    }
+    rcu_assign_pointer(server.cluster->routing, rt);
+    if (old)
+        call_rcu(&old->rcu_head, clusterFreeRoutingRcu);
 }
 
 /* -----------------------------------------------------------------------------
@@ -3724,6 +3831,7 @@ void clusterUpdateState(void)
         serverLog(LL_WARNING, "Cluster state changed: %s",
                   new_state == CLUSTER_OK ? "ok" : "fail");
         server.cluster->state = new_state;
+        clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_ROUTING);
     }
 }
 
@@ -3826,6 +3934,7 @@ void clusterSetMaster(clusterNode *n)
     clusterNodeAddSlave(n, myself);
     replicationSetMaster(n->ip, n->port);
     resetManualFailover();
+    clusterDoBeforeSleep(CLUSTER_TODO_UPDATE_ROUTING);
 }
 
 /* -----------------------------------------------------------------------------
@@ -4256,7 +4365,8 @@ void clusterCommand(client *c)
             return;
         }
         clusterDoBeforeSleep(CLUSTER_TODO_SAVE_CONFIG |
-                             CLUSTER_TODO_UPDATE_STATE);
+                             CLUSTER_TODO_UPDATE_STATE |
+                             CLUSTER_TODO_UPDATE_ROUTING);
         addReply(c, shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr, "bumpepoch") && c->argc == 2) {
         /* CLUSTER BUMPEPOCH */
@@ -4340,6 +4450,9 @@ void clusterCommand(client *c)
             return;
         }
         addReplyLongLong(c, countKeysInSlot(slot));
+    } else if (!strcasecmp(c->argv[1]->ptr, "migrateslot") && c->argc >= 3) {
+        /* CLUSTER MIGRATESLOT <slot> [REPLACE] [TIMEOUT <ms>] */
+        clusterMigrateSlotCommand(c);
     } else if (!strcasecmp(c->argv[1]->ptr, "getkeysinslot") && c->argc == 4) {
         /* CLUSTER GETKEYSINSLOT <slot> <count> */
         long long maxkeys, slot;
@@ -4355,11 +4468,15 @@ void clusterCommand(client *c)
             return;
         }
 
+        if (maxkeys > countKeysInSlot(slot))
+            maxkeys = countKeysInSlot(slot);
         keys = zmalloc(sizeof(robj *) * maxkeys);
         numkeys = getKeysInSlot(slot, keys, maxkeys);
         addReplyMultiBulkLen(c, numkeys);
-        for (j = 0; j < numkeys; j++)
+        for (j = 0; j < numkeys; j++) {
             addReplyBulk(c, keys[j]);
+            decrRefCount(keys[j]);
+        }
         zfree(keys);
     } else if (!strcasecmp(c->argv[1]->ptr, "forget") && c->argc == 3) {
         /* CLUSTER FORGET <NODE ID> */
@@ -5137,6 +5254,458 @@ socket_err:
     return;
 }
 
+/* -----------------------------------------------------------------------------
+ * CLUSTER MIGRATESLOT: streaming migration of a whole hash slot
+ * -------------------------------------------------------------------------- */
+
+/* MIGRATE moves a batch of keys and then blocks waiting for the target to
+ * acknowledge it, so resharding a large slot is a long sequence of round
+ * trips on the server thread. A slot migration job instead keeps a window
+ * of keys in flight over its own connection: the write handler serializes
+ * the next keys of the slot while the read handler deletes the keys the
+ * target already acknowledged. Multiple slots can be migrated in parallel,
+ * every job uses its own connection.
+ *
+ * The slot must already be in MIGRATING state, so that clients asking for
+ * keys that were already moved get an -ASK redirection to the target. The
+ * final CLUSTER SETSLOT NODE is still up to the caller. */
+#define CLUSTER_MIGRATION_WINDOW 1024   /* Max keys in flight. */
+#define CLUSTER_MIGRATION_BATCH 128     /* Keys serialized per write event. */
+#define CLUSTER_MIGRATION_BUFFER (1024 * 1024) /* Max pending output. */
+#define CLUSTER_MIGRATION_DEFAULT_TIMEOUT 60000
+
+static void clusterMigrationReadHandler(aeEventLoop *el,
+                                        int fd,
+                                        void *privdata,
+                                        int mask);
+static void clusterMigrationWriteHandler(aeEventLoop *el,
+                                         int fd,
+                                         void *privdata,
+                                         int mask);
+
+static char *clusterMigrationStateName(int state)
+{
+    switch (state) {
+    case CLUSTER_MIGRATION_CONNECTING:
+        return "connecting";
+    case CLUSTER_MIGRATION_STREAMING:
+        return "streaming";
+    case CLUSTER_MIGRATION_DONE:
+        return "done";
+    case CLUSTER_MIGRATION_FAILED:
+        return "failed";
+    default:
+        return "unknown";
+    }
+}
+
+/* Release the connection and the in flight state of a job. The keys that
+ * were not acknowledged yet are still stored locally, so they just become
+ * writable again. The job itself is retained so that its final state can
+ * be reported by CLUSTER MIGRATESLOT STATUS. */
+static void clusterMigrationClose(clusterSlotMigration *sm, int state)
+{
+    if (sm->fd != -1) {
+        aeDeleteFileEvent(server.el, sm->fd, AE_READABLE | AE_WRITABLE);
+        close(sm->fd);
+        sm->fd = -1;
+    }
+    if (sm->state == CLUSTER_MIGRATION_CONNECTING ||
+        sm->state == CLUSTER_MIGRATION_STREAMING)
+        server.cluster->slot_migrations_active--;
+    sm->state = state;
+    sdsclear(sm->sendbuf);
+    sm->sendpos = 0;
+    sdsclear(sm->readbuf);
+    dictEmpty(sm->inflight_keys, NULL);
+    while (listLength(sm->inflight))
+        listDelNode(sm->inflight, listFirst(sm->inflight));
+}
+
+static void clusterMigrationFail(clusterSlotMigration *sm, sds err)
+{
+    serverLog(LL_WARNING, "Migration of slot %d to %s:%d failed: %s", sm->slot,
+              sm->host, sm->port, err);
+    sdsfree(sm->err);
+    sm->err = err;
+    clusterMigrationClose(sm, CLUSTER_MIGRATION_FAILED);
+}
+
+static void clusterMigrationFree(clusterSlotMigration *sm)
+{
+    clusterMigrationClose(sm, sm->state);
+    server.cluster->slot_migrations[sm->slot] = NULL;
+    sdsfree(sm->sendbuf);
+    sdsfree(sm->readbuf);
+    sdsfree(sm->err);
+    listRelease(sm->inflight);
+    dictRelease(sm->inflight_keys);
+    zfree(sm);
+}
+
+/* Serialize up to CLUSTER_MIGRATION_BATCH keys of the slot that are not
+ * already in flight, appending the RESTORE-ASKING commands to the output
+ * buffer. Returns the number of keys added. */
+static int clusterMigrationFeed(clusterSlotMigration *sm)
+{
+    unsigned int numkeys, j, want;
+    robj **keys;
+    rio cmd, payload;
+    int added = 0;
+
+    if (sdslen(sm->sendbuf) - sm->sendpos >= CLUSTER_MIGRATION_BUFFER ||
+        listLength(sm->inflight) >= CLUSTER_MIGRATION_WINDOW)
+        return 0;
+
+    /* The in flight keys are still linked in the slot, fetch enough keys
+     * to skip them. */
+    want = listLength(sm->inflight) + CLUSTER_MIGRATION_BATCH;
+    keys = zmalloc(sizeof(robj *) * want);
+    numkeys = getKeysInSlot(sm->slot, keys, want);
+
+    rioInitWithBuffer(&cmd, sm->sendbuf);
+    for (j = 0; j < numkeys; j++) {
+        robj *key = keys[j], *o;
+        long long ttl = 0, expireat;
+
+        if (added == CLUSTER_MIGRATION_BATCH ||
+            listLength(sm->inflight) >= CLUSTER_MIGRATION_WINDOW ||
+            dictFind(sm->inflight_keys, key->ptr) ||
+            (o = lookupKeyWrite(&server.db[0], key)) == NULL) {
+            decrRefCount(key);
+            continue;
+        }
+
+        expireat = getExpire(&server.db[0], key);
+        if (expireat != -1) {
+            ttl = expireat - mstime();
+            if (ttl < 1)
+                ttl = 1;
+        }
+        serverAssert(rioWriteBulkCount(&cmd, '*', sm->replace ? 5 : 4));
+        serverAssert(rioWriteBulkString(&cmd, "RESTORE-ASKING", 14));
+        serverAssert(rioWriteBulkString(&cmd, key->ptr, sdslen(key->ptr)));
+        serverAssert(rioWriteBulkLongLong(&cmd, ttl));
+        createDumpPayload(&payload, o);
+        serverAssert(rioWriteBulkString(&cmd, payload.io.buffer.ptr,
+                                        sdslen(payload.io.buffer.ptr)));
+        sm->bytes += sdslen(payload.io.buffer.ptr);
+        sdsfree(payload.io.buffer.ptr);
+        if (sm->replace)
+            serverAssert(rioWriteBulkString(&cmd, "REPLACE", 7));
+
+        /* The list takes our reference to the key object. */
+        listAddNodeTail(sm->inflight, key);
+        dictAdd(sm->inflight_keys, key->ptr, NULL);
+        sm->sent++;
+        added++;
+    }
+    sm->sendbuf = cmd.io.buffer.ptr;
+    zfree(keys);
+    return added;
+}
+
+/* Mark the job as completed if nothing is left to move. Returns 1 if the
+ * job is done. */
+static int clusterMigrationCheckDone(clusterSlotMigration *sm)
+{
+    if (sm->state != CLUSTER_MIGRATION_STREAMING ||
+        listLength(sm->inflight) || countKeysInSlot(sm->slot))
+        return 0;
+    serverLog(LL_NOTICE,
+              "Migration of slot %d to %s:%d completed: %llu keys moved "
+              "in %lld ms",
+              sm->slot, sm->host, sm->port, sm->moved,
+              (long long) (mstime() - sm->start_time));
+    clusterMigrationClose(sm, CLUSTER_MIGRATION_DONE);
+    return 1;
+}
+
+static void clusterMigrationWriteHandler(aeEventLoop *el,
+                                         int fd,
+                                         void *privdata,
+                                         int mask)
+{
+    clusterSlotMigration *sm = privdata;
+    ssize_t nwritten;
+    int added;
+    UNUSED(mask);
+
+    if (sm->state == CLUSTER_MIGRATION_CONNECTING) {
+        int sockerr = 0;
+        socklen_t errlen = sizeof(sockerr);
+
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &sockerr, &errlen) == -1)
+            sockerr = errno;
+        if (sockerr) {
+            clusterMigrationFail(sm,
+                                 sdscatprintf(sdsempty(),
+                                              "Can't connect to target: %s",
+                                              strerror(sockerr)));
+            return;
+        }
+        if (aeCreateFileEvent(el, fd, AE_READABLE, clusterMigrationReadHandler,
+                              sm) == AE_ERR) {
+            clusterMigrationFail(sm, sdsnew("Can't create readable event"));
+            return;
+        }
+        sm->state = CLUSTER_MIGRATION_STREAMING;
+        sm->last_io_time = mstime();
+        serverLog(LL_NOTICE, "Migrating slot %d to %s:%d (%u keys)", sm->slot,
+                  sm->host, sm->port, countKeysInSlot(sm->slot));
+    }
+
+    added = clusterMigrationFeed(sm);
+    while (sm->sendpos < sdslen(sm->sendbuf)) {
+        nwritten = write(fd, sm->sendbuf + sm->sendpos,
+                         sdslen(sm->sendbuf) - sm->sendpos);
+        if (nwritten <= 0) {
+            if (nwritten == -1 && errno == EAGAIN)
+                break;
+            clusterMigrationFail(sm,
+                                 sdscatprintf(sdsempty(),
+                                              "Error writing to target: %s",
+                                              strerror(errno)));
+            return;
+        }
+        sm->sendpos += nwritten;
+    }
+    if (sm->sendpos == sdslen(sm->sendbuf)) {
+        sdsclear(sm->sendbuf);
+        sm->sendpos = 0;
+        /* Nothing left to write and nothing new to serialize: wait for the
+         * read handler to make room in the window. */
+        if (added == 0) {
+            aeDeleteFileEvent(el, fd, AE_WRITABLE);
+            clusterMigrationCheckDone(sm);
+        }
+    } else if (sm->sendpos > CLUSTER_MIGRATION_BUFFER) {
+        sdsrange(sm->sendbuf, sm->sendpos, -1);
+        sm->sendpos = 0;
+    }
+}
+
+static void clusterMigrationReadHandler(aeEventLoop *el,
+                                        int fd,
+                                        void *privdata,
+                                        int mask)
+{
+    clusterSlotMigration *sm = privdata;
+    char buf[PROTO_IOBUF_LEN], *p;
+    ssize_t nread;
+    size_t pos = 0;
+    UNUSED(mask);
+
+    nread = read(fd, buf, sizeof(buf));
+    if (nread == -1 && errno == EAGAIN)
+        return;
+    if (nread <= 0) {
+        clusterMigrationFail(
+            sm, sdscatprintf(sdsempty(), "Error reading from target: %s",
+                             nread ? strerror(errno) : "connection closed"));
+        return;
+    }
+    sm->last_io_time = mstime();
+    sm->readbuf = sdscatlen(sm->readbuf, buf, nread);
+
+    /* Every RESTORE-ASKING gets a single line reply, in order. */
+    while ((p = strchr(sm->readbuf + pos, '\n')) != NULL) {
+        listNode *ln = listFirst(sm->inflight);
+        robj *key;
+
+        if (ln == NULL) {
+            clusterMigrationFail(sm, sdsnew("Unexpected reply from target"));
+            return;
+        }
+        if (sm->readbuf[pos] == '-') {
+            *p = '\0';
+            if (p > sm->readbuf + pos && p[-1] == '\r')
+                p[-1] = '\0';
+            clusterMigrationFail(
+                sm, sdscatprintf(sdsempty(),
+                                 "Target instance replied with error: %s",
+                                 sm->readbuf + pos + 1));
+            return;
+        }
+        pos = p - sm->readbuf + 1;
+
+        /* Acknowledged: remove the local copy and propagate it as DEL. */
+        key = listNodeValue(ln);
+        dictDelete(sm->inflight_keys, key->ptr);
+        if (dbDelete(&server.db[0], key)) {
+            robj *argv[2] = {shared.del, key};
+
+            signalModifiedKey(&server.db[0], key);
+            propagate(server.delCommand, 0, argv, 2,
+                      PROPAGATE_AOF | PROPAGATE_REPL);
+            server.dirty++;
+        }
+        listDelNode(sm->inflight, ln);
+        sm->moved++;
+    }
+    sdsrange(sm->readbuf, pos, -1);
+
+    if (!clusterMigrationCheckDone(sm) &&
+        aeCreateFileEvent(el, fd, AE_WRITABLE, clusterMigrationWriteHandler,
+                          sm) == AE_ERR)
+        clusterMigrationFail(sm, sdsnew("Can't create writable event"));
+}
+
+/* Called by clusterCron(): abort jobs that timed out, and jobs whose slot
+ * is no longer migrating, for instance after CLUSTER SETSLOT STABLE. */
+void clusterMigrationCron(void)
+{
+    mstime_t now = mstime();
+    int j;
+
+    if (server.cluster->slot_migrations_active == 0)
+        return;
+    for (j = 0; j < CLUSTER_SLOTS; j++) {
+        clusterSlotMigration *sm = server.cluster->slot_migrations[j];
+
+        if (sm == NULL || (sm->state != CLUSTER_MIGRATION_CONNECTING &&
+                           sm->state != CLUSTER_MIGRATION_STREAMING))
+            continue;
+        if (server.cluster->slots[j] != myself ||
+            server.cluster->migrating_slots_to[j] == NULL) {
+            clusterMigrationFail(sm, sdsnew("Slot is no longer migrating"));
+        } else if ((sm->state == CLUSTER_MIGRATION_CONNECTING ||
+                    listLength(sm->inflight)) &&
+                   now - sm->last_io_time > sm->timeout) {
+            clusterMigrationFail(sm, sdsnew("Timeout talking with target"));
+        }
+    }
+}
+
+/* Return 1 if 'key' was sent to the target by a slot migration job and
+ * was not acknowledged yet. Writes against such keys must be refused. */
+int clusterKeyIsMigrating(int slot, robj *key)
+{
+    clusterSlotMigration *sm = server.cluster->slot_migrations[slot];
+
+    return sm && listLength(sm->inflight) &&
+           dictFind(sm->inflight_keys, key->ptr) != NULL;
+}
+
+/* CLUSTER MIGRATESLOT <slot> [REPLACE] [TIMEOUT <milliseconds>]
+ * CLUSTER MIGRATESLOT CANCEL <slot>
+ * CLUSTER MIGRATESLOT STATUS */
+void clusterMigrateSlotCommand(client *c)
+{
+    clusterSlotMigration *sm;
+    clusterNode *target;
+    long long timeout = CLUSTER_MIGRATION_DEFAULT_TIMEOUT;
+    int slot, replace = 0, fd, j;
+
+    if (!strcasecmp(c->argv[2]->ptr, "status") && c->argc == 3) {
+        void *replylen = addDeferredMultiBulkLength(c);
+        int numjobs = 0;
+
+        for (j = 0; j < CLUSTER_SLOTS; j++) {
+            sds info;
+
+            if ((sm = server.cluster->slot_migrations[j]) == NULL)
+                continue;
+            info = sdscatprintf(
+                sdsempty(),
+                "slot=%d target=%s:%d state=%s keys_sent=%llu "
+                "keys_moved=%llu keys_inflight=%lu bytes=%llu keys_left=%u",
+                sm->slot, sm->host, sm->port,
+                clusterMigrationStateName(sm->state), sm->sent, sm->moved,
+                listLength(sm->inflight), sm->bytes, countKeysInSlot(j));
+            if (sm->err)
+                info = sdscatprintf(info, " error=%s", sm->err);
+            addReplyBulkSds(c, info);
+            numjobs++;
+        }
+        setDeferredMultiBulkLength(c, replylen, numjobs);
+        return;
+    }
+
+    if (!strcasecmp(c->argv[2]->ptr, "cancel") && c->argc == 4) {
+        if ((slot = getSlotOrReply(c, c->argv[3])) == -1)
+            return;
+        if ((sm = server.cluster->slot_migrations[slot]) == NULL) {
+            addReplyErrorFormat(c, "No migration job for slot %d", slot);
+            return;
+        }
+        clusterMigrationFree(sm);
+        addReply(c, shared.ok);
+        return;
+    }
+
+    if ((slot = getSlotOrReply(c, c->argv[2])) == -1)
+        return;
+    for (j = 3; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr, "replace")) {
+            replace = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr, "timeout") &&
+                   j + 1 < c->argc) {
+            if (getLongLongFromObjectOrReply(c, c->argv[++j], &timeout,
+                                             NULL) != C_OK)
+                return;
+            if (timeout <= 0)
+                timeout = CLUSTER_MIGRATION_DEFAULT_TIMEOUT;
+        } else {
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+    }
+
+    if (server.cluster->slots[slot] != myself) {
+        addReplyErrorFormat(c, "I'm not the owner of hash slot %u", slot);
+        return;
+    }
+    if ((target = server.cluster->migrating_slots_to[slot]) == NULL) {
+        addReplyErrorFormat(c, "Slot %d is not in migrating state", slot);
+        return;
+    }
+    sm = server.cluster->slot_migrations[slot];
+    if (sm && (sm->state == CLUSTER_MIGRATION_CONNECTING ||
+               sm->state == CLUSTER_MIGRATION_STREAMING)) {
+        addReplyErrorFormat(c, "Slot %d is already being migrated", slot);
+        return;
+    }
+
+    fd = anetTcpNonBlockConnect(server.neterr, target->ip, target->port);
+    if (fd == -1) {
+        addReplyErrorFormat(c, "Can't connect to target node: %s",
+                            server.neterr);
+        return;
+    }
+    anetEnableTcpNoDelay(NULL, fd);
+
+    /* A job for the same slot that already terminated is replaced. */
+    if (sm)
+        clusterMigrationFree(sm);
+    sm = zcalloc(sizeof(*sm));
+    sm->slot = slot;
+    sm->fd = fd;
+    sm->state = CLUSTER_MIGRATION_CONNECTING;
+    sm->replace = replace;
+    memcpy(sm->host, target->ip, sizeof(sm->host));
+    sm->port = target->port;
+    sm->timeout = timeout;
+    sm->start_time = sm->last_io_time = mstime();
+    sm->sendbuf = sdsempty();
+    sm->readbuf = sdsempty();
+    sm->inflight = listCreate();
+    listSetFreeMethod(sm->inflight, decrRefCountVoid);
+    sm->inflight_keys = dictCreate(&keyptrDictType, NULL);
+    if (aeCreateFileEvent(server.el, fd, AE_WRITABLE,
+                          clusterMigrationWriteHandler, sm) == AE_ERR) {
+        close(fd);
+        sm->fd = -1;
+        sm->state = CLUSTER_MIGRATION_FAILED;
+        clusterMigrationFree(sm);
+        addReplyError(c, "Can't create writable event");
+        return;
+    }
+    server.cluster->slot_migrations[slot] = sm;
+    server.cluster->slot_migrations_active++;
+    addReply(c, shared.ok);
+}
+
 /* -----------------------------------------------------------------------------
  * Cluster functions related to serving / redirecting clients
  * -------------------------------------------------------------------------- */
@@ -5220,6 +5789,7 @@ clusterNode *getNodeByQuery(client *c,
     multiState *ms, _ms;
     multiCmd mc;
     int i, slot = 0, migrating_slot = 0, importing_slot = 0, missing_keys = 0;
+    int inflight_keys = 0;
 
     /* Set error code optimistically for the base case. */
     if (error_code)
@@ -5313,6 +5883,10 @@ clusterNode *getNodeByQuery(client *c,
             if ((migrating_slot || importing_slot) &&
                 lookupKeyRead(&server.db[0], thiskey) == NULL) {
                 missing_keys++;
+            } else if (migrating_slot && mcmd->flags & CMD_WRITE &&
+                       clusterKeyIsMigrating(slot, thiskey)) {
+                /* Sent by CLUSTER MIGRATESLOT, not acknowledged yet. */
+                inflight_keys++;
             }
         }
         getKeysFreeResult(keyindex);
@@ -5348,6 +5922,14 @@ clusterNode *getNodeByQuery(client *c,
         return server.cluster->migrating_slots_to[slot];
     }
 
+    /* A write against a key that is being moved by a slot migration job
+     * must wait until the target acknowledged it. */
+    if (migrating_slot && inflight_keys) {
+        if (error_code)
+            *error_code = CLUSTER_REDIR_MIGRATING;
+        return NULL;
+    }
+
     /* If we are receiving the slot, and the client correctly flagged the
      * request as "ASKING", we can serve the request. However if the request
      * involves multiple keys and we don't have them all, the only option is
@@ -5389,6 +5971,19 @@ void clusterRedirectClient(client *c,
                            clusterNode *n,
                            int hashslot,
                            int error_code)
+{
+    clusterReplyRedirect(c, n ? n->ip : NULL, n ? n->port : 0, hashslot,
+                         error_code);
+}
+
+/* Implements clusterRedirectClient() given the address of the node, so
+ * that it can be used by worker threads that only have a clusterRouting
+ * snapshot. */
+void clusterReplyRedirect(client *c,
+                          const char *ip,
+                          int port,
+                          int hashslot,
+                          int error_code)
 {
     if (error_code == CLUSTER_REDIR_CROSS_SLOT) {
         addReplySds(
@@ -5401,6 +5996,9 @@ void clusterRedirectClient(client *c,
          * a migration or import in progress. */
         addReplySds(c, sdsnew("-TRYAGAIN Multiple keys request during "
                               "rehashing of slot\r\n"));
+    } else if (error_code == CLUSTER_REDIR_MIGRATING) {
+        addReplySds(c, sdsnew("-TRYAGAIN Key is being migrated to another "
+                              "node\r\n"));
     } else if (error_code == CLUSTER_REDIR_DOWN_STATE) {
         addReplySds(c, sdsnew("-CLUSTERDOWN The cluster is down\r\n"));
     } else if (error_code == CLUSTER_REDIR_DOWN_UNBOUND) {
@@ -5410,7 +6008,7 @@ void clusterRedirectClient(client *c,
         addReplySds(
             c, sdscatprintf(sdsempty(), "-%s %d %s:%d\r\n",
                             (error_code == CLUSTER_REDIR_ASK) ? "ASK" : "MOVED",
-                            hashslot, n->ip, n->port));
+                            hashslot, ip, port));
     } else {
         serverPanic("getNodeByQuery() unknown error.");
     }
@@ -5465,3 +6063,90 @@ int clusterRedirectBlockedClientIfNeeded(client *c)
     }
     return 0;
 }
+
+/* Worker threads version of the redirection performed by processCommand()
+ * for the commands they execute locally, that are read only. It implements
+ * the same rules of getNodeByQuery() for a single command, but against the
+ * clusterRouting snapshot, so that no lock is needed and a concurrent
+ * update of the cluster state by the server thread can't be observed half
+ * done.
+ *
+ * If the client was sent a redirection or an error 1 is returned,
+ * otherwise 0 is returned and the command can be executed. */
+int clusterWorkerRedirectIfNeeded(client *c)
+{
+    clusterRouting *rt;
+    robj *firstkey = NULL;
+    int *keyindex, numkeys, j;
+    int slot = 0, n = CLUSTER_ROUTING_NONE;
+    int migrating_slot = 0, importing_slot = 0;
+    int missing_keys = 0, multiple_keys = 0;
+    int error_code = CLUSTER_REDIR_NONE, target = CLUSTER_ROUTING_NONE;
+    char ip[NET_IP_STR_LEN];
+    int port = 0;
+
+    if (c->flags & CLIENT_MASTER ||
+        (c->cmd->getkeys_proc == NULL && c->cmd->firstkey == 0))
+        return 0;
+
+    keyindex = getKeysFromCommand(c->cmd, c->argv, c->argc, &numkeys);
+    rcu_read_lock();
+    rt = rcu_dereference(server.cluster->routing);
+    for (j = 0; rt && j < numkeys; j++) {
+        robj *thiskey = c->argv[keyindex[j]];
+        int thisslot = keyHashSlot(thiskey->ptr, sdslen(thiskey->ptr));
+
+        if (firstkey == NULL) {
+            firstkey = thiskey;
+            slot = thisslot;
+            n = rt->slots[slot];
+            if (n == CLUSTER_ROUTING_NONE) {
+                error_code = CLUSTER_REDIR_DOWN_UNBOUND;
+                break;
+            }
+            if (n == 0 && rt->migrating[slot] != CLUSTER_ROUTING_NONE)
+                migrating_slot = 1;
+            else if (rt->importing[slot] != CLUSTER_ROUTING_NONE)
+                importing_slot = 1;
+        } else if (!equalStringObjects(firstkey, thiskey)) {
+            if (slot != thisslot) {
+                error_code = CLUSTER_REDIR_CROSS_SLOT;
+                break;
+            }
+            multiple_keys = 1;
+        }
+        if ((migrating_slot || importing_slot) &&
+            lookupKey(&server.db[0], thiskey, LOOKUP_NOTOUCH) == NULL)
+            missing_keys++;
+    }
+
+    if (rt == NULL || firstkey == NULL || error_code != CLUSTER_REDIR_NONE) {
+        /* No snapshot yet, no keys, or an error already detected. */
+    } else if (rt->state != CLUSTER_OK) {
+        error_code = CLUSTER_REDIR_DOWN_STATE;
+    } else if (migrating_slot && missing_keys) {
+        error_code = CLUSTER_REDIR_ASK;
+        target = rt->migrating[slot];
+    } else if (importing_slot &&
+               (c->flags & CLIENT_ASKING || c->cmd->flags & CMD_ASKING)) {
+        if (multiple_keys && missing_keys)
+            error_code = CLUSTER_REDIR_UNSTABLE;
+    } else if (c->flags & CLIENT_READONLY && rt->master == n) {
+        /* Read only client reading from a slave of the right master. */
+    } else if (n != 0) {
+        error_code = CLUSTER_REDIR_MOVED;
+        target = n;
+    }
+    if (target != CLUSTER_ROUTING_NONE) {
+        memcpy(ip, rt->nodes[target].ip, NET_IP_STR_LEN);
+        port = rt->nodes[target].port;
+    }
+    rcu_read_unlock();
+    getKeysFreeResult(keyindex);
+
+    if (error_code == CLUSTER_REDIR_NONE)
+        return 0;
+    flagTransaction(c);
+    clusterReplyRedirect(c, ip, port, slot, error_code);
+    return 1;
+}
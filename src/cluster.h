@@ -33,6 +33,7 @@
 #define CLUSTER_REDIR_MOVED 4        /* -MOVED redirection required. */
 #define CLUSTER_REDIR_DOWN_STATE 5   /* -CLUSTERDOWN, global state. */
 #define CLUSTER_REDIR_DOWN_UNBOUND 6 /* -CLUSTERDOWN, unbound slot. */
+#define CLUSTER_REDIR_MIGRATING 7    /* -TRYAGAIN, key is being migrated. */
 
 struct clusterNode;
 
@@ -109,9 +110,73 @@ typedef struct clusterNode {
     char ip[NET_IP_STR_LEN];   /* Latest known IP address of this node */
     int port;                  /* Latest known port of this node */
     clusterLink *link;         /* TCP/IP link with this node */
+    int routing_id;            /* Index in the clusterRouting nodes table */
     list *fail_reports;        /* List of nodes signaling this as failing */
 } clusterNode;
 
+/* Keys of a single hash slot. The entries of the db 0 keyspace are linked
+ * together through q_dictEntry->link.slot, see slotToKeyAdd(). */
+typedef struct clusterSlotKeys {
+    q_dictEntry *head;   /* First key of the slot, NULL if the slot is empty */
+    unsigned long count; /* Number of keys in the slot */
+} clusterSlotKeys;
+
+/* State of a CLUSTER MIGRATESLOT job. The keys of the slot are streamed to
+ * the target as pipelined RESTORE-ASKING commands over a dedicated
+ * connection, and every key is deleted locally once the target acknowledged
+ * it. Keys sent but not yet acknowledged are "in flight": writes against
+ * them are refused with -TRYAGAIN so that the copy on the target can't go
+ * stale before the local one is removed. */
+#define CLUSTER_MIGRATION_CONNECTING 0 /* Non blocking connect in progress. */
+#define CLUSTER_MIGRATION_STREAMING 1  /* Sending keys, reading acks. */
+#define CLUSTER_MIGRATION_DONE 2       /* All the keys were moved. */
+#define CLUSTER_MIGRATION_FAILED 3     /* Aborted, see 'err'. */
+
+typedef struct clusterSlotMigration {
+    int slot;
+    int fd;
+    int state;                   /* CLUSTER_MIGRATION_* */
+    int replace;                 /* Send RESTORE-ASKING ... REPLACE. */
+    char host[NET_IP_STR_LEN];   /* Target address, copied from the node */
+    int port;                    /* the slot is migrating to. */
+    mstime_t timeout;            /* I/O timeout in milliseconds. */
+    mstime_t start_time;         /* Job creation time. */
+    mstime_t last_io_time;       /* Last time we got data from the target. */
+    sds sendbuf;                 /* Serialized commands not yet written. */
+    size_t sendpos;              /* Bytes of 'sendbuf' already written. */
+    sds readbuf;                 /* Partial replies from the target. */
+    list *inflight;              /* Keys (robj) sent and not yet acked. */
+    dict *inflight_keys;         /* Same keys, for fast lookups. */
+    unsigned long long sent;     /* Number of keys sent. */
+    unsigned long long moved;    /* Number of keys acked and removed. */
+    unsigned long long bytes;    /* Payload bytes sent. */
+    sds err;                     /* Failure reason, NULL if none. */
+} clusterSlotMigration;
+
+/* Immutable snapshot of the slot -> node routing, published by the server
+ * thread with rcu_assign_pointer() so that worker threads can compute
+ * MOVED / ASK redirections without touching clusterState, that the server
+ * thread mutates concurrently. Nodes are referenced by index in 'nodes',
+ * that holds a copy of their address; index 0 is always myself. */
+#define CLUSTER_ROUTING_NONE 0xffff
+
+typedef struct clusterRoutingNode {
+    char ip[NET_IP_STR_LEN];
+    int port;
+} clusterRoutingNode;
+
+typedef struct clusterRouting {
+    struct rcu_head rcu_head;
+    /* Everything below is compared to detect if a new snapshot changed. */
+    int state;                          /* CLUSTER_OK, CLUSTER_FAIL */
+    uint16_t master;                    /* Our master if we are a slave */
+    uint16_t slots[CLUSTER_SLOTS];      /* Serving node */
+    uint16_t migrating[CLUSTER_SLOTS];  /* Migrating to node */
+    uint16_t importing[CLUSTER_SLOTS];  /* Importing from node */
+    int numnodes;
+    clusterRoutingNode nodes[];
+} clusterRouting;
+
 typedef struct clusterState {
     clusterNode *myself; /* This node */
     uint64_t currentEpoch;
@@ -122,7 +187,11 @@ typedef struct clusterState {
     clusterNode *migrating_slots_to[CLUSTER_SLOTS];
     clusterNode *importing_slots_from[CLUSTER_SLOTS];
     clusterNode *slots[CLUSTER_SLOTS];
-    zskiplist *slots_to_keys;
+    clusterSlotKeys slots_to_keys[CLUSTER_SLOTS];
+    pthread_mutex_t slots_to_keys_lock; /* Workers may delete expired keys. */
+    clusterSlotMigration *slot_migrations[CLUSTER_SLOTS];
+    int slot_migrations_active; /* Jobs in CONNECTING or STREAMING state. */
+    clusterRouting *routing;    /* Snapshot for the worker threads. */
     /* The following fields are used to take the slave state on elections. */
     mstime_t failover_auth_time; /* Time of previous or next election. */
     int failover_auth_count;     /* Number of votes received so far. */
@@ -153,6 +222,7 @@ typedef struct clusterState {
 #define CLUSTER_TODO_UPDATE_STATE (1 << 1)
 #define CLUSTER_TODO_SAVE_CONFIG (1 << 2)
 #define CLUSTER_TODO_FSYNC_CONFIG (1 << 3)
+#define CLUSTER_TODO_UPDATE_ROUTING (1 << 4)
 
 /* Redis cluster messages header */
 
@@ -270,6 +340,11 @@ clusterNode *getNodeByQuery(client *c,
                             int *hashslot,
                             int *ask);
 int clusterRedirectBlockedClientIfNeeded(client *c);
+int clusterKeyIsMigrating(int slot, robj *key);
+void clusterMigrationCron(void);
+void clusterUpdateRouting(void);
+int clusterWorkerRedirectIfNeeded(client *c);
+void clusterMigrateSlotCommand(client *c);
 void clusterRedirectClient(client *c,
                            clusterNode *n,
                            int hashslot,
@@ -30,6 +30,7 @@
 
 #include "server.h"
 #include "cluster.h"
+#include "q_worker.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -45,9 +46,11 @@ typedef struct configEnum {
 
 configEnum maxmemory_policy_enum[] = {
     {"volatile-lru", MAXMEMORY_VOLATILE_LRU},
+    {"volatile-lfu", MAXMEMORY_VOLATILE_LFU},
     {"volatile-random", MAXMEMORY_VOLATILE_RANDOM},
     {"volatile-ttl", MAXMEMORY_VOLATILE_TTL},
     {"allkeys-lru", MAXMEMORY_ALLKEYS_LRU},
+    {"allkeys-lfu", MAXMEMORY_ALLKEYS_LFU},
     {"allkeys-random", MAXMEMORY_ALLKEYS_RANDOM},
     {"noeviction", MAXMEMORY_NO_EVICTION},
     {NULL, 0}};
@@ -76,6 +79,12 @@ configEnum aof_fsync_enum[] = {{"everysec", AOF_FSYNC_EVERYSEC},
                                {"no", AOF_FSYNC_NO},
                                {NULL, 0}};
 
+configEnum repl_diskless_load_enum[] = {
+    {"disabled", REPL_DISKLESS_LOAD_DISABLED},
+    {"on-empty-db", REPL_DISKLESS_LOAD_WHEN_DB_EMPTY},
+    {"swapdb", REPL_DISKLESS_LOAD_SWAPDB},
+    {NULL, 0}};
+
 /* Output buffer limits presets. */
 clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT] = {
     {0, 0, 0},                                 /* normal */
@@ -192,7 +201,8 @@ void loadServerConfigFromString(char *config)
         /* Execute config directives */
         if (!strcasecmp(argv[0], "threads_num") && argc == 2) {
             server.threads_num = atoi(argv[1]);
-            if (server.threads_num < 0) {
+            if (server.threads_num < 0 ||
+                server.threads_num > CONFIG_MAX_THREADS_NUM) {
                 err = "Invalid threads value";
                 goto loaderr;
             }
@@ -321,6 +331,9 @@ void loadServerConfigFromString(char *config)
             }
         } else if (!strcasecmp(argv[0], "maxmemory") && argc == 2) {
             server.maxmemory = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0], "rcu-reclaim-max-memory") &&
+                   argc == 2) {
+            server.rcu_reclaim_max_memory = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0], "maxmemory-policy") && argc == 2) {
             server.maxmemory_policy =
                 configEnumGetValue(maxmemory_policy_enum, argv[1]);
@@ -334,6 +347,38 @@ void loadServerConfigFromString(char *config)
                 err = "maxmemory-samples must be 1 or greater";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0], "lfu-log-factor") && argc == 2) {
+            server.lfu_log_factor = atoi(argv[1]);
+            if (server.lfu_log_factor < 0) {
+                err = "lfu-log-factor must be 0 or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "jemalloc-thread-arenas") &&
+                   argc == 2) {
+            if ((server.jemalloc_thread_arenas = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "jemalloc-dirty-decay-ms") &&
+                   argc == 2) {
+            server.jemalloc_dirty_decay_ms = strtoll(argv[1], NULL, 10);
+            if (server.jemalloc_dirty_decay_ms < -1) {
+                err = "jemalloc-dirty-decay-ms must be -1 or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "jemalloc-muzzy-decay-ms") &&
+                   argc == 2) {
+            server.jemalloc_muzzy_decay_ms = strtoll(argv[1], NULL, 10);
+            if (server.jemalloc_muzzy_decay_ms < -1) {
+                err = "jemalloc-muzzy-decay-ms must be -1 or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "lfu-decay-time") && argc == 2) {
+            server.lfu_decay_time = atoi(argv[1]);
+            if (server.lfu_decay_time < 0) {
+                err = "lfu-decay-time must be 0 or greater";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0], "slaveof") && argc == 3) {
             slaveof_linenum = linenum;
             server.masterhost = sdsnew(argv[1]);
@@ -363,6 +408,20 @@ void loadServerConfigFromString(char *config)
                 err = "argument must be 'yes' or 'no'";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0], "repl-diskless-load") && argc == 2) {
+            server.repl_diskless_load =
+                configEnumGetValue(repl_diskless_load_enum, argv[1]);
+            if (server.repl_diskless_load == INT_MIN) {
+                err = "argument must be 'disabled', 'on-empty-db' or 'swapdb'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "repl-apply-threads") && argc == 2) {
+            server.repl_apply_threads = atoi(argv[1]);
+            if (server.repl_apply_threads < 0 ||
+                server.repl_apply_threads > CONFIG_MAX_THREADS_NUM) {
+                err = "Invalid number of apply threads";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0], "repl-diskless-sync-delay") &&
                    argc == 2) {
             server.repl_diskless_sync_delay = atoi(argv[1]);
@@ -589,6 +648,47 @@ void loadServerConfigFromString(char *config)
             }
         } else if (!strcasecmp(argv[0], "slowlog-max-len") && argc == 2) {
             server.slowlog_max_len = strtoll(argv[1], NULL, 10);
+        } else if (!strcasecmp(argv[0], "tracking-table-max-keys") &&
+                   argc == 2) {
+            server.tracking_table_max_keys = strtoll(argv[1], NULL, 10);
+            if (server.tracking_table_max_keys < 0) {
+                err = "tracking-table-max-keys can't be negative";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "hotkeys-sample-rate") && argc == 2) {
+            server.hotkeys_sample_rate = atoi(argv[1]);
+            if (server.hotkeys_sample_rate < 0) {
+                err = "hotkeys-sample-rate can't be negative";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "key-prefix-index") && argc == 2) {
+            if ((server.key_prefix_index = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "key-load-delay") && argc == 2) {
+            server.key_load_delay = atoi(argv[1]);
+            if (server.key_load_delay < 0) {
+                err = "key-load-delay can't be negative";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],
+                               "loading-process-events-interval-bytes") &&
+                   argc == 2) {
+            server.loading_process_events_interval_bytes =
+                strtoll(argv[1], NULL, 10);
+            if (server.loading_process_events_interval_bytes < 1024) {
+                err = "loading-process-events-interval-bytes must be 1024 or "
+                      "greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "keys-threads") && argc == 2) {
+            server.keys_threads = atoi(argv[1]);
+            if (server.keys_threads < 0 ||
+                server.keys_threads > CONFIG_MAX_THREADS_NUM) {
+                err = "Invalid number of keys threads";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0], "client-output-buffer-limit") &&
                    argc == 5) {
             int class = getClientTypeByName(argv[1]);
@@ -674,8 +774,9 @@ void loadServerConfigFromString(char *config)
             }
         } else if (!strcasecmp(argv[0], "threads") && argc == 2) {
             server.threads_num = atoi(argv[1]);
-            if (server.threads_num <= 0) {
-                err = "worker threads num must be 1 or greater";
+            if (server.threads_num <= 0 ||
+                server.threads_num > CONFIG_MAX_THREADS_NUM) {
+                err = "worker threads num must be between 1 and 256";
                 goto loaderr;
             }
         } else {
@@ -862,6 +963,45 @@ void configSetCommand(client *c)
                 }
             }
         }
+        config_set_special_field("threads_num")
+        {
+            if (getLongLongFromObject(o, &ll) == C_ERR || ll < 1 ||
+                ll > CONFIG_MAX_THREADS_NUM)
+                goto badfmt;
+
+            if (q_workers_resize((int) ll) == C_ERR) {
+                addReplyError(c,
+                              "Worker threads from a previous CONFIG SET "
+                              "threads_num are still stopping, retry later");
+                return;
+            }
+        }
+        config_set_special_field("repl-apply-threads")
+        {
+            if (getLongLongFromObject(o, &ll) == C_ERR || ll < 0 ||
+                ll > CONFIG_MAX_THREADS_NUM)
+                goto badfmt;
+
+            if (q_applyResize((int) ll) == C_ERR) {
+                server.repl_apply_threads = 0;
+                addReplyError(c, "Unable to start the apply threads");
+                return;
+            }
+            server.repl_apply_threads = (int) ll;
+        }
+        config_set_special_field("keys-threads")
+        {
+            if (getLongLongFromObject(o, &ll) == C_ERR || ll < 0 ||
+                ll > CONFIG_MAX_THREADS_NUM)
+                goto badfmt;
+
+            if (q_matchResize((int) ll) == C_ERR) {
+                server.keys_threads = 0;
+                addReplyError(c, "Unable to start the keys threads");
+                return;
+            }
+            server.keys_threads = (int) ll;
+        }
         config_set_special_field("appendonly")
         {
             int enable = yesnotoi(o->ptr);
@@ -1031,6 +1171,37 @@ void configSetCommand(client *c)
                                    server.maxmemory_samples, 1, LLONG_MAX)
         {
         }
+        config_set_numerical_field("lfu-log-factor", server.lfu_log_factor, 0,
+                                   INT_MAX)
+        {
+        }
+        config_set_numerical_field("key-load-delay", server.key_load_delay, 0,
+                                   INT_MAX)
+        {
+        }
+        config_set_numerical_field("loading-process-events-interval-bytes",
+                                   server.loading_process_events_interval_bytes,
+                                   1024, LLONG_MAX)
+        {
+        }
+        config_set_numerical_field("lfu-decay-time", server.lfu_decay_time, 0,
+                                   INT_MAX)
+        {
+        }
+        config_set_numerical_field("jemalloc-dirty-decay-ms",
+                                   server.jemalloc_dirty_decay_ms, -1,
+                                   LLONG_MAX)
+        {
+            zmalloc_set_decay(server.jemalloc_dirty_decay_ms,
+                              server.jemalloc_muzzy_decay_ms);
+        }
+        config_set_numerical_field("jemalloc-muzzy-decay-ms",
+                                   server.jemalloc_muzzy_decay_ms, -1,
+                                   LLONG_MAX)
+        {
+            zmalloc_set_decay(server.jemalloc_dirty_decay_ms,
+                              server.jemalloc_muzzy_decay_ms);
+        }
         config_set_numerical_field("timeout", server.maxidletime, 0, LONG_MAX)
         {
         }
@@ -1086,6 +1257,14 @@ void configSetCommand(client *c)
             /* Cast to unsigned. */
             server.slowlog_max_len = (unsigned) ll;
         }
+        config_set_numerical_field("tracking-table-max-keys",
+                                   server.tracking_table_max_keys, 0, LLONG_MAX)
+        {
+        }
+        config_set_numerical_field("hotkeys-sample-rate",
+                                   server.hotkeys_sample_rate, 0, INT_MAX)
+        {
+        }
         config_set_numerical_field("latency-monitor-threshold",
                                    server.latency_monitor_threshold, 0,
                                    LLONG_MAX)
@@ -1174,6 +1353,10 @@ void configSetCommand(client *c)
                 freeMemoryIfNeeded();
             }
         }
+        config_set_memory_field("rcu-reclaim-max-memory",
+                                server.rcu_reclaim_max_memory)
+        {
+        }
         config_set_memory_field("repl-backlog-size", ll)
         {
             resizeReplicationBacklog(ll);
@@ -1191,6 +1374,10 @@ void configSetCommand(client *c)
         {
         }
         config_set_enum_field("appendfsync", server.aof_fsync, aof_fsync_enum)
+        {
+        }
+        config_set_enum_field("repl-diskless-load", server.repl_diskless_load,
+                              repl_diskless_load_enum)
         {
             /* Everyhing else is an error... */
         }
@@ -1272,8 +1459,16 @@ void configSetCommand(client *c)
 
         /* Numerical values */
         config_get_numerical_field("maxmemory", server.maxmemory);
+        config_get_numerical_field("rcu-reclaim-max-memory",
+                                   server.rcu_reclaim_max_memory);
         config_get_numerical_field("maxmemory-samples",
                                    server.maxmemory_samples);
+        config_get_numerical_field("lfu-log-factor", server.lfu_log_factor);
+        config_get_numerical_field("lfu-decay-time", server.lfu_decay_time);
+        config_get_numerical_field("jemalloc-dirty-decay-ms",
+                                   server.jemalloc_dirty_decay_ms);
+        config_get_numerical_field("jemalloc-muzzy-decay-ms",
+                                   server.jemalloc_muzzy_decay_ms);
         config_get_numerical_field("timeout", server.maxidletime);
         config_get_numerical_field("auto-aof-rewrite-percentage",
                                    server.aof_rewrite_perc);
@@ -1301,6 +1496,10 @@ void configSetCommand(client *c)
         config_get_numerical_field("latency-monitor-threshold",
                                    server.latency_monitor_threshold);
         config_get_numerical_field("slowlog-max-len", server.slowlog_max_len);
+        config_get_numerical_field("tracking-table-max-keys",
+                                   server.tracking_table_max_keys);
+        config_get_numerical_field("hotkeys-sample-rate",
+                                   server.hotkeys_sample_rate);
         config_get_numerical_field("port", server.port);
         config_get_numerical_field("tcp-backlog", server.tcp_backlog);
         config_get_numerical_field("databases", server.dbnum);
@@ -1312,6 +1511,7 @@ void configSetCommand(client *c)
         config_get_numerical_field("repl-backlog-ttl",
                                    server.repl_backlog_time_limit);
         config_get_numerical_field("maxclients", server.maxclients);
+        config_get_numerical_field("threads_num", server.threads_num);
         config_get_numerical_field("watchdog-period", server.watchdog_period);
         config_get_numerical_field("slave-priority", server.slave_priority);
         config_get_numerical_field("slave-announce-port",
@@ -1327,6 +1527,13 @@ void configSetCommand(client *c)
                                    server.cluster_migration_barrier);
         config_get_numerical_field("cluster-slave-validity-factor",
                                    server.cluster_slave_validity_factor);
+        config_get_numerical_field("repl-apply-threads",
+                                   server.repl_apply_threads);
+        config_get_numerical_field("keys-threads", server.keys_threads);
+        config_get_numerical_field("key-load-delay", server.key_load_delay);
+        config_get_numerical_field(
+            "loading-process-events-interval-bytes",
+            server.loading_process_events_interval_bytes);
         config_get_numerical_field("repl-diskless-sync-delay",
                                    server.repl_diskless_sync_delay);
         config_get_numerical_field("tcp-keepalive", server.tcpkeepalive);
@@ -1342,6 +1549,9 @@ void configSetCommand(client *c)
         config_get_bool_field("stop-writes-on-bgsave-error",
                               server.stop_writes_on_bgsave_err);
         config_get_bool_field("daemonize", server.daemonize);
+        config_get_bool_field("jemalloc-thread-arenas",
+                              server.jemalloc_thread_arenas);
+        config_get_bool_field("key-prefix-index", server.key_prefix_index);
         config_get_bool_field("rdbcompression", server.rdb_compression);
         config_get_bool_field("rdbchecksum", server.rdb_checksum);
         config_get_bool_field("activerehashing", server.activerehashing);
@@ -1360,6 +1570,8 @@ void configSetCommand(client *c)
         config_get_enum_field("supervised", server.supervised_mode,
                               supervised_mode_enum);
         config_get_enum_field("appendfsync", server.aof_fsync, aof_fsync_enum);
+        config_get_enum_field("repl-diskless-load", server.repl_diskless_load,
+                              repl_diskless_load_enum);
         config_get_enum_field("syslog-facility", server.syslog_facility,
                               syslog_facility_enum);
 
@@ -1463,7 +1675,7 @@ void configSetCommand(client *c)
     /* We use the following dictionary type to store where a configuration
      * option is mentioned in the old configuration file, so it's
      * like "maxmemory" -> list of line numbers (first line is zero). */
-    unsigned int dictSdsCaseHash(const void *key);
+    uint64_t dictSdsCaseHash(const void *key);
     int dictSdsKeyCaseCompare(void *privdata, const void *key1,
                               const void *key2);
     void dictSdsDestructor(void *privdata, void *val);
@@ -2113,6 +2325,13 @@ void configSetCommand(client *c)
         rewriteConfigNumericalOption(state, "repl-diskless-sync-delay",
                                      server.repl_diskless_sync_delay,
                                      CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY);
+        rewriteConfigEnumOption(state, "repl-diskless-load",
+                                server.repl_diskless_load,
+                                repl_diskless_load_enum,
+                                CONFIG_DEFAULT_REPL_DISKLESS_LOAD);
+        rewriteConfigNumericalOption(state, "repl-apply-threads",
+                                     server.repl_apply_threads,
+                                     CONFIG_DEFAULT_REPL_APPLY_THREADS);
         rewriteConfigNumericalOption(state, "slave-priority",
                                      server.slave_priority,
                                      CONFIG_DEFAULT_SLAVE_PRIORITY);
@@ -2126,14 +2345,34 @@ void configSetCommand(client *c)
                                   NULL);
         rewriteConfigNumericalOption(state, "maxclients", server.maxclients,
                                      CONFIG_DEFAULT_MAX_CLIENTS);
+        rewriteConfigNumericalOption(state, "threads_num", server.threads_num,
+                                     CONFIG_DEFAULT_THREADS_NUM);
         rewriteConfigBytesOption(state, "maxmemory", server.maxmemory,
                                  CONFIG_DEFAULT_MAXMEMORY);
+        rewriteConfigBytesOption(state, "rcu-reclaim-max-memory",
+                                 server.rcu_reclaim_max_memory,
+                                 CONFIG_DEFAULT_RCU_RECLAIM_MAX_MEMORY);
         rewriteConfigEnumOption(state, "maxmemory-policy",
                                 server.maxmemory_policy, maxmemory_policy_enum,
                                 CONFIG_DEFAULT_MAXMEMORY_POLICY);
         rewriteConfigNumericalOption(state, "maxmemory-samples",
                                      server.maxmemory_samples,
                                      CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
+        rewriteConfigNumericalOption(state, "lfu-log-factor",
+                                     server.lfu_log_factor,
+                                     CONFIG_DEFAULT_LFU_LOG_FACTOR);
+        rewriteConfigYesNoOption(state, "jemalloc-thread-arenas",
+                                 server.jemalloc_thread_arenas,
+                                 CONFIG_DEFAULT_JEMALLOC_THREAD_ARENAS);
+        rewriteConfigNumericalOption(state, "jemalloc-dirty-decay-ms",
+                                     server.jemalloc_dirty_decay_ms,
+                                     CONFIG_DEFAULT_JEMALLOC_DIRTY_DECAY_MS);
+        rewriteConfigNumericalOption(state, "jemalloc-muzzy-decay-ms",
+                                     server.jemalloc_muzzy_decay_ms,
+                                     CONFIG_DEFAULT_JEMALLOC_MUZZY_DECAY_MS);
+        rewriteConfigNumericalOption(state, "lfu-decay-time",
+                                     server.lfu_decay_time,
+                                     CONFIG_DEFAULT_LFU_DECAY_TIME);
         rewriteConfigYesNoOption(state, "appendonly",
                                  server.aof_state != AOF_OFF, 0);
         rewriteConfigStringOption(state, "appendfilename", server.aof_filename,
@@ -2177,6 +2416,25 @@ void configSetCommand(client *c)
         rewriteConfigNumericalOption(state, "slowlog-max-len",
                                      server.slowlog_max_len,
                                      CONFIG_DEFAULT_SLOWLOG_MAX_LEN);
+        rewriteConfigNumericalOption(state, "tracking-table-max-keys",
+                                     server.tracking_table_max_keys,
+                                     CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS);
+        rewriteConfigNumericalOption(state, "hotkeys-sample-rate",
+                                     server.hotkeys_sample_rate,
+                                     CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE);
+        rewriteConfigYesNoOption(state, "key-prefix-index",
+                                 server.key_prefix_index,
+                                 CONFIG_DEFAULT_KEY_PREFIX_INDEX);
+        rewriteConfigNumericalOption(state, "keys-threads",
+                                     server.keys_threads,
+                                     CONFIG_DEFAULT_KEYS_THREADS);
+        rewriteConfigNumericalOption(state, "key-load-delay",
+                                     server.key_load_delay,
+                                     CONFIG_DEFAULT_KEY_LOAD_DELAY);
+        rewriteConfigNumericalOption(
+            state, "loading-process-events-interval-bytes",
+            server.loading_process_events_interval_bytes,
+            CONFIG_DEFAULT_LOADING_PROCESS_EVENTS_INTERVAL_BYTES);
         rewriteConfigNotifykeyspaceeventsOption(state);
         rewriteConfigNumericalOption(state, "hash-max-ziplist-entries",
                                      server.hash_max_ziplist_entries,
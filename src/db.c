@@ -33,9 +33,6 @@
 #include <signal.h>
 #include <ctype.h>
 
-void slotToKeyAdd(robj *key);
-void slotToKeyDel(robj *key);
-void slotToKeyFlush(void);
 
 /*-----------------------------------------------------------------------------
  * C-level DB API
@@ -69,15 +66,20 @@ robj *lookupKey(redisDb *db, robj *key, int flags)
     struct q_dictEntry *de = NULL;
     robj *o = NULL;
 
-    UNUSED(flags);  // flags trigger write action, which is not allowd in lookup
-                    // only command.
-    unsigned int hash = dictSdsHash(key->ptr);
-    cds_lfht_lookup(db->dict->table, hash, q_dictSdsKeyCaseMatch, key->ptr,
-                    &iter);
+    unsigned long hash = dictSdsHash(key->ptr);
+    cds_lfht_lookup(rcu_dereference(db->dict->table), hash,
+                    q_dictSdsKeyCaseMatch, key->ptr, &iter);
     node = cds_lfht_iter_get_node(&iter);
     if (node) {
         de = caa_container_of(node, struct q_dictEntry, node);
         o = rcu_dereference((robj *) de->v.val);
+
+        /* Update the access time or frequency for the eviction, unless a
+         * child is saving, that would copy the pages of all the objects
+         * accessed. Safe from the worker threads, see updateObjectAccess(). */
+        if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+            !(flags & LOOKUP_NOTOUCH))
+            updateObjectAccess(o);
         return o;
     }
     return NULL;
@@ -199,8 +201,6 @@ void dbAdd(redisDb *db, robj *key, robj *val)
     serverAssertWithInfo(NULL, key, retval == DICT_OK);
     if (val->type == OBJ_LIST)
         signalListAsReady(db, key);
-    if (server.cluster_enabled)
-        slotToKeyAdd(key);
 }
 
 // ToDo: the same as dbAdd for lfht. Consider to unify dbAdd and dbOverwrite.
@@ -283,13 +283,7 @@ int dbDelete(redisDb *db, robj *key)
      * the key, because it is shared with the main dictionary. */
     if (q_dictSize(db->expires) > 0)
         q_dictDelete(db->expires, key->ptr, true);
-    if (q_dictDelete(db->dict, key->ptr, false) == DICT_OK) {
-        if (server.cluster_enabled)
-            slotToKeyDel(key);
-        return 1;
-    } else {
-        return 0;
-    }
+    return q_dictDelete(db->dict, key->ptr, false) == DICT_OK;
 }
 
 /* Prepare the string object stored at 'key' to be modified destructively
@@ -331,6 +325,88 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o)
     return o;
 }
 
+/* Return a private copy of the string object 'o', never stored in the keyspace
+ * yet, padded with zeroes up to 'minlen' bytes. A NULL 'o' stands for the
+ * empty string. This is how the server thread updates a value while worker
+ * threads may be reading it: the new value is written in a copy that then
+ * replaces 'o' with dbOverwrite(), 'o' being freed after a grace period.
+ *
+ * A copy growing the value gets spare room past 'minlen' as sdsMakeRoomFor()
+ * gives, so that the next appends can be written in place. */
+robj *dbCopyStringValue(robj *o, size_t minlen)
+{
+    robj *decoded = o ? getDecodedObject(o) : NULL;
+    size_t len = decoded ? sdslen(decoded->ptr) : 0;
+    robj *copy;
+    sds s;
+
+    if (decoded && minlen > len) {
+        s = sdsMakeRoomFor(sdsnewlen(decoded->ptr, len), minlen - len);
+        memset(s + len, 0, minlen - len);
+        sdssetlen(s, minlen);
+        s[minlen] = '\0';
+    } else if (decoded) {
+        s = sdsnewlen(decoded->ptr, len);
+    } else {
+        s = sdsnewlen(NULL, minlen);
+    }
+    copy = createObject(OBJ_STRING, s);
+    if (decoded) {
+        if (o->refcount == 1)
+            copy->lru = o->lru;
+        decrRefCount(decoded);
+    }
+    return copy;
+}
+
+/* Write 'len' bytes from 'p' at 'offset' in the string object 'o' stored at
+ * 'key', padding the value with zeroes up to 'offset' if it is shorter. The
+ * object now holding the value is returned.
+ *
+ * Worker threads may be replying with the value meanwhile, so 'o' is only
+ * modified in place when readers can't tell: a single byte overwritten, as
+ * SETBIT does, which is one store and leaves the length alone, or bytes
+ * written past the length, as APPEND does, when the value has room for them.
+ * These are written first and the new length is published after a write
+ * barrier; readers load the length once (see addReplyBulk()) and see either
+ * the old value or the new one. Otherwise the value is written in a copy
+ * replacing 'o' in the keyspace, see dbCopyStringValue(). */
+robj *dbWriteStringValue(redisDb *db,
+                         robj *key,
+                         robj *o,
+                         size_t offset,
+                         const char *p,
+                         size_t len)
+{
+    robj *copy;
+
+    serverAssert(o->type == OBJ_STRING);
+    if (o->refcount == 1 && o->encoding == OBJ_ENCODING_RAW) {
+        sds s = o->ptr;
+        size_t curlen = sdslen(s);
+
+        if (len == 1 && offset < curlen) {
+            CMM_STORE_SHARED(s[offset], p[0]);
+            return o;
+        }
+        if (offset >= curlen && offset + len <= curlen + sdsavail(s)) {
+            memset(s + curlen, 0, offset - curlen);
+            memcpy(s + offset, p, len);
+            s[offset + len] = '\0';
+            cmm_smp_wmb();
+            /* The length field is aligned at the start of the header, so
+             * this is a single store. */
+            sdssetlen(s, offset + len);
+            return o;
+        }
+    }
+
+    copy = dbCopyStringValue(o, offset + len);
+    memcpy((char *) copy->ptr + offset, p, len);
+    dbOverwrite(db, key, copy);
+    return copy;
+}
+
 long long emptyDb(void(callback)(void *))
 {
     int j;
@@ -341,11 +417,234 @@ long long emptyDb(void(callback)(void *))
         q_dictEmpty(server.db[j].expires, callback, true);
         q_dictEmpty(server.db[j].dict, callback, false);
     }
-    if (server.cluster_enabled)
-        slotToKeyFlush();
     return removed;
 }
 
+/* The keyspace kept aside while a slave loads the RDB of its master straight
+ * from the socket (repl-diskless-load swapdb), so that it can be restored if
+ * the transfer fails. */
+struct dbBackup {
+    q_dict *dict;    /* Tables and key indexes of every db, without type */
+    q_dict *expires; /* and expires tables */
+    clusterSlotKeys *slots_to_keys; /* Slot lists of db 0 in cluster mode */
+};
+
+static struct cds_lfht *createDbTable(void)
+{
+    return cds_lfht_new(1, 1, 0, CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING,
+                        NULL);
+}
+
+/* Publish 'table' as the table of 'd', the previous one is returned. Workers
+ * may still be walking it until the next grace period. */
+static struct cds_lfht *swapDbTable(q_dict *d,
+                                    struct cds_lfht *table,
+                                    unsigned int size)
+{
+    struct cds_lfht *old = d->table;
+
+    rcu_assign_pointer(d->table, table);
+    d->size = size;
+    return old;
+}
+
+/* An empty key index, or NULL without key-prefix-index. */
+static q_keyIndex *createDbKeyIndex(void)
+{
+    return server.key_prefix_index ? q_keyIndexCreate() : NULL;
+}
+
+/* Publish 'keyindex' as the key index of 'd', the previous one is returned.
+ * As for the table, SCAN and KEYS may still be reading it. */
+static q_keyIndex *swapDbKeyIndex(q_dict *d, q_keyIndex *keyindex)
+{
+    q_keyIndex *old = d->keyindex;
+
+    rcu_assign_pointer(d->keyindex, keyindex);
+    return old;
+}
+
+/* Empty and destroy the tables and key indexes of 'dict' and 'expires',
+ * already unpublished. The slot lists are not touched, as the dicts have no
+ * type. */
+static void freeDbTables(q_dict *dict,
+                         q_dict *expires,
+                         void(callback)(void *))
+{
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        q_dictEmpty(&expires[j], callback, true);
+        q_dictEmpty(&dict[j], callback, false);
+    }
+    synchronize_rcu();
+    for (j = 0; j < server.dbnum; j++) {
+        cds_lfht_destroy(expires[j].table, NULL);
+        cds_lfht_destroy(dict[j].table, NULL);
+        if (dict[j].keyindex)
+            q_keyIndexRelease(dict[j].keyindex);
+    }
+}
+
+/* Replace the tables of every db with empty ones and return the current
+ * ones, to be handed to restoreDbBackup() or discardDbBackup(). */
+dbBackup *backupDb(void)
+{
+    dbBackup *backup = zmalloc(sizeof(*backup));
+    int j;
+
+    backup->dict = zcalloc(sizeof(q_dict) * server.dbnum);
+    backup->expires = zcalloc(sizeof(q_dict) * server.dbnum);
+    backup->slots_to_keys = NULL;
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db + j;
+
+        backup->dict[j].size = q_dictSize(db->dict);
+        backup->dict[j].table = swapDbTable(db->dict, createDbTable(), 0);
+        backup->dict[j].keyindex = swapDbKeyIndex(db->dict, createDbKeyIndex());
+        backup->expires[j].size = q_dictSize(db->expires);
+        backup->expires[j].table = swapDbTable(db->expires, createDbTable(), 0);
+    }
+
+    if (server.cluster_enabled) {
+        size_t len = sizeof(server.cluster->slots_to_keys);
+
+        pthread_mutex_lock(&server.cluster->slots_to_keys_lock);
+        backup->slots_to_keys = zmalloc(len);
+        memcpy(backup->slots_to_keys, server.cluster->slots_to_keys, len);
+        memset(server.cluster->slots_to_keys, 0, len);
+        pthread_mutex_unlock(&server.cluster->slots_to_keys_lock);
+    }
+    signalFlushedDb(-1);
+    return backup;
+}
+
+static void freeDbBackup(dbBackup *backup)
+{
+    zfree(backup->dict);
+    zfree(backup->expires);
+    zfree(backup->slots_to_keys);
+    zfree(backup);
+}
+
+/* Drop whatever was loaded since backupDb() and put the backup back. */
+void restoreDbBackup(dbBackup *backup, void(callback)(void *))
+{
+    q_dict *dict = zcalloc(sizeof(q_dict) * server.dbnum);
+    q_dict *expires = zcalloc(sizeof(q_dict) * server.dbnum);
+    int j;
+
+    /* Empty through the slot hooks, so that the slot lists are empty too. */
+    emptyDb(callback);
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db + j;
+
+        dict[j].table = swapDbTable(db->dict, backup->dict[j].table,
+                                    backup->dict[j].size);
+        dict[j].keyindex =
+            swapDbKeyIndex(db->dict, backup->dict[j].keyindex);
+        expires[j].table = swapDbTable(db->expires, backup->expires[j].table,
+                                       backup->expires[j].size);
+    }
+    if (backup->slots_to_keys) {
+        pthread_mutex_lock(&server.cluster->slots_to_keys_lock);
+        memcpy(server.cluster->slots_to_keys, backup->slots_to_keys,
+               sizeof(server.cluster->slots_to_keys));
+        pthread_mutex_unlock(&server.cluster->slots_to_keys_lock);
+    }
+    signalFlushedDb(-1);
+
+    freeDbTables(dict, expires, callback);
+    zfree(dict);
+    zfree(expires);
+    freeDbBackup(backup);
+}
+
+/* The new dataset was loaded: free the backup. */
+void discardDbBackup(dbBackup *backup, void(callback)(void *))
+{
+    freeDbTables(backup->dict, backup->expires, callback);
+    freeDbBackup(backup);
+}
+
+/* Create the dbs a slave loads the RDB of its master into while the current
+ * keyspace keeps serving reads (repl-diskless-load swapdb). Nothing but the
+ * loading code sees them until swapTempDb() publishes their tables. */
+redisDb *createTempDb(void)
+{
+    redisDb *tempDb = zcalloc(sizeof(redisDb) * server.dbnum);
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        tempDb[j].dict = zcalloc(sizeof(q_dict));
+        tempDb[j].dict->table = createDbTable();
+        tempDb[j].dict->type = &keyspaceDictType;
+        tempDb[j].dict->keyindex = createDbKeyIndex();
+        tempDb[j].expires = zcalloc(sizeof(q_dict));
+        tempDb[j].expires->table = createDbTable();
+        /* Always empty: no client can block on these keys. */
+        tempDb[j].blocking_keys = dictCreate(&keylistDictType, NULL);
+        tempDb[j].id = j;
+    }
+    return tempDb;
+}
+
+static void freeTempDb(redisDb *tempDb)
+{
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        zfree(tempDb[j].dict);
+        zfree(tempDb[j].expires);
+        dictRelease(tempDb[j].blocking_keys);
+    }
+    zfree(tempDb);
+}
+
+/* Publish the tables of 'tempDb' as the keyspace, and free the previous
+ * ones once the workers still reading them are done. */
+void swapTempDb(redisDb *tempDb, void(callback)(void *))
+{
+    q_dict *dict = zcalloc(sizeof(q_dict) * server.dbnum);
+    q_dict *expires = zcalloc(sizeof(q_dict) * server.dbnum);
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db + j;
+
+        dict[j].table = swapDbTable(db->dict, tempDb[j].dict->table,
+                                    q_dictSize(tempDb[j].dict));
+        dict[j].keyindex = swapDbKeyIndex(db->dict, tempDb[j].dict->keyindex);
+        expires[j].table = swapDbTable(db->expires, tempDb[j].expires->table,
+                                       q_dictSize(tempDb[j].expires));
+    }
+    signalFlushedDb(-1);
+
+    freeDbTables(dict, expires, callback);
+    zfree(dict);
+    zfree(expires);
+    freeTempDb(tempDb);
+}
+
+/* The load failed: free what was loaded in 'tempDb'. The keyspace was never
+ * touched. */
+void discardTempDb(redisDb *tempDb, void(callback)(void *))
+{
+    q_dict *dict = zcalloc(sizeof(q_dict) * server.dbnum);
+    q_dict *expires = zcalloc(sizeof(q_dict) * server.dbnum);
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        dict[j] = *tempDb[j].dict;
+        dict[j].type = NULL;
+        expires[j] = *tempDb[j].expires;
+    }
+    freeDbTables(dict, expires, callback);
+    zfree(dict);
+    zfree(expires);
+    freeTempDb(tempDb);
+}
+
 int selectDb(client *c, int id)
 {
     if (id < 0 || id >= server.dbnum)
@@ -367,11 +666,13 @@ int selectDb(client *c, int id)
 void signalModifiedKey(redisDb *db, robj *key)
 {
     touchWatchedKey(db, key);
+    q_trackingInvalidateKey(key);
 }
 
 void signalFlushedDb(int dbid)
 {
     touchWatchedKeysOnFlush(dbid);
+    q_trackingInvalidateKeysOnFlush();
 }
 
 /*-----------------------------------------------------------------------------
@@ -384,8 +685,9 @@ void flushdbCommand(client *c)
     signalFlushedDb(c->db->id);
     q_dictEmpty(c->db->dict, NULL, false);
     q_dictEmpty(c->db->expires, NULL, true);
-    if (server.cluster_enabled)
-        slotToKeyFlush();
+    /* The keys are freed after a grace period: wait for them, so that the
+     * memory is back once the flush is acknowledged. */
+    rcu_barrier();
     addReply(c, shared.ok);
 }
 
@@ -393,6 +695,7 @@ void flushallCommand(client *c)
 {
     signalFlushedDb(-1);
     server.dirty += emptyDb(NULL);
+    rcu_barrier(); /* See flushdbCommand(). */
     addReply(c, shared.ok);
     if (server.rdb_child_pid != -1) {
         kill(server.rdb_child_pid, SIGUSR1);
@@ -424,6 +727,145 @@ void delCommand(client *c)
     addReplyLongLong(c, deleted);
 }
 
+/* Keys taken from the key index at a time by KEYS and DELPREFIX: its lock
+ * is released between two chunks, so the keys of other clients can be added
+ * and deleted meanwhile. */
+#define KEYINDEX_CHUNK_KEYS 1024
+
+/* Add the keys of a q_keyIndexRange() to the list 'privdata' as string
+ * objects. The keyspace can't be modified under the lock of the index, so
+ * they are checked for expiry and deleted once the range is done. */
+static void keyIndexCollect(void *privdata, const char *key, size_t len)
+{
+    listAddNodeTail(privdata, createStringObject(key, len));
+}
+
+/* Take the next chunk of the keys starting with 'prefix' from the key index
+ * of the db, after the key '*after' when set, and add them to 'keys'.
+ * '*after' is set to the last of them. Returns the number of keys added, or
+ * -1 when the db has no key index. */
+static long keyIndexNextChunk(redisDb *db,
+                              sds prefix,
+                              size_t plen,
+                              sds *after,
+                              list *keys)
+{
+    q_keyIndex *keyindex;
+    unsigned long found;
+
+    rcu_read_lock();
+    keyindex = rcu_dereference(db->dict->keyindex);
+    if (keyindex == NULL) {
+        rcu_read_unlock();
+        return -1;
+    }
+    found = q_keyIndexRangeAfter(keyindex, prefix, plen, *after,
+                                 *after ? sdslen(*after) : 0,
+                                 KEYINDEX_CHUNK_KEYS, keyIndexCollect, keys);
+    rcu_read_unlock();
+    if (found) {
+        robj *last = listNodeValue(listLast(keys));
+
+        sdsfree(*after);
+        *after = sdsdup(last->ptr);
+    }
+    return found;
+}
+
+/* A prefix with a hash tag, whose keys all have the hash slot of the prefix,
+ * see keyHashSlot(). */
+static int prefixHasHashTag(sds prefix, size_t plen)
+{
+    char *s = memchr(prefix, '{', plen), *e;
+
+    if (s == NULL)
+        return 0;
+    e = memchr(s + 1, '}', plen - (s + 1 - prefix));
+    return e != NULL && e != s + 1;
+}
+
+/* Delete the keys of the list 'keys' for DELPREFIX, and empty it. Returns the
+ * number of keys deleted, expired ones included. */
+static long long delprefixDeleteKeys(client *c, list *keys)
+{
+    long long deleted = 0;
+    listNode *ln;
+
+    while ((ln = listFirst(keys)) != NULL) {
+        robj *key = listNodeValue(ln);
+        int expired = expireIfNeeded(c->db, key);
+
+        if (dbDelete(c->db, key)) {
+            signalModifiedKey(c->db, key);
+            notifyKeyspaceEvent(NOTIFY_GENERIC, "del", key, c->db->id);
+            server.dirty++;
+            deleted++;
+        } else if (expired) {
+            /* deleted by expireIfNeeded(), which notified it */
+            deleted++;
+        }
+        decrRefCount(key);
+        listDelNode(keys, ln);
+    }
+    return deleted;
+}
+
+/* DELPREFIX prefix
+ * Delete every key whose name starts with 'prefix', and return their number.
+ * The keys are found in the key index with key-prefix-index, by chunks of
+ * KEYINDEX_CHUNK_KEYS deleted before the next one is taken, otherwise the
+ * whole keyspace is walked. As for DEL, their memory is released by the RCU
+ * reclaim threads.
+ *
+ * The prefix can't be empty, FLUSHDB deletes every key. In cluster mode the
+ * command is sent to the node of the slot of the prefix, which must have a
+ * hash tag so that all its keys are in that slot. */
+void delprefixCommand(client *c)
+{
+    sds prefix = c->argv[1]->ptr;
+    size_t plen = sdslen(prefix);
+    list *keys;
+    sds after = NULL;
+    long long deleted = 0;
+    long found;
+
+    if (plen == 0) {
+        addReplyError(c, "DELPREFIX needs a non empty prefix");
+        return;
+    }
+    if (server.cluster_enabled && !prefixHasHashTag(prefix, plen)) {
+        addReplyError(c, "DELPREFIX needs a prefix with a hash tag "
+                         "in cluster mode");
+        return;
+    }
+
+    keys = listCreate();
+    do {
+        found = keyIndexNextChunk(c->db, prefix, plen, &after, keys);
+        deleted += delprefixDeleteKeys(c, keys);
+    } while (found == KEYINDEX_CHUNK_KEYS);
+    sdsfree(after);
+
+    if (found == -1) {
+        q_dictIterator *di;
+        q_dictEntry *de;
+
+        rcu_read_lock();
+        di = q_dictGetIterator(c->db->dict);
+        while ((de = q_dictNext(di)) != NULL) {
+            sds key = dictGetKey(de);
+
+            if (sdslen(key) >= plen && !memcmp(key, prefix, plen))
+                keyIndexCollect(keys, key, sdslen(key));
+        }
+        q_dictReleaseIterator(di);
+        rcu_read_unlock();
+        deleted += delprefixDeleteKeys(c, keys);
+    }
+    listRelease(keys);
+    addReplyLongLong(c, deleted);
+}
+
 /* EXISTS key1 key2 ... key_N.
  * Return value is the number of keys existing. */
 void existsCommand(client *c)
@@ -475,35 +917,202 @@ void randomkeyCommand(client *c)
     rcu_read_unlock();
 }
 
+/* Keys added to a KEYS reply between two attempts to send it. */
+#define KEYS_STREAM_KEYS 1024
+
+/* KEYS through the key index of the db, when it has one and the pattern
+ * starts with a literal prefix: only the keys having that prefix are matched
+ * against the pattern, a chunk at a time, each in its own RCU read section.
+ * Returns 0 when the whole table has to be walked. */
+static int keysFromKeyIndex(client *c, sds pattern, int plen, q_glob *glob)
+{
+    size_t prefixlen = q_keyIndexPatternPrefix(pattern, plen);
+    unsigned long sent = 0;
+    long found;
+    list *keys;
+    listNode *ln, *next;
+    sds after = NULL;
+
+    if (prefixlen == 0)
+        return 0;
+    keys = listCreate();
+    do {
+        /* match the keys of the chunk, added after the last one kept */
+        ln = listLast(keys);
+        found = keyIndexNextChunk(c->db, pattern, prefixlen, &after, keys);
+        if (found == -1 && after == NULL) {
+            listRelease(keys);
+            return 0;
+        }
+        ln = ln ? listNextNode(ln) : listFirst(keys);
+        rcu_read_lock();
+        for (; ln != NULL; ln = next) {
+            robj *keyobj = listNodeValue(ln);
+
+            next = listNextNode(ln);
+            if (!q_globMatch(glob, keyobj->ptr, sdslen(keyobj->ptr)) ||
+                q_expireIfNeeded(c->db, keyobj)) {
+                decrRefCount(keyobj);
+                listDelNode(keys, ln);
+            }
+        }
+        rcu_read_unlock();
+    } while (found == KEYINDEX_CHUNK_KEYS);
+    sdsfree(after);
+
+    addReplyMultiBulkLen(c, listLength(keys));
+    while ((ln = listFirst(keys)) != NULL) {
+        robj *keyobj = listNodeValue(ln);
+
+        addReplyBulk(c, keyobj);
+        decrRefCount(keyobj);
+        listDelNode(keys, ln);
+        if (++sent % KEYS_STREAM_KEYS == 0)
+            streamClientReplies(c);
+    }
+    listRelease(keys);
+    return 1;
+}
+
+/* Wait for a batch of keys of KEYS to be matched, and add a copy of the
+ * matching ones that are not expired to the array 'keys' of '*numkeys'
+ * entries. */
+static void keysCollectBatch(client *c,
+                             q_matchBatch *batch,
+                             sds **keys,
+                             unsigned long *numkeys,
+                             unsigned long *size)
+{
+    int j;
+
+    q_matchWait(batch);
+    for (j = 0; j < batch->matched; j++) {
+        q_dictEntry *de = batch->entries[j];
+        robj keyobj;
+
+        initStaticStringObject(keyobj, dictGetKey(de));
+        if (q_expireIfNeeded(c->db, &keyobj))
+            continue;
+        if (*numkeys == *size) {
+            *size = *size ? *size * 2 : Q_MATCH_BATCH_SIZE;
+            *keys = zrealloc(*keys, sizeof(sds) * (*size));
+        }
+        (*keys)[(*numkeys)++] = sdsdup(dictGetKey(de));
+    }
+    batch->count = 0;
+}
+
+/* Entries of the table KEYS walks in one RCU read section. */
+#define KEYS_WALK_CHUNK (Q_MATCH_BATCH_SIZE * Q_MATCH_INFLIGHT)
+
+/* KEYS pattern
+ * The pattern is compiled once, see q_glob.c. The table is walked by the
+ * thread running the command, which hands the keys to the keys-threads
+ * threads by batches to be matched, see q_match.c. The matching keys are
+ * copied: their number has to come first in the reply, which is built once
+ * the walk is done.
+ *
+ * The walk leaves the RCU read section every KEYS_WALK_CHUNK entries, so
+ * that it doesn't hold back the reclaim of the keyspace for the whole
+ * command, and resumes after the last entry walked. The table is ordered by
+ * hash: when that entry was deleted meanwhile, the walk starts over and
+ * skips the entries up to the hash of the last one matched. */
 void keysCommand(client *c)
 {
-    q_dictIterator *di;
-    q_dictEntry *de;
     sds pattern = c->argv[1]->ptr;
-    int plen = sdslen(pattern), allkeys;
-    unsigned long numkeys = 0;
-    void *replylen = addDeferredMultiBulkLength(c);
+    int plen = sdslen(pattern);
+    q_glob *glob = q_globCompile(pattern, plen, 0);
+    q_matchBatch *batches, *batch;
+    q_matchRun run;
+    struct cds_lfht *table;
+    struct cds_lfht_iter iter;
+    struct cds_lfht_node *node, *last = NULL;
+    sds cursor = NULL, *keys = NULL;
+    unsigned long numkeys = 0, size = 0, submitted = 0, collected = 0, j;
+    unsigned long walked, matched_hash = 0;
+    int skipping = 0;
+
+    if (keysFromKeyIndex(c, pattern, plen, glob)) {
+        q_globFree(glob);
+        return;
+    }
 
-    rcu_read_lock();
-    // di = dictGetSafeIterator(c->db->dict);
-    di = q_dictGetIterator(c->db->dict);
-    allkeys = (pattern[0] == '*' && pattern[1] == '\0');
-    while ((de = q_dictNext(di)) != NULL) {
-        sds key = dictGetKey(de);
-        robj *keyobj;
+    batches = zmalloc(sizeof(q_matchBatch) * Q_MATCH_INFLIGHT);
+    q_matchRunInit(&run, glob);
+    for (j = 0; j < Q_MATCH_INFLIGHT; j++) {
+        batches[j].run = &run;
+        batches[j].count = 0;
+    }
+
+    do {
+        rcu_read_lock();
+        table = rcu_dereference(c->db->dict->table);
+        if (cursor == NULL) {
+            cds_lfht_first(table, &iter);
+        } else {
+            cds_lfht_lookup(table, dictSdsHash(cursor), q_dictSdsKeyCaseMatch,
+                            cursor, &iter);
+            if (cds_lfht_iter_get_node(&iter)) {
+                cds_lfht_next(table, &iter);
+            } else {
+                skipping = 1;
+                cds_lfht_first(table, &iter);
+            }
+        }
 
-        if (allkeys || stringmatchlen(pattern, plen, key, sdslen(key), 0)) {
-            keyobj = createStringObject(key, sdslen(key));
-            if (q_expireIfNeeded(c->db, keyobj) == 0) {
-                addReplyBulk(c, keyobj);
-                numkeys++;
+        for (walked = 0; walked < KEYS_WALK_CHUNK; walked++) {
+            node = cds_lfht_iter_get_node(&iter);
+            if (node == NULL)
+                break;
+            last = node;
+            cds_lfht_next(table, &iter);
+            if (skipping && node->reverse_hash <= matched_hash)
+                continue;
+            skipping = 0;
+            matched_hash = node->reverse_hash;
+
+            batch = &batches[submitted % Q_MATCH_INFLIGHT];
+            batch->entries[batch->count++] =
+                caa_container_of(node, q_dictEntry, node);
+            if (batch->count == Q_MATCH_BATCH_SIZE) {
+                q_matchSubmit(batch);
+                submitted++;
+                /* Make room for the next batch. */
+                if (submitted - collected == Q_MATCH_INFLIGHT) {
+                    keysCollectBatch(c,
+                                     &batches[collected++ % Q_MATCH_INFLIGHT],
+                                     &keys, &numkeys, &size);
+                }
             }
-            decrRefCount(keyobj);
         }
+
+        /* The entries can't be used out of the read section. */
+        batch = &batches[submitted % Q_MATCH_INFLIGHT];
+        if (batch->count) {
+            q_matchSubmit(batch);
+            submitted++;
+        }
+        while (collected < submitted) {
+            keysCollectBatch(c, &batches[collected++ % Q_MATCH_INFLIGHT],
+                             &keys, &numkeys, &size);
+        }
+        sdsfree(cursor);
+        cursor = node ? sdsdup(caa_container_of(last, q_dictEntry, node)->key)
+                      : NULL;
+        rcu_read_unlock();
+    } while (cursor);
+    q_matchRunDeinit(&run);
+    zfree(batches);
+    q_globFree(glob);
+
+    addReplyMultiBulkLen(c, numkeys);
+    for (j = 0; j < numkeys; j++) {
+        addReplyBulkCBuffer(c, keys[j], sdslen(keys[j]));
+        sdsfree(keys[j]);
+        if ((j + 1) % KEYS_STREAM_KEYS == 0)
+            streamClientReplies(c);
     }
-    q_dictReleaseIterator(di);
-    rcu_read_unlock();
-    setDeferredMultiBulkLength(c, replylen, numkeys);
+    zfree(keys);
 }
 
 /* This callback is used by scanGenericCommand in order to collect elements
@@ -558,6 +1167,36 @@ int parseScanCursorOrReply(client *c, robj *o, unsigned long *cursor)
     return C_OK;
 }
 
+/* SCAN MATCH through the key index of 'd', when it has one and the pattern
+ * starts with a literal prefix: only the keys having that prefix are visited,
+ * in order, and the cursor is the rank of the next one among them. Returns 0
+ * when the table has to be scanned instead. */
+static int scanKeyIndex(q_dict *d,
+                        sds pat,
+                        int patlen,
+                        long count,
+                        list *keys,
+                        unsigned long *cursor)
+{
+    size_t prefixlen = q_keyIndexPatternPrefix(pat, patlen);
+    q_keyIndex *keyindex;
+    unsigned long found;
+
+    if (prefixlen == 0)
+        return 0;
+    rcu_read_lock();
+    keyindex = rcu_dereference(d->keyindex);
+    if (keyindex == NULL) {
+        rcu_read_unlock();
+        return 0;
+    }
+    found = q_keyIndexRange(keyindex, pat, prefixlen, *cursor, count,
+                            keyIndexCollect, keys);
+    rcu_read_unlock();
+    *cursor = (found == (unsigned long) count) ? *cursor + found : 0;
+    return 1;
+}
+
 /* This command implements SCAN, HSCAN and SSCAN commands.
  * If object 'o' is passed, then it must be a Hash or Set object, otherwise
  * if 'o' is NULL the command will operate on the dictionary associated with
@@ -577,6 +1216,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor)
     long count = 10;
     sds pat = NULL;
     int patlen = 0, use_pattern = 0;
+    q_glob *glob = NULL;
     q_dict *ht;
 
     /* Object must be NULL (to iterate keys names), or the type of the object
@@ -617,6 +1257,9 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor)
         }
     }
 
+    if (use_pattern)
+        glob = q_globCompile(pat, patlen, 0);
+
     /* Step 2: Iterate the collection.
      *
      * Note that if the object is encoded with a ziplist, intset, or any other
@@ -647,7 +1290,10 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor)
          */
     }
 
-    if (ht) {
+    if (ht && o == NULL && use_pattern &&
+        scanKeyIndex(ht, pat, patlen, count, keys, &cursor)) {
+        /* The keys are still matched against the whole pattern below. */
+    } else if (ht) {
         /* void *privdata[2]; */
         /* We set the max number of iterations to ten times the specified
          * COUNT, so if the hash table is in a pathological state (very
@@ -671,7 +1317,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor)
         long oldcount = cursor;
 
         q_dictIterator *it = q_dictGetIterator(ht);
-        q_dictEntry *de;
+        q_dictEntry *de = NULL;
 
         if (o == NULL) {
             while ((de = q_dictNext(it)) != NULL) {
@@ -691,7 +1337,9 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor)
                     break;
             }
         }
-        if (oldcount > 0)
+        /* The iteration is complete when the table has no more entries,
+         * signal it to the caller with a zero cursor. */
+        if (de == NULL)
             cursor = 0;
         q_dictReleaseIterator(it);
     } else if (o->type == OBJ_SET) {
@@ -731,8 +1379,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor)
         /* Filter element if it does not match the pattern. */
         if (!filter && use_pattern) {
             if (sdsEncodedObject(kobj)) {
-                if (!stringmatchlen(pat, patlen, kobj->ptr, sdslen(kobj->ptr),
-                                    0))
+                if (!q_globMatch(glob, kobj->ptr, sdslen(kobj->ptr)))
                     filter = 1;
             } else {
                 char buf[LONG_STR_SIZE];
@@ -740,7 +1387,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor)
 
                 serverAssert(kobj->encoding == OBJ_ENCODING_INT);
                 len = ll2string(buf, sizeof(buf), (long) kobj->ptr);
-                if (!stringmatchlen(pat, patlen, buf, len, 0))
+                if (!q_globMatch(glob, buf, len))
                     filter = 1;
             }
         }
@@ -783,6 +1430,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor)
     }
 
 cleanup:
+    q_globFree(glob);
     listSetFreeMethod(keys, decrRefCountVoid);
     listRelease(keys);
 }
@@ -1099,6 +1747,7 @@ int expireIfNeeded(redisDb *db, robj *key)
     server.stat_expiredkeys++;
     propagateExpire(db, key);
     notifyKeyspaceEvent(NOTIFY_EXPIRED, "expired", key, db->id);
+    q_trackingInvalidateKey(key);
     return dbDelete(db, key);
 }
 
@@ -1482,46 +2131,149 @@ int *georadiusGetKeys(struct redisCommand *cmd,
     return keys;
 }
 
+/* Helper function to extract keys from the MEMORY command: only MEMORY USAGE
+ * has a key, MEMORY USAGE <key> [SAMPLES <count>]. */
+int *memoryGetKeys(struct redisCommand *cmd,
+                   robj **argv,
+                   int argc,
+                   int *numkeys)
+{
+    int *keys;
+    UNUSED(cmd);
+
+    if (argc >= 3 && !strcasecmp(argv[1]->ptr, "usage")) {
+        keys = zmalloc(sizeof(int));
+        keys[0] = 2;
+        *numkeys = 1;
+        return keys;
+    }
+    *numkeys = 0;
+    return NULL;
+}
+
 /* Slot to Key API. This is used by Redis Cluster in order to obtain in
  * a fast way a key that belongs to a specified hash slot. This is useful
- * while rehashing the cluster. */
-void slotToKeyAdd(robj *key)
+ * while rehashing the cluster.
+ *
+ * Every key of db 0 is linked into the list of its hash slot through the
+ * link.slot pointers of its q_dictEntry. The lists are maintained
+ * by the q_dict hooks below, so entries replaced by dbOverwrite() or removed
+ * by q_dictEmpty() are handled as well. The hooks may run on worker threads
+ * (expired keys), so the lists are protected by slots_to_keys_lock. */
+static void slotToKeyAdd(q_dictEntry *de)
+{
+    sds key = de->key;
+    clusterSlotKeys *sk =
+        &server.cluster->slots_to_keys[keyHashSlot(key, sdslen(key))];
+
+    pthread_mutex_lock(&server.cluster->slots_to_keys_lock);
+    de->link.slot.prev = NULL;
+    de->link.slot.next = sk->head;
+    if (sk->head)
+        sk->head->link.slot.prev = de;
+    sk->head = de;
+    sk->count++;
+    pthread_mutex_unlock(&server.cluster->slots_to_keys_lock);
+}
+
+static void slotToKeyReplace(q_dictEntry *oldde, q_dictEntry *de)
+{
+    pthread_mutex_lock(&server.cluster->slots_to_keys_lock);
+    de->link.slot.prev = oldde->link.slot.prev;
+    de->link.slot.next = oldde->link.slot.next;
+    if (de->link.slot.next)
+        de->link.slot.next->link.slot.prev = de;
+    if (de->link.slot.prev) {
+        de->link.slot.prev->link.slot.next = de;
+    } else {
+        sds key = de->key;
+        server.cluster->slots_to_keys[keyHashSlot(key, sdslen(key))].head = de;
+    }
+    pthread_mutex_unlock(&server.cluster->slots_to_keys_lock);
+}
+
+static void slotToKeyDel(q_dictEntry *de)
 {
-    unsigned int hashslot = keyHashSlot(key->ptr, sdslen(key->ptr));
+    sds key = de->key;
+    clusterSlotKeys *sk =
+        &server.cluster->slots_to_keys[keyHashSlot(key, sdslen(key))];
+
+    pthread_mutex_lock(&server.cluster->slots_to_keys_lock);
+    if (de->link.slot.next)
+        de->link.slot.next->link.slot.prev = de->link.slot.prev;
+    if (de->link.slot.prev)
+        de->link.slot.prev->link.slot.next = de->link.slot.next;
+    else
+        sk->head = de->link.slot.next;
+    de->link.slot.prev = de->link.slot.next = NULL;
+    sk->count--;
+    pthread_mutex_unlock(&server.cluster->slots_to_keys_lock);
+}
+
+/* Hooks of the tables of every db: they keep the key index of the db, when
+ * key-prefix-index is enabled, and the slot lists of db 0 in cluster mode in
+ * sync with the table. */
+static int keyspaceHasSlots(q_dict *d)
+{
+    return server.cluster_enabled && d == server.db[0].dict;
+}
 
-    zslInsert(server.cluster->slots_to_keys, hashslot, key);
-    incrRefCount(key);
+static void keyspaceEntryAdded(q_dict *d, q_dictEntry *de)
+{
+    if (d->keyindex)
+        q_keyIndexInsert(d->keyindex, de->key, sdslen(de->key));
+    if (keyspaceHasSlots(d))
+        slotToKeyAdd(de);
 }
 
-void slotToKeyDel(robj *key)
+static void keyspaceEntryReplaced(q_dict *d,
+                                  q_dictEntry *oldde,
+                                  q_dictEntry *de)
 {
-    unsigned int hashslot = keyHashSlot(key->ptr, sdslen(key->ptr));
+    /* Same key name: the key index doesn't change. */
+    if (keyspaceHasSlots(d))
+        slotToKeyReplace(oldde, de);
+}
 
-    zslDelete(server.cluster->slots_to_keys, hashslot, key);
+static void keyspaceEntryDeleted(q_dict *d, q_dictEntry *de)
+{
+    if (d->keyindex)
+        q_keyIndexDelete(d->keyindex, de->key, sdslen(de->key));
+    if (keyspaceHasSlots(d))
+        slotToKeyDel(de);
 }
 
-void slotToKeyFlush(void)
+/* The whole table is being emptied: cheaper than deleting key by key. */
+static void keyspaceEmptying(q_dict *d)
 {
-    zslFree(server.cluster->slots_to_keys);
-    server.cluster->slots_to_keys = zslCreate();
+    if (d->keyindex)
+        q_keyIndexClear(d->keyindex);
 }
 
+q_dictType keyspaceDictType = {
+    keyspaceEntryAdded,    /* entry added */
+    keyspaceEntryReplaced, /* entry replaced */
+    keyspaceEntryDeleted,  /* entry deleted */
+    keyspaceEmptying       /* emptying */
+};
+
+/* Fill 'keys' with up to 'count' keys of the specified hash slot. The
+ * returned objects are new string objects owned by the caller, that is
+ * responsible of releasing them with decrRefCount(). */
 unsigned int getKeysInSlot(unsigned int hashslot,
                            robj **keys,
                            unsigned int count)
 {
-    zskiplistNode *n;
-    zrangespec range;
+    q_dictEntry *de;
     int j = 0;
 
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
-
-    n = zslFirstInRange(server.cluster->slots_to_keys, &range);
-    while (n && n->score == hashslot && count--) {
-        keys[j++] = n->obj;
-        n = n->level[0].forward;
+    pthread_mutex_lock(&server.cluster->slots_to_keys_lock);
+    de = server.cluster->slots_to_keys[hashslot].head;
+    while (de && count--) {
+        keys[j++] = createStringObject(de->key, sdslen(de->key));
+        de = de->link.slot.next;
     }
+    pthread_mutex_unlock(&server.cluster->slots_to_keys_lock);
     return j;
 }
 
@@ -1529,18 +2281,12 @@ unsigned int getKeysInSlot(unsigned int hashslot,
  * The number of removed items is returned. */
 unsigned int delKeysInSlot(unsigned int hashslot)
 {
-    zskiplistNode *n;
-    zrangespec range;
+    robj *key;
     int j = 0;
 
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
-
-    n = zslFirstInRange(server.cluster->slots_to_keys, &range);
-    while (n && n->score == hashslot) {
-        robj *key = n->obj;
-        n = n->level[0].forward; /* Go to the next item before freeing it. */
-        incrRefCount(key);       /* Protect the object while freeing it. */
+    /* dbDelete() unlinks the head of the slot, so keep fetching it until
+     * the slot is empty. */
+    while (getKeysInSlot(hashslot, &key, 1)) {
         dbDelete(&server.db[0], key);
         decrRefCount(key);
         j++;
@@ -1550,30 +2296,5 @@ unsigned int delKeysInSlot(unsigned int hashslot)
 
 unsigned int countKeysInSlot(unsigned int hashslot)
 {
-    zskiplist *zsl = server.cluster->slots_to_keys;
-    zskiplistNode *zn;
-    zrangespec range;
-    int rank, count = 0;
-
-    range.min = range.max = hashslot;
-    range.minex = range.maxex = 0;
-
-    /* Find first element in range */
-    zn = zslFirstInRange(zsl, &range);
-
-    /* Use rank of first element, if any, to determine preliminary count */
-    if (zn != NULL) {
-        rank = zslGetRank(zsl, zn->score, zn->obj);
-        count = (zsl->length - (rank - 1));
-
-        /* Find last element in range */
-        zn = zslLastInRange(zsl, &range);
-
-        /* Use rank of last element, if any, to determine the actual count */
-        if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->obj);
-            count -= (zsl->length - rank);
-        }
-    }
-    return count;
+    return server.cluster->slots_to_keys[hashslot].count;
 }
@@ -1121,8 +1121,9 @@ void sigsegvHandler(int sig, siginfo_t *info, void *secret)
     /* Log INFO and CLIENT LIST */
     serverLogRaw(LL_WARNING | LL_RAW, "\n------ INFO OUTPUT ------\n");
     infostring = genRedisInfoString("all");
-    infostring = sdscatprintf(infostring, "hash_init_value: %u\n",
-                              dictGetHashFunctionSeed());
+    infostring = sdscat(infostring, "hash_init_value: ");
+    infostring = sdscatrepr(infostring, (char *) dictGetHashFunctionSeed(), 16);
+    infostring = sdscat(infostring, "\n");
     serverLogRaw(LL_WARNING | LL_RAW, infostring);
     serverLogRaw(LL_WARNING | LL_RAW, "\n------ CLIENT LIST OUTPUT ------\n");
     clients = getAllClientsInfoString();
@@ -31,7 +31,7 @@
 #include <sys/uio.h>
 #include "server.h"
 
-static void setProtocolError(client *c, int pos);
+static void setProtocolError(client *c);
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -103,12 +103,13 @@ client *createClient(q_eventloop *qel, int fd)
     // qel can not be NULL, that's the invariants we made, so server need a qel
     // as well.
     c->qel = qel;
-    // c->id = server.next_client_id++;
-    c->id = qel->next_client_id++;
+    // unique across the threads, CLIENT TRACKING REDIRECT names clients by id
+    c->id = __atomic_fetch_add(&server.next_client_id, 1, __ATOMIC_RELAXED);
     c->fd = fd;
     c->name = NULL;
     c->bufpos = 0;
     c->querybuf = sdsempty();
+    c->qb_pos = 0;
     c->querybuf_peak = 0;
     c->reqtype = 0;
     c->argc = 0;
@@ -122,7 +123,10 @@ client *createClient(q_eventloop *qel, int fd)
     c->authenticated = 0;
     c->replstate = REPL_STATE_NONE;
     c->repl_put_online_on_ack = 0;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
     c->reploff = 0;
+    c->read_reploff = 0;
     c->repl_ack_off = 0;
     c->repl_ack_time = 0;
     c->slave_listening_port = 0;
@@ -146,6 +150,7 @@ client *createClient(q_eventloop *qel, int fd)
     c->peerid = NULL;
     listSetFreeMethod(c->pubsub_patterns, decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns, listMatchObjects);
+    q_trackingInitClient(c);
     if (fd != -1)
         listAddNodeTail(qel->clients, c);
     initClientMultiState(c);
@@ -617,6 +622,15 @@ void addReplyBulkLen(client *c, robj *obj)
 /* Add a Redis Object as a bulk reply */
 void addReplyBulk(client *c, robj *obj)
 {
+    /* The server thread may append to a string value while a worker replies
+     * with it, see dbWriteStringValue(), so its length is loaded once. */
+    if (sdsEncodedObject(obj)) {
+        size_t len = sdslen(obj->ptr);
+
+        cmm_smp_rmb();
+        addReplyBulkCBuffer(c, obj->ptr, len);
+        return;
+    }
     addReplyBulkLen(c, obj);
     addReply(c, obj);
     addReply(c, shared.crlf);
@@ -668,13 +682,32 @@ void copyClientOutputBuffer(client *dst, client *src)
     memcpy(dst->buf, src->buf, src->bufpos);
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
+    /* The replication stream accumulated for a slave is only referenced. */
+    unrefReplicationBuffer(dst);
+    if (src->ref_repl_buf_node) {
+        dst->ref_repl_buf_node = src->ref_repl_buf_node;
+        dst->ref_block_pos = src->ref_block_pos;
+        ((replBufBlock *) listNodeValue(dst->ref_repl_buf_node))->refcount++;
+    }
+}
+
+/* Return true if the slave 'c' has a part of the replication buffer left
+ * to send. */
+static int slaveHasPendingReplBuffer(client *c)
+{
+    listNode *tail = listLast(server.repl_buffer_blocks);
+
+    if (c->ref_repl_buf_node == NULL)
+        return 0;
+    return c->ref_repl_buf_node != tail ||
+           c->ref_block_pos < ((replBufBlock *) listNodeValue(tail))->used;
 }
 
 /* Return true if the specified client has pending reply buffers to write to
  * the socket. */
 int clientHasPendingReplies(client *c)
 {
-    return c->bufpos || listLength(c->reply);
+    return c->bufpos || listLength(c->reply) || slaveHasPendingReplBuffer(c);
 }
 
 static void freeClientArgv(client *c)
@@ -753,6 +786,7 @@ void freeClient(client *c)
      * some unexpected state, by checking its flags. */
     if (server.master && c->flags & CLIENT_MASTER) {
         serverLog(LL_WARNING, "Connection with master lost.");
+        q_applyDrain();
         if (!(c->flags & (CLIENT_CLOSE_AFTER_REPLY | CLIENT_CLOSE_ASAP |
                           CLIENT_BLOCKED | CLIENT_UNBLOCKED))) {
             replicationCacheMaster(c);
@@ -767,6 +801,7 @@ void freeClient(client *c)
     }
 
     /* Free the query buffer */
+    returnSharedQueryBuffer(c);
     sdsfree(c->querybuf);
     c->querybuf = NULL;
 
@@ -787,6 +822,9 @@ void freeClient(client *c)
     dictRelease(c->pubsub_channels);
     listRelease(c->pubsub_patterns);
 
+    /* Stop client side caching and drop the invalidations not sent. */
+    q_trackingFreeClient(c);
+
     /* Free data structures. */
     listRelease(c->reply);
     freeClientArgv(c);
@@ -809,6 +847,7 @@ void freeClient(client *c)
         ln = listSearchKey(l, c);
         serverAssert(ln != NULL);
         listDelNode(l, ln);
+        unrefReplicationBuffer(c);
         /* We need to remember the time when we started to have zero
          * attached slaves, as after some time we'll free the replication
          * backlog. */
@@ -878,7 +917,29 @@ int writeToClient(int fd, client *c, int handler_installed)
     robj *o;
 
     while (clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
+        if (!c->bufpos && !listLength(c->reply)) {
+            /* A slave, sending the shared replication buffer once its own
+             * replies were sent. */
+            replBufBlock *b = listNodeValue(c->ref_repl_buf_node);
+
+            if (c->ref_block_pos == b->used) {
+                /* Move to the next block, the one we leave may be trimmed
+                 * from the backlog now. */
+                c->ref_repl_buf_node = listNextNode(c->ref_repl_buf_node);
+                c->ref_block_pos = 0;
+                ((replBufBlock *) listNodeValue(c->ref_repl_buf_node))
+                    ->refcount++;
+                b->refcount--;
+                incrementalTrimReplicationBacklog(1);
+                continue;
+            }
+            nwritten = write(fd, b->buf + c->ref_block_pos,
+                             b->used - c->ref_block_pos);
+            if (nwritten <= 0)
+                break;
+            c->ref_block_pos += nwritten;
+            totwritten += nwritten;
+        } else if (c->bufpos > 0) {
             nwritten = write(fd, c->buf + c->sentlen, c->bufpos - c->sentlen);
             if (nwritten <= 0)
                 break;
@@ -961,6 +1022,62 @@ int writeToClient(int fd, client *c, int handler_installed)
     return C_OK;
 }
 
+/* Send what the client can take of the replies queued so far, while a
+ * command producing a huge reply, like KEYS, is still running: the reply then
+ * never has to be held in memory at once. This stops at the first deferred
+ * length not set yet, and never frees the client: a write error just closes
+ * it once the command returns. Only clients served by their own thread are
+ * written to. */
+void streamClientReplies(client *c)
+{
+    ssize_t nwritten = 0, totwritten = 0;
+    size_t objlen;
+    robj *o;
+
+    if (c->fd <= 0 ||
+        c->flags & (CLIENT_SLAVE | CLIENT_MASTER | CLIENT_CLOSE_ASAP |
+                    CLIENT_JUMP | CLIENT_REPLY_OFF | CLIENT_REPLY_SKIP))
+        return;
+
+    while (c->bufpos > 0 || listLength(c->reply)) {
+        if (c->bufpos > 0) {
+            nwritten =
+                write(c->fd, c->buf + c->sentlen, c->bufpos - c->sentlen);
+            if (nwritten <= 0)
+                break;
+            c->sentlen += nwritten;
+            totwritten += nwritten;
+            if ((int) c->sentlen == c->bufpos) {
+                c->bufpos = 0;
+                c->sentlen = 0;
+            }
+        } else {
+            o = listNodeValue(listFirst(c->reply));
+            if (o->ptr == NULL)
+                break; /* Deferred length. */
+            objlen = sdslen(o->ptr);
+            if (objlen > c->sentlen) {
+                nwritten = write(c->fd, ((char *) o->ptr) + c->sentlen,
+                                 objlen - c->sentlen);
+                if (nwritten <= 0)
+                    break;
+                c->sentlen += nwritten;
+                totwritten += nwritten;
+            }
+            if (c->sentlen == objlen) {
+                c->reply_bytes -= getStringObjectSdsUsedMemory(o);
+                listDelNode(c->reply, listFirst(c->reply));
+                c->sentlen = 0;
+            }
+        }
+    }
+    c->qel->stats.stat_net_output_bytes += totwritten;
+    if (nwritten == -1 && errno != EAGAIN) {
+        serverLog(LL_VERBOSE, "Error writing to client: %s", strerror(errno));
+        freeClientAsync(c);
+    }
+}
+
 /* Write event handler. Just send data to the client. */
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask)
 {
@@ -1041,37 +1158,92 @@ void resetClient(client *c)
     }
 }
 
+/* Worker threads read into a buffer shared by all the clients of the worker
+ * (qel->querybuf): most reads carry whole commands, so once they are
+ * processed nothing is left and idle clients only keep an empty query buffer.
+ * What is left of a command that spans reads is moved to the client's own
+ * query buffer, that is then used for the following reads until it is
+ * consumed. */
+static int clientHasSharedQueryBuffer(client *c)
+{
+    return c->qel != NULL && c->qel->querybuf_client == c;
+}
+
+static void lendSharedQueryBuffer(client *c)
+{
+    q_eventloop *qel = c->qel;
+    sds qb = c->querybuf;
+
+    if (qel->querybuf == NULL)
+        qel->querybuf = sdsMakeRoomFor(sdsempty(), PROTO_IOBUF_LEN);
+    c->querybuf = qel->querybuf;
+    qel->querybuf = qb;
+    qel->querybuf_client = c;
+}
+
+/* Give the client its own query buffer back, with what was not processed
+ * yet. Must be called before the client leaves the worker or is freed. */
+void returnSharedQueryBuffer(client *c)
+{
+    q_eventloop *qel = c->qel;
+    sds shared, qb;
+
+    if (!clientHasSharedQueryBuffer(c)) {
+        trimClientQueryBuffer(c);
+        return;
+    }
+    shared = c->querybuf;
+    qb = qel->querybuf;
+    if (sdslen(shared) > c->qb_pos) {
+        qb = sdscatlen(qb, shared + c->qb_pos, sdslen(shared) - c->qb_pos);
+        /* Make room for the big argument being read, as
+         * processMultibulkBuffer() does for a private buffer. */
+        if (c->reqtype == PROTO_REQ_MULTIBULK && c->multibulklen &&
+            c->bulklen >= PROTO_MBULK_BIG_ARG &&
+            sdslen(qb) < (size_t) c->bulklen + 2)
+            qb = sdsMakeRoomFor(qb, c->bulklen + 2 - sdslen(qb));
+    }
+    sdsclear(shared);
+    c->qb_pos = 0;
+    c->querybuf = qb;
+    qel->querybuf = shared;
+    qel->querybuf_client = NULL;
+}
+
 int processInlineBuffer(client *c)
 {
-    char *newline;
-    int argc, j;
+    char *querybuf = c->querybuf + c->qb_pos, *newline;
+    size_t qblen = sdslen(c->querybuf) - c->qb_pos;
+    int argc, j, linefeed_chars = 1;
     sds *argv, aux;
     size_t querylen;
 
     /* Search for end of line */
-    newline = strchr(c->querybuf, '\n');
+    newline = memchr(querybuf, '\n', qblen);
 
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
-        if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+        if (qblen > PROTO_INLINE_MAX_SIZE) {
             addReplyError(c, "Protocol error: too big inline request");
-            setProtocolError(c, 0);
+            setProtocolError(c);
         }
         return C_ERR;
     }
 
     /* Handle the \r\n case. */
-    if (newline && newline != c->querybuf && *(newline - 1) == '\r')
+    if (newline != querybuf && *(newline - 1) == '\r') {
         newline--;
+        linefeed_chars++;
+    }
 
     /* Split the input buffer up to the \r\n */
-    querylen = newline - (c->querybuf);
-    aux = sdsnewlen(c->querybuf, querylen);
+    querylen = newline - querybuf;
+    aux = sdsnewlen(querybuf, querylen);
     argv = sdssplitargs(aux, &argc);
     sdsfree(aux);
     if (argv == NULL) {
         addReplyError(c, "Protocol error: unbalanced quotes in request");
-        setProtocolError(c, 0);
+        setProtocolError(c);
         return C_ERR;
     }
 
@@ -1082,7 +1254,7 @@ int processInlineBuffer(client *c)
         c->repl_ack_time = server.unixtime;
 
     /* Leave data after the first line of the query in the buffer */
-    sdsrange(c->querybuf, querylen + 2, -1);
+    c->qb_pos += querylen + linefeed_chars;
 
     /* Setup argv array on client structure */
     if (argc) {
@@ -1104,9 +1276,9 @@ int processInlineBuffer(client *c)
     return C_OK;
 }
 
-/* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
-static void setProtocolError(client *c, int pos)
+/* Helper function. Stops processing the commands of the client, that is
+ * closed once the error is sent. */
+static void setProtocolError(client *c)
 {
     if (server.verbosity <= LL_VERBOSE) {
         sds client = catClientInfoString(sdsempty(), c);
@@ -1114,13 +1286,28 @@ static void setProtocolError(client *c, int pos)
         sdsfree(client);
     }
     c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf, pos, -1);
 }
 
+/* Drop the part of the query buffer already parsed, see qb_pos. The commands
+ * of a pipeline are parsed one after the other from the same buffer, and the
+ * buffer is compacted once they are all processed, rather than memmove()ing
+ * what follows every single command to the start of the buffer. */
+void trimClientQueryBuffer(client *c)
+{
+    if (c->qb_pos == 0)
+        return;
+    sdsrange(c->querybuf, c->qb_pos, -1);
+    c->qb_pos = 0;
+}
+
+/* Parse the next command of the query buffer, starting at qb_pos. The
+ * delimiters are found with memchr() bounded by the data read, not strchr()
+ * that also has to look for the terminator. Parsing a command that is not
+ * complete yet is resumed where it stopped after the next read. */
 int processMultibulkBuffer(client *c)
 {
     char *newline = NULL;
-    int pos = 0, ok;
+    int ok;
     long long ll;
 
     if (c->multibulklen == 0) {
@@ -1128,11 +1315,12 @@ int processMultibulkBuffer(client *c)
         serverAssertWithInfo(c, NULL, c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf, '\r');
+        newline = memchr(c->querybuf + c->qb_pos, '\r',
+                         sdslen(c->querybuf) - c->qb_pos);
         if (newline == NULL) {
-            if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+            if (sdslen(c->querybuf) - c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                 addReplyError(c, "Protocol error: too big mbulk count string");
-                setProtocolError(c, 0);
+                setProtocolError(c);
             }
             return C_ERR;
         }
@@ -1143,19 +1331,18 @@ int processMultibulkBuffer(client *c)
 
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
-        serverAssertWithInfo(c, NULL, c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf + 1, newline - (c->querybuf + 1), &ll);
+        serverAssertWithInfo(c, NULL, c->querybuf[c->qb_pos] == '*');
+        ok = string2ll(c->querybuf + c->qb_pos + 1,
+                       newline - (c->querybuf + c->qb_pos + 1), &ll);
         if (!ok || ll > 1024 * 1024) {
             addReplyError(c, "Protocol error: invalid multibulk length");
-            setProtocolError(c, pos);
+            setProtocolError(c);
             return C_ERR;
         }
 
-        pos = (newline - c->querybuf) + 2;
-        if (ll <= 0) {
-            sdsrange(c->querybuf, pos, -1);
+        c->qb_pos = (newline - c->querybuf) + 2;
+        if (ll <= 0)
             return C_OK;
-        }
 
         c->multibulklen = ll;
 
@@ -1169,12 +1356,13 @@ int processMultibulkBuffer(client *c)
     while (c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf + pos, '\r');
+            newline = memchr(c->querybuf + c->qb_pos, '\r',
+                             sdslen(c->querybuf) - c->qb_pos);
             if (newline == NULL) {
-                if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+                if (sdslen(c->querybuf) - c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                     addReplyError(c,
                                   "Protocol error: too big bulk count string");
-                    setProtocolError(c, 0);
+                    setProtocolError(c);
                     return C_ERR;
                 }
                 break;
@@ -1184,22 +1372,22 @@ int processMultibulkBuffer(client *c)
             if (newline - (c->querybuf) > ((signed) sdslen(c->querybuf) - 2))
                 break;
 
-            if (c->querybuf[pos] != '$') {
+            if (c->querybuf[c->qb_pos] != '$') {
                 addReplyErrorFormat(c, "Protocol error: expected '$', got '%c'",
-                                    c->querybuf[pos]);
-                setProtocolError(c, pos);
+                                    c->querybuf[c->qb_pos]);
+                setProtocolError(c);
                 return C_ERR;
             }
 
-            ok = string2ll(c->querybuf + pos + 1,
-                           newline - (c->querybuf + pos + 1), &ll);
+            ok = string2ll(c->querybuf + c->qb_pos + 1,
+                           newline - (c->querybuf + c->qb_pos + 1), &ll);
             if (!ok || ll < 0 || ll > 512 * 1024 * 1024) {
                 addReplyError(c, "Protocol error: invalid bulk length");
-                setProtocolError(c, pos);
+                setProtocolError(c);
                 return C_ERR;
             }
 
-            pos += newline - (c->querybuf + pos) + 2;
+            c->qb_pos = (newline - c->querybuf) + 2;
             if (ll >= PROTO_MBULK_BIG_ARG) {
                 size_t qblen;
 
@@ -1207,48 +1395,43 @@ int processMultibulkBuffer(client *c)
                  * try to make it likely that it will start at c->querybuf
                  * boundary so that we can optimize object creation
                  * avoiding a large copy of data. */
-                sdsrange(c->querybuf, pos, -1);
-                pos = 0;
+                trimClientQueryBuffer(c);
                 qblen = sdslen(c->querybuf);
                 /* Hint the sds library about the amount of bytes this string is
                  * going to contain. */
-                if (qblen < (size_t) ll + 2)
+                if (qblen < (size_t) ll + 2 && !clientHasSharedQueryBuffer(c))
                     c->querybuf = sdsMakeRoomFor(c->querybuf, ll + 2 - qblen);
             }
             c->bulklen = ll;
         }
 
         /* Read bulk argument */
-        if (sdslen(c->querybuf) - pos < (unsigned) (c->bulklen + 2)) {
+        if (sdslen(c->querybuf) - c->qb_pos < (size_t) (c->bulklen + 2)) {
             /* Not enough data (+2 == trailing \r\n) */
             break;
         } else {
             /* Optimization: if the buffer contains JUST our bulk element
              * instead of creating a new object by *copying* the sds we
              * just use the current sds string. */
-            if (pos == 0 && c->bulklen >= PROTO_MBULK_BIG_ARG &&
-                (signed) sdslen(c->querybuf) == c->bulklen + 2) {
+            if (c->qb_pos == 0 && c->bulklen >= PROTO_MBULK_BIG_ARG &&
+                (signed) sdslen(c->querybuf) == c->bulklen + 2 &&
+                !clientHasSharedQueryBuffer(c)) {
                 c->argv[c->argc++] = createObject(OBJ_STRING, c->querybuf);
                 sdsIncrLen(c->querybuf, -2); /* remove CRLF */
                 /* Assume that if we saw a fat argument we'll see another one
                  * likely... */
                 c->querybuf = sdsnewlen(NULL, c->bulklen + 2);
                 sdsclear(c->querybuf);
-                pos = 0;
             } else {
                 c->argv[c->argc++] =
-                    createStringObject(c->querybuf + pos, c->bulklen);
-                pos += c->bulklen + 2;
+                    createStringObject(c->querybuf + c->qb_pos, c->bulklen);
+                c->qb_pos += c->bulklen + 2;
             }
             c->bulklen = -1;
             c->multibulklen--;
         }
     }
 
-    /* Trim to pos */
-    if (pos)
-        sdsrange(c->querybuf, pos, -1);
-
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0)
         return C_OK;
@@ -1261,7 +1444,7 @@ void processInputBuffer(client *c)
 {
     server.current_client = c;
     /* Keep processing while there is something in the input buffer */
-    while (sdslen(c->querybuf)) {
+    while (c->qb_pos < sdslen(c->querybuf)) {
         /* Return if clients are paused. */
         if (!(c->flags & CLIENT_SLAVE) && clientsArePaused())
             break;
@@ -1280,7 +1463,7 @@ void processInputBuffer(client *c)
 
         /* Determine request type when unknown. */
         if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
+            if (c->querybuf[c->qb_pos] == '*') {
                 c->reqtype = PROTO_REQ_MULTIBULK;
             } else {
                 c->reqtype = PROTO_REQ_INLINE;
@@ -1302,8 +1485,16 @@ void processInputBuffer(client *c)
             resetClient(c);
         } else {
             /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK)
+            if (processCommand(c) == C_OK) {
+                /* Our master's offset only covers applied commands: not the
+                 * ones still run by the apply threads, which move it once
+                 * they are done, nor an incomplete transaction. */
+                if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI) &&
+                    !q_applyPending())
+                    c->reploff = c->read_reploff - sdslen(c->querybuf) +
+                                 c->qb_pos;
                 resetClient(c);
+            }
             /* freeMemoryIfNeeded may flush slave output buffers. This may
              * result into a slave, that may be the active client, to be freed.
              */
@@ -1311,6 +1502,11 @@ void processInputBuffer(client *c)
                 break;
         }
     }
+    /* Trim the commands processed, unless the client was freed. */
+    if (server.current_client != NULL)
+        trimClientQueryBuffer(c);
+    /* Never return to the event loop while the apply threads write. */
+    q_applyDrain();
     server.current_client = NULL;
 }
 
@@ -1323,7 +1519,7 @@ int worker_processInputBuffer(client *c)
     qel->current_client = c;
 
     /* Keep processing while there is something in the input buffer */
-    while (sdslen(c->querybuf)) {
+    while (c->qb_pos < sdslen(c->querybuf)) {
         /* Return if clients are paused. */
         if (!(c->flags & CLIENT_SLAVE) && clientsArePaused())
             break;
@@ -1342,7 +1538,7 @@ int worker_processInputBuffer(client *c)
 
         /* Determine request type when unknown. */
         if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
+            if (c->querybuf[c->qb_pos] == '*') {
                 c->reqtype = PROTO_REQ_MULTIBULK;
             } else {
                 c->reqtype = PROTO_REQ_INLINE;
@@ -1370,6 +1566,9 @@ int worker_processInputBuffer(client *c)
                 break;
         }
     }
+    /* Trim the commands processed, unless the client left the worker. */
+    if (qel->current_client != NULL)
+        trimClientQueryBuffer(c);
     qel->current_client = NULL;
     return res;
 }
@@ -1419,7 +1618,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask)
     sdsIncrLen(c->querybuf, nread);
     c->lastinteraction = server.unixtime;
     if (c->flags & CLIENT_MASTER)
-        c->reploff += nread;
+        c->read_reploff += nread;
     server.stat_net_input_bytes += nread;
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(), c), bytes = sdsempty();
@@ -1463,6 +1662,11 @@ void worker_readQueryFromClient(aeEventLoop *el,
             readlen = remaining;
     }
 
+    /* Nothing pending: read into the shared buffer, unless the bulk being
+     * read is big enough to be worth reading in place (see above). */
+    if (sdslen(c->querybuf) == 0 && c->bulklen < PROTO_MBULK_BIG_ARG)
+        lendSharedQueryBuffer(c);
+
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen)
         c->querybuf_peak = qblen;
@@ -1470,6 +1674,7 @@ void worker_readQueryFromClient(aeEventLoop *el,
     nread = read(fd, c->querybuf + qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
+            returnSharedQueryBuffer(c);
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s", strerror(errno));
@@ -1499,7 +1704,9 @@ void worker_readQueryFromClient(aeEventLoop *el,
         freeClient(c);
         return;
     }
-    worker_processInputBuffer(c);
+    /* A client sent to the server thread already got its buffer back. */
+    if (worker_processInputBuffer(c) != C_SCHED)
+        returnSharedQueryBuffer(c);
 }
 
 void getClientsMaxBuffers(unsigned long *longest_output_list,
@@ -1615,7 +1822,7 @@ sds catClientInfoString(sds s, client *client)
         client->db->id, (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
+        (unsigned long long) (sdslen(client->querybuf) - client->qb_pos),
         (unsigned long long) sdsavail(client->querybuf),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
@@ -1799,10 +2006,46 @@ void clientCommand(client *c)
             return;
         pauseClients(duration);
         addReply(c, shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr, "id") && c->argc == 2) {
+        /* CLIENT ID */
+        addReplyLongLong(c, c->id);
+    } else if (!strcasecmp(c->argv[1]->ptr, "tracking") &&
+               (c->argc == 3 || c->argc == 5)) {
+        /* CLIENT TRACKING ON|OFF [REDIRECT <id>] */
+        long long redir = 0;
+
+        if (c->argc == 5) {
+            if (strcasecmp(c->argv[3]->ptr, "redirect")) {
+                addReply(c, shared.syntaxerr);
+                return;
+            }
+            if (getLongLongFromObjectOrReply(c, c->argv[4], &redir, NULL) !=
+                C_OK)
+                return;
+            /* Invalidations are sent as Pub/Sub messages, the target must be
+             * listening already. */
+            if (!q_trackingTargetExists((uint64_t) redir)) {
+                addReplyError(c,
+                              "The client ID you want redirect to does not "
+                              "exist or is not subscribed to "
+                              Q_TRACKING_CHANNEL);
+                return;
+            }
+        }
+
+        if (!strcasecmp(c->argv[2]->ptr, "on")) {
+            q_trackingEnable(c, (uint64_t) redir);
+        } else if (!strcasecmp(c->argv[2]->ptr, "off") && c->argc == 3) {
+            q_trackingDisable(c);
+        } else {
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+        addReply(c, shared.ok);
     } else {
         addReplyError(c,
                       "Syntax error, try CLIENT (LIST | KILL | GETNAME | "
-                      "SETNAME | PAUSE | REPLY)");
+                      "SETNAME | PAUSE | REPLY | ID | TRACKING)");
     }
 }
 
@@ -1924,8 +2167,18 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval)
 unsigned long getClientOutputBufferMemoryUsage(client *c)
 {
     unsigned long list_item_size = sizeof(listNode) + sizeof(robj);
+    unsigned long repl_buf_bytes = 0;
 
-    return c->reply_bytes + (list_item_size * listLength(c->reply));
+    /* Slaves also retain the replication buffer from the block they are
+     * sending, even if it is shared with the backlog and other slaves. */
+    if (c->ref_repl_buf_node) {
+        replBufBlock *b = listNodeValue(c->ref_repl_buf_node);
+
+        repl_buf_bytes =
+            server.master_repl_offset + 1 - (b->repl_offset + c->ref_block_pos);
+    }
+    return c->reply_bytes + (list_item_size * listLength(c->reply)) +
+           repl_buf_bytes;
 }
 
 /* Get the class of a client, used in order to enforce limits to different
@@ -2034,7 +2287,8 @@ int checkClientOutputBufferLimits(client *c)
 void asyncCloseClientOnOutputBufferLimitReached(client *c)
 {
     serverAssert(c->reply_bytes < SIZE_MAX - (1024 * 64));
-    if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP)
+    if ((c->reply_bytes == 0 && c->ref_repl_buf_node == NULL) ||
+        c->flags & CLIENT_CLOSE_ASAP)
         return;
     if (checkClientOutputBufferLimits(c)) {
         sds client = catClientInfoString(sdsempty(), c);
@@ -31,6 +31,8 @@
 #include <ctype.h>
 #include <math.h>
 #include "server.h"
+#include "q_master.h"
+#include "q_worker.h"
 
 #ifdef __CYGWIN__
 #define strtold(a, b) ((long double) strtod((a), (b)))
@@ -44,8 +46,21 @@ robj *createObject(int type, void *ptr)
     o->ptr = ptr;
     o->refcount = 1;
 
-    /* Set the LRU to the current lruclock (minutes resolution). */
-    o->lru = LRU_CLOCK();
+    /* Set the LRU to the current lruclock (minutes resolution), or
+     * alternatively the LFU counter. */
+    o->lru = objectNewLRU();
+    return o;
+}
+
+/* Set a special refcount in the object to make it "shared":
+ * incrRefCount and decrRefCount() will test for this special refcount
+ * and will not touch the object. This way it is free to access shared
+ * objects such as small integers from different threads without any
+ * mutex. */
+robj *makeObjectShared(robj *o)
+{
+    serverAssert(o->refcount == 1);
+    o->refcount = OBJ_SHARED_REFCOUNT;
     return o;
 }
 
@@ -68,7 +83,7 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len)
     o->encoding = OBJ_ENCODING_EMBSTR;
     o->ptr = sh + 1;
     o->refcount = 1;
-    o->lru = LRU_CLOCK();
+    o->lru = objectNewLRU();
 
     sh->len = len;
     sh->alloc = len;
@@ -314,7 +329,8 @@ void freeHashObject(robj *o)
 
 void incrRefCount(robj *o)
 {
-    o->refcount++;
+    if (o->refcount != OBJ_SHARED_REFCOUNT)
+        o->refcount++;
 }
 
 void decrRefCount(robj *o)
@@ -343,7 +359,7 @@ void decrRefCount(robj *o)
             break;
         }
         zfree(o);
-    } else {
+    } else if (o->refcount != OBJ_SHARED_REFCOUNT) {
         o->refcount--;
     }
 }
@@ -430,8 +446,7 @@ robj *tryObjectEncoding(robj *o)
          * because every object needs to have a private LRU field for the LRU
          * algorithm to work well. */
         if ((server.maxmemory == 0 ||
-             (server.maxmemory_policy != MAXMEMORY_VOLATILE_LRU &&
-              server.maxmemory_policy != MAXMEMORY_ALLKEYS_LRU)) &&
+             !(server.maxmemory_policy & MAXMEMORY_FLAG_NO_SHARED_INTEGERS)) &&
             value >= 0 && value < OBJ_SHARED_INTEGERS) {
             decrRefCount(o);
             incrRefCount(shared.integers[value]);
@@ -763,6 +778,133 @@ unsigned long long estimateObjectIdleTime(robj *o)
     }
 }
 
+/* ----------------------------------------------------------------------------
+ * LFU (Least Frequently Used) implementation.
+ *
+ * With an LFU policy the 24 bits of robj->lru are split in two fields:
+ *
+ *          16 bits      8 bits
+ *     +----------------+--------+
+ *     + Last decr time | LOG_C  |
+ *     +----------------+--------+
+ *
+ * LOG_C is a logarithmic counter of the accesses: it is incremented with a
+ * probability that gets lower as it grows, so that 255 is only reached
+ * after about a million accesses with the default lfu-log-factor. It is
+ * also decremented by one every lfu-decay-time minutes the key is not
+ * accessed, so that keys that were popular in the past don't stay in
+ * memory forever. The last decrement time is in minutes, modulo 2^16.
+ * --------------------------------------------------------------------------*/
+
+/* Return the current time in minutes, just taking the least significant
+ * 16 bits. The returned time is suitable to be stored as LDT (last decrement
+ * time) for the LFU implementation. */
+static unsigned long LFUGetTimeInMinutes(void)
+{
+    return (server.unixtime / 60) & 65535;
+}
+
+/* Given an object last access time, compute the minimum number of minutes
+ * that elapsed since the last access. Handle overflow (ldt greater than
+ * the current 16 bits minutes time) considering the time as wrapping
+ * exactly once. */
+static unsigned long LFUTimeElapsed(unsigned long ldt)
+{
+    unsigned long now = LFUGetTimeInMinutes();
+
+    if (now >= ldt)
+        return now - ldt;
+    return 65535 - ldt + now;
+}
+
+/* Logarithmically increment a counter. The greater is the current counter
+ * value the less likely is that it gets really implemented. Saturate it at
+ * 255. Workers call it concurrently, hence the xorshift state per thread. */
+static uint8_t LFULogIncr(uint8_t counter)
+{
+    static __thread uint32_t state = 2463534242;
+    double r, baseval, p;
+
+    if (counter == 255)
+        return 255;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    r = (double) state / UINT32_MAX;
+    baseval = counter - LFU_INIT_VAL;
+    if (baseval < 0)
+        baseval = 0;
+    p = 1.0 / (baseval * server.lfu_log_factor + 1);
+    if (r < p)
+        counter++;
+    return counter;
+}
+
+/* Decrement the counter of an LFU robj->lru value by the number of decay
+ * periods elapsed since its last decrement time. */
+static unsigned long LFUDecr(unsigned long lru)
+{
+    unsigned long ldt = lru >> 8;
+    unsigned long counter = lru & 255;
+    unsigned long num_periods =
+        server.lfu_decay_time ? LFUTimeElapsed(ldt) / server.lfu_decay_time
+                              : 0;
+
+    if (num_periods)
+        counter = (num_periods > counter) ? 0 : counter - num_periods;
+    return counter;
+}
+
+/* Return the access counter of an object, as decayed at this time. The
+ * object is not modified, that happens only when it is accessed. */
+unsigned long LFUDecrAndReturn(robj *o)
+{
+    return LFUDecr(o->lru);
+}
+
+/* Value of robj->lru for a new object. */
+unsigned int objectNewLRU(void)
+{
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU)
+        return (LFUGetTimeInMinutes() << 8) | LFU_INIT_VAL;
+    return LRU_CLOCK();
+}
+
+/* The first word of robj, holding type, encoding and lru. */
+typedef unsigned int __attribute__((__may_alias__)) robjHeader;
+
+/* Update the access time of an object found by a key lookup, or its access
+ * counter with an LFU policy.
+ *
+ * The worker threads look up the same objects at the same time and the
+ * server thread may be changing the type and encoding bits that share the
+ * word with robj->lru, so the word is replaced with a compare and swap,
+ * and only when lru actually changes: once per second for the LRU clock,
+ * rarely for the LFU counter of a popular key. */
+void updateObjectAccess(robj *o)
+{
+    robjHeader *word = (robjHeader *) o;
+    robjHeader old, new;
+    robj tmp;
+
+    if (o->refcount == OBJ_SHARED_REFCOUNT)
+        return;
+    old = __atomic_load_n(word, __ATOMIC_RELAXED);
+    do {
+        memcpy(&tmp, &old, sizeof(old));
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+            tmp.lru = (LFUGetTimeInMinutes() << 8) |
+                      LFULogIncr(LFUDecr(tmp.lru));
+        } else {
+            tmp.lru = LRU_CLOCK();
+        }
+        memcpy(&new, &tmp, sizeof(new));
+        if (new == old)
+            return;
+    } while (!__atomic_compare_exchange_n(word, &old, new, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
 /* This is a helper function for the OBJECT command. We need to lookup keys
  * without any modification of LRU or other parameters. */
 robj *objectCommandLookup(client *c, robj *key)
@@ -784,7 +926,7 @@ robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply)
 }
 
 /* Object command allows to inspect the internals of an Redis Object.
- * Usage: OBJECT <refcount|encoding|idletime> <key> */
+ * Usage: OBJECT <refcount|encoding|idletime|freq> <key> */
 void objectCommand(client *c)
 {
     robj *o;
@@ -793,21 +935,398 @@ void objectCommand(client *c)
     if (!strcasecmp(c->argv[1]->ptr, "refcount") && c->argc == 3) {
         if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.nullbulk)) ==
             NULL)
-            return;
+            goto done;
         addReplyLongLong(c, o->refcount);
     } else if (!strcasecmp(c->argv[1]->ptr, "encoding") && c->argc == 3) {
         if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.nullbulk)) ==
             NULL)
-            return;
+            goto done;
         addReplyBulkCString(c, strEncoding(o->encoding));
     } else if (!strcasecmp(c->argv[1]->ptr, "idletime") && c->argc == 3) {
         if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.nullbulk)) ==
             NULL)
-            return;
+            goto done;
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+            addReplyError(c, "An LFU maxmemory policy is selected, idle time "
+                             "not tracked. Please note that when switching "
+                             "between policies at runtime LRU and LFU data "
+                             "will take some time to adjust.");
+            goto done;
+        }
         addReplyLongLong(c, estimateObjectIdleTime(o) / 1000);
+    } else if (!strcasecmp(c->argv[1]->ptr, "freq") && c->argc == 3) {
+        if ((o = objectCommandLookupOrReply(c, c->argv[2], shared.nullbulk)) ==
+            NULL)
+            goto done;
+        if (!(server.maxmemory_policy & MAXMEMORY_FLAG_LFU)) {
+            addReplyError(c, "An LFU maxmemory policy is not selected, access "
+                             "frequency not tracked. Please note that when "
+                             "switching between policies at runtime LRU and "
+                             "LFU data will take some time to adjust.");
+            goto done;
+        }
+        addReplyLongLong(c, LFUDecrAndReturn(o));
     } else {
-        addReplyError(c,
-                      "Syntax error. Try OBJECT (refcount|encoding|idletime)");
+        addReplyError(
+            c, "Syntax error. Try OBJECT (refcount|encoding|idletime|freq)");
     }
+done:
     rcu_read_unlock();
 }
+
+/* ======================= The MEMORY command =============================== */
+
+/* Default number of elements sampled by MEMORY USAGE for aggregate types. */
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5
+
+/* Return the memory used by a string object, header included. Strings are
+ * also used as elements of sets, hashes and sorted sets in their hash table
+ * and skiplist encodings. */
+static size_t stringObjectAllocSize(robj *o)
+{
+    if (o->encoding == OBJ_ENCODING_RAW)
+        return zmalloc_size(o) + sdsAllocSize(o->ptr);
+    /* OBJ_ENCODING_INT stores the value in the pointer itself, while
+     * OBJ_ENCODING_EMBSTR allocates the sds string with the object. */
+    return zmalloc_size(o);
+}
+
+/* Return the memory used by a dict of the given type: its struct, the
+ * bucket arrays and the entries, but not what the entries point to. */
+static size_t dictAllocSize(dict *d)
+{
+    return sizeof(*d) + dictSlots(d) * sizeof(dictEntry *) +
+           dictSize(d) * sizeof(dictEntry);
+}
+
+/* Return an approximation of the memory used by the object, including the
+ * object header and the internal encoding. For aggregate types only up to
+ * 'sample_size' elements are measured and the result is extrapolated to the
+ * whole object, a 'sample_size' of zero measures all the elements. */
+size_t objectComputeSize(robj *o, size_t sample_size)
+{
+    size_t asize = 0, elesize = 0, samples = 0;
+    dictIterator *di;
+    dictEntry *de;
+    dict *d;
+
+    if (sample_size == 0)
+        sample_size = SIZE_MAX;
+
+    if (o->type == OBJ_STRING) {
+        asize = stringObjectAllocSize(o);
+    } else if (o->type == OBJ_LIST) {
+        if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node = ql->head;
+
+            asize = zmalloc_size(o) + zmalloc_size(ql);
+            while (node && samples < sample_size) {
+                elesize += zmalloc_size(node) + zmalloc_size(node->zl);
+                samples++;
+                node = node->next;
+            }
+            if (samples)
+                asize += (double) elesize / samples * ql->len;
+        } else if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+            asize = zmalloc_size(o) + zmalloc_size(o->ptr);
+        } else {
+            serverPanic("Unknown list encoding");
+        }
+    } else if (o->type == OBJ_SET) {
+        if (o->encoding == OBJ_ENCODING_HT) {
+            d = o->ptr;
+            asize = zmalloc_size(o) + dictAllocSize(d);
+            di = dictGetIterator(d);
+            while ((de = dictNext(di)) != NULL && samples < sample_size) {
+                elesize += stringObjectAllocSize(dictGetKey(de));
+                samples++;
+            }
+            dictReleaseIterator(di);
+            if (samples)
+                asize += (double) elesize / samples * dictSize(d);
+        } else if (o->encoding == OBJ_ENCODING_INTSET) {
+            asize = zmalloc_size(o) + zmalloc_size(o->ptr);
+        } else {
+            serverPanic("Unknown set encoding");
+        }
+    } else if (o->type == OBJ_ZSET) {
+        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+            asize = zmalloc_size(o) + zmalloc_size(o->ptr);
+        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+            zset *zs = o->ptr;
+            zskiplist *zsl = zs->zsl;
+            zskiplistNode *znode = zsl->header->level[0].forward;
+
+            asize = zmalloc_size(o) + zmalloc_size(zs) + dictAllocSize(zs->dict) +
+                    zmalloc_size(zsl) + zmalloc_size(zsl->header);
+            /* The element object is shared by the dict and the skiplist. */
+            while (znode != NULL && samples < sample_size) {
+                elesize += stringObjectAllocSize(znode->obj) + zmalloc_size(znode);
+                samples++;
+                znode = znode->level[0].forward;
+            }
+            if (samples)
+                asize += (double) elesize / samples * zsl->length;
+        } else {
+            serverPanic("Unknown sorted set encoding");
+        }
+    } else if (o->type == OBJ_HASH) {
+        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+            asize = zmalloc_size(o) + zmalloc_size(o->ptr);
+        } else if (o->encoding == OBJ_ENCODING_HT) {
+            d = o->ptr;
+            asize = zmalloc_size(o) + dictAllocSize(d);
+            di = dictGetIterator(d);
+            while ((de = dictNext(di)) != NULL && samples < sample_size) {
+                elesize += stringObjectAllocSize(dictGetKey(de)) +
+                           stringObjectAllocSize(dictGetVal(de));
+                samples++;
+            }
+            dictReleaseIterator(di);
+            if (samples)
+                asize += (double) elesize / samples * dictSize(d);
+        } else {
+            serverPanic("Unknown hash encoding");
+        }
+    } else {
+        serverPanic("Unknown object type");
+    }
+    return asize;
+}
+
+/* Return the memory used by a client: the client structure, which embeds
+ * the static reply buffer, the query buffer and the reply list. */
+static size_t clientAllocSize(client *c)
+{
+    return zmalloc_size(c) + sdsAllocSize(c->querybuf) +
+           getClientOutputBufferMemoryUsage(c);
+}
+
+/* Add the MEMORY STATS entries of a thread: bytes allocated and freed by it
+ * according to the allocator, its clients and their buffers. */
+static void addReplyThreadMemoryStats(client *c,
+                                      q_eventloop *qel,
+                                      unsigned long clients,
+                                      size_t querybuf,
+                                      size_t reply)
+{
+    addReplyMultiBulkLen(c, 10);
+    addReplyBulkCString(c, "allocator.allocated");
+    addReplyLongLong(c, qel->alloc_bytes ? (long long) *qel->alloc_bytes : 0);
+    addReplyBulkCString(c, "allocator.freed");
+    addReplyLongLong(c, qel->free_bytes ? (long long) *qel->free_bytes : 0);
+    addReplyBulkCString(c, "clients");
+    addReplyLongLong(c, clients);
+    addReplyBulkCString(c, "clients.querybuf");
+    addReplyLongLong(c, querybuf);
+    addReplyBulkCString(c, "clients.reply");
+    addReplyLongLong(c, reply);
+}
+
+/* MEMORY STATS: a flat list of field/value pairs describing where the memory
+ * of the server goes. Must run in the server thread. */
+static void memoryStatsCommand(client *c)
+{
+    size_t zmalloc_used = zmalloc_used_memory();
+    size_t overhead = 0, keys = 0, mem, entries, bytes;
+    size_t allocated, active, resident, mapped, retained;
+    size_t normal_mem = 0, slaves_mem = 0, querybuf = 0, reply = 0;
+    unsigned long normal = 0;
+    void *replylen = addDeferredMultiBulkLength(c);
+    int fields = 0, j;
+    listIter li;
+    listNode *ln;
+
+    if (zmalloc_used > server.stat_peak_memory)
+        server.stat_peak_memory = zmalloc_used;
+
+    addReplyBulkCString(c, "peak.allocated");
+    addReplyLongLong(c, server.stat_peak_memory);
+    addReplyBulkCString(c, "total.allocated");
+    addReplyLongLong(c, zmalloc_used);
+    fields += 2;
+
+    /* The replication buffer is shared by the backlog and the slaves, what
+     * the slaves retain past the backlog size is counted as theirs. */
+    mem = 0;
+    if (server.repl_backlog) {
+        mem = server.repl_buffer_mem;
+        if (listLength(server.slaves) &&
+            mem > (size_t) server.repl_backlog_size)
+            mem = server.repl_backlog_size;
+    }
+    addReplyBulkCString(c, "replication.backlog");
+    addReplyLongLong(c, mem);
+    overhead += mem;
+    fields++;
+
+    /* Clients owned by the server thread, including the slaves. */
+    listRewind(server.clients, &li);
+    while ((ln = listNext(&li)) != NULL) {
+        client *cl = listNodeValue(ln);
+
+        if (cl->flags & CLIENT_SLAVE) {
+            slaves_mem += zmalloc_size(cl) + sdsAllocSize(cl->querybuf) +
+                          cl->reply_bytes;
+        } else {
+            normal_mem += clientAllocSize(cl);
+            querybuf += sdsAllocSize(cl->querybuf);
+            reply += getClientOutputBufferMemoryUsage(cl);
+            normal++;
+        }
+    }
+    /* Clients owned by the workers, as sampled by their last cron. */
+    for (j = 0; j < (int) darray_n(&workers); j++) {
+        q_worker *worker = darray_get(&workers, (uint32_t) j);
+
+        normal_mem += worker->stats.connected_clients * sizeof(client) +
+                      worker->stats.querybuf_bytes + worker->stats.reply_bytes;
+    }
+    if (server.repl_buffer_mem > mem)
+        slaves_mem += server.repl_buffer_mem - mem;
+    addReplyBulkCString(c, "clients.slaves");
+    addReplyLongLong(c, slaves_mem);
+    addReplyBulkCString(c, "clients.normal");
+    addReplyLongLong(c, normal_mem);
+    overhead += slaves_mem + normal_mem;
+    fields += 2;
+
+    mem = 0;
+    if (server.aof_state != AOF_OFF)
+        mem = sdsalloc(server.aof_buf) + aofRewriteBufferSize();
+    addReplyBulkCString(c, "aof.buffer");
+    addReplyLongLong(c, mem);
+    overhead += mem;
+    fields++;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db + j;
+        size_t main_mem, expires_mem;
+
+        if (q_dictSize(db->dict) == 0)
+            continue;
+        main_mem = q_dictBuckets(db->dict) * sizeof(struct cds_lfht_node) +
+                   q_dictSize(db->dict) * sizeof(q_dictEntry);
+        expires_mem = q_dictBuckets(db->expires) * sizeof(struct cds_lfht_node) +
+                      q_dictSize(db->expires) * sizeof(q_dictEntry);
+        keys += q_dictSize(db->dict);
+        overhead += main_mem + expires_mem;
+
+        addReplyBulkSds(c, sdscatprintf(sdsempty(), "db.%d", j));
+        addReplyMultiBulkLen(c, 8);
+        addReplyBulkCString(c, "overhead.hashtable.main");
+        addReplyLongLong(c, main_mem);
+        addReplyBulkCString(c, "overhead.hashtable.expires");
+        addReplyLongLong(c, expires_mem);
+        addReplyBulkCString(c, "lfht.buckets.main");
+        addReplyLongLong(c, q_dictBuckets(db->dict));
+        addReplyBulkCString(c, "lfht.buckets.expires");
+        addReplyLongLong(c, q_dictBuckets(db->expires));
+        fields++;
+    }
+
+    q_dictGetPendingReclaim(&entries, &bytes);
+    addReplyBulkCString(c, "rcu.pending.entries");
+    addReplyLongLong(c, entries);
+    addReplyBulkCString(c, "rcu.pending.bytes");
+    addReplyLongLong(c, bytes);
+    fields += 2;
+
+    addReplyBulkCString(c, "overhead.total");
+    addReplyLongLong(c, overhead);
+    addReplyBulkCString(c, "keys.count");
+    addReplyLongLong(c, keys);
+    /* Memory waiting for a grace period is neither overhead nor dataset. */
+    mem = zmalloc_used > overhead + bytes ? zmalloc_used - overhead - bytes : 0;
+    addReplyBulkCString(c, "keys.bytes-per-key");
+    addReplyLongLong(c, keys ? mem / keys : 0);
+    addReplyBulkCString(c, "dataset.bytes");
+    addReplyLongLong(c, mem);
+    addReplyBulkCString(c, "dataset.percentage");
+    addReplyDouble(c, zmalloc_used ? (double) mem * 100 / zmalloc_used : 0);
+    fields += 5;
+
+    zmalloc_get_allocator_info(&allocated, &active, &resident, &mapped,
+                               &retained);
+    addReplyBulkCString(c, "allocator.allocated");
+    addReplyLongLong(c, allocated);
+    addReplyBulkCString(c, "allocator.active");
+    addReplyLongLong(c, active);
+    addReplyBulkCString(c, "allocator.resident");
+    addReplyLongLong(c, resident);
+    addReplyBulkCString(c, "allocator.mapped");
+    addReplyLongLong(c, mapped);
+    addReplyBulkCString(c, "allocator.retained");
+    addReplyLongLong(c, retained);
+    fields += 5;
+
+    addReplyBulkCString(c, "thread.server");
+    addReplyThreadMemoryStats(c, &server.qel, normal, querybuf, reply);
+    addReplyBulkCString(c, "thread.master");
+    addReplyThreadMemoryStats(c, &master.qel, 0, 0, 0);
+    fields += 2;
+    for (j = 0; j < (int) darray_n(&workers); j++) {
+        q_worker *worker = darray_get(&workers, (uint32_t) j);
+
+        addReplyBulkSds(c, sdscatprintf(sdsempty(), "thread.worker.%d", j));
+        addReplyThreadMemoryStats(c, &worker->qel,
+                                  worker->stats.connected_clients,
+                                  worker->stats.querybuf_bytes,
+                                  worker->stats.reply_bytes);
+        fields++;
+    }
+
+    setDeferredMultiBulkLength(c, replylen, fields * 2);
+}
+
+/* MEMORY USAGE <key> [SAMPLES <count>]
+ * MEMORY STATS
+ * MEMORY PURGE */
+void memoryCommand(client *c)
+{
+    robj *o;
+    q_dictEntry *de;
+    long long samples = OBJ_COMPUTE_SIZE_DEF_SAMPLES;
+    size_t usage;
+    int j;
+
+    if (!strcasecmp(c->argv[1]->ptr, "usage") && c->argc >= 3) {
+        for (j = 3; j < c->argc; j++) {
+            if (!strcasecmp(c->argv[j]->ptr, "samples") && j + 1 < c->argc) {
+                if (getLongLongFromObjectOrReply(c, c->argv[j + 1], &samples,
+                                                 NULL) == C_ERR)
+                    return;
+                if (samples < 0) {
+                    addReply(c, shared.syntaxerr);
+                    return;
+                }
+                j++;
+            } else {
+                addReply(c, shared.syntaxerr);
+                return;
+            }
+        }
+        rcu_read_lock();
+        if ((de = q_dictFind(c->db->dict, c->argv[2]->ptr)) == NULL) {
+            rcu_read_unlock();
+            addReply(c, shared.nullbulk);
+            return;
+        }
+        o = dictGetVal(de);
+        usage = zmalloc_size(de) + sdsAllocSize(de->key) +
+                objectComputeSize(o, samples);
+        rcu_read_unlock();
+        addReplyLongLong(c, usage);
+    } else if (!strcasecmp(c->argv[1]->ptr, "stats") && c->argc == 2) {
+        memoryStatsCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr, "purge") && c->argc == 2) {
+        /* Don't wait for the decay of the freed pages, see
+         * jemalloc-dirty-decay-ms. */
+        zmalloc_purge();
+        addReply(c, shared.ok);
+    } else {
+        addReplyError(c, "Syntax error. Try MEMORY (usage <key> [samples "
+                         "<count>]|stats|purge)");
+    }
+}
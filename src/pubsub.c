@@ -57,6 +57,15 @@ int clientSubscriptionsCount(client *c)
 
 /* Subscribe a client to a channel. Returns 1 if the operation succeeded, or
  * 0 if the client was already subscribed to that channel. */
+/* Subscribers of __redis__:invalidate receive the invalidation messages of
+ * client side caching, see q_tracking.c. */
+static int pubsubIsTrackingChannel(robj *channel)
+{
+    return sdsEncodedObject(channel) &&
+           sdslen(channel->ptr) == strlen(Q_TRACKING_CHANNEL) &&
+           !memcmp(channel->ptr, Q_TRACKING_CHANNEL, strlen(Q_TRACKING_CHANNEL));
+}
+
 int pubsubSubscribeChannel(client *c, robj *channel)
 {
     dictEntry *de;
@@ -77,6 +86,8 @@ int pubsubSubscribeChannel(client *c, robj *channel)
             clients = dictGetVal(de);
         }
         listAddNodeTail(clients, c);
+        if (pubsubIsTrackingChannel(channel))
+            q_trackingSubscribed(c);
     }
     /* Notify the client */
     addReply(c, shared.mbulkhdr[3]);
@@ -113,6 +124,8 @@ int pubsubUnsubscribeChannel(client *c, robj *channel, int notify)
              * Redis PUBSUB creating millions of channels. */
             dictDelete(server.pubsub_channels, channel);
         }
+        if (pubsubIsTrackingChannel(channel))
+            q_trackingUnsubscribed(c);
     }
     /* Notify the client */
     if (notify) {
@@ -0,0 +1,345 @@
+//
+// Parallel application of the replication stream on slaves.
+//
+// The master client is still read and parsed by the server thread, but with
+// repl-apply-threads > 0 the write commands it carries are handed over to a
+// pool of apply threads, by hash of their keys: commands on the same key keep
+// the order of the stream while commands on different keys run concurrently
+// against the q_dict keyspace. Commands that can't be split by key (MULTI/EXEC,
+// SELECT, FLUSH*, scripts, commands whose keys belong to several threads...)
+// are barriers: the server thread waits for the pool to be idle, then runs
+// them itself through call() as before.
+//
+// The pool is idle again before processInputBuffer() returns, so serverCron(),
+// forks and the other clients of the server thread never run concurrently
+// with an apply thread, and the master client's reploff, which the ACKs send,
+// only ever covers commands that were applied.
+//
+
+#include "fmacros.h"
+#include <signal.h>
+#include <urcu.h>
+
+#include "q_apply.h"
+#include "server.h"
+
+#define Q_APPLY_THREAD_STACK_SIZE (1024 * 1024 * 4)
+
+static q_applier **appliers = NULL;
+static int num_appliers = 0;
+
+// Jobs queued to the apply threads and not run yet, the server thread waits
+// on apply_done_cond for it to drop to zero.
+static pthread_mutex_t apply_done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t apply_done_cond = PTHREAD_COND_INITIALIZER;
+static long apply_running = 0;
+
+// Commands dispatched since the pool was last drained, server thread only.
+static long long apply_epoch_jobs = 0;
+static long long apply_dirty_base;    // server.dirty before the first one
+static client *apply_client = NULL;   // master client they were read from
+static long long apply_reploff;       // offset right after the last one
+
+static void applyJobsDone(long done)
+{
+    if (__atomic_sub_fetch(&apply_running, done, __ATOMIC_RELEASE) == 0) {
+        pthread_mutex_lock(&apply_done_lock);
+        pthread_cond_signal(&apply_done_cond);
+        pthread_mutex_unlock(&apply_done_lock);
+    }
+}
+
+static void applyRunJob(q_applier *a, q_apply_job *job)
+{
+    client *c = a->c;
+    long long start, duration;
+    int j;
+
+    selectDb(c, job->dbid);
+    c->argv = job->argv;
+    c->argc = job->argc;
+    c->cmd = c->lastcmd = job->cmd;
+
+    start = ustime();
+    c->cmd->proc(c);
+    duration = ustime() - start;
+    __atomic_add_fetch(&c->cmd->microseconds, duration, __ATOMIC_RELAXED);
+
+    // The command may have rewritten its arguments, free what it left.
+    for (j = 0; j < c->argc; j++) {
+        decrRefCount(c->argv[j]);
+    }
+    zfree(c->argv);
+    c->argv = NULL;
+    c->argc = 0;
+    c->cmd = NULL;
+    zfree(job);
+}
+
+static void *applyThreadMain(void *arg)
+{
+    q_applier *a = arg;
+    struct cds_wfcq_node *qnode;
+    sigset_t sigset;
+    long done = 0;
+    int stop;
+
+    // Only the server thread handles the watchdog signal.
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+    rcu_register_thread();
+    while (1) {
+        qnode = __cds_wfcq_dequeue_blocking(&a->q_head, &a->q_tail);
+        if (qnode) {
+            applyRunJob(a, caa_container_of(qnode, q_apply_job, q_node));
+            done++;
+            continue;
+        }
+
+        // Out of work: report what was run, then wait for more.
+        if (done) {
+            applyJobsDone(done);
+            done = 0;
+        }
+        pthread_mutex_lock(&a->lock);
+        while (cds_wfcq_empty(&a->q_head, &a->q_tail) && !a->stop) {
+            pthread_cond_wait(&a->cond, &a->lock);
+        }
+        stop = a->stop && cds_wfcq_empty(&a->q_head, &a->q_tail);
+        pthread_mutex_unlock(&a->lock);
+        if (stop) {
+            break;
+        }
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static q_applier *applyStart(int id)
+{
+    q_applier *a = zcalloc(sizeof(*a));
+    pthread_attr_t attr;
+    size_t stacksize;
+
+    a->id = id;
+    a->c = createClient(&server.qel, -1);
+    // Masters get no replies, and neither do the commands they sent us.
+    a->c->flags |= CLIENT_MASTER;
+    a->c->authenticated = 1;
+    cds_wfcq_init(&a->q_head, &a->q_tail);
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->cond, NULL);
+
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr, &stacksize);
+    if (!stacksize) {
+        stacksize = 1;
+    }
+    while (stacksize < Q_APPLY_THREAD_STACK_SIZE) {
+        stacksize *= 2;
+    }
+    pthread_attr_setstacksize(&attr, stacksize);
+    if (pthread_create(&a->thread_id, &attr, applyThreadMain, a) != 0) {
+        serverLog(LL_WARNING, "Can't create apply thread #%d: %s", id,
+                  strerror(errno));
+        a->c->flags &= ~CLIENT_MASTER;
+        freeClient(a->c);
+        zfree(a);
+        return NULL;
+    }
+    return a;
+}
+
+// Called with the pool drained.
+static void applyStop(q_applier *a)
+{
+    pthread_mutex_lock(&a->lock);
+    a->stop = 1;
+    pthread_cond_signal(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+    pthread_join(a->thread_id, NULL);
+
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->cond);
+    // Not our master: don't let freeClient() cache it.
+    a->c->flags &= ~CLIENT_MASTER;
+    freeClient(a->c);
+    zfree(a);
+}
+
+// Set the number of apply threads, 0 to run every command of the master on
+// the server thread. Keys are spread over the threads by hash modulo their
+// number, so the pool is drained and started over.
+int q_applyResize(int count)
+{
+    int j;
+
+    if (count == num_appliers) {
+        return C_OK;
+    }
+    q_applyDrain();
+    for (j = 0; j < num_appliers; j++) {
+        applyStop(appliers[j]);
+    }
+    zfree(appliers);
+    appliers = NULL;
+    num_appliers = 0;
+    if (count == 0) {
+        return C_OK;
+    }
+
+    appliers = zmalloc(sizeof(q_applier *) * count);
+    for (j = 0; j < count; j++) {
+        if ((appliers[j] = applyStart(j)) == NULL) {
+            q_applyResize(0);
+            return C_ERR;
+        }
+        num_appliers++;
+    }
+    serverLog(LL_NOTICE, "Applying the replication stream with %d threads",
+              count);
+    return C_OK;
+}
+
+// Wake up a thread for the jobs queued since the last time. A thread that is
+// still busy picks them up by itself, the wake up is only needed once it ran
+// out of work, so it is done every Q_APPLY_BATCH_SIZE jobs and when draining.
+static void applyWakeUp(q_applier *a)
+{
+    if (a->staged == 0) {
+        return;
+    }
+    a->staged = 0;
+    pthread_mutex_lock(&a->lock);
+    pthread_cond_signal(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+}
+
+// Wait for every command dispatched so far to be applied. Called by the
+// server thread before anything that isn't safe while the apply threads
+// write to the keyspace.
+void q_applyDrain(void)
+{
+    int j;
+
+    if (apply_epoch_jobs == 0) {
+        return;
+    }
+    for (j = 0; j < num_appliers; j++) {
+        applyWakeUp(appliers[j]);
+    }
+    pthread_mutex_lock(&apply_done_lock);
+    while (__atomic_load_n(&apply_running, __ATOMIC_ACQUIRE)) {
+        pthread_cond_wait(&apply_done_cond, &apply_done_lock);
+    }
+    pthread_mutex_unlock(&apply_done_lock);
+
+    // The apply threads race on server.dirty, count one change per command
+    // instead: the master only sends commands that changed its dataset.
+    server.dirty = apply_dirty_base + apply_epoch_jobs;
+    apply_client->reploff = apply_reploff;
+    apply_epoch_jobs = 0;
+}
+
+int q_applyPending(void)
+{
+    return apply_epoch_jobs != 0;
+}
+
+// Return the apply thread that owns every key of the command, or -1 if it
+// must run on the server thread.
+static int applyThreadForCommand(client *c)
+{
+    struct redisCommand *cmd = c->cmd;
+    int *keys, numkeys, j, idx = -1, t;
+
+    if (!(cmd->flags & CMD_WRITE) ||
+        cmd->flags & (CMD_NOSCRIPT | CMD_RANDOM | CMD_ADMIN | CMD_PUBSUB)) {
+        return -1;
+    }
+    // Other dbs, keys not in the key specs, or arguments rewritten for the
+    // propagation.
+    if (cmd->proc == moveCommand || cmd->proc == sortCommand ||
+        cmd->proc == flushdbCommand || cmd->proc == flushallCommand ||
+        cmd->proc == migrateCommand || cmd->proc == incrbyfloatCommand ||
+        cmd->proc == hincrbyfloatCommand) {
+        return -1;
+    }
+    // Side effects on structures owned by the server thread.
+    if (server.notify_keyspace_events || dictSize(c->db->watched_keys) ||
+        dictSize(c->db->blocking_keys)) {
+        return -1;
+    }
+
+    keys = getKeysFromCommand(cmd, c->argv, c->argc, &numkeys);
+    for (j = 0; j < numkeys; j++) {
+        // arguments from the protocol parser are always sds strings
+        t = dictSdsHash(c->argv[keys[j]]->ptr) % num_appliers;
+        if (j && t != idx) {
+            idx = -1;
+            break;
+        }
+        idx = t;
+    }
+    getKeysFreeResult(keys);
+    return idx;
+}
+
+// Called by processCommand() for the commands of the master. Return C_OK if
+// the command was handed over to an apply thread, C_ERR if the caller must
+// run it, in which case everything dispatched before it was applied.
+int q_applyDispatch(client *c)
+{
+    q_apply_job *job;
+    q_applier *a;
+    int idx;
+
+    if (num_appliers == 0) {
+        return C_ERR;
+    }
+    if ((idx = applyThreadForCommand(c)) == -1) {
+        if (apply_epoch_jobs) {
+            server.stat_repl_apply_barriers++;
+        }
+        q_applyDrain();
+        return C_ERR;
+    }
+
+    // call() feeds MONITOR and propagates the command once it ran. Doing it
+    // here keeps the sub-slaves and the AOF in the order of the stream.
+    if (listLength(server.monitors) && !server.loading &&
+        !(c->cmd->flags & (CMD_SKIP_MONITOR | CMD_ADMIN))) {
+        replicationFeedMonitors(c, server.monitors, c->db->id, c->argv,
+                                c->argc);
+    }
+    propagate(c->cmd, c->db->id, c->argv, c->argc,
+              PROPAGATE_AOF | PROPAGATE_REPL);
+    c->cmd->calls++;
+    server.stat_numcommands++;
+    server.stat_repl_apply_parallel++;
+
+    if (apply_epoch_jobs++ == 0) {
+        apply_dirty_base = server.dirty;
+    }
+    apply_client = c;
+    apply_reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
+
+    job = zmalloc(sizeof(*job));
+    job->dbid = c->db->id;
+    job->cmd = c->cmd;
+    job->argv = c->argv;
+    job->argc = c->argc;
+    cds_wfcq_node_init(&job->q_node);
+    c->argv = NULL;
+    c->argc = 0;
+
+    a = appliers[idx];
+    __atomic_add_fetch(&apply_running, 1, __ATOMIC_RELAXED);
+    cds_wfcq_enqueue(&a->q_head, &a->q_tail, &job->q_node);
+    if (++a->staged == Q_APPLY_BATCH_SIZE) {
+        applyWakeUp(a);
+    }
+    return C_OK;
+}
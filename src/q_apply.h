@@ -0,0 +1,45 @@
+//
+// Parallel application of the replication stream on slaves.
+//
+
+#ifndef Q_REDIS_Q_APPLY_H
+#define Q_REDIS_Q_APPLY_H
+
+#include <pthread.h>
+#include <urcu/wfcqueue.h>
+
+#define Q_APPLY_BATCH_SIZE 32  // commands queued before waking an apply thread
+
+struct client;
+struct redisCommand;
+struct redisObject;
+
+// A command of the master stream, taken over from the master client.
+typedef struct q_apply_job {
+    int dbid;
+    struct redisCommand *cmd;
+    struct redisObject **argv;
+    int argc;
+    struct cds_wfcq_node q_node;
+} q_apply_job;
+
+typedef struct q_applier {
+    int id;
+    pthread_t thread_id;
+    struct client *c;  // fake client the commands are run with
+
+    // jobs of the thread, it sleeps on cond when there are none
+    struct cds_wfcq_head q_head;
+    struct cds_wfcq_tail q_tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    int staged;  // queued since the thread was last woken up
+} q_applier;
+
+int q_applyResize(int count);
+int q_applyDispatch(struct client *c);
+void q_applyDrain(void);
+int q_applyPending(void);
+
+#endif  // Q_REDIS_Q_APPLY_H
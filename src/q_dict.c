@@ -1,6 +1,11 @@
 #include "server.h"
 #include <urcu.h>
 
+// Entries handed to call_rcu() and not reclaimed yet, together with the
+// memory they keep alive. Updated by the writers and by the call_rcu thread.
+static size_t pending_reclaim_entries = 0;
+static size_t pending_reclaim_bytes = 0;
+
 int q_dictSdsKeyCaseMatch(struct cds_lfht_node *ht_node, const void *key)
 {
     struct q_dictEntry *de =
@@ -21,10 +26,18 @@ void q_freeDictEntry(q_dictEntry *de)
     zfree(de);
 }
 
+static void q_dictReclaimDone(q_dictEntry *de)
+{
+    __atomic_sub_fetch(&pending_reclaim_entries, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&pending_reclaim_bytes, de->reclaim_bytes,
+                       __ATOMIC_RELAXED);
+}
+
 void q_freeRcuDictEntry(struct rcu_head *head)
 {
     struct q_dictEntry *de =
-        caa_container_of(head, struct q_dictEntry, rcu_head);
+        caa_container_of(head, struct q_dictEntry, link.rcu_head);
+    q_dictReclaimDone(de);
     q_freeDictEntry(de);
 }
 
@@ -39,15 +52,59 @@ void q_freeDictExpirationEntry(q_dictEntry *de)
 void q_freeRcuDictExpirationEntry(struct rcu_head *head)
 {
     struct q_dictEntry *de =
-        caa_container_of(head, struct q_dictEntry, rcu_head);
+        caa_container_of(head, struct q_dictEntry, link.rcu_head);
+    q_dictReclaimDone(de);
     q_freeDictExpirationEntry(de);
 }
 
+// O(1) estimate of the memory of a value: the object and its top level
+// allocation, the elements of an aggregate are not walked.
+static size_t q_dictValueAllocSize(robj *val)
+{
+    size_t bytes = zmalloc_size(val);
+
+    if (val->encoding == OBJ_ENCODING_RAW)
+        bytes += sdsAllocSize(val->ptr);
+    else if (val->encoding != OBJ_ENCODING_EMBSTR &&
+             val->encoding != OBJ_ENCODING_INT)
+        bytes += zmalloc_size(val->ptr);
+    return bytes;
+}
+
+// Hand an entry unlinked from the table to call_rcu(), accounting the memory
+// it keeps alive until the grace period ends. This runs on the write path,
+// so the value is estimated, and only counted when the entry holds the last
+// reference to it. The key is counted with the main entry only.
+static void q_dictDeferFree(q_dictEntry *de, bool expire)
+{
+    size_t bytes = zmalloc_size(de);
+    robj *val = de->v.val;
+
+    if (!expire) {
+        bytes += sdsAllocSize(de->key);
+        if (val && val->refcount == 1)
+            bytes += q_dictValueAllocSize(val);
+    }
+    de->reclaim_bytes = bytes > UINT32_MAX ? UINT32_MAX : (uint32_t) bytes;
+    __atomic_add_fetch(&pending_reclaim_entries, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pending_reclaim_bytes, de->reclaim_bytes,
+                       __ATOMIC_RELAXED);
+    call_rcu(&de->link.rcu_head,
+             expire ? q_freeRcuDictExpirationEntry : q_freeRcuDictEntry);
+}
+
+void q_dictGetPendingReclaim(size_t *entries, size_t *bytes)
+{
+    *entries = __atomic_load_n(&pending_reclaim_entries, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n(&pending_reclaim_bytes, __ATOMIC_RELAXED);
+}
+
 q_dictIterator *q_dictGetIterator(q_dict *ht)
 {
     q_dictIterator *iter = zmalloc(sizeof(*iter));
     iter->d = ht;
-    cds_lfht_first(ht->table, &iter->iter);
+    iter->table = rcu_dereference(ht->table);
+    cds_lfht_first(iter->table, &iter->iter);
     return iter;
 }
 
@@ -63,7 +120,7 @@ q_dictEntry *q_dictNext(q_dictIterator *iter)
     struct q_dictEntry *de = NULL;
     node = cds_lfht_iter_get_node(&iter->iter);
     if (node != NULL) {
-        cds_lfht_next(iter->d->table, &iter->iter);
+        cds_lfht_next(iter->table, &iter->iter);
         de = caa_container_of(node, struct q_dictEntry, node);
         return de;
     }
@@ -120,6 +177,7 @@ int q_expireIfNeeded(redisDb *db, robj *key)
 
     // ToDo: use above solution
     // temp solution dbDelete is not thread safe for cluster mode
+    q_trackingInvalidateKey(key);
     return dbDelete(db, key);
 }
 
@@ -127,28 +185,29 @@ int q_expireIfNeeded(redisDb *db, robj *key)
 int q_dictDelete(q_dict *d, void *key, bool expire)
 {
     unsigned long hash;
+    struct cds_lfht *table;
     struct cds_lfht_node *ht_node;
     struct cds_lfht_iter iter;
     int ret = 0;
     int deleted = DICT_ERR;
 
     rcu_read_lock();
+    table = rcu_dereference(d->table);
     hash = dictSdsHash(key);
-    cds_lfht_lookup(d->table, hash, q_dictSdsKeyCaseMatch, key, &iter);
+    cds_lfht_lookup(table, hash, q_dictSdsKeyCaseMatch, key, &iter);
     ht_node = cds_lfht_iter_get_node(&iter);
     if (ht_node) {
-        ret = cds_lfht_del(d->table, ht_node);
+        ret = cds_lfht_del(table, ht_node);
         if (ret) {
             // concurrently deleted.
         } else {
             q_dictEntry *de =
                 caa_container_of(ht_node, struct q_dictEntry, node);
-            if (!expire)
-                call_rcu(&de->rcu_head, q_freeRcuDictEntry);
-            else
-                call_rcu(&de->rcu_head, q_freeRcuDictExpirationEntry);
+            if (d->type && d->type->entryDeleted)
+                d->type->entryDeleted(d, de);
+            q_dictDeferFree(de, expire);
             deleted = DICT_OK;
-            --d->size;
+            __atomic_sub_fetch(&d->size, 1, __ATOMIC_RELAXED);
         }
     } else {
         // not found node
@@ -164,6 +223,7 @@ q_dictEntry *q_createDictEntry(sds key, robj *val)
     cds_lfht_node_init(&de->node);
     de->key = key;
     de->v.val = val;
+    de->link.slot.prev = de->link.slot.next = NULL;
     return de;
 }
 
@@ -178,17 +238,21 @@ int q_dictAdd(q_dict *d, sds key, robj *val)
     rcu_read_lock();
     de = q_createDictEntry(key, val);
     hash = dictSdsHash(key);
-    ht_node = cds_lfht_add_replace(d->table, hash, q_dictSdsKeyCaseMatch, key,
-                                   &de->node);
+    ht_node = cds_lfht_add_replace(rcu_dereference(d->table), hash,
+                                   q_dictSdsKeyCaseMatch, key, &de->node);
 
     if (ht_node) {
         struct q_dictEntry *ode =
             caa_container_of(ht_node, struct q_dictEntry, node);
-        call_rcu(&ode->rcu_head, q_freeRcuDictEntry);
+        if (d->type && d->type->entryReplaced)
+            d->type->entryReplaced(d, ode, de);
+        q_dictDeferFree(ode, false);
         rcu_read_unlock();
         return DICT_REPLACED;
     } else {
-        ++d->size;
+        __atomic_add_fetch(&d->size, 1, __ATOMIC_RELAXED);
+        if (d->type && d->type->entryAdded)
+            d->type->entryAdded(d, de);
         rcu_read_unlock();
         return DICT_OK;
     }
@@ -207,17 +271,18 @@ int q_dictAddExpiration(q_dict *d, sds key, long long when)
     cds_lfht_node_init(&de->node);
     de->key = key;
     de->v.s64 = when;
+    de->link.slot.prev = de->link.slot.next = NULL;
     hash = dictSdsHash(key);
-    ht_node = cds_lfht_add_replace(d->table, hash, q_dictSdsKeyCaseMatch, key,
-                                   &de->node);
+    ht_node = cds_lfht_add_replace(rcu_dereference(d->table), hash,
+                                   q_dictSdsKeyCaseMatch, key, &de->node);
     if (ht_node) {
         struct q_dictEntry *ode =
             caa_container_of(ht_node, struct q_dictEntry, node);
-        call_rcu(&ode->rcu_head, q_freeRcuDictExpirationEntry);
+        q_dictDeferFree(ode, true);
         rcu_read_unlock();
         return DICT_REPLACED;
     } else {
-        ++d->size;
+        __atomic_add_fetch(&d->size, 1, __ATOMIC_RELAXED);
         rcu_read_unlock();
         return DICT_OK;
     }
@@ -234,7 +299,8 @@ q_dictEntry *q_dictFind(q_dict *d, void *key)
     struct cds_lfht_node *ht_node;
 
     hash = dictSdsHash(key);
-    cds_lfht_lookup(d->table, hash, q_dictSdsKeyCaseMatch, key, &iter);
+    cds_lfht_lookup(rcu_dereference(d->table), hash, q_dictSdsKeyCaseMatch,
+                    key, &iter);
     ht_node = cds_lfht_iter_get_node(&iter);
     if (!ht_node) {
         return NULL;
@@ -249,25 +315,26 @@ q_dictEntry *q_dictFind(q_dict *d, void *key)
 void q_dictEmpty(q_dict *d, void(callback)(void *), bool expire)
 {
     unsigned long i = 0;
+    struct cds_lfht *table;
     struct cds_lfht_iter iter;
     struct cds_lfht_node *ht_node;
     struct q_dictEntry *entry;
     int ret = 0;
 
+    if (d->type && d->type->emptying)
+        d->type->emptying(d);
     rcu_read_lock();
-    cds_lfht_for_each_entry(d->table, &iter, entry, node)
+    table = rcu_dereference(d->table);
+    cds_lfht_for_each_entry(table, &iter, entry, node)
     {
         ht_node = cds_lfht_iter_get_node(&iter);
-        ret = cds_lfht_del(d->table, ht_node);
+        ret = cds_lfht_del(table, ht_node);
         if (ret) {
             // concurrently delete
         } else {
-            if (!expire)
-                call_rcu(&entry->rcu_head, q_freeRcuDictEntry);
-            else
-                call_rcu(
-                    &entry->rcu_head,
-                    q_freeRcuDictExpirationEntry);  // free expire dict entry
+            if (d->type && d->type->entryDeleted)
+                d->type->entryDeleted(d, entry);
+            q_dictDeferFree(entry, expire);
             ++i;
             if ((i & 65535) == 0)
                 callback(d->privdata);
@@ -316,7 +383,7 @@ q_dictEntry *q_dictGetRandomKey(q_dict *d)
      * }
      */
     rcu_read_lock();
-    cds_lfht_for_each_entry(d->table, &iter, de, node)
+    cds_lfht_for_each_entry(rcu_dereference(d->table), &iter, de, node)
     {
         i++;
         sde = de;
@@ -327,12 +394,86 @@ q_dictEntry *q_dictGetRandomKey(q_dict *d)
     return sde;
 }
 
+// Returns up to 'count' entries of the table, which is ordered by hash,
+// for eviction sampling. The walk resumes after '*cursor', the last key
+// sampled by the previous call, skipping a random number of entries first,
+// and wraps around at the end of the table; '*cursor' is then set to the
+// last key returned. Unlike starting from a random offset, the cost doesn't
+// grow with the size of the table and every part of it gets sampled. Called
+// with rcu_read_lock held, the entries are valid until it is released.
+unsigned int q_dictGetSomeKeys(q_dict *d, sds *cursor, q_dictEntry **des,
+                               unsigned int count)
+{
+    struct cds_lfht *table = rcu_dereference(d->table);
+    struct cds_lfht_iter iter;
+    struct cds_lfht_node *node = NULL;
+    unsigned long size;
+    unsigned int skip, stored = 0;
+    int wrapped = 0;
+
+    size = q_dictSize(d);
+    if (size == 0 || count == 0)
+        return 0;
+    if (count > size)
+        count = size;
+    // don't skip so far that the walk would come back to where it started
+    skip = random() % count;
+    if (skip > size - count)
+        skip = size - count;
+
+    if (*cursor) {
+        cds_lfht_lookup(table, dictSdsHash(*cursor), q_dictSdsKeyCaseMatch,
+                        *cursor, &iter);
+        node = cds_lfht_iter_get_node(&iter);
+        if (node) {
+            cds_lfht_next(table, &iter);
+            node = cds_lfht_iter_get_node(&iter);
+        }
+    }
+    while (stored < count) {
+        if (node == NULL) {
+            // the end of the table, or a cursor deleted meanwhile
+            if (wrapped++)
+                break;
+            cds_lfht_first(table, &iter);
+            node = cds_lfht_iter_get_node(&iter);
+            if (node == NULL)
+                break;
+        }
+        if (skip)
+            skip--;
+        else
+            des[stored++] = caa_container_of(node, q_dictEntry, node);
+        cds_lfht_next(table, &iter);
+        node = cds_lfht_iter_get_node(&iter);
+    }
+
+    sdsfree(*cursor);
+    *cursor = stored ? sdsdup(des[stored - 1]->key) : NULL;
+    return stored;
+}
+
+// cds_lfht does not expose its bucket array, estimate it from the number of
+// entries: with CDS_LFHT_AUTO_RESIZE the table keeps one bucket per entry,
+// rounded to the next power of two.
+unsigned long q_dictBuckets(q_dict *d)
+{
+    unsigned long buckets = 1;
+
+    while (buckets < d->size)
+        buckets <<= 1;
+    return buckets;
+}
+
 void q_dictGetStats(char *buf, size_t bufsize, q_dict *d)
 {
     snprintf(buf, bufsize,
              "Hash table stats:\n"
-             " table size: %d\n",
-             d->size);
+             " table size: %u\n"
+             " number of buckets (estimated): %lu\n"
+             " bucket array bytes (estimated): %lu\n",
+             d->size, q_dictBuckets(d),
+             q_dictBuckets(d) * sizeof(struct cds_lfht_node));
     if (bufsize)
         buf[bufsize - 1] = '\0';
     return;
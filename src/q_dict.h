@@ -14,30 +14,61 @@
 typedef struct q_dictEntry {
     unsigned type : 4;  // four data structure types: string, list, set, zset
                         // and hash
+    // bytes accounted as pending reclamation once handed to call_rcu(), it
+    // fits in the padding after the bitfield.
+    uint32_t reclaim_bytes;
     void *key;
     union {
         void *val;
         int64_t s64;
     } v;
     struct cds_lfht_node node;
-    struct rcu_head rcu_head;
+    union {
+        // intrusive per hash slot list, only linked in cluster mode. An
+        // entry leaves its slot list before it is handed to call_rcu(), so
+        // the links can share their storage with the rcu_head.
+        struct {
+            struct q_dictEntry *prev;
+            struct q_dictEntry *next;
+        } slot;
+        struct rcu_head rcu_head;
+    } link;
 } q_dictEntry;
 
+struct q_dict;
+struct q_keyIndex;
+
+// Optional hooks used to keep a secondary index in sync with the table.
+// They run on the thread that modified the table, before a replaced or
+// deleted entry is handed to call_rcu(). emptying() runs once before
+// q_dictEmpty() deletes the entries.
+typedef struct q_dictType {
+    void (*entryAdded)(struct q_dict *d, q_dictEntry *de);
+    void (*entryReplaced)(struct q_dict *d,
+                          q_dictEntry *oldde,
+                          q_dictEntry *de);
+    void (*entryDeleted)(struct q_dict *d, q_dictEntry *de);
+    void (*emptying)(struct q_dict *d);
+} q_dictType;
+
 typedef struct q_dict {
-    unsigned int size;
+    unsigned int size;  // updated atomically, apply threads write concurrently
     struct cds_lfht *table;
+    q_dictType *type;
     void *privdata;
+    struct q_keyIndex *keyindex;  // ordered key names, see key-prefix-index
 } q_dict;
 
 typedef struct q_dictIterator {
     q_dict *d;
+    struct cds_lfht *table;  // the table the walk started in
     struct cds_lfht_iter iter;
 } q_dictIterator;
 
 struct redisDb;
 struct redisObject;  // alias robj defined in server.h
 
-unsigned int dictSdsHash(const void *key);
+uint64_t dictSdsHash(const void *key);
 q_dictIterator *q_dictGetIterator(q_dict *d);
 void q_dictReleaseIterator(q_dictIterator *iter);
 q_dictEntry *q_dictNext(q_dictIterator *iter);
@@ -55,6 +86,10 @@ void q_freeDictEntry(q_dictEntry *de);
 int q_dictSdsKeyCaseMatch(struct cds_lfht_node *ht_node, const void *key);
 void q_dictEmpty(q_dict *d, void(callback)(void *), bool expire);
 q_dictEntry *q_dictGetRandomKey(q_dict *d);
+unsigned int q_dictGetSomeKeys(q_dict *d, sds *cursor, q_dictEntry **des,
+                               unsigned int count);
 void q_dictGetStats(char *buf, size_t bufsize, q_dict *d);
+unsigned long q_dictBuckets(q_dict *d);
+void q_dictGetPendingReclaim(size_t *entries, size_t *bytes);
 
 #endif
@@ -6,6 +6,13 @@
 #include "q_thread.h"
 #include "server.h"
 
+// Arenas of the event loops deinitialized, for the next threads started: the
+// allocator can't destroy an arena still owning memory, and the objects of a
+// retired worker live on.
+static pthread_mutex_t spare_arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+static int spare_arenas[CONFIG_MAX_THREADS_NUM + 2];
+static int spare_arenas_n = 0;
+
 void resetEventloopStats(q_eventloop_stats *stats)
 {
     int j;
@@ -40,6 +47,14 @@ int q_eventloop_init(q_eventloop *qel, int filelimit)
     qel->clients_pending_write = NULL;
     qel->clients_to_close = NULL;
     qel->unblocked_clients = NULL;
+    qel->querybuf = NULL;
+    qel->querybuf_client = NULL;
+    qel->alloc_bytes = NULL;
+    qel->free_bytes = NULL;
+    qel->arena = -1;
+    cds_wfcq_init(&qel->tracking_head, &qel->tracking_tail);
+    qel->tracking_wakeup = 0;
+    q_hotkeysInit(&qel->hotkeys);
 
     qel->el = aeCreateEventLoop(filelimit);
     if (qel->el == NULL) {
@@ -80,8 +95,29 @@ int q_eventloop_init(q_eventloop *qel, int filelimit)
     return C_OK;
 }
 
+// Called by the thread that runs the event loop before entering it. With
+// jemalloc-thread-arenas the thread gets an arena of its own, so the objects
+// and buffers it creates don't share pages, nor arena locks, with the other
+// threads.
+void q_eventloop_bind_thread(q_eventloop *qel)
+{
+    int reuse = -1;
+
+    zmalloc_get_thread_counters(&qel->alloc_bytes, &qel->free_bytes);
+    if (!server.jemalloc_thread_arenas)
+        return;
+
+    pthread_mutex_lock(&spare_arenas_lock);
+    if (spare_arenas_n > 0)
+        reuse = spare_arenas[--spare_arenas_n];
+    pthread_mutex_unlock(&spare_arenas_lock);
+    qel->arena = zmalloc_thread_arena_create(reuse);
+}
+
 void q_eventloop_deinit(q_eventloop *qel)
 {
+    struct cds_wfcq_node *qnode;
+
     if (qel == NULL) {
         return;
     }
@@ -126,4 +162,23 @@ void q_eventloop_deinit(q_eventloop *qel)
         listRelease(qel->unblocked_clients);
         qel->unblocked_clients = NULL;
     }
+
+    sdsfree(qel->querybuf);
+    qel->querybuf = NULL;
+
+    // the clients notified here are served wherever they went
+    while ((qnode = __cds_wfcq_dequeue_blocking(&qel->tracking_head,
+                                                &qel->tracking_tail))) {
+        zfree(caa_container_of(qnode, q_tracking_notify, q_node));
+    }
+
+    q_hotkeysDeinit(&qel->hotkeys);
+
+    if (qel->arena != -1) {
+        pthread_mutex_lock(&spare_arenas_lock);
+        if (spare_arenas_n < (int) (sizeof(spare_arenas) / sizeof(int)))
+            spare_arenas[spare_arenas_n++] = qel->arena;
+        pthread_mutex_unlock(&spare_arenas_lock);
+        qel->arena = -1;
+    }
 }
@@ -5,16 +5,22 @@
 #ifndef Q_REDIS_Q_EVENTLOOP_H
 #define Q_REDIS_Q_EVENTLOOP_H
 
+#include <stdint.h>
+#include <urcu/wfcqueue.h>
+
 #include "adlist.h"
 #include "ae.h"
+#include "q_hotkeys.h"
 #include "q_thread.h"
+#include "sds.h"
 
 /* Instantaneous metrics tracking. */
 #define STATS_METRIC_SAMPLES 16   /* Number of samples per metric. */
 #define STATS_METRIC_COMMAND 0    /* Number of commands executed. */
 #define STATS_METRIC_NET_INPUT 1  /* Bytes read to network .*/
 #define STATS_METRIC_NET_OUTPUT 2 /* Bytes written to network. */
-#define STATS_METRIC_COUNT 3
+#define STATS_METRIC_EXPIRED 3    /* Keys found expired by active expiry. */
+#define STATS_METRIC_COUNT 4
 
 typedef struct q_eventloop_stats {
     long long stat_numcommands;
@@ -55,6 +61,31 @@ typedef struct q_eventloop {
 
     /* Blocked clients */
     list *unblocked_clients; /* list of clients to unblock before next loop */
+
+    // read buffer shared by the clients of a worker, see
+    // worker_readQueryFromClient(). While querybuf_client is being served it
+    // has the shared buffer and this holds its own query buffer instead.
+    sds querybuf;
+    struct client *querybuf_client;
+
+    // allocator counters of the thread running this event loop, NULL until
+    // the thread is started or when the allocator doesn't keep them.
+    uint64_t *alloc_bytes;
+    uint64_t *free_bytes;
+
+    // allocator arena the thread running this event loop allocates from, -1
+    // when it uses the default ones, see q_eventloop_bind_thread().
+    int arena;
+
+    // ids of the clients with invalidations to write out, see q_tracking.c;
+    // tracking_wakeup is set while the worker was woken up and didn't serve
+    // them yet.
+    struct cds_wfcq_head tracking_head;
+    struct cds_wfcq_tail tracking_tail;
+    int tracking_wakeup;
+
+    // keys most accessed by the commands run here, see q_hotkeys.c
+    q_hotkeys hotkeys;
 } q_eventloop;
 
 int q_eventloop_init(q_eventloop *qel, int filelimit);
@@ -63,4 +94,5 @@ void trackInstantaneousMetric(int metric,
                               q_eventloop *qel,
                               long long current_reading);
 void resetEventloopStats(q_eventloop_stats *stats);
+void q_eventloop_bind_thread(q_eventloop *qel);
 #endif
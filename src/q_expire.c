@@ -0,0 +1,345 @@
+//
+// Background active expiry spread across the worker threads.
+//
+// The slow expire cycle can't run in the server thread anymore: sampling
+// random keys of a cds_lfht means walking it. Instead every worker walks its
+// own segment of each db->expires table from worker_cron(), a few entries at
+// a time and within a CPU budget, under RCU like any other reader. Expired
+// keys are collected in batches and deleted by the server thread.
+//
+
+#include "fmacros.h"
+#include <limits.h>
+#include <urcu.h>
+
+#include "q_expire.h"
+#include "q_worker.h"
+#include "server.h"
+
+void q_expireInit(q_expire_state *state)
+{
+    state->segment = 0;
+    state->segments = 0;
+    state->current_db = 0;
+    state->cursor = zcalloc(sizeof(sds) * server.dbnum);
+    state->live_cursor = zcalloc(sizeof(sds) * server.dbnum);
+    state->next_hash = zcalloc(sizeof(unsigned long) * server.dbnum);
+    state->batch = NULL;
+    state->scanned = 0;
+    state->expired = 0;
+    state->backlog = 0;
+    state->avg_ttl = 0;
+}
+
+static void expireResetCursors(q_expire_state *state)
+{
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        sdsfree(state->cursor[j]);
+        sdsfree(state->live_cursor[j]);
+        state->cursor[j] = NULL;
+        state->live_cursor[j] = NULL;
+        state->next_hash[j] = 0;
+    }
+}
+
+void q_expireDeinit(q_expire_state *state)
+{
+    int j;
+
+    if (state->cursor == NULL) {
+        return;
+    }
+    expireResetCursors(state);
+    zfree(state->cursor);
+    zfree(state->live_cursor);
+    zfree(state->next_hash);
+    state->cursor = NULL;
+    state->live_cursor = NULL;
+    state->next_hash = NULL;
+    if (state->batch) {
+        for (j = 0; j < state->batch->count; j++) {
+            sdsfree(state->batch->keys[j]);
+        }
+        zfree(state->batch);
+        state->batch = NULL;
+    }
+}
+
+// Range of reverse hashes of a segment, both ends included.
+static void expireSegmentBounds(q_expire_state *state,
+                                unsigned long *lo,
+                                unsigned long *hi)
+{
+    unsigned long width = ULONG_MAX / (unsigned long) state->segments;
+
+    *lo = width * (unsigned long) state->segment;
+    *hi = state->segment == state->segments - 1 ? ULONG_MAX : *lo + width - 1;
+}
+
+// Hand the batch being filled over to the server thread.
+static void expireFlush(q_worker *worker)
+{
+    q_expire_state *state = &worker->expire;
+    q_expire_batch *b = state->batch;
+    char buf = 'e';
+
+    if (b == NULL) {
+        return;
+    }
+    state->batch = NULL;
+    __atomic_add_fetch(&state->backlog, b->count, __ATOMIC_RELAXED);
+    cds_wfcq_enqueue(&server.expire_batches_head, &server.expire_batches_tail,
+                     &b->q_node);
+    if (write(server.socketpairs[1], &buf, 1) != 1) {
+        // serverCron drains the queue as well
+        serverLog(LL_VERBOSE,
+                  "write to server thread's socketpair[1] from worker thread "
+                  "failed.");
+    }
+}
+
+static q_expire_batch *expireGetBatch(q_worker *worker, int dbid)
+{
+    q_expire_state *state = &worker->expire;
+    q_expire_batch *b = state->batch;
+
+    if (b && (b->dbid != dbid || b->count == Q_EXPIRE_BATCH_SIZE)) {
+        expireFlush(worker);
+        b = NULL;
+    }
+    if (b == NULL) {
+        b = zmalloc(sizeof(*b));
+        b->worker = worker;
+        b->dbid = dbid;
+        b->count = 0;
+        b->ttl_sum = 0;
+        b->ttl_samples = 0;
+        cds_wfcq_node_init(&b->q_node);
+        state->batch = b;
+    }
+    return b;
+}
+
+static void expireSetCursor(sds *cursor, q_dictEntry *de)
+{
+    sdsfree(*cursor);
+    *cursor = de ? sdsdup(dictGetKey(de)) : NULL;
+}
+
+// Position 'iter' on the entry of 'key', return NULL if it's not in the
+// table anymore.
+static struct cds_lfht_node *expireLookupCursor(struct cds_lfht *table,
+                                                sds key,
+                                                struct cds_lfht_iter *iter)
+{
+    if (key == NULL) {
+        return NULL;
+    }
+    cds_lfht_lookup(table, dictSdsHash(key), q_dictSdsKeyCaseMatch, key, iter);
+    return cds_lfht_iter_get_node(iter);
+}
+
+// Check up to 'count' entries of this worker's segment of db->expires,
+// starting where the previous call stopped, and return how many of them were
+// expired. '*done' is set when the end of the segment is reached, the next
+// call then starts over. Called with rcu_read_lock held.
+static int expireScanSegment(q_worker *worker,
+                             redisDb *db,
+                             long long now,
+                             int count,
+                             int *done)
+{
+    q_expire_state *state = &worker->expire;
+    struct cds_lfht *table = rcu_dereference(db->expires->table);
+    struct cds_lfht_node *node = NULL;
+    struct cds_lfht_iter iter;
+    q_dictEntry *de, *last = NULL, *last_live = NULL;
+    unsigned long lo, hi, from;
+    int expired = 0;
+    long long ttl;
+    q_expire_batch *b;
+
+    expireSegmentBounds(state, &lo, &hi);
+    from = state->next_hash[db->id];
+    if (from < lo) {
+        from = lo;
+    }
+
+    // Resume from the last key checked, or from the last live one when the
+    // server thread already deleted it, then skip what was checked already.
+    // Without either walk from the start of the table, the entries skipped
+    // count against 'count': the walk goes on at the next call from where
+    // it stopped, instead of starting over.
+    *done = 0;
+    node = expireLookupCursor(table, state->cursor[db->id], &iter);
+    if (node == NULL) {
+        node = expireLookupCursor(table, state->live_cursor[db->id], &iter);
+    }
+    if (node == NULL) {
+        cds_lfht_first(table, &iter);
+        node = cds_lfht_iter_get_node(&iter);
+    }
+    while (node && node->reverse_hash < from) {
+        if (count-- == 0) {
+            expireSetCursor(&state->cursor[db->id],
+                            caa_container_of(node, q_dictEntry, node));
+            return 0;
+        }
+        cds_lfht_next(table, &iter);
+        node = cds_lfht_iter_get_node(&iter);
+    }
+
+    while (count-- > 0) {
+        if (node == NULL || node->reverse_hash > hi) {
+            *done = 1;
+            break;
+        }
+        de = caa_container_of(node, q_dictEntry, node);
+        ttl = dictGetSignedIntegerVal(de) - now;
+        state->scanned++;
+        if (ttl < 0) {
+            b = expireGetBatch(worker, db->id);
+            b->keys[b->count++] = sdsdup(dictGetKey(de));
+            state->expired++;
+            expired++;
+        } else {
+            b = expireGetBatch(worker, db->id);
+            b->ttl_sum += ttl;
+            b->ttl_samples++;
+            if (state->avg_ttl == 0) {
+                state->avg_ttl = ttl;
+            }
+            state->avg_ttl = (state->avg_ttl / 50) * 49 + (ttl / 50);
+            last_live = de;
+        }
+        last = de;
+        if (node->reverse_hash == ULONG_MAX) {
+            *done = 1;
+            break;
+        }
+        state->next_hash[db->id] = node->reverse_hash + 1;
+        cds_lfht_next(table, &iter);
+        node = cds_lfht_iter_get_node(&iter);
+    }
+
+    if (*done) {
+        expireSetCursor(&state->cursor[db->id], NULL);
+        expireSetCursor(&state->live_cursor[db->id], NULL);
+        state->next_hash[db->id] = lo;
+    } else {
+        if (last) {
+            expireSetCursor(&state->cursor[db->id], last);
+        }
+        if (last_live) {
+            expireSetCursor(&state->live_cursor[db->id], last_live);
+        }
+    }
+    return expired;
+}
+
+// Called by worker_cron() server.hz times per second. Like the slow cycle
+// of activeExpireCycle() it checks ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP keys
+// per db, more while many of them are found expired, and uses at most
+// ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC percent of the worker's time.
+void q_expireCycle(q_worker *worker)
+{
+    q_expire_state *state = &worker->expire;
+    int segments = __atomic_load_n(&server.threads_num, __ATOMIC_ACQUIRE);
+    long long start, timelimit, now;
+    int j, expired, done;
+
+    // Slaves wait for the DELs of their master.
+    if (!server.active_expire_enabled || server.masterhost != NULL ||
+        server.loading || worker->retiring) {
+        return;
+    }
+
+    // CONFIG SET threads_num moved the segments, start over.
+    if (state->segments != segments || state->segment != worker->id) {
+        expireResetCursors(state);
+        state->segments = segments;
+        state->segment = worker->id;
+    }
+
+    timelimit = 1000000 * ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC / worker->qel.hz /
+                100;
+    if (timelimit <= 0) {
+        timelimit = 1;
+    }
+    start = ustime();
+    now = start / 1000;
+
+    rcu_read_lock();
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db + (state->current_db % server.dbnum);
+
+        // Go on with the next db at the next call if we run out of time.
+        state->current_db++;
+        if (q_dictSize(db->expires) == 0) {
+            continue;
+        }
+        // Keys found expired stay in the table until the server thread
+        // deletes them, so a segment is walked at most once per call.
+        do {
+            expired = expireScanSegment(worker, db, now,
+                                        ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP,
+                                        &done);
+            if (ustime() - start > timelimit) {
+                goto out;
+            }
+        } while (!done && expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP / 4);
+        expireFlush(worker);
+    }
+out:
+    rcu_read_unlock();
+    expireFlush(worker);
+}
+
+// Delete the keys found expired by the workers, called by the server thread.
+// Every key is checked again: it may have been deleted, persisted or given a
+// new TTL since the worker saw it.
+void q_expireProcessBatches(void)
+{
+    struct cds_wfcq_node *qnode;
+    q_expire_batch *b;
+    q_dictEntry *de;
+    redisDb *db;
+    long long now;
+    int j;
+
+    while ((qnode = __cds_wfcq_dequeue_blocking(
+                &server.expire_batches_head, &server.expire_batches_tail))) {
+        b = caa_container_of(qnode, q_expire_batch, q_node);
+        db = server.db + b->dbid;
+        now = mstime();
+
+        for (j = 0; j < b->count; j++) {
+            // The dataset must not change while clients are paused.
+            if (server.active_expire_enabled && server.masterhost == NULL &&
+                !server.clients_paused) {
+                rcu_read_lock();
+                if ((de = q_dictFind(db->expires, b->keys[j])) != NULL) {
+                    activeExpireCycleTryExpire(db, de, now);
+                }
+                rcu_read_unlock();
+            }
+            sdsfree(b->keys[j]);
+        }
+
+        // Update the average TTL stats of the db, as activeExpireCycle()
+        // does from its own samples.
+        if (b->ttl_samples) {
+            long long avg_ttl = b->ttl_sum / b->ttl_samples;
+
+            if (db->avg_ttl == 0)
+                db->avg_ttl = avg_ttl;
+            db->avg_ttl = (db->avg_ttl / 50) * 49 + (avg_ttl / 50);
+        }
+
+        __atomic_sub_fetch(&b->worker->expire.backlog, b->count,
+                           __ATOMIC_RELAXED);
+        zfree(b);
+    }
+}
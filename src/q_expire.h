@@ -0,0 +1,52 @@
+//
+// Background active expiry spread across the worker threads.
+//
+
+#ifndef Q_REDIS_Q_EXPIRE_H
+#define Q_REDIS_Q_EXPIRE_H
+
+#include <urcu/wfcqueue.h>
+
+#include "sds.h"
+
+#define Q_EXPIRE_BATCH_SIZE 64  // expired keys sent to the server thread at once
+
+struct q_worker;
+
+// Expired keys found by a worker. The server thread deletes them, as it does
+// for every other write, so that DELs are propagated in order.
+typedef struct q_expire_batch {
+    struct q_worker *worker;
+    int dbid;
+    int count;
+    long long ttl_sum;  // TTL of the live keys checked, for db->avg_ttl
+    int ttl_samples;
+    sds keys[Q_EXPIRE_BATCH_SIZE];
+    struct cds_wfcq_node q_node;
+} q_expire_batch;
+
+// Every worker scans one segment of each db->expires table. The lfht keeps
+// its entries ordered by bit reversed hash, so a segment is a range of
+// reverse hashes and can be walked without looking at the other segments.
+typedef struct q_expire_state {
+    int segment;   // segment of the tables scanned by this worker
+    int segments;  // number of segments, one per live worker
+    int current_db;
+    sds *cursor;               // per db, last key checked
+    sds *live_cursor;          // per db, last live key checked
+    unsigned long *next_hash;  // per db, reverse hash to resume the scan at
+    q_expire_batch *batch;     // being filled, not sent yet
+
+    // read by INFO from the server thread
+    long long scanned;  // entries checked
+    long long expired;  // keys found expired
+    long long backlog;  // found expired, not handled by the server thread yet
+    long long avg_ttl;  // running average TTL of the live keys checked (ms)
+} q_expire_state;
+
+void q_expireInit(q_expire_state *state);
+void q_expireDeinit(q_expire_state *state);
+void q_expireCycle(struct q_worker *worker);
+void q_expireProcessBatches(void);
+
+#endif  // Q_REDIS_Q_EXPIRE_H
@@ -0,0 +1,315 @@
+//
+// Glob-style patterns compiled once and matched against many strings.
+//
+// stringmatchlen() interprets the pattern again for every string, and
+// backtracks on every '*'. KEYS and SCAN match one pattern against a whole
+// keyspace, so they compile it first:
+//
+// - a pattern made of literal characters only is compared with memcmp(),
+// - the literal prefix and suffix of the pattern, the characters before its
+//   first '*' and after its last one, reject most strings with a memcmp(),
+//   and a pattern like "prefix*suffix" needs nothing more,
+// - otherwise the pattern runs as an NFA of one state per character of the
+//   pattern, '*' being a state looping on itself, simulated on the bits of
+//   a word: each character of the string costs a table lookup, a shift and
+//   two ands, without ever backtracking.
+//
+// The syntax, including the quirks of the character classes, is the one of
+// stringmatchlen(), which is still used for patterns having more than 63
+// characters to match.
+//
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "q_glob.h"
+#include "util.h"
+#include "zmalloc.h"
+
+#define GLOB_MAX_STATES 63  // one bit of a word per state, plus the final one
+
+typedef enum globKind {
+    GLOB_EXACT,          // literal characters only
+    GLOB_PREFIX_SUFFIX,  // prefix*suffix, both literal
+    GLOB_NFA,
+    GLOB_INTERPRET,      // too many states: stringmatchlen()
+} globKind;
+
+struct q_glob {
+    globKind kind;
+    int nocase;
+    int matchempty;  // the empty string matches
+    char *pattern;
+    size_t patternlen;
+    char *prefix;  // literal characters before the first '*'
+    size_t prefixlen;
+    char *suffix;  // literal characters after the last '*'
+    size_t suffixlen;
+    uint64_t star;           // states looping on any character
+    uint64_t final;          // the state reached when the whole pattern matched
+    uint64_t accept[256];    // states moving to the next one on a character
+};
+
+// A pattern token: a '*', or the set of the characters a single character of
+// the string may be to match it.
+typedef struct globToken {
+    int star;
+    int literal;  // a single character, case sensitive: 'ch'
+    unsigned char ch;
+    uint64_t set[4];
+} globToken;
+
+static void setAdd(uint64_t *set, int c)
+{
+    set[c >> 6] |= 1ULL << (c & 63);
+}
+
+static int setHas(const uint64_t *set, int c)
+{
+    return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+// Whether the class starting after its '[' and optional '^' matches the
+// character 'c', exactly as stringmatchlen() evaluates it. '*consumed' is set
+// to the bytes of the pattern taken by the class, its ']' included. Returns
+// -1 for a class stringmatchlen() would read past the end of the pattern.
+static int classMatches(const char *pattern,
+                        int patternLen,
+                        char c,
+                        int nocase,
+                        int *consumed)
+{
+    const char *start = pattern;
+    int match = 0;
+
+    while (1) {
+        if (patternLen == 0) {
+            // unterminated: the class ends with the pattern
+            pattern--;
+            break;
+        } else if (pattern[0] == '\\') {
+            if (patternLen < 2)
+                return -1;
+            pattern++;
+            patternLen--;
+            if (pattern[0] == c)
+                match = 1;
+        } else if (pattern[0] == ']') {
+            break;
+        } else if (patternLen >= 3 && pattern[1] == '-') {
+            int lo = pattern[0];
+            int hi = pattern[2];
+            int ch = c;
+
+            if (lo > hi) {
+                int t = lo;
+                lo = hi;
+                hi = t;
+            }
+            if (nocase) {
+                lo = tolower(lo);
+                hi = tolower(hi);
+                ch = tolower(ch);
+            }
+            pattern += 2;
+            patternLen -= 2;
+            if (ch >= lo && ch <= hi)
+                match = 1;
+        } else if (!nocase) {
+            if (pattern[0] == c)
+                match = 1;
+        } else if (tolower((int) pattern[0]) == tolower((int) c)) {
+            match = 1;
+        }
+        pattern++;
+        patternLen--;
+    }
+    *consumed = (int) (pattern - start) + 1;
+    return match;
+}
+
+// Split the pattern in tokens, consecutive '*' folded. Returns the number of
+// tokens, or -1 if the pattern can't be compiled.
+static int globTokenize(const char *pattern,
+                        int patternLen,
+                        int nocase,
+                        globToken *tokens)
+{
+    int n = 0, c, not, consumed = 0, m;
+
+    while (patternLen > 0) {
+        globToken *t = &tokens[n];
+
+        memset(t, 0, sizeof(*t));
+        switch (pattern[0]) {
+        case '*':
+            if (n && tokens[n - 1].star) {
+                pattern++;
+                patternLen--;
+                continue;
+            }
+            t->star = 1;
+            break;
+        case '?':
+            memset(t->set, 0xff, sizeof(t->set));
+            break;
+        case '[':
+            pattern++;
+            patternLen--;
+            not = patternLen > 0 && pattern[0] == '^';
+            if (not) {
+                pattern++;
+                patternLen--;
+            }
+            for (c = 0; c < 256; c++) {
+                m = classMatches(pattern, patternLen, (char) c, nocase,
+                                 &consumed);
+                if (m == -1)
+                    return -1;
+                if (m != not)
+                    setAdd(t->set, c);
+            }
+            // leave the ']' to the common code below
+            pattern += consumed - 1;
+            patternLen -= consumed - 1;
+            break;
+        case '\\':
+            if (patternLen >= 2) {
+                pattern++;
+                patternLen--;
+            }
+            /* fall through */
+        default:
+            if (nocase) {
+                for (c = 0; c < 256; c++) {
+                    if (tolower((int) pattern[0]) == tolower((int) (char) c))
+                        setAdd(t->set, c);
+                }
+            } else {
+                t->literal = 1;
+                t->ch = (unsigned char) pattern[0];
+                setAdd(t->set, t->ch);
+            }
+            break;
+        }
+        n++;
+        pattern++;
+        patternLen--;
+    }
+    return n;
+}
+
+q_glob *q_globCompile(const char *pattern, size_t len, int nocase)
+{
+    q_glob *g = zcalloc(sizeof(*g));
+    globToken *tokens = zmalloc(sizeof(globToken) * (len + 1));
+    int n, j, c, states = 0, first = -1, last = -1, literals = 1;
+
+    g->nocase = nocase;
+    g->pattern = zmalloc(len + 1);
+    memcpy(g->pattern, pattern, len);
+    g->pattern[len] = '\0';
+    g->patternlen = len;
+    g->prefix = zmalloc(len + 1);
+    g->suffix = zmalloc(len + 1);
+
+    n = globTokenize(pattern, (int) len, nocase, tokens);
+    if (n == -1) {
+        g->kind = GLOB_INTERPRET;
+        goto done;
+    }
+
+    g->matchempty = 1;
+    for (j = 0; j < n; j++) {
+        if (tokens[j].star) {
+            if (first == -1)
+                first = j;
+            last = j;
+        } else {
+            g->matchempty = 0;
+            if (!tokens[j].literal)
+                literals = 0;
+        }
+    }
+
+    // literal prefix and suffix, around the stars
+    for (j = 0; j < n && tokens[j].literal; j++)
+        g->prefix[g->prefixlen++] = tokens[j].ch;
+    if (last != -1) {
+        for (j = last + 1; j < n && tokens[j].literal; j++)
+            g->suffix[g->suffixlen++] = tokens[j].ch;
+        if (j < n)
+            g->suffixlen = 0;
+    }
+    if (literals && first == -1) {
+        g->kind = GLOB_EXACT;
+        goto done;
+    }
+    if (literals && first == last) {
+        g->kind = GLOB_PREFIX_SUFFIX;
+        goto done;
+    }
+
+    // the NFA: state i means that the first i tokens but the stars matched
+    for (j = 0; j < n; j++) {
+        if (tokens[j].star) {
+            g->star |= 1ULL << states;
+            continue;
+        }
+        if (states == GLOB_MAX_STATES) {
+            g->kind = GLOB_INTERPRET;
+            goto done;
+        }
+        for (c = 0; c < 256; c++) {
+            if (setHas(tokens[j].set, c))
+                g->accept[c] |= 1ULL << states;
+        }
+        states++;
+    }
+    g->final = 1ULL << states;
+    g->kind = GLOB_NFA;
+
+done:
+    zfree(tokens);
+    return g;
+}
+
+void q_globFree(q_glob *g)
+{
+    if (g == NULL)
+        return;
+    zfree(g->pattern);
+    zfree(g->prefix);
+    zfree(g->suffix);
+    zfree(g);
+}
+
+int q_globMatch(const q_glob *g, const char *string, size_t len)
+{
+    const unsigned char *s = (const unsigned char *) string;
+    uint64_t state = 1;
+    size_t j;
+
+    if (g->kind == GLOB_INTERPRET)
+        return stringmatchlen(g->pattern, g->patternlen, string, len,
+                              g->nocase);
+    if (len == 0)
+        return g->matchempty;
+    if (g->kind == GLOB_EXACT)
+        return len == g->prefixlen && !memcmp(string, g->prefix, len);
+
+    if (len < g->prefixlen + g->suffixlen ||
+        memcmp(string, g->prefix, g->prefixlen) ||
+        memcmp(string + len - g->suffixlen, g->suffix, g->suffixlen))
+        return 0;
+    if (g->kind == GLOB_PREFIX_SUFFIX)
+        return 1;
+
+    for (j = 0; j < len; j++) {
+        state = ((state & g->accept[s[j]]) << 1) | (state & g->star);
+        if (state == 0)
+            return 0;
+    }
+    return (state & g->final) != 0;
+}
@@ -0,0 +1,17 @@
+//
+// Glob-style patterns compiled once and matched against many strings, see
+// q_glob.c.
+//
+
+#ifndef Q_REDIS_Q_GLOB_H
+#define Q_REDIS_Q_GLOB_H
+
+#include <stddef.h>
+
+typedef struct q_glob q_glob;
+
+q_glob *q_globCompile(const char *pattern, size_t len, int nocase);
+void q_globFree(q_glob *g);
+int q_globMatch(const q_glob *g, const char *string, size_t len);
+
+#endif  // Q_REDIS_Q_GLOB_H
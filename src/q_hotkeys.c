@@ -0,0 +1,212 @@
+//
+// Sampled hot keys detection.
+//
+// When hotkeys-sample-rate is N > 0, one in N commands having keys is sampled
+// by call() on the thread running it: worker threads for the reads, the
+// server thread for the writes. The keys of a sampled command are counted, N
+// times each, in the space-saving summary of the event loop of that thread:
+// up to Q_HOTKEYS_SLOTS keys with their counts, and when a new key comes in a
+// full summary it takes the slot of the least counted key, inheriting its
+// count. So the count of a key is an upper bound of its accesses, and a key
+// getting more than 1/Q_HOTKEYS_SLOTS of the sampled accesses of a thread is
+// always in its summary.
+//
+// HOTKEYS runs in the server thread, sums the summaries of all the threads and
+// replies with the keys having the highest counts. With the sampling off the
+// cost in call() is a single test.
+//
+
+#include <stdlib.h>
+
+#include "q_worker.h"
+#include "q_master.h"
+#include "server.h"
+
+static void hotkeysTouch(q_hotkeys *hk, sds key, unsigned long long weight)
+{
+    dictEntry *de = dictFind(hk->index, key);
+    q_hotkey *hot;
+    int j;
+
+    if (de) {
+        hot = dictGetVal(de);
+        hot->count += weight;
+        return;
+    }
+    if (hk->used < Q_HOTKEYS_SLOTS) {
+        hot = &hk->slots[hk->used++];
+        hot->count = 0;
+    } else {
+        hot = &hk->slots[0];
+        for (j = 1; j < Q_HOTKEYS_SLOTS; j++) {
+            if (hk->slots[j].count < hot->count)
+                hot = &hk->slots[j];
+        }
+        dictDelete(hk->index, hot->key);
+        sdsfree(hot->key);
+    }
+    hot->key = sdsdup(key);
+    hot->count += weight;
+    dictAdd(hk->index, hot->key, hot);
+}
+
+static void hotkeysReset(q_hotkeys *hk)
+{
+    int j;
+
+    pthread_mutex_lock(&hk->lock);
+    dictEmpty(hk->index, NULL);
+    for (j = 0; j < hk->used; j++)
+        sdsfree(hk->slots[j].key);
+    hk->used = 0;
+    pthread_mutex_unlock(&hk->lock);
+}
+
+void q_hotkeysInit(q_hotkeys *hk)
+{
+    pthread_mutex_init(&hk->lock, NULL);
+    hk->tick = 0;
+    hk->sampled = 0;
+    hk->index = dictCreate(&keyptrDictType, NULL);
+    hk->used = 0;
+}
+
+void q_hotkeysDeinit(q_hotkeys *hk)
+{
+    if (hk->index == NULL)
+        return;
+    hotkeysReset(hk);
+    dictRelease(hk->index);
+    hk->index = NULL;
+    pthread_mutex_destroy(&hk->lock);
+}
+
+// Called by call() when the sampling is enabled.
+void q_hotkeysSample(client *c)
+{
+    q_hotkeys *hk = &c->qel->hotkeys;
+    unsigned long long rate = (unsigned long long) server.hotkeys_sample_rate;
+    int *keys, numkeys, j;
+    robj *key;
+
+    if (c->cmd->firstkey == 0 && c->cmd->getkeys_proc == NULL)
+        return;
+    if (++hk->tick < rate)
+        return;
+    hk->tick = 0;
+
+    keys = getKeysFromCommand(c->cmd, c->argv, c->argc, &numkeys);
+    pthread_mutex_lock(&hk->lock);
+    for (j = 0; j < numkeys; j++) {
+        key = getDecodedObject(c->argv[keys[j]]);
+        hotkeysTouch(hk, key->ptr, rate);
+        decrRefCount(key);
+    }
+    hk->sampled++;
+    pthread_mutex_unlock(&hk->lock);
+    getKeysFreeResult(keys);
+}
+
+// The summaries of all the event loops, called in the server thread so that
+// the workers can't be resized meanwhile.
+static int hotkeysTables(q_hotkeys **tables)
+{
+    int n = 0, j;
+
+    tables[n++] = &server.qel.hotkeys;
+    tables[n++] = &master.qel.hotkeys;
+    for (j = 0; j < (int) darray_n(&workers); j++) {
+        q_worker *worker = darray_get(&workers, (uint32_t) j);
+        tables[n++] = &worker->qel.hotkeys;
+    }
+    return n;
+}
+
+unsigned long long q_hotkeysSampled(void)
+{
+    q_hotkeys *tables[darray_n(&workers) + 2];
+    unsigned long long sampled = 0;
+    int n = hotkeysTables(tables), j;
+
+    for (j = 0; j < n; j++) {
+        pthread_mutex_lock(&tables[j]->lock);
+        sampled += tables[j]->sampled;
+        pthread_mutex_unlock(&tables[j]->lock);
+    }
+    return sampled;
+}
+
+static int hotkeysCompareKeys(const void *a, const void *b)
+{
+    return sdscmp(((const q_hotkey *) a)->key, ((const q_hotkey *) b)->key);
+}
+
+static int hotkeysCompareCounts(const void *a, const void *b)
+{
+    unsigned long long ca = ((const q_hotkey *) a)->count;
+    unsigned long long cb = ((const q_hotkey *) b)->count;
+
+    return ca < cb ? 1 : (ca > cb ? -1 : 0);
+}
+
+/* HOTKEYS [COUNT <count>]
+ * HOTKEYS RESET */
+void hotkeysCommand(client *c)
+{
+    q_hotkeys *tables[darray_n(&workers) + 2];
+    int n = hotkeysTables(tables), len = 0, merged, i, j;
+    long count = Q_HOTKEYS_DEFAULT_COUNT;
+    q_hotkey *all;
+
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr, "reset")) {
+        for (j = 0; j < n; j++)
+            hotkeysReset(tables[j]);
+        addReply(c, shared.ok);
+        return;
+    } else if (c->argc == 3 && !strcasecmp(c->argv[1]->ptr, "count")) {
+        if (getLongFromObjectOrReply(c, c->argv[2], &count, NULL) != C_OK)
+            return;
+        if (count <= 0) {
+            addReplyError(c, "COUNT must be > 0");
+            return;
+        }
+    } else if (c->argc != 1) {
+        addReplyError(c, "Syntax error. Try HOTKEYS [COUNT <count>] | RESET");
+        return;
+    }
+
+    // Copy the summaries, then sum the counts of the keys sampled by more
+    // than one thread.
+    all = zmalloc(sizeof(q_hotkey) * n * Q_HOTKEYS_SLOTS);
+    for (j = 0; j < n; j++) {
+        pthread_mutex_lock(&tables[j]->lock);
+        for (i = 0; i < tables[j]->used; i++) {
+            all[len] = tables[j]->slots[i];
+            all[len].key = sdsdup(all[len].key);
+            len++;
+        }
+        pthread_mutex_unlock(&tables[j]->lock);
+    }
+    qsort(all, len, sizeof(q_hotkey), hotkeysCompareKeys);
+    for (merged = 0, j = 0; j < len; j++) {
+        if (merged && !sdscmp(all[merged - 1].key, all[j].key)) {
+            all[merged - 1].count += all[j].count;
+            sdsfree(all[j].key);
+        } else {
+            all[merged++] = all[j];
+        }
+    }
+    qsort(all, merged, sizeof(q_hotkey), hotkeysCompareCounts);
+
+    if (count > merged)
+        count = merged;
+    addReplyMultiBulkLen(c, count * 2);
+    for (j = 0; j < merged; j++) {
+        if (j < count) {
+            addReplyBulkCBuffer(c, all[j].key, sdslen(all[j].key));
+            addReplyLongLong(c, all[j].count);
+        }
+        sdsfree(all[j].key);
+    }
+    zfree(all);
+}
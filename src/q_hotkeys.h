@@ -0,0 +1,39 @@
+//
+// Sampled hot keys detection, see q_hotkeys.c.
+//
+
+#ifndef Q_REDIS_Q_HOTKEYS_H
+#define Q_REDIS_Q_HOTKEYS_H
+
+#include <pthread.h>
+
+#include "dict.h"
+#include "sds.h"
+
+#define Q_HOTKEYS_SLOTS 128       // keys counted by each thread
+#define Q_HOTKEYS_DEFAULT_COUNT 10
+
+struct client;
+
+typedef struct q_hotkey {
+    sds key;
+    unsigned long long count;  // estimated accesses, never below the real ones
+} q_hotkey;
+
+// Space-saving top-K summary of the keys accessed by the commands run on one
+// event loop. Only its thread updates it, the lock is there for HOTKEYS.
+typedef struct q_hotkeys {
+    pthread_mutex_t lock;
+    unsigned long long tick;     // commands seen since the last sample
+    unsigned long long sampled;  // commands sampled
+    dict *index;                 // key -> slot
+    int used;
+    q_hotkey slots[Q_HOTKEYS_SLOTS];
+} q_hotkeys;
+
+void q_hotkeysInit(q_hotkeys *hk);
+void q_hotkeysDeinit(q_hotkeys *hk);
+void q_hotkeysSample(struct client *c);
+unsigned long long q_hotkeysSampled(void);
+
+#endif  // Q_REDIS_Q_HOTKEYS_H
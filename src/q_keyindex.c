@@ -0,0 +1,512 @@
+//
+// Ordered index of the key names of a db, enabled with key-prefix-index.
+//
+// The index is a compressed radix tree. Every node has a label, the bytes
+// leading to it from its parent, and its children sorted by the first byte
+// of their label, so that a depth first walk visits the keys in lexicographic
+// order. Every node also counts the keys of its subtree: the keys having a
+// prefix are counted in O(prefix length), and a walk can start at the N-th
+// of them without visiting the previous ones, which is how SCAN resumes from
+// its cursor.
+//
+// The table of the db keeps the index in sync through its q_dict hooks, see
+// keyspaceDictType in db.c. They may run on the server thread, on the workers
+// expiring keys and on the apply threads of a slave, so they take the write
+// lock. SCAN, KEYS and DELPREFIX take the read lock, KEYS and DELPREFIX for
+// a chunk of keys at a time.
+//
+
+#include "fmacros.h"
+#include <pthread.h>
+#include <string.h>
+
+#include "q_keyindex.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+typedef struct q_keyIndexNode q_keyIndexNode;
+
+struct q_keyIndex {
+    pthread_rwlock_t lock;
+    q_keyIndexNode *root;  // empty label, freed with the index only
+    unsigned long nodes;
+};
+
+struct q_keyIndexNode {
+    unsigned long keys;         // keys in the subtree, this node included
+    q_keyIndexNode **children;  // sorted by the first byte of their label
+    unsigned int numchildren;
+    unsigned int iskey : 1;     // a key ends here
+    unsigned int len : 31;      // bytes of the label
+    unsigned char label[];
+};
+
+static q_keyIndexNode *nodeCreate(q_keyIndex *idx,
+                                  const unsigned char *label,
+                                  size_t len)
+{
+    q_keyIndexNode *n = zmalloc(sizeof(*n) + len);
+
+    n->keys = 0;
+    n->children = NULL;
+    n->numchildren = 0;
+    n->iskey = 0;
+    n->len = len;
+    if (label)
+        memcpy(n->label, label, len);
+    idx->nodes++;
+    return n;
+}
+
+static void nodeFree(q_keyIndex *idx, q_keyIndexNode *n)
+{
+    zfree(n->children);
+    zfree(n);
+    idx->nodes--;
+}
+
+// Position of the child of 'n' whose label starts with 'c', or where it
+// would be inserted.
+static unsigned int childPos(q_keyIndexNode *n, unsigned char c)
+{
+    unsigned int lo = 0, hi = n->numchildren, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (n->children[mid]->label[0] < c)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static q_keyIndexNode *childFind(q_keyIndexNode *n, unsigned char c)
+{
+    unsigned int pos = childPos(n, c);
+
+    if (pos < n->numchildren && n->children[pos]->label[0] == c)
+        return n->children[pos];
+    return NULL;
+}
+
+static void childAdd(q_keyIndexNode *n, q_keyIndexNode *child)
+{
+    unsigned int pos = childPos(n, child->label[0]);
+
+    n->children =
+        zrealloc(n->children, sizeof(*n->children) * (n->numchildren + 1));
+    memmove(n->children + pos + 1, n->children + pos,
+            sizeof(*n->children) * (n->numchildren - pos));
+    n->children[pos] = child;
+    n->numchildren++;
+}
+
+static void childRemove(q_keyIndexNode *n, q_keyIndexNode *child)
+{
+    unsigned int pos = childPos(n, child->label[0]);
+
+    memmove(n->children + pos, n->children + pos + 1,
+            sizeof(*n->children) * (n->numchildren - pos - 1));
+    if (--n->numchildren == 0) {
+        zfree(n->children);
+        n->children = NULL;
+    }
+}
+
+// 'new' takes the place of 'old', their labels start with the same byte.
+static void childReplace(q_keyIndexNode *n,
+                         q_keyIndexNode *old,
+                         q_keyIndexNode *new)
+{
+    n->children[childPos(n, old->label[0])] = new;
+}
+
+static size_t commonLen(const unsigned char *a,
+                        size_t alen,
+                        const unsigned char *b,
+                        size_t blen)
+{
+    size_t j = 0;
+
+    while (j < alen && j < blen && a[j] == b[j])
+        j++;
+    return j;
+}
+
+// Merge 'n', a node that is neither a key nor the root, with its only child.
+static void nodeMerge(q_keyIndex *idx,
+                      q_keyIndexNode *parent,
+                      q_keyIndexNode *n)
+{
+    q_keyIndexNode *child = n->children[0];
+    q_keyIndexNode *merged = nodeCreate(idx, NULL, n->len + child->len);
+
+    memcpy(merged->label, n->label, n->len);
+    memcpy(merged->label + n->len, child->label, child->len);
+    merged->keys = child->keys;
+    merged->iskey = child->iskey;
+    merged->children = child->children;
+    merged->numchildren = child->numchildren;
+    child->children = NULL;
+    childReplace(parent, n, merged);
+    nodeFree(idx, child);
+    nodeFree(idx, n);
+}
+
+static q_keyIndexNode *nodeFind(q_keyIndex *idx,
+                                const unsigned char *key,
+                                size_t len)
+{
+    q_keyIndexNode *n = idx->root;
+    size_t pos = 0;
+
+    while (pos < len) {
+        n = childFind(n, key[pos]);
+        if (n == NULL || n->len > len - pos ||
+            memcmp(n->label, key + pos, n->len))
+            return NULL;
+        pos += n->len;
+    }
+    return n->iskey ? n : NULL;
+}
+
+// The node whose subtree holds the keys starting with 'prefix', or NULL. The
+// prefix may end inside its label, '*base' is set to the length of the
+// prefix leading to the label.
+static q_keyIndexNode *nodeSeek(q_keyIndex *idx,
+                                const unsigned char *prefix,
+                                size_t len,
+                                size_t *base)
+{
+    q_keyIndexNode *n = idx->root;
+    size_t pos = 0, m;
+
+    *base = 0;
+    while (pos < len) {
+        n = childFind(n, prefix[pos]);
+        if (n == NULL)
+            return NULL;
+        m = commonLen(n->label, n->len, prefix + pos, len - pos);
+        if (m < n->len && pos + m < len)
+            return NULL;
+        *base = pos;
+        pos += n->len;
+    }
+    return n;
+}
+
+q_keyIndex *q_keyIndexCreate(void)
+{
+    q_keyIndex *idx = zmalloc(sizeof(*idx));
+
+    pthread_rwlock_init(&idx->lock, NULL);
+    idx->nodes = 0;
+    idx->root = nodeCreate(idx, NULL, 0);
+    return idx;
+}
+
+// Free every node but the root, without taking the lock.
+static void indexFreeNodes(q_keyIndex *idx)
+{
+    q_keyIndexNode **stack, *n;
+    unsigned long depth = 0, j;
+
+    stack = zmalloc(sizeof(*stack) * (idx->nodes + 1));
+    for (j = 0; j < idx->root->numchildren; j++)
+        stack[depth++] = idx->root->children[j];
+    while (depth) {
+        n = stack[--depth];
+        for (j = 0; j < n->numchildren; j++)
+            stack[depth++] = n->children[j];
+        nodeFree(idx, n);
+    }
+    zfree(stack);
+    zfree(idx->root->children);
+    idx->root->children = NULL;
+    idx->root->numchildren = 0;
+    idx->root->iskey = 0;
+    idx->root->keys = 0;
+}
+
+// Nobody may be using the index anymore.
+void q_keyIndexRelease(q_keyIndex *idx)
+{
+    indexFreeNodes(idx);
+    nodeFree(idx, idx->root);
+    pthread_rwlock_destroy(&idx->lock);
+    zfree(idx);
+}
+
+void q_keyIndexClear(q_keyIndex *idx)
+{
+    pthread_rwlock_wrlock(&idx->lock);
+    indexFreeNodes(idx);
+    pthread_rwlock_unlock(&idx->lock);
+}
+
+void q_keyIndexInsert(q_keyIndex *idx, const char *key, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) key;
+    q_keyIndexNode *n, *child, *mid, *rest;
+    size_t pos = 0, m;
+
+    pthread_rwlock_wrlock(&idx->lock);
+    if (nodeFind(idx, p, len))
+        goto done;
+
+    n = idx->root;
+    n->keys++;
+    while (pos < len) {
+        child = childFind(n, p[pos]);
+        if (child == NULL) {
+            child = nodeCreate(idx, p + pos, len - pos);
+            child->iskey = 1;
+            child->keys = 1;
+            childAdd(n, child);
+            goto done;
+        }
+        m = commonLen(child->label, child->len, p + pos, len - pos);
+        if (m < child->len) {
+            // split the label, 'mid' takes the part in common with the key
+            mid = nodeCreate(idx, child->label, m);
+            rest = nodeCreate(idx, child->label + m, child->len - m);
+            rest->keys = child->keys;
+            rest->iskey = child->iskey;
+            rest->children = child->children;
+            rest->numchildren = child->numchildren;
+            child->children = NULL;
+            mid->keys = child->keys;
+            childAdd(mid, rest);
+            childReplace(n, child, mid);
+            nodeFree(idx, child);
+            child = mid;
+        }
+        child->keys++;
+        n = child;
+        pos += m;
+    }
+    n->iskey = 1;
+done:
+    pthread_rwlock_unlock(&idx->lock);
+}
+
+void q_keyIndexDelete(q_keyIndex *idx, const char *key, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) key;
+    q_keyIndexNode *n, *parent = NULL, *grandparent = NULL, *child;
+    size_t pos = 0;
+
+    pthread_rwlock_wrlock(&idx->lock);
+    if (nodeFind(idx, p, len) == NULL)
+        goto done;
+
+    n = idx->root;
+    n->keys--;
+    while (pos < len) {
+        child = childFind(n, p[pos]);
+        child->keys--;
+        grandparent = parent;
+        parent = n;
+        n = child;
+        pos += child->len;
+    }
+    n->iskey = 0;
+
+    // keep the tree compressed: no leaf without a key, and no node with a
+    // single child unless it is a key
+    if (n != idx->root) {
+        if (n->numchildren == 0) {
+            childRemove(parent, n);
+            nodeFree(idx, n);
+            if (parent != idx->root && !parent->iskey &&
+                parent->numchildren == 1)
+                nodeMerge(idx, grandparent, parent);
+        } else if (n->numchildren == 1) {
+            nodeMerge(idx, parent, n);
+        }
+    }
+done:
+    pthread_rwlock_unlock(&idx->lock);
+}
+
+unsigned long q_keyIndexCount(q_keyIndex *idx, const char *prefix, size_t len)
+{
+    q_keyIndexNode *n;
+    unsigned long count;
+    size_t base;
+
+    pthread_rwlock_rdlock(&idx->lock);
+    n = nodeSeek(idx, (const unsigned char *) prefix, len, &base);
+    count = n ? n->keys : 0;
+    pthread_rwlock_unlock(&idx->lock);
+    return count;
+}
+
+typedef struct rangeFrame {
+    q_keyIndexNode *node;
+    unsigned int next;  // next child to visit
+    size_t keylen;      // length of the key leading to the node
+} rangeFrame;
+
+// Number of keys sorting before 'key', or at it with 'inclusive'.
+static unsigned long keysBelow(q_keyIndex *idx,
+                               const unsigned char *key,
+                               size_t len,
+                               int inclusive)
+{
+    q_keyIndexNode *n = idx->root, *child;
+    unsigned long below = 0;
+    unsigned int pos, j;
+    size_t at = 0, m;
+
+    while (at < len) {
+        // the key of 'n' is a proper prefix of 'key', so are the keys of
+        // the children before the one 'key' leads to
+        if (n->iskey)
+            below++;
+        pos = childPos(n, key[at]);
+        for (j = 0; j < pos; j++)
+            below += n->children[j]->keys;
+        if (pos == n->numchildren || n->children[pos]->label[0] != key[at])
+            return below;
+        child = n->children[pos];
+        m = commonLen(child->label, child->len, key + at, len - at);
+        if (m < child->len) {
+            // 'key' ends in the label, or leaves the subtree before or after
+            // its keys
+            if (at + m < len && child->label[m] < key[at + m])
+                below += child->keys;
+            return below;
+        }
+        n = child;
+        at += m;
+    }
+    return below + (inclusive && n->iskey);
+}
+
+// Walk the range of q_keyIndexRange(), under the read lock.
+static unsigned long rangeLocked(q_keyIndex *idx,
+                                 const char *prefix,
+                                 size_t len,
+                                 unsigned long skip,
+                                 unsigned long count,
+                                 q_keyIndexRangeProc *proc,
+                                 void *privdata)
+{
+    rangeFrame *stack = NULL, *f;
+    unsigned long depth = 0, alloc = 0, called = 0;
+    q_keyIndexNode *n;
+    sds key = NULL;
+    size_t base;
+
+    n = nodeSeek(idx, (const unsigned char *) prefix, len, &base);
+    if (n == NULL || skip >= n->keys)
+        goto done;
+
+    key = sdsnewlen(prefix, base);
+    key = sdscatlen(key, n->label, n->len);
+    while (1) {
+        // visit 'n', whose key is 'key', then its children
+        if (n->iskey) {
+            if (skip) {
+                skip--;
+            } else {
+                proc(privdata, key, sdslen(key));
+                called++;
+            }
+        }
+        if (depth == alloc) {
+            alloc = alloc ? alloc * 2 : 16;
+            stack = zrealloc(stack, sizeof(*stack) * alloc);
+        }
+        stack[depth].node = n;
+        stack[depth].next = 0;
+        stack[depth].keylen = sdslen(key);
+        depth++;
+
+        // the next node to visit, skipping whole subtrees when possible
+        n = NULL;
+        while (depth && (count == 0 || called < count)) {
+            f = &stack[depth - 1];
+            if (f->next == f->node->numchildren) {
+                depth--;
+                continue;
+            }
+            n = f->node->children[f->next++];
+            if (skip >= n->keys) {
+                skip -= n->keys;
+                n = NULL;
+                continue;
+            }
+            sdssetlen(key, f->keylen);
+            key = sdscatlen(key, n->label, n->len);
+            break;
+        }
+        if (n == NULL)
+            break;
+    }
+done:
+    sdsfree(key);
+    zfree(stack);
+    return called;
+}
+
+// Call 'proc' for the keys starting with 'prefix', in lexicographic order,
+// skipping the first 'skip' ones and stopping after 'count' ones, 0 meaning
+// no limit. Returns the number of keys 'proc' was called for. 'proc' runs
+// under the read lock: it can't modify the keyspace.
+unsigned long q_keyIndexRange(q_keyIndex *idx,
+                              const char *prefix,
+                              size_t len,
+                              unsigned long skip,
+                              unsigned long count,
+                              q_keyIndexRangeProc *proc,
+                              void *privdata)
+{
+    unsigned long called;
+
+    pthread_rwlock_rdlock(&idx->lock);
+    called = rangeLocked(idx, prefix, len, skip, count, proc, privdata);
+    pthread_rwlock_unlock(&idx->lock);
+    return called;
+}
+
+// As q_keyIndexRange(), starting after the key 'after', which starts with
+// 'prefix', or at the first key when it is NULL. A long range is walked by
+// chunks this way, releasing the lock between them: unlike a number of keys
+// to skip, the last key of a chunk stays a valid position while keys are
+// added and deleted, even the key itself.
+unsigned long q_keyIndexRangeAfter(q_keyIndex *idx,
+                                   const char *prefix,
+                                   size_t len,
+                                   const char *after,
+                                   size_t afterlen,
+                                   unsigned long count,
+                                   q_keyIndexRangeProc *proc,
+                                   void *privdata)
+{
+    unsigned long skip = 0, called;
+
+    pthread_rwlock_rdlock(&idx->lock);
+    if (after)
+        skip = keysBelow(idx, (const unsigned char *) after, afterlen, 1) -
+               keysBelow(idx, (const unsigned char *) prefix, len, 0);
+    called = rangeLocked(idx, prefix, len, skip, count, proc, privdata);
+    pthread_rwlock_unlock(&idx->lock);
+    return called;
+}
+
+// Length of the literal prefix of a glob-style pattern, that is of the keys
+// it can match, see stringmatchlen().
+size_t q_keyIndexPatternPrefix(const char *pattern, size_t len)
+{
+    size_t j;
+
+    for (j = 0; j < len; j++) {
+        if (pattern[j] == '*' || pattern[j] == '?' || pattern[j] == '[' ||
+            pattern[j] == '\\')
+            break;
+    }
+    return j;
+}
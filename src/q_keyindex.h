@@ -0,0 +1,38 @@
+//
+// Ordered index of the key names of a db, see q_keyindex.c.
+//
+
+#ifndef Q_REDIS_Q_KEYINDEX_H
+#define Q_REDIS_Q_KEYINDEX_H
+
+#include <stddef.h>
+
+typedef struct q_keyIndex q_keyIndex;
+
+// Called for every key of a range, under the read lock of the index.
+typedef void q_keyIndexRangeProc(void *privdata, const char *key, size_t len);
+
+q_keyIndex *q_keyIndexCreate(void);
+void q_keyIndexRelease(q_keyIndex *idx);
+void q_keyIndexClear(q_keyIndex *idx);
+void q_keyIndexInsert(q_keyIndex *idx, const char *key, size_t len);
+void q_keyIndexDelete(q_keyIndex *idx, const char *key, size_t len);
+unsigned long q_keyIndexCount(q_keyIndex *idx, const char *prefix, size_t len);
+unsigned long q_keyIndexRange(q_keyIndex *idx,
+                              const char *prefix,
+                              size_t len,
+                              unsigned long skip,
+                              unsigned long count,
+                              q_keyIndexRangeProc *proc,
+                              void *privdata);
+unsigned long q_keyIndexRangeAfter(q_keyIndex *idx,
+                                   const char *prefix,
+                                   size_t len,
+                                   const char *after,
+                                   size_t afterlen,
+                                   unsigned long count,
+                                   q_keyIndexRangeProc *proc,
+                                   void *privdata);
+size_t q_keyIndexPatternPrefix(const char *pattern, size_t len);
+
+#endif  // Q_REDIS_Q_KEYINDEX_H
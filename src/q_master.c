@@ -171,6 +171,7 @@ static void *master_thread_run(void *args)
     UNUSED(args);
 
     rcu_register_thread();
+    q_eventloop_bind_thread(&master.qel);
     aeMain(master.qel.el);
     rcu_unregister_thread();
     return NULL;
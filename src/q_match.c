@@ -0,0 +1,185 @@
+//
+// Matching of the keyspace against a pattern by a pool of threads, for KEYS.
+//
+// The thread running KEYS walks the table, which is a linked list that can't
+// be split without walking it, and hands the entries to the pool by batches
+// of Q_MATCH_BATCH_SIZE, so that reading the key names and matching them,
+// the bulk of the work, runs on keys-threads threads at once. The walking
+// thread stays in its RCU read-side critical section until every batch it
+// queued is done: the entries the pool reads can't be reclaimed meanwhile,
+// and the pool threads don't need to be RCU readers themselves.
+//
+// A thread waiting for a batch matches the queued ones meanwhile, whichever
+// command they belong to: every batch gets done even without pool threads,
+// so the pool can be resized at any time.
+//
+
+#include "fmacros.h"
+#include <signal.h>
+
+#include "q_match.h"
+#include "server.h"
+
+static pthread_mutex_t match_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t match_cond = PTHREAD_COND_INITIALIZER;
+static q_matchBatch *match_head = NULL, *match_tail = NULL;
+static int match_stop = 0;
+
+static pthread_t *match_threads = NULL;
+static int num_match_threads = 0;
+
+static q_matchBatch *matchPop(void)
+{
+    q_matchBatch *batch = match_head;
+
+    if (batch) {
+        match_head = batch->next;
+        if (match_head == NULL)
+            match_tail = NULL;
+    }
+    return batch;
+}
+
+static void matchBatch(q_matchBatch *batch)
+{
+    q_matchRun *run = batch->run;
+    int j, matched = 0;
+
+    for (j = 0; j < batch->count; j++) {
+        sds key = batch->entries[j]->key;
+
+        if (q_globMatch(run->glob, key, sdslen(key)))
+            batch->entries[matched++] = batch->entries[j];
+    }
+    batch->matched = matched;
+
+    pthread_mutex_lock(&run->lock);
+    batch->done = 1;
+    pthread_cond_broadcast(&run->cond);
+    pthread_mutex_unlock(&run->lock);
+}
+
+static void *matchThreadMain(void *arg)
+{
+    q_matchBatch *batch;
+    sigset_t sigset;
+
+    UNUSED(arg);
+
+    // Only the server thread handles the watchdog signal.
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+    while (1) {
+        pthread_mutex_lock(&match_lock);
+        while (match_head == NULL && !match_stop)
+            pthread_cond_wait(&match_cond, &match_lock);
+        batch = matchPop();
+        pthread_mutex_unlock(&match_lock);
+        if (batch == NULL)
+            break;
+        matchBatch(batch);
+    }
+    return NULL;
+}
+
+// Set the number of threads of the pool, 0 to match the keys on the thread
+// running the command.
+int q_matchResize(int count)
+{
+    int j;
+
+    if (count == num_match_threads)
+        return C_OK;
+
+    pthread_mutex_lock(&match_lock);
+    match_stop = 1;
+    pthread_cond_broadcast(&match_cond);
+    pthread_mutex_unlock(&match_lock);
+    for (j = 0; j < num_match_threads; j++)
+        pthread_join(match_threads[j], NULL);
+    zfree(match_threads);
+    match_threads = NULL;
+    __atomic_store_n(&num_match_threads, 0, __ATOMIC_RELAXED);
+    match_stop = 0;
+    if (count == 0)
+        return C_OK;
+
+    match_threads = zmalloc(sizeof(pthread_t) * count);
+    for (j = 0; j < count; j++) {
+        if (pthread_create(&match_threads[j], NULL, matchThreadMain, NULL)) {
+            serverLog(LL_WARNING, "Can't create match thread #%d: %s", j,
+                      strerror(errno));
+            __atomic_store_n(&num_match_threads, j, __ATOMIC_RELAXED);
+            q_matchResize(0);
+            return C_ERR;
+        }
+    }
+    __atomic_store_n(&num_match_threads, count, __ATOMIC_RELAXED);
+    return C_OK;
+}
+
+void q_matchRunInit(q_matchRun *run, const q_glob *glob)
+{
+    run->glob = glob;
+    pthread_mutex_init(&run->lock, NULL);
+    pthread_cond_init(&run->cond, NULL);
+}
+
+// Every batch of the run must be done.
+void q_matchRunDeinit(q_matchRun *run)
+{
+    pthread_mutex_destroy(&run->lock);
+    pthread_cond_destroy(&run->cond);
+}
+
+// Match the 'count' entries of 'batch' against the pattern of 'batch->run',
+// on a thread of the pool. See q_matchWait().
+void q_matchSubmit(q_matchBatch *batch)
+{
+    batch->done = 0;
+    batch->next = NULL;
+    if (__atomic_load_n(&num_match_threads, __ATOMIC_RELAXED) == 0) {
+        matchBatch(batch);
+        return;
+    }
+
+    pthread_mutex_lock(&match_lock);
+    if (match_tail)
+        match_tail->next = batch;
+    else
+        match_head = batch;
+    match_tail = batch;
+    pthread_cond_signal(&match_cond);
+    pthread_mutex_unlock(&match_lock);
+}
+
+// Wait for 'batch' to be matched, matching the queued batches meanwhile.
+void q_matchWait(q_matchBatch *batch)
+{
+    q_matchRun *run = batch->run;
+    q_matchBatch *queued;
+
+    while (1) {
+        pthread_mutex_lock(&run->lock);
+        if (batch->done) {
+            pthread_mutex_unlock(&run->lock);
+            return;
+        }
+        pthread_mutex_unlock(&run->lock);
+
+        pthread_mutex_lock(&match_lock);
+        queued = matchPop();
+        pthread_mutex_unlock(&match_lock);
+        if (queued == NULL)
+            break;
+        matchBatch(queued);
+    }
+
+    // being matched by another thread
+    pthread_mutex_lock(&run->lock);
+    while (!batch->done)
+        pthread_cond_wait(&run->cond, &run->lock);
+    pthread_mutex_unlock(&run->lock);
+}
@@ -0,0 +1,40 @@
+//
+// Matching of the keyspace against a pattern by a pool of threads, see
+// q_match.c.
+//
+
+#ifndef Q_REDIS_Q_MATCH_H
+#define Q_REDIS_Q_MATCH_H
+
+#include <pthread.h>
+
+#include "q_glob.h"
+
+#define Q_MATCH_BATCH_SIZE 1024  // keys matched by a thread at once
+#define Q_MATCH_INFLIGHT 16      // batches of a KEYS queued or being matched
+
+struct q_dictEntry;
+
+// The batches of one command, matched against its pattern.
+typedef struct q_matchRun {
+    const q_glob *glob;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;  // signaled when a batch of the run is done
+} q_matchRun;
+
+typedef struct q_matchBatch {
+    q_matchRun *run;
+    struct q_matchBatch *next;  // in the queue of the pool
+    int done;
+    int count;    // entries to match
+    int matched;  // the first 'matched' entries matched, in their order
+    struct q_dictEntry *entries[Q_MATCH_BATCH_SIZE];
+} q_matchBatch;
+
+int q_matchResize(int count);
+void q_matchRunInit(q_matchRun *run, const q_glob *glob);
+void q_matchRunDeinit(q_matchRun *run);
+void q_matchSubmit(q_matchBatch *batch);
+void q_matchWait(q_matchBatch *batch);
+
+#endif  // Q_REDIS_Q_MATCH_H
@@ -0,0 +1,465 @@
+//
+// Server assisted client side caching.
+//
+// A client that sent CLIENT TRACKING ON gets the names of the keys it read
+// recorded in a table of tracked keys, with the id of the connection the
+// invalidations go to: itself, or the one given with REDIRECT. When a tracked
+// key is modified, expires or is evicted, its entry is removed and every
+// recorded connection is sent the key name as a message of the
+// __redis__:invalidate Pub/Sub channel, so it only gets one message until it
+// reads the key again. Only connections subscribed to that channel can
+// receive the messages.
+//
+// Reads run in the worker threads and writes in the server thread (or in the
+// apply threads of a slave), so the table is split in Q_TRACKING_STRIPES
+// dicts, each with its own lock. Key names are tracked regardless of the db.
+//
+// The thread that invalidates a key doesn't own the connections it notifies.
+// It queues the message in the inbox of the connection, then the connection
+// id to the event loop currently owning it, waking up that worker. The owner
+// writes the messages out. A connection moving between threads when notified
+// is served by the thread it lands on, see q_trackingClientArrived().
+//
+
+#include "fmacros.h"
+#include <urcu.h>
+
+#include "q_tracking.h"
+#include "q_worker.h"
+#include "server.h"
+
+typedef struct tracking_stripe {
+    pthread_mutex_t lock;
+    dict *keys;  // key name -> intset of the ids of the connections to notify
+} tracking_stripe;
+
+static tracking_stripe stripes[Q_TRACKING_STRIPES];
+static unsigned long long total_keys = 0;
+static int tracking_clients = 0;
+static int evict_stripe = 0;  // next stripe q_trackingCron() evicts from
+
+// Connections subscribed to __redis__:invalidate, by id. A connection is
+// only freed by its owner after leaving the dict, so whoever finds it here
+// can queue messages to it while holding targets_lock.
+static pthread_mutex_t targets_lock = PTHREAD_MUTEX_INITIALIZER;
+static dict *targets;
+
+static uint64_t trackingKeyHash(const void *key)
+{
+    return dictGenHashFunction(key, (int) sdslen((sds) key));
+}
+
+static int trackingKeyCompare(void *privdata, const void *key1,
+                              const void *key2)
+{
+    size_t l1 = sdslen((sds) key1), l2 = sdslen((sds) key2);
+
+    UNUSED(privdata);
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+static void trackingKeyDestructor(void *privdata, void *key)
+{
+    UNUSED(privdata);
+    sdsfree(key);
+}
+
+static void trackingIdsDestructor(void *privdata, void *ids)
+{
+    UNUSED(privdata);
+    zfree(ids);
+}
+
+static uint64_t trackingIdHash(const void *key)
+{
+    uint64_t id = (uintptr_t) key;
+
+    return dictGenHashFunction(&id, sizeof(id));
+}
+
+static dictType trackingKeysDictType = {
+    trackingKeyHash,       /* hash function */
+    NULL,                  /* key dup */
+    NULL,                  /* val dup */
+    trackingKeyCompare,    /* key compare */
+    trackingKeyDestructor, /* key destructor */
+    trackingIdsDestructor  /* val destructor */
+};
+
+// ids are stored as the keys themselves
+static dictType trackingTargetsDictType = {
+    trackingIdHash, /* hash function */
+    NULL,           /* key dup */
+    NULL,           /* val dup */
+    NULL,           /* key compare */
+    NULL,           /* key destructor */
+    NULL            /* val destructor */
+};
+
+void q_trackingInit(void)
+{
+    int j;
+
+    for (j = 0; j < Q_TRACKING_STRIPES; j++) {
+        pthread_mutex_init(&stripes[j].lock, NULL);
+        stripes[j].keys = dictCreate(&trackingKeysDictType, NULL);
+    }
+    targets = dictCreate(&trackingTargetsDictType, NULL);
+}
+
+// The stripes use the high bits of the hash, the dicts the low ones.
+static tracking_stripe *trackingStripe(sds key)
+{
+    uint64_t h = trackingKeyHash(key);
+
+    return &stripes[(h >> 56) & (Q_TRACKING_STRIPES - 1)];
+}
+
+void q_trackingInitClient(client *c)
+{
+    c->client_tracking_redirection = 0;
+    c->tracking_target = 0;
+    c->tracking_notified = 0;
+    cds_wfcq_init(&c->tracking_head, &c->tracking_tail);
+}
+
+void q_trackingFreeClient(client *c)
+{
+    struct cds_wfcq_node *qnode;
+    q_tracking_msg *msg;
+
+    q_trackingDisable(c);
+    q_trackingUnsubscribed(c);
+    // nothing can be queued anymore
+    while ((qnode = __cds_wfcq_dequeue_blocking(&c->tracking_head,
+                                                &c->tracking_tail))) {
+        msg = caa_container_of(qnode, q_tracking_msg, q_node);
+        sdsfree(msg->key);
+        zfree(msg);
+    }
+}
+
+void q_trackingEnable(client *c, uint64_t redirect)
+{
+    if (!(c->flags & CLIENT_TRACKING)) {
+        __atomic_add_fetch(&tracking_clients, 1, __ATOMIC_RELAXED);
+    }
+    c->flags |= CLIENT_TRACKING;
+    c->client_tracking_redirection = redirect;
+}
+
+// The keys already recorded stay in the table until they are invalidated.
+void q_trackingDisable(client *c)
+{
+    if (c->flags & CLIENT_TRACKING) {
+        __atomic_sub_fetch(&tracking_clients, 1, __ATOMIC_RELAXED);
+    }
+    c->flags &= ~CLIENT_TRACKING;
+    c->client_tracking_redirection = 0;
+}
+
+int q_trackingTargetExists(uint64_t id)
+{
+    int found;
+
+    pthread_mutex_lock(&targets_lock);
+    found = dictFind(targets, (void *) (uintptr_t) id) != NULL;
+    pthread_mutex_unlock(&targets_lock);
+    return found;
+}
+
+// Called by the server thread when the client subscribes to
+// __redis__:invalidate.
+void q_trackingSubscribed(client *c)
+{
+    if (c->tracking_target) {
+        return;
+    }
+    pthread_mutex_lock(&targets_lock);
+    dictAdd(targets, (void *) (uintptr_t) c->id, c);
+    pthread_mutex_unlock(&targets_lock);
+    c->tracking_target = 1;
+}
+
+void q_trackingUnsubscribed(client *c)
+{
+    if (!c->tracking_target) {
+        return;
+    }
+    pthread_mutex_lock(&targets_lock);
+    dictDelete(targets, (void *) (uintptr_t) c->id);
+    pthread_mutex_unlock(&targets_lock);
+    c->tracking_target = 0;
+}
+
+static void trackingRememberKey(sds key, uint64_t id)
+{
+    tracking_stripe *s = trackingStripe(key);
+    dictEntry *de;
+    uint8_t added;
+
+    pthread_mutex_lock(&s->lock);
+    if ((de = dictFind(s->keys, key)) == NULL) {
+        de = dictAddRaw(s->keys, sdsdup(key));
+        dictSetVal(s->keys, de, intsetNew());
+        __atomic_add_fetch(&total_keys, 1, __ATOMIC_RELAXED);
+    }
+    dictSetVal(s->keys, de, intsetAdd(dictGetVal(de), (int64_t) id, &added));
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Called by call() before a read only command of a tracking client runs, so
+// that a write racing with the read from another thread is notified.
+void q_trackingRememberKeys(client *c)
+{
+    uint64_t id = c->client_tracking_redirection;
+    int *keys, numkeys, j;
+    robj *key;
+
+    if (id == 0) {
+        id = c->id;
+    }
+    keys = getKeysFromCommand(c->cmd, c->argv, c->argc, &numkeys);
+    for (j = 0; j < numkeys; j++) {
+        key = getDecodedObject(c->argv[keys[j]]);
+        trackingRememberKey(key->ptr, id);
+        decrRefCount(key);
+    }
+    getKeysFreeResult(keys);
+}
+
+// Queue an invalidation to a connection and make sure its owner is told,
+// called with targets_lock held.
+static void trackingEnqueue(client *c, sds key)
+{
+    q_tracking_msg *msg = zmalloc(sizeof(*msg));
+    q_tracking_notify *n;
+    q_eventloop *qel;
+    q_worker *worker = NULL;
+    int idx;
+
+    msg->key = key ? sdsdup(key) : NULL;
+    cds_wfcq_node_init(&msg->q_node);
+    cds_wfcq_enqueue(&c->tracking_head, &c->tracking_tail, &msg->q_node);
+
+    // Already told and not served yet: the owner will find this one too.
+    if (__atomic_exchange_n(&c->tracking_notified, 1, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    idx = __atomic_load_n(&c->curidx, __ATOMIC_RELAXED);
+    if (idx < 0) {
+        qel = &server.qel;
+    } else {
+        worker = darray_get(&workers, (uint32_t) idx);
+        qel = &worker->qel;
+    }
+    n = zmalloc(sizeof(*n));
+    n->id = c->id;
+    cds_wfcq_node_init(&n->q_node);
+    cds_wfcq_enqueue(&qel->tracking_head, &qel->tracking_tail, &n->q_node);
+
+    // The server thread serves its queue before sleeping, and keys are only
+    // modified on its behalf.
+    if (worker &&
+        !__atomic_exchange_n(&qel->tracking_wakeup, 1, __ATOMIC_SEQ_CST)) {
+        if (write(worker->socketpairs[0], "i", 1) != 1) {
+            serverLog(LL_WARNING, "Notice the worker failed.");
+        }
+    }
+}
+
+static void trackingSend(intset *ids, sds key)
+{
+    uint32_t j;
+    int64_t id;
+    client *c;
+
+    pthread_mutex_lock(&targets_lock);
+    for (j = 0; j < intsetLen(ids); j++) {
+        intsetGet(ids, j, &id);
+        if ((c = dictFetchValue(targets, (void *) (uintptr_t) id)) != NULL) {
+            trackingEnqueue(c, key);
+        }
+    }
+    pthread_mutex_unlock(&targets_lock);
+}
+
+// Remove the entry of a key, the caller holds the lock of its stripe and
+// gets the ids to notify.
+static intset *trackingUnlinkKey(tracking_stripe *s, dictEntry *de)
+{
+    intset *ids = dictGetVal(de);
+
+    dictSetVal(s->keys, de, NULL);
+    dictDelete(s->keys, dictGetKey(de));
+    __atomic_sub_fetch(&total_keys, 1, __ATOMIC_RELAXED);
+    return ids;
+}
+
+// Called every time a key is modified, expired or evicted, from the server
+// thread or from an apply thread.
+void q_trackingInvalidateKey(robj *keyobj)
+{
+    tracking_stripe *s;
+    dictEntry *de;
+    intset *ids;
+    robj *key;
+
+    if (__atomic_load_n(&total_keys, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    key = getDecodedObject(keyobj);
+    s = trackingStripe(key->ptr);
+    pthread_mutex_lock(&s->lock);
+    if ((de = dictFind(s->keys, key->ptr)) == NULL) {
+        pthread_mutex_unlock(&s->lock);
+        decrRefCount(key);
+        return;
+    }
+    ids = trackingUnlinkKey(s, de);
+    pthread_mutex_unlock(&s->lock);
+
+    trackingSend(ids, key->ptr);
+    zfree(ids);
+    decrRefCount(key);
+}
+
+// FLUSHDB and FLUSHALL forget every tracked key and send a null invalidation
+// to all the subscribers of __redis__:invalidate.
+void q_trackingInvalidateKeysOnFlush(void)
+{
+    tracking_stripe *s;
+    dictIterator *di;
+    dictEntry *de;
+    unsigned long removed;
+    int j;
+
+    if (__atomic_load_n(&total_keys, __ATOMIC_RELAXED)) {
+        for (j = 0; j < Q_TRACKING_STRIPES; j++) {
+            s = &stripes[j];
+            pthread_mutex_lock(&s->lock);
+            removed = dictSize(s->keys);
+            dictEmpty(s->keys, NULL);
+            __atomic_sub_fetch(&total_keys, removed, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+
+    pthread_mutex_lock(&targets_lock);
+    di = dictGetIterator(targets);
+    while ((de = dictNext(di)) != NULL) {
+        trackingEnqueue(dictGetVal(de), NULL);
+    }
+    dictReleaseIterator(di);
+    pthread_mutex_unlock(&targets_lock);
+}
+
+static void trackingReply(client *c, sds key)
+{
+    addReply(c, shared.mbulkhdr[3]);
+    addReply(c, shared.messagebulk);
+    addReplyBulkCBuffer(c, Q_TRACKING_CHANNEL, strlen(Q_TRACKING_CHANNEL));
+    if (key) {
+        addReplyMultiBulkLen(c, 1);
+        addReplyBulkCBuffer(c, key, sdslen(key));
+    } else {
+        addReply(c, shared.nullmultibulk);
+    }
+}
+
+// Write out the inbox of a connection, called by its owner.
+static void trackingServeClient(client *c)
+{
+    struct cds_wfcq_node *qnode;
+    q_tracking_msg *msg;
+
+    // Pairs with the exchange of trackingEnqueue(): a message queued after
+    // this is either seen below, or notified to the current c->curidx.
+    __atomic_exchange_n(&c->tracking_notified, 0, __ATOMIC_SEQ_CST);
+    while ((qnode = __cds_wfcq_dequeue_blocking(&c->tracking_head,
+                                                &c->tracking_tail))) {
+        msg = caa_container_of(qnode, q_tracking_msg, q_node);
+        trackingReply(c, msg->key);
+        sdsfree(msg->key);
+        zfree(msg);
+    }
+}
+
+// Serve the connections notified to an event loop, from its own thread.
+// The ones it doesn't own anymore are served where they went.
+void q_trackingServe(q_eventloop *qel)
+{
+    struct cds_wfcq_node *qnode;
+    q_tracking_notify *n;
+    client *c;
+    int owned;
+
+    __atomic_store_n(&qel->tracking_wakeup, 0, __ATOMIC_SEQ_CST);
+    while ((qnode = __cds_wfcq_dequeue_blocking(&qel->tracking_head,
+                                                &qel->tracking_tail))) {
+        n = caa_container_of(qnode, q_tracking_notify, q_node);
+        pthread_mutex_lock(&targets_lock);
+        c = dictFetchValue(targets, (void *) (uintptr_t) n->id);
+        owned = c && __atomic_load_n(&c->qel, __ATOMIC_RELAXED) == qel;
+        pthread_mutex_unlock(&targets_lock);
+        zfree(n);
+        if (owned) {
+            trackingServeClient(c);
+        }
+    }
+}
+
+// Called by the thread a connection was just handed to, once c->curidx
+// names it.
+void q_trackingClientArrived(client *c)
+{
+    if (c->tracking_target) {
+        trackingServeClient(c);
+    }
+}
+
+// Evict keys when the table is over tracking-table-max-keys, notifying the
+// connections that may cache them. Called by serverCron().
+void q_trackingCron(void)
+{
+    unsigned long long max = (unsigned long long) server.tracking_table_max_keys;
+    tracking_stripe *s;
+    dictEntry *de;
+    intset *ids;
+    sds key;
+    int tries;
+
+    if (max == 0) {
+        return;
+    }
+    for (tries = 0; tries < Q_TRACKING_EVICT_MAX &&
+                    __atomic_load_n(&total_keys, __ATOMIC_RELAXED) > max;
+         tries++) {
+        s = &stripes[evict_stripe];
+        evict_stripe = (evict_stripe + 1) % Q_TRACKING_STRIPES;
+
+        pthread_mutex_lock(&s->lock);
+        if ((de = dictGetRandomKey(s->keys)) == NULL) {
+            pthread_mutex_unlock(&s->lock);
+            continue;
+        }
+        key = sdsdup(dictGetKey(de));
+        ids = trackingUnlinkKey(s, de);
+        pthread_mutex_unlock(&s->lock);
+
+        trackingSend(ids, key);
+        zfree(ids);
+        sdsfree(key);
+    }
+}
+
+unsigned long long q_trackingTotalKeys(void)
+{
+    return __atomic_load_n(&total_keys, __ATOMIC_RELAXED);
+}
+
+int q_trackingClients(void)
+{
+    return __atomic_load_n(&tracking_clients, __ATOMIC_RELAXED);
+}
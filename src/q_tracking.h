@@ -0,0 +1,54 @@
+//
+// Server assisted client side caching, see q_tracking.c.
+//
+
+#ifndef Q_REDIS_Q_TRACKING_H
+#define Q_REDIS_Q_TRACKING_H
+
+#include <stdint.h>
+#include <urcu/wfcqueue.h>
+
+#include "sds.h"
+
+#define Q_TRACKING_CHANNEL "__redis__:invalidate"
+#define Q_TRACKING_STRIPES 256     // locks over the table of tracked keys
+#define Q_TRACKING_EVICT_MAX 1000  // keys evicted per q_trackingCron() call
+
+struct client;
+struct q_eventloop;
+struct redisObject;
+
+// An invalidation waiting in the inbox of the client it is sent to, key is
+// NULL when the whole keyspace was flushed.
+typedef struct q_tracking_msg {
+    sds key;
+    struct cds_wfcq_node q_node;
+} q_tracking_msg;
+
+// Asks the event loop owning a client to serve its inbox.
+typedef struct q_tracking_notify {
+    uint64_t id;
+    struct cds_wfcq_node q_node;
+} q_tracking_notify;
+
+void q_trackingInit(void);
+void q_trackingInitClient(struct client *c);
+void q_trackingFreeClient(struct client *c);
+void q_trackingEnable(struct client *c, uint64_t redirect);
+void q_trackingDisable(struct client *c);
+int q_trackingTargetExists(uint64_t id);
+void q_trackingSubscribed(struct client *c);
+void q_trackingUnsubscribed(struct client *c);
+
+void q_trackingRememberKeys(struct client *c);
+void q_trackingInvalidateKey(struct redisObject *key);
+void q_trackingInvalidateKeysOnFlush(void);
+
+void q_trackingServe(struct q_eventloop *qel);
+void q_trackingClientArrived(struct client *c);
+void q_trackingCron(void);
+
+unsigned long long q_trackingTotalKeys(void);
+int q_trackingClients(void);
+
+#endif  // Q_REDIS_Q_TRACKING_H
@@ -16,6 +16,8 @@
 /* Which thread we assigned a connection to most recently. */
 static int last_worker_thread = -1;
 static int num_worker_threads;
+// workers removed by q_workers_resize() whose thread is not reaped yet
+static int num_retiring_workers;
 struct darray workers;
 
 static void *worker_thread_run(void *args);
@@ -76,6 +78,8 @@ void q_worker_init_stats(q_worker_stats *stats)
     stats->bib = 0;
     stats->connected_clients = 0;
     stats->lol = 0;
+    stats->querybuf_bytes = 0;
+    stats->reply_bytes = 0;
 }
 
 int q_worker_init(q_worker *worker)
@@ -90,6 +94,10 @@ int q_worker_init(q_worker *worker)
     worker->id = 0;
     worker->socketpairs[0] = -1;
     worker->socketpairs[1] = -1;
+    worker->call_rcu_data = NULL;
+    worker->retiring = 0;
+    worker->exited = 0;
+    q_expireInit(&worker->expire);
     cds_wfcq_init(&worker->q_head, &worker->q_tail);
     cds_wfcq_init(&worker->r_head, &worker->r_tail);
 
@@ -128,6 +136,67 @@ int q_worker_init(q_worker *worker)
     return C_OK;
 }
 
+// Hand the clients of a retiring worker over to the remaining workers, the
+// same way the server thread sends a client back after running its command,
+// pending replies included. Clients in the middle of a request stay until
+// they are done, or are closed once the worker has been retiring for
+// Q_WORKER_RETIRE_TIMEOUT ms, so that a client that never stops in between
+// two requests can't keep the worker, and every later resize, forever. Once
+// the worker owns nothing it leaves its event loop.
+static void worker_retire(q_worker *worker)
+{
+    q_eventloop *qel = &worker->qel;
+    int live = __atomic_load_n(&server.threads_num, __ATOMIC_ACQUIRE);
+    int timedout = mstime() > worker->retire_deadline, closed = 0;
+    struct connswapunit *su;
+    q_worker *target;
+    listNode *ln;
+    listIter li;
+    client *c;
+    char buf = 'b';
+
+    listRewind(qel->clients, &li);
+    while ((ln = listNext(&li)) != NULL) {
+        c = listNodeValue(ln);
+        if (c->flags & CLIENT_CLOSE_ASAP) {
+            continue;
+        }
+        if (c->flags & CLIENT_BLOCKED || c->argc || c->multibulklen) {
+            if (timedout) {
+                freeClientAsync(c);
+                closed++;
+            }
+            continue;
+        }
+        su = csui_new();
+        if (su == NULL) {
+            break;
+        }
+
+        target = darray_get(&workers, (uint32_t) (c->id % live));
+        unlinkClientFromEventloop(c);
+        su->num = target->id;
+        rcu_assign_pointer(su->data, c);
+        csul_server_push(target, su);
+        if (write(target->socketpairs[0], &buf, 1) != 1) {
+            serverLog(LL_WARNING, "Notice the worker failed.");
+        }
+    }
+    if (closed) {
+        serverLog(LL_WARNING,
+                  "Closing %d clients of the stopping worker thread %d, "
+                  "still in the middle of a request after %d ms",
+                  closed, worker->id, Q_WORKER_RETIRE_TIMEOUT);
+        freeClientsInAsyncFreeQueue(qel);
+    }
+
+    if (listLength(qel->clients) == 0 &&
+        listLength(qel->clients_to_close) == 0 &&
+        cds_wfcq_empty(&worker->q_head, &worker->q_tail) &&
+        cds_wfcq_empty(&worker->r_head, &worker->r_tail)) {
+        aeStop(qel->el);
+    }
+}
 
 // worker threads to master/server thread communication handler function
 static void worker_thread_event_process(aeEventLoop *el,
@@ -247,6 +316,9 @@ static void worker_thread_event_process(aeEventLoop *el,
             }
         }
 
+        // invalidations queued while the client was away
+        q_trackingClientArrived(c);
+
         if (sdslen(c->querybuf) > 0) {
             // if we still have command to be processed inside querybuf, process
             // it first.
@@ -262,6 +334,14 @@ static void worker_thread_event_process(aeEventLoop *el,
             }
         }
 
+        break;
+    case 'q':
+        // removed from the pool by q_workers_resize()
+        worker_retire(worker);
+        break;
+    case 'i':
+        // invalidations of client side caching, see q_tracking.c
+        q_trackingServe(&worker->qel);
         break;
     default:
         serverLog(LL_WARNING,
@@ -310,10 +390,29 @@ int worker_cron(struct aeEventLoop *eventLoop, long long id, void *clientData)
                                  qel->stats.stat_net_input_bytes);
         trackInstantaneousMetric(STATS_METRIC_NET_OUTPUT, qel,
                                  qel->stats.stat_net_output_bytes);
+        trackInstantaneousMetric(STATS_METRIC_EXPIRED, qel,
+                                 worker->expire.expired);
     }
 
     freeClientsInAsyncFreeQueue(&worker->qel);
 
+    // timeouts and query buffers shrinking, as clientsCron() does for the
+    // clients of the server thread
+    clientsCronList(qel->clients, qel->hz);
+
+    q_expireCycle(worker);
+
+    // the allocator only returns the decayed pages of an arena when it is
+    // used, don't keep them when the worker is idle
+    worker_run_with_period(1000)
+    {
+        zmalloc_arena_decay(qel->arena);
+    }
+
+    if (worker->retiring) {
+        worker_retire(worker);
+    }
+
     // to collect stats for info Command
     // if (!(cron_loops%((5000)/(1000/worker->qel.hz)))) {
     worker_run_with_period(5000)
@@ -321,6 +420,7 @@ int worker_cron(struct aeEventLoop *eventLoop, long long id, void *clientData)
         client *c;
         listNode *ln;
         listIter li;
+        unsigned long querybuf_bytes = 0, reply_bytes = 0;
         listRewind(worker->qel.clients, &li);
         while ((ln = listNext(&li)) != NULL) {
             c = listNodeValue(ln);
@@ -330,7 +430,14 @@ int worker_cron(struct aeEventLoop *eventLoop, long long id, void *clientData)
             if (sdslen(c->querybuf) > worker->stats.bib) {
                 worker->stats.bib = sdslen(c->querybuf);
             }
+            querybuf_bytes += sdsAllocSize(c->querybuf);
+            reply_bytes += getClientOutputBufferMemoryUsage(c);
         }
+        if (qel->querybuf) {
+            querybuf_bytes += sdsAllocSize(qel->querybuf);
+        }
+        worker->stats.querybuf_bytes = querybuf_bytes;
+        worker->stats.reply_bytes = reply_bytes;
         worker->stats.connected_clients = listLength(worker->qel.clients);
     }
 
@@ -370,27 +477,45 @@ static void *worker_thread_run(void *args)
     q_worker *worker = args;
 
     rcu_register_thread();
+    q_eventloop_bind_thread(&worker->qel);
+    worker->call_rcu_data = create_call_rcu_data(0, -1);
+    set_thread_call_rcu_data(worker->call_rcu_data);
     /* vire worker run */
     aeMain(worker->qel.el);
+    set_thread_call_rcu_data(NULL);
+    call_rcu_data_free(worker->call_rcu_data);
+    worker->call_rcu_data = NULL;
     rcu_unregister_thread();
+    __atomic_store_n(&worker->exited, 1, __ATOMIC_RELEASE);
     return NULL;
 }
 
+static q_worker *q_worker_create(uint32_t idx)
+{
+    q_worker *worker;
+
+    worker = darray_push(&workers);
+    if (q_worker_init(worker) != C_OK) {
+        return NULL;
+    }
+    worker->id = idx;
+    worker->qel.id = idx;
+    if (setup_worker(worker) != C_OK) {
+        return NULL;
+    }
+    return worker;
+}
+
 int q_workers_init(uint32_t worker_count)
 {
-    int status;
     uint32_t idx;
-    q_worker *worker;
 
-    darray_init(&workers, worker_count, sizeof(q_worker));
+    // The master and the server thread keep pointers into the array, so it
+    // is allocated once for the largest pool q_workers_resize() may create.
+    darray_init(&workers, CONFIG_MAX_THREADS_NUM, sizeof(q_worker));
 
     for (idx = 0; idx < worker_count; idx++) {
-        worker = darray_push(&workers);
-        q_worker_init(worker);
-        worker->id = idx;
-        worker->qel.id = idx;
-        status = setup_worker(worker);
-        if (status != C_OK) {
+        if (q_worker_create(idx) == NULL) {
             exit(1);
         }
     }
@@ -407,6 +532,7 @@ void q_worker_deinit(q_worker *worker)
     }
 
     q_eventloop_deinit(&worker->qel);
+    q_expireDeinit(&worker->expire);
 
     if (worker->socketpairs[0] > 0) {
         close(worker->socketpairs[0]);
@@ -437,11 +563,15 @@ int cpu_count()
     return CPU_COUNT(&cpuset);
 }
 
+static int worker_cpu(uint32_t i)
+{
+    return ((i + 2) / 2) % cpu_count();
+}
+
 int q_workers_run(void)
 {
     uint32_t i, thread_count;
     q_worker *worker;
-    int cpu_num = cpu_count();
 
     thread_count = (uint32_t) num_worker_threads;
     serverLog(LL_NOTICE, "fn: q_workers_run, start %d worker thread",
@@ -449,12 +579,86 @@ int q_workers_run(void)
 
     for (i = 0; i < thread_count; i++) {
         worker = darray_get(&workers, i);
-        q_thread_start(&worker->qel.thread, ((i + 2) / 2) % cpu_num);
+        q_thread_start(&worker->qel.thread, worker_cpu(i));
     }
 
     return C_OK;
 }
 
+// Change the number of worker threads at runtime, called from the server
+// thread by CONFIG SET threads_num. New workers get new connections right
+// away. Removed workers, always the ones with the highest ids, stop getting
+// new connections, migrate their clients to the remaining workers and exit;
+// q_workers_cron() reaps them. Returns C_ERR while a previous shrink is still
+// draining.
+int q_workers_resize(int count)
+{
+    int idx, cur = server.threads_num;
+    q_worker *worker;
+    char buf = 'q';
+
+    if (num_retiring_workers) {
+        return C_ERR;
+    }
+
+    if (count > cur) {
+        for (idx = cur; idx < count; idx++) {
+            worker = q_worker_create((uint32_t) idx);
+            if (worker == NULL) {
+                serverPanic("Can't create worker thread.");
+            }
+            q_thread_start(&worker->qel.thread, worker_cpu((uint32_t) idx));
+        }
+        num_worker_threads = count;
+        __atomic_store_n(&server.threads_num, count, __ATOMIC_RELEASE);
+        serverLog(LL_NOTICE, "Started %d worker threads, %d running",
+                  count - cur, count);
+    } else if (count < cur) {
+        __atomic_store_n(&server.threads_num, count, __ATOMIC_RELEASE);
+        // dispatch_conn_new() reads threads_num inside a read-side critical
+        // section: after this no new connection can reach a removed worker.
+        synchronize_rcu();
+        for (idx = count; idx < cur; idx++) {
+            worker = darray_get(&workers, (uint32_t) idx);
+            worker->retire_deadline = mstime() + Q_WORKER_RETIRE_TIMEOUT;
+            worker->retiring = 1;
+            if (write(worker->socketpairs[0], &buf, 1) != 1) {
+                serverLog(LL_WARNING, "Notice the worker failed.");
+            }
+        }
+        num_retiring_workers = cur - count;
+        serverLog(LL_NOTICE, "Stopping %d worker threads, %d running",
+                  cur - count, count);
+    }
+
+    return C_OK;
+}
+
+int q_workers_resizing(void)
+{
+    return num_retiring_workers != 0;
+}
+
+// Reap the removed workers once their threads are gone, called by serverCron.
+void q_workers_cron(void)
+{
+    q_worker *worker;
+
+    // the expired keys batches still queued point to their worker
+    q_expireProcessBatches();
+    while (num_retiring_workers) {
+        worker = darray_top(&workers);
+        if (!__atomic_load_n(&worker->exited, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        pthread_join(worker->qel.thread.thread_id, NULL);
+        q_worker_deinit(worker);
+        darray_pop(&workers);
+        num_retiring_workers--;
+    }
+    num_worker_threads = (int) darray_n(&workers);
+}
+
 
 // server main thread will create worker and master thread,
 // main thread will enter it's own eventloop, so there is no need
@@ -488,7 +692,10 @@ void dispatch_conn_new(int sd)
         return;
     }
 
-    int tid = (last_worker_thread + 1) % server.threads_num;
+    // q_workers_resize() waits for this section before retiring workers
+    rcu_read_lock();
+    int tid = (last_worker_thread + 1) %
+              __atomic_load_n(&server.threads_num, __ATOMIC_ACQUIRE);
     worker = darray_get(&workers, (uint32_t) tid);
     last_worker_thread = tid;
 
@@ -501,6 +708,7 @@ void dispatch_conn_new(int sd)
     if (write(worker->socketpairs[0], &buf, 1) != 1) {
         serverLog(LL_WARNING, "Notice the worker failed.");
     }
+    rcu_read_unlock();
 }
 
 /* dispatch new connection client to worker's eventloop. */
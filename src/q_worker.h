@@ -11,11 +11,17 @@
 #include "ae.h"
 #include "darray.h"
 #include "q_eventloop.h"
+#include "q_expire.h"
+
+// ms a removed worker waits for its clients to finish their request
+#define Q_WORKER_RETIRE_TIMEOUT 5000
 
 typedef struct q_worker_stats {
     unsigned long lol;  // longest output_list
     unsigned long bib;  // biggest_input_buffer
     unsigned long connected_clients;
+    unsigned long querybuf_bytes;  // query buffers of all the clients
+    unsigned long reply_bytes;     // output buffers of all the clients
     // long long stat_net_input_bytes;
 } q_worker_stats;
 
@@ -34,6 +40,16 @@ typedef struct q_worker {
     struct cds_wfcq_tail q_tail;
     struct cds_wfcq_head q_head;
 
+    // reclaims the call_rcu() callbacks queued by this worker (expired keys)
+    struct call_rcu_data *call_rcu_data;
+
+    // set by q_workers_resize() when the worker is being removed, it then
+    // hands its clients to the remaining workers and leaves its event loop.
+    int retiring;
+    long long retire_deadline;  // mstime() its busy clients are closed at
+    int exited;  // worker thread returned, ready to be joined and freed
+
+    q_expire_state expire;  // background active expiry
     q_worker_stats stats;
 } q_worker;
 
@@ -57,6 +73,9 @@ int q_workers_init(uint32_t worker_count);
 int q_workers_run(void);
 int q_workers_wait(void);
 void q_workers_deinit(void);
+int q_workers_resize(int count);
+int q_workers_resizing(void);
+void q_workers_cron(void);
 
 struct connswapunit *csui_new(void);
 void csui_free(struct connswapunit *item);
@@ -1405,19 +1405,25 @@ robj *rdbLoadObject(int rdbtype, rio *rdb)
 
 /* Mark that we are loading in the global state and setup the fields
  * needed to provide loading stats. */
-void startLoading(FILE *fp)
+void startLoading(size_t size)
 {
-    struct stat sb;
-
     /* Load the DB */
     server.loading = 1;
     server.loading_start_time = time(NULL);
     server.loading_loaded_bytes = 0;
-    if (fstat(fileno(fp), &sb) == -1) {
-        server.loading_total_bytes = 0;
-    } else {
-        server.loading_total_bytes = sb.st_size;
-    }
+    server.loading_total_bytes = size;
+}
+
+/* Mark that we are loading in the global state and setup the fields
+ * needed to provide loading stats.
+ * 'fp' is the file we are loading from, used for the total size. */
+void startLoadingFile(FILE *fp)
+{
+    struct stat sb;
+
+    if (fstat(fileno(fp), &sb) == -1)
+        sb.st_size = 0;
+    startLoading(sb.st_size);
 }
 
 /* Refresh the loading progress info */
@@ -1432,6 +1438,7 @@ void loadingProgress(off_t pos)
 void stopLoading(void)
 {
     server.loading = 0;
+    server.async_loading = 0;
 }
 
 /* Track loading progress in order to serve client's from time to time
@@ -1455,46 +1462,45 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len)
     }
 }
 
-int rdbLoad(char *filename)
+/* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
+ * otherwise C_ERR is returned and 'errno' is set accordingly.
+ *
+ * A short read is a corrupted or truncated file, and the server exits,
+ * unless RDBFLAGS_REPLICATION is set: the payload is then read from the
+ * master's socket and a short read is an I/O error the caller handles.
+ *
+ * The keys are added to 'dbarray', server.db or the dbs of createTempDb(). */
+int rdbLoadRio(rio *rdb, int rdbflags, redisDb *dbarray)
 {
     uint32_t dbid;
     int type, rdbver;
-    redisDb *db = server.db + 0;
+    redisDb *db = dbarray + 0;
     char buf[1024];
     long long expiretime, now = mstime();
-    FILE *fp;
-    rio rdb;
 
-    if ((fp = fopen(filename, "r")) == NULL)
-        return C_ERR;
-
-    rioInitWithFile(&rdb, fp);
-    rdb.update_cksum = rdbLoadProgressCallback;
-    rdb.max_processing_chunk = server.loading_process_events_interval_bytes;
-    if (rioRead(&rdb, buf, 9) == 0)
+    rdb->update_cksum = rdbLoadProgressCallback;
+    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
+    if (rioRead(rdb, buf, 9) == 0)
         goto eoferr;
     buf[9] = '\0';
     if (memcmp(buf, "REDIS", 5) != 0) {
-        fclose(fp);
         serverLog(LL_WARNING, "Wrong signature trying to load DB from file");
         errno = EINVAL;
         return C_ERR;
     }
     rdbver = atoi(buf + 5);
     if (rdbver < 1 || rdbver > RDB_VERSION) {
-        fclose(fp);
         serverLog(LL_WARNING, "Can't handle RDB format version %d", rdbver);
         errno = EINVAL;
         return C_ERR;
     }
 
-    startLoading(fp);
     while (1) {
         robj *key, *val;
         expiretime = -1;
 
         /* Read type. */
-        if ((type = rdbLoadType(&rdb)) == -1)
+        if ((type = rdbLoadType(rdb)) == -1)
             goto eoferr;
 
         /* Handle special types. */
@@ -1502,10 +1508,10 @@ int rdbLoad(char *filename)
             /* EXPIRETIME: load an expire associated with the next key
              * to load. Note that after loading an expire we need to
              * load the actual type, and continue. */
-            if ((expiretime = rdbLoadTime(&rdb)) == -1)
+            if ((expiretime = rdbLoadTime(rdb)) == -1)
                 goto eoferr;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(&rdb)) == -1)
+            if ((type = rdbLoadType(rdb)) == -1)
                 goto eoferr;
             /* the EXPIRETIME opcode specifies time in seconds, so convert
              * into milliseconds. */
@@ -1513,17 +1519,17 @@ int rdbLoad(char *filename)
         } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
             /* EXPIRETIME_MS: milliseconds precision expire times introduced
              * with RDB v3. Like EXPIRETIME but no with more precision. */
-            if ((expiretime = rdbLoadMillisecondTime(&rdb)) == -1)
+            if ((expiretime = rdbLoadMillisecondTime(rdb)) == -1)
                 goto eoferr;
             /* We read the time so we need to read the object type again. */
-            if ((type = rdbLoadType(&rdb)) == -1)
+            if ((type = rdbLoadType(rdb)) == -1)
                 goto eoferr;
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
         } else if (type == RDB_OPCODE_SELECTDB) {
             /* SELECTDB: Select the specified database. */
-            if ((dbid = rdbLoadLen(&rdb, NULL)) == RDB_LENERR)
+            if ((dbid = rdbLoadLen(rdb, NULL)) == RDB_LENERR)
                 goto eoferr;
             if (dbid >= (unsigned) server.dbnum) {
                 serverLog(LL_WARNING,
@@ -1533,15 +1539,15 @@ int rdbLoad(char *filename)
                           server.dbnum);
                 exit(1);
             }
-            db = server.db + dbid;
+            db = dbarray + dbid;
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_RESIZEDB) {
             /* RESIZEDB: Hint about the size of the keys in the currently
              * selected data base, in order to avoid useless rehashing. */
             uint32_t db_size, expires_size;
-            if ((db_size = rdbLoadLen(&rdb, NULL)) == RDB_LENERR)
+            if ((db_size = rdbLoadLen(rdb, NULL)) == RDB_LENERR)
                 goto eoferr;
-            if ((expires_size = rdbLoadLen(&rdb, NULL)) == RDB_LENERR)
+            if ((expires_size = rdbLoadLen(rdb, NULL)) == RDB_LENERR)
                 goto eoferr;
             // we have auto-resize lock-free hash table, do not need expand
             // manually dictExpand(db->dict,db_size);
@@ -1554,9 +1560,9 @@ int rdbLoad(char *filename)
              *
              * An AUX field is composed of two strings: key and value. */
             robj *auxkey, *auxval;
-            if ((auxkey = rdbLoadStringObject(&rdb)) == NULL)
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL)
                 goto eoferr;
-            if ((auxval = rdbLoadStringObject(&rdb)) == NULL)
+            if ((auxval = rdbLoadStringObject(rdb)) == NULL)
                 goto eoferr;
 
             if (((char *) auxkey->ptr)[0] == '%') {
@@ -1578,11 +1584,13 @@ int rdbLoad(char *filename)
         }
 
         /* Read key */
-        if ((key = rdbLoadStringObject(&rdb)) == NULL)
+        if ((key = rdbLoadStringObject(rdb)) == NULL)
             goto eoferr;
         /* Read value */
-        if ((val = rdbLoadObject(type, &rdb)) == NULL)
+        if ((val = rdbLoadObject(type, rdb)) == NULL) {
+            decrRefCount(key);
             goto eoferr;
+        }
         /* Check if the key already expired. This function is used when loading
          * an RDB file from disk, either at startup, or when an RDB was
          * received from the master. In the latter case, the master is
@@ -1601,12 +1609,21 @@ int rdbLoad(char *filename)
             setExpire(db, key, expiretime);
 
         decrRefCount(key);
+
+        /* Slow the load down, for the tests. */
+        if (server.key_load_delay) {
+            struct timespec tv;
+
+            tv.tv_sec = server.key_load_delay / 1000000;
+            tv.tv_nsec = (server.key_load_delay % 1000000) * 1000;
+            nanosleep(&tv, NULL);
+        }
     }
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
-        uint64_t cksum, expected = rdb.cksum;
+        uint64_t cksum, expected = rdb->cksum;
 
-        if (rioRead(&rdb, &cksum, 8) == 0)
+        if (rioRead(rdb, &cksum, 8) == 0)
             goto eoferr;
         memrev64ifbe(&cksum);
         if (cksum == 0) {
@@ -1614,16 +1631,23 @@ int rdbLoad(char *filename)
                       "RDB file was saved with checksum disabled: no check "
                       "performed.");
         } else if (cksum != expected) {
+            if (rdbflags & RDBFLAGS_REPLICATION) {
+                serverLog(LL_WARNING, "Wrong RDB checksum from MASTER.");
+                errno = EINVAL;
+                return C_ERR;
+            }
             serverLog(LL_WARNING, "Wrong RDB checksum. Aborting now.");
             rdbExitReportCorruptRDB("RDB CRC error");
         }
     }
-
-    fclose(fp);
-    stopLoading();
     return C_OK;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
+    if (rdbflags & RDBFLAGS_REPLICATION) {
+        serverLog(LL_WARNING, "Short read loading DB from MASTER: %s",
+                  strerror(errno));
+        return C_ERR;
+    }
     serverLog(
         LL_WARNING,
         "Short read or OOM loading DB. Unrecoverable error, aborting now.");
@@ -1631,6 +1655,24 @@ eoferr: /* unexpected end of file is handled here with a fatal exit */
     return C_ERR; /* Just to avoid warning */
 }
 
+int rdbLoad(char *filename)
+{
+    FILE *fp;
+    rio rdb;
+    int retval;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        return C_ERR;
+
+    rioInitWithFile(&rdb, fp);
+    startLoadingFile(fp);
+    retval = rdbLoadRio(&rdb, RDBFLAGS_NONE, server.db);
+    fclose(fp);
+    stopLoading();
+    return retval;
+}
+
+
 /* A background saving child (BGSAVE) terminated its work. Handle this.
  * This function covers the case of actual BGSAVEs. */
 void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal)
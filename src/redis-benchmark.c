@@ -32,7 +32,10 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <math.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,6 +51,49 @@
 
 #define UNUSED(V) ((void) V)
 #define RANDPTR_INITIAL_SIZE 8
+#define MAX_THREADS 64
+
+#define atomicIncr(var) __atomic_add_fetch(&(var), 1, __ATOMIC_RELAXED)
+#define atomicDecr(var) __atomic_sub_fetch(&(var), 1, __ATOMIC_RELAXED)
+#define atomicGet(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define atomicSet(var, value) __atomic_store_n(&(var), value, __ATOMIC_RELAXED)
+
+/* Key distributions used to expand __rand_int__ and by the mixed workload. */
+#define KEYDIST_UNIFORM 0
+#define KEYDIST_ZIPF 1
+#define KEYDIST_HOTSPOT 2
+
+/* Latency histogram with a bounded relative error, in the spirit of HDR
+ * histograms: values below 128 usec are recorded exactly, then every power
+ * of two range is split in 64 linear sub buckets, so the error is below
+ * 1/64 (1.6%) at any scale. Histograms of different threads are merged by
+ * summing the counters. */
+#define LATENCY_HIST_SUB_BITS 6
+#define LATENCY_HIST_SUB_COUNT (1 << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_EXACT (LATENCY_HIST_SUB_COUNT * 2)
+#define LATENCY_HIST_MAX_EXP 40
+#define LATENCY_HIST_SIZE \
+    (LATENCY_HIST_EXACT + LATENCY_HIST_MAX_EXP * LATENCY_HIST_SUB_COUNT)
+
+typedef struct latencyHistogram {
+    long long count;
+    long long max;
+    long long counts[LATENCY_HIST_SIZE];
+} latencyHistogram;
+
+/* Every benchmark thread runs its own event loop serving a subset of the
+ * clients. With a single thread the event loop is run by the main thread,
+ * like it always was. */
+typedef struct benchmarkThread {
+    int index;
+    pthread_t thread;
+    aeEventLoop *el;
+    list *clients;
+    list *idle;          /* Clients waiting for their turn with --rps. */
+    long long scheduled; /* Requests scheduled so far with --rps. */
+    uint64_t seed;       /* State of the thread PRNG. */
+    latencyHistogram *latency;
+} benchmarkThread;
 
 static struct config {
     aeEventLoop *el;
@@ -59,20 +105,33 @@ static struct config {
     int requests;
     int requests_issued;
     int requests_finished;
+    int done;
     int keysize;
     int datasize;
+    int datasize_max;
+    char *value;
     int randomkeys;
     int randomkeys_keyspacelen;
+    int keydist;
+    double zipf_theta, zipf_zetan, zipf_eta, zipf_alpha;
+    double hot_keys, hot_ops;
+    int mixed;         /* --ratio was given. */
+    int mixed_running; /* The mixed test is running. */
+    double read_fraction;
+    long long rps;
     int keepalive;
     int pipeline;
     int showerrors;
     long long start;
+    long long start_us;
     long long totlatency;
-    long long *latency;
+    latencyHistogram *latency;
     const char *title;
-    list *clients;
+    int num_threads;
+    benchmarkThread **threads;
     int quiet;
     int csv;
+    int percentiles; /* Add the latency percentiles to -q and --csv */
     int loop;
     int idlemode;
     int dbnum;
@@ -83,12 +142,14 @@ static struct config {
 
 typedef struct _client {
     redisContext *context;
+    benchmarkThread *thread; /* Thread serving the client. */
     sds obuf;
     char **randptr;     /* Pointers to :rand: strings inside the command buf */
     size_t randlen;     /* Number of pointers in client->randptr */
     size_t randfree;    /* Number of unused pointers in client->randptr */
     size_t written;     /* Bytes of 'obuf' already written */
     long long start;    /* Start time of a request */
+    long long scheduled_start; /* Intended start time with --rps */
     long long latency;  /* Request latency */
     int pending;        /* Number of pending requests (replies to consume) */
     int prefix_pending; /* If non-zero, number of pending prefix commands.
@@ -101,6 +162,10 @@ typedef struct _client {
 /* Prototypes */
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 static void createMissingClients(client c);
+static client createClient(char *cmd,
+                           size_t len,
+                           client from,
+                           benchmarkThread *thread);
 
 /* Implementation */
 static long long ustime(void)
@@ -125,39 +190,205 @@ static long long mstime(void)
     return mst;
 }
 
+/* ------------------------- Latency histograms ----------------------------- */
+
+static int latencyHistogramIndex(long long value)
+{
+    int exp;
+
+    if (value < 0)
+        value = 0;
+    if (value < LATENCY_HIST_EXACT)
+        return value;
+    /* Shift the value so that it falls in [SUB_COUNT, 2*SUB_COUNT). */
+    exp = (63 - __builtin_clzll(value)) - LATENCY_HIST_SUB_BITS;
+    if (exp > LATENCY_HIST_MAX_EXP)
+        return LATENCY_HIST_SIZE - 1;
+    return LATENCY_HIST_EXACT + (exp - 1) * LATENCY_HIST_SUB_COUNT +
+           (int) ((value >> exp) - LATENCY_HIST_SUB_COUNT);
+}
+
+/* Return the highest value recorded in the bucket at 'index'. */
+static long long latencyHistogramValue(int index)
+{
+    int exp, sub;
+
+    if (index < LATENCY_HIST_EXACT)
+        return index;
+    exp = (index - LATENCY_HIST_EXACT) / LATENCY_HIST_SUB_COUNT + 1;
+    sub = (index - LATENCY_HIST_EXACT) % LATENCY_HIST_SUB_COUNT +
+          LATENCY_HIST_SUB_COUNT;
+    return (((long long) sub + 1) << exp) - 1;
+}
+
+static void latencyHistogramRecord(latencyHistogram *h, long long value)
+{
+    h->counts[latencyHistogramIndex(value)]++;
+    h->count++;
+    if (value > h->max)
+        h->max = value;
+}
+
+static void latencyHistogramMerge(latencyHistogram *dst, latencyHistogram *src)
+{
+    int j;
+
+    for (j = 0; j < LATENCY_HIST_SIZE; j++)
+        dst->counts[j] += src->counts[j];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* Return the value at the specified percentile (0-100). */
+static long long latencyHistogramPercentile(latencyHistogram *h, double perc)
+{
+    long long target = (long long) ceil(perc * h->count / 100), seen = 0;
+    int j;
+
+    if (target < 1)
+        target = 1;
+    for (j = 0; j < LATENCY_HIST_SIZE; j++) {
+        seen += h->counts[j];
+        if (seen >= target) {
+            long long value = latencyHistogramValue(j);
+            return value > h->max ? h->max : value;
+        }
+    }
+    return h->max;
+}
+
+/* ------------------------- Keys and values -------------------------------- */
+
+/* xorshift64*, every thread has its own state. */
+static uint64_t benchmarkRandom(benchmarkThread *t)
+{
+    uint64_t x = t->seed;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    t->seed = x;
+    return x * 2685821657736338717ULL;
+}
+
+/* Return a random double in [0,1). */
+static double benchmarkRandomUnit(benchmarkThread *t)
+{
+    return (benchmarkRandom(t) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Precompute the constants of the zipfian generator, see "Quickly
+ * Generating Billion-Record Synthetic Databases", Gray et al. */
+static void zipfInit(void)
+{
+    double n = config.randomkeys_keyspacelen, zeta2;
+    long long j;
+
+    config.zipf_zetan = 0;
+    for (j = 1; j <= config.randomkeys_keyspacelen; j++)
+        config.zipf_zetan += 1 / pow(j, config.zipf_theta);
+    zeta2 = 1 + 1 / pow(2, config.zipf_theta);
+    config.zipf_alpha = 1 / (1 - config.zipf_theta);
+    config.zipf_eta = (1 - pow(2 / n, 1 - config.zipf_theta)) /
+                      (1 - zeta2 / config.zipf_zetan);
+}
+
+/* Return the next key (as an integer in [0, keyspacelen)) according to the
+ * selected distribution. */
+static unsigned long long nextKey(benchmarkThread *t)
+{
+    unsigned long long n = config.randomkeys_keyspacelen, hot, key;
+    double u;
+
+    if (n == 0)
+        return 0;
+    switch (config.keydist) {
+    case KEYDIST_ZIPF:
+        u = benchmarkRandomUnit(t);
+        if (u * config.zipf_zetan < 1)
+            return 0;
+        if (u * config.zipf_zetan < 1 + pow(0.5, config.zipf_theta))
+            return 1 % n;
+        key = n * pow(config.zipf_eta * u - config.zipf_eta + 1,
+                      config.zipf_alpha);
+        return key < n ? key : n - 1;
+    case KEYDIST_HOTSPOT:
+        hot = n * config.hot_keys;
+        if (hot == 0)
+            hot = 1;
+        if (hot >= n || benchmarkRandomUnit(t) < config.hot_ops)
+            return benchmarkRandom(t) % hot;
+        return hot + benchmarkRandom(t) % (n - hot);
+    default:
+        return benchmarkRandom(t) % n;
+    }
+}
+
+static size_t nextValueSize(benchmarkThread *t)
+{
+    if (config.datasize_max <= config.datasize)
+        return config.datasize;
+    return config.datasize +
+           benchmarkRandom(t) % (config.datasize_max - config.datasize + 1);
+}
+
+/* ------------------------- Clients ---------------------------------------- */
+
 static void freeClient(client c)
 {
+    benchmarkThread *t = c->thread;
     listNode *ln;
-    aeDeleteFileEvent(config.el, c->context->fd, AE_WRITABLE);
-    aeDeleteFileEvent(config.el, c->context->fd, AE_READABLE);
+
+    aeDeleteFileEvent(t->el, c->context->fd, AE_WRITABLE);
+    aeDeleteFileEvent(t->el, c->context->fd, AE_READABLE);
     redisFree(c->context);
     sdsfree(c->obuf);
     zfree(c->randptr);
     zfree(c);
-    config.liveclients--;
-    ln = listSearchKey(config.clients, c);
+    atomicDecr(config.liveclients);
+    ln = listSearchKey(t->clients, c);
     assert(ln != NULL);
-    listDelNode(config.clients, ln);
+    listDelNode(t->clients, ln);
+    if ((ln = listSearchKey(t->idle, c)) != NULL)
+        listDelNode(t->idle, ln);
 }
 
 static void freeAllClients(void)
 {
-    listNode *ln = config.clients->head, *next;
+    int j;
+
+    for (j = 0; j < config.num_threads; j++) {
+        listNode *ln = config.threads[j]->clients->head, *next;
 
-    while (ln) {
-        next = ln->next;
-        freeClient(ln->value);
-        ln = next;
+        while (ln) {
+            next = ln->next;
+            freeClient(ln->value);
+            ln = next;
+        }
     }
 }
 
+/* Let the client send its next request: now, or when the rate limiter
+ * schedules it if --rps is used. */
+static void scheduleClient(client c)
+{
+    if (config.rps)
+        listAddNodeTail(c->thread->idle, c);
+    else
+        aeCreateFileEvent(c->thread->el, c->context->fd, AE_WRITABLE,
+                          writeHandler, c);
+}
+
 static void resetClient(client c)
 {
-    aeDeleteFileEvent(config.el, c->context->fd, AE_WRITABLE);
-    aeDeleteFileEvent(config.el, c->context->fd, AE_READABLE);
-    aeCreateFileEvent(config.el, c->context->fd, AE_WRITABLE, writeHandler, c);
+    aeEventLoop *el = c->thread->el;
+
+    aeDeleteFileEvent(el, c->context->fd, AE_WRITABLE);
+    aeDeleteFileEvent(el, c->context->fd, AE_READABLE);
     c->written = 0;
     c->pending = config.pipeline;
+    scheduleClient(c);
 }
 
 static void randomizeClientKey(client c)
@@ -166,7 +397,7 @@ static void randomizeClientKey(client c)
 
     for (i = 0; i < c->randlen; i++) {
         char *p = c->randptr[i] + 11;
-        size_t r = random() % config.randomkeys_keyspacelen;
+        size_t r = nextKey(c->thread);
         size_t j;
 
         for (j = 0; j < 12; j++) {
@@ -177,19 +408,51 @@ static void randomizeClientKey(client c)
     }
 }
 
+/* Build the requests of the mixed workload: every request of the pipeline
+ * is a GET or a SET, chosen accordingly to --ratio. */
+static void buildMixedRequest(client c)
+{
+    benchmarkThread *t = c->thread;
+    int j;
+
+    if (c->prefixlen)
+        sdsrange(c->obuf, 0, c->prefixlen - 1);
+    else
+        sdsclear(c->obuf);
+    for (j = 0; j < config.pipeline; j++) {
+        unsigned long long key = nextKey(t);
+
+        if (benchmarkRandomUnit(t) < config.read_fraction) {
+            c->obuf = sdscatprintf(c->obuf,
+                                   "*2\r\n$3\r\nGET\r\n$16\r\nkey:%012llu\r\n",
+                                   key);
+        } else {
+            size_t vlen = nextValueSize(t);
+
+            c->obuf = sdscatprintf(
+                c->obuf, "*3\r\n$3\r\nSET\r\n$16\r\nkey:%012llu\r\n$%zu\r\n",
+                key, vlen);
+            c->obuf = sdscatlen(c->obuf, config.value, vlen);
+            c->obuf = sdscatlen(c->obuf, "\r\n", 2);
+        }
+    }
+}
+
 static void clientDone(client c)
 {
-    if (config.requests_finished == config.requests) {
+    if (atomicGet(config.requests_finished) >= config.requests) {
         freeClient(c);
-        aeStop(config.el);
+        /* Only stop the loop of this thread, the other ones see
+         * config.done from their cron. */
+        atomicSet(config.done, 1);
+        aeStop(c->thread->el);
         return;
     }
     if (config.keepalive) {
         resetClient(c);
     } else {
-        config.liveclients--;
-        createMissingClients(c);
-        config.liveclients++;
+        /* Replace the client with a new connection on the same thread. */
+        createClient(NULL, 0, c, c->thread);
         freeClient(c);
     }
 }
@@ -251,8 +514,8 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask)
                     continue;
                 }
 
-                if (config.requests_finished < config.requests)
-                    config.latency[config.requests_finished++] = c->latency;
+                if (atomicIncr(config.requests_finished) <= config.requests)
+                    latencyHistogramRecord(c->thread->latency, c->latency);
                 c->pending--;
                 if (c->pending == 0) {
                     clientDone(c);
@@ -275,15 +538,20 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask)
     /* Initialize request when nothing was written. */
     if (c->written == 0) {
         /* Enforce upper bound to number of requests. */
-        if (config.requests_issued++ >= config.requests) {
+        if (atomicIncr(config.requests_issued) > config.requests) {
             freeClient(c);
             return;
         }
 
-        /* Really initialize: randomize keys and set start time. */
-        if (config.randomkeys)
+        /* Really initialize: randomize keys and set start time. With --rps
+         * the latency is measured from the time the request was supposed
+         * to be sent, so that a slow server can't hide its queueing delay
+         * (coordinated omission). */
+        if (config.mixed_running)
+            buildMixedRequest(c);
+        else if (config.randomkeys)
             randomizeClientKey(c);
-        c->start = ustime();
+        c->start = config.rps ? c->scheduled_start : ustime();
         c->latency = -1;
     }
 
@@ -292,6 +560,8 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask)
         ssize_t nwritten =
             write(c->context->fd, ptr, sdslen(c->obuf) - c->written);
         if (nwritten == -1) {
+            if (errno == EAGAIN)
+                return;
             if (errno != EPIPE)
                 fprintf(stderr, "Writing to socket: %s\n", strerror(errno));
             freeClient(c);
@@ -299,8 +569,8 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask)
         }
         c->written += nwritten;
         if (sdslen(c->obuf) == c->written) {
-            aeDeleteFileEvent(config.el, c->context->fd, AE_WRITABLE);
-            aeCreateFileEvent(config.el, c->context->fd, AE_READABLE,
+            aeDeleteFileEvent(c->thread->el, c->context->fd, AE_WRITABLE);
+            aeCreateFileEvent(c->thread->el, c->context->fd, AE_READABLE,
                               readHandler, c);
         }
     }
@@ -326,8 +596,13 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask)
  * 2) The offsets of the __rand_int__ elements inside the command line, used
  *    for arguments randomization.
  *
- * Even when cloning another client, prefix commands are applied if needed.*/
-static client createClient(char *cmd, size_t len, client from)
+ * Even when cloning another client, prefix commands are applied if needed.
+ *
+ * The client is served by the event loop of 'thread'. */
+static client createClient(char *cmd,
+                           size_t len,
+                           client from,
+                           benchmarkThread *thread)
 {
     int j;
     client c = zmalloc(sizeof(struct _client));
@@ -346,6 +621,7 @@ static client createClient(char *cmd, size_t len, client from)
             fprintf(stderr, "%s: %s\n", config.hostsocket, c->context->errstr);
         exit(1);
     }
+    c->thread = thread;
     /* Suppress hiredis cleanup of unused buffers for max speed. */
     c->context->reader->maxbuf = 0;
 
@@ -419,20 +695,21 @@ static client createClient(char *cmd, size_t len, client from)
             }
         }
     }
+    listAddNodeTail(thread->clients, c);
     if (config.idlemode == 0)
-        aeCreateFileEvent(config.el, c->context->fd, AE_WRITABLE, writeHandler,
-                          c);
-    listAddNodeTail(config.clients, c);
-    config.liveclients++;
+        scheduleClient(c);
+    atomicIncr(config.liveclients);
     return c;
 }
 
+/* Create the missing clients, spreading them among the threads. */
 static void createMissingClients(client c)
 {
     int n = 0;
 
     while (config.liveclients < config.numclients) {
-        createClient(NULL, 0, c);
+        createClient(NULL, 0, c,
+                     config.threads[config.liveclients % config.num_threads]);
 
         /* Listen backlog is quite limited on most systems */
         if (++n > 64) {
@@ -442,15 +719,83 @@ static void createMissingClients(client c)
     }
 }
 
-static int compareLatency(const void *a, const void *b)
+/* ------------------------- Threads ---------------------------------------- */
+
+/* Rate limiter for the open loop mode (--rps): every thread releases its
+ * idle clients at the pace of its share of the requests per second. If no
+ * client is idle when a request is due, the request is sent as soon as one
+ * becomes available, and its latency accounts for the wait. */
+static void scheduleIdleClients(benchmarkThread *t)
 {
-    return (*(long long *) a) - (*(long long *) b);
+    double rate =
+        (double) config.rps / config.num_threads / config.pipeline / 1000000;
+    long long due = (long long) ((ustime() - config.start_us) * rate) + 1;
+
+    while (t->scheduled < due && listLength(t->idle)) {
+        listNode *ln = listFirst(t->idle);
+        client c = listNodeValue(ln);
+
+        listDelNode(t->idle, ln);
+        c->scheduled_start = config.start_us + (long long) (t->scheduled / rate);
+        t->scheduled++;
+        aeCreateFileEvent(t->el, c->context->fd, AE_WRITABLE, writeHandler, c);
+    }
+}
+
+static int benchmarkThreadCron(struct aeEventLoop *eventLoop,
+                               long long id,
+                               void *clientData)
+{
+    benchmarkThread *t = clientData;
+    UNUSED(id);
+
+    if (atomicGet(config.done)) {
+        aeStop(eventLoop);
+        return 1;
+    }
+    if (config.rps)
+        scheduleIdleClients(t);
+    return 1;
+}
+
+static benchmarkThread *createBenchmarkThread(int index)
+{
+    benchmarkThread *t = zmalloc(sizeof(*t));
+
+    t->index = index;
+    t->el = aeCreateEventLoop(1024 * 10);
+    aeCreateTimeEvent(t->el, 1, benchmarkThreadCron, t, NULL);
+    t->clients = listCreate();
+    t->idle = listCreate();
+    t->scheduled = 0;
+    t->seed = ((uint64_t) ustime() << 16) ^ (0x9E3779B97F4A7C15ULL * (index + 1));
+    t->latency = zcalloc(sizeof(latencyHistogram));
+    return t;
+}
+
+static void *benchmarkThreadMain(void *arg)
+{
+    benchmarkThread *t = arg;
+
+    aeMain(t->el);
+    return NULL;
 }
 
 static void showLatencyReport(void)
 {
-    int i, curlat = 0;
+    int i, curlat = -1;
     float perc, reqpersec;
+    latencyHistogram *h = config.latency;
+    long long seen = 0;
+    double p50, p99, p999, max;
+
+    memset(h, 0, sizeof(*h));
+    for (i = 0; i < config.num_threads; i++)
+        latencyHistogramMerge(h, config.threads[i]->latency);
+    p50 = latencyHistogramPercentile(h, 50) / 1000.0;
+    p99 = latencyHistogramPercentile(h, 99) / 1000.0;
+    p999 = latencyHistogramPercentile(h, 99.9) / 1000.0;
+    max = h->max / 1000.0;
 
     reqpersec =
         (float) config.requests_finished / ((float) config.totlatency / 1000);
@@ -459,42 +804,97 @@ static void showLatencyReport(void)
         printf("  %d requests completed in %.2f seconds\n",
                config.requests_finished, (float) config.totlatency / 1000);
         printf("  %d parallel clients\n", config.numclients);
+        if (config.num_threads > 1)
+            printf("  %d threads\n", config.num_threads);
         printf("  %d bytes payload\n", config.datasize);
         printf("  keep alive: %d\n", config.keepalive);
         printf("\n");
 
-        qsort(config.latency, config.requests, sizeof(long long),
-              compareLatency);
-        for (i = 0; i < config.requests; i++) {
-            if (config.latency[i] / 1000 != curlat ||
-                i == (config.requests - 1)) {
-                curlat = config.latency[i] / 1000;
-                perc = ((float) (i + 1) * 100) / config.requests;
+        /* Cumulative distribution, one line per millisecond. */
+        for (i = 0; i < LATENCY_HIST_SIZE; i++) {
+            int lat;
+
+            if (h->counts[i] == 0)
+                continue;
+            lat = latencyHistogramValue(i) / 1000;
+            if (curlat != -1 && lat != curlat) {
+                perc = ((float) seen * 100) / h->count;
                 printf("%.2f%% <= %d milliseconds\n", perc, curlat);
             }
+            curlat = lat;
+            seen += h->counts[i];
         }
+        if (curlat != -1)
+            printf("100.00%% <= %d milliseconds\n", curlat);
+        printf("latency (msec): p50=%.3f p99=%.3f p99.9=%.3f max=%.3f\n", p50,
+               p99, p999, max);
         printf("%.2f requests per second\n\n", reqpersec);
     } else if (config.csv) {
-        printf("\"%s\",\"%.2f\"\n", config.title, reqpersec);
+        if (config.percentiles)
+            printf(
+                "\"%s\",\"%.2f\",\"%.3f\",\"%.3f\",\"%.3f\",\"%.3f\"\n",
+                config.title, reqpersec, p50, p99, p999, max);
+        else
+            printf("\"%s\",\"%.2f\"\n", config.title, reqpersec);
     } else {
-        printf("%s: %.2f requests per second\n", config.title, reqpersec);
+        if (config.percentiles)
+            printf("%s: %.2f requests per second, p50=%.3f p99=%.3f msec\n",
+                   config.title, reqpersec, p50, p99);
+        else
+            printf("%s: %.2f requests per second\n", config.title, reqpersec);
     }
 }
 
+int showThroughput(struct aeEventLoop *eventLoop,
+                   long long id,
+                   void *clientData);
+
 static void benchmark(char *title, char *cmd, int len)
 {
     client c;
+    int j;
 
     config.title = title;
     config.requests_issued = 0;
     config.requests_finished = 0;
+    config.done = 0;
+    for (j = 0; j < config.num_threads; j++) {
+        memset(config.threads[j]->latency, 0, sizeof(latencyHistogram));
+        config.threads[j]->scheduled = 0;
+    }
 
-    c = createClient(cmd, len, NULL);
+    c = createClient(cmd, len, NULL, config.threads[0]);
     createMissingClients(c);
 
     config.start = mstime();
-    aeMain(config.el);
+    config.start_us = ustime();
+    if (config.num_threads == 1) {
+        aeMain(config.el);
+    } else {
+        long long last_report = 0;
+
+        for (j = 0; j < config.num_threads; j++) {
+            if (pthread_create(&config.threads[j]->thread, NULL,
+                               benchmarkThreadMain, config.threads[j])) {
+                fprintf(stderr, "Can't create benchmark thread: %s\n",
+                        strerror(errno));
+                exit(1);
+            }
+        }
+        while (!atomicGet(config.done)) {
+            usleep(10000);
+            if (mstime() - last_report >= 250) {
+                showThroughput(NULL, 0, NULL);
+                last_report = mstime();
+            }
+        }
+        for (j = 0; j < config.num_threads; j++)
+            pthread_join(config.threads[j]->thread, NULL);
+    }
     config.totlatency = mstime() - config.start;
+    /* Pipelined clients may complete a few requests past the limit. */
+    if (config.requests_finished > config.requests)
+        config.requests_finished = config.requests;
 
     showLatencyReport();
     freeAllClients();
@@ -546,6 +946,12 @@ int parseOptions(int argc, const char **argv)
                 config.datasize = 1;
             if (config.datasize > 1024 * 1024 * 1024)
                 config.datasize = 1024 * 1024 * 1024;
+        } else if (!strcmp(argv[i], "--datasize-max")) {
+            if (lastarg)
+                goto invalid;
+            config.datasize_max = atoi(argv[++i]);
+            if (config.datasize_max > 1024 * 1024 * 1024)
+                config.datasize_max = 1024 * 1024 * 1024;
         } else if (!strcmp(argv[i], "-P")) {
             if (lastarg)
                 goto invalid;
@@ -563,6 +969,8 @@ int parseOptions(int argc, const char **argv)
             config.quiet = 1;
         } else if (!strcmp(argv[i], "--csv")) {
             config.csv = 1;
+        } else if (!strcmp(argv[i], "--percentiles")) {
+            config.percentiles = 1;
         } else if (!strcmp(argv[i], "-l")) {
             config.loop = 1;
         } else if (!strcmp(argv[i], "-I")) {
@@ -586,6 +994,60 @@ int parseOptions(int argc, const char **argv)
                 goto invalid;
             config.dbnum = atoi(argv[++i]);
             config.dbnumstr = sdsfromlonglong(config.dbnum);
+        } else if (!strcmp(argv[i], "--threads")) {
+            if (lastarg)
+                goto invalid;
+            config.num_threads = atoi(argv[++i]);
+            if (config.num_threads < 1)
+                config.num_threads = 1;
+            if (config.num_threads > MAX_THREADS)
+                config.num_threads = MAX_THREADS;
+        } else if (!strcmp(argv[i], "--ratio")) {
+            int reads, writes;
+
+            if (lastarg)
+                goto invalid;
+            if (sscanf(argv[++i], "%d:%d", &reads, &writes) != 2 ||
+                reads < 0 || writes < 0 || reads + writes == 0)
+                goto invalid;
+            config.mixed = 1;
+            config.read_fraction = (double) reads / (reads + writes);
+        } else if (!strcmp(argv[i], "--keydist")) {
+            const char *dist;
+
+            if (lastarg)
+                goto invalid;
+            dist = argv[++i];
+            if (!strcmp(dist, "uniform")) {
+                config.keydist = KEYDIST_UNIFORM;
+            } else if (!strncmp(dist, "zipf", 4) &&
+                       (dist[4] == '\0' || dist[4] == ':')) {
+                config.keydist = KEYDIST_ZIPF;
+                if (dist[4] == ':')
+                    config.zipf_theta = atof(dist + 5);
+                if (config.zipf_theta <= 0 || config.zipf_theta >= 1)
+                    goto invalid;
+            } else if (!strncmp(dist, "hotspot", 7) &&
+                       (dist[7] == '\0' || dist[7] == ':')) {
+                double keys, ops;
+
+                config.keydist = KEYDIST_HOTSPOT;
+                if (dist[7] == ':') {
+                    if (sscanf(dist + 8, "%lf:%lf", &keys, &ops) != 2 ||
+                        keys <= 0 || keys > 100 || ops < 0 || ops > 100)
+                        goto invalid;
+                    config.hot_keys = keys / 100;
+                    config.hot_ops = ops / 100;
+                }
+            } else {
+                goto invalid;
+            }
+        } else if (!strcmp(argv[i], "--rps")) {
+            if (lastarg)
+                goto invalid;
+            config.rps = strtoll(argv[++i], NULL, 10);
+            if (config.rps < 0)
+                config.rps = 0;
         } else if (!strcmp(argv[i], "--help")) {
             exit_status = 0;
             goto usage;
@@ -615,6 +1077,9 @@ usage:
         " -c <clients>       Number of parallel connections (default 50)\n"
         " -n <requests>      Total number of requests (default 100000)\n"
         " -d <size>          Data size of SET/GET value in bytes (default 2)\n"
+        " --datasize-max <size> Use values of random size between -d and "
+        "this\n"
+        "                    size in the mixed workload (default: fixed size)\n"
         " --dbnum <db>        SELECT the specified db number (default 0)\n"
         " -k <boolean>       1=keep alive 0=reconnect (default 1)\n"
         " -r <keyspacelen>   Use random keys for SET/GET/INCR, random values "
@@ -633,13 +1098,35 @@ usage:
         "                    (no more than 1 error per second is displayed)\n"
         " -q                 Quiet. Just show query/sec values\n"
         " --csv              Output in CSV format\n"
+        " --percentiles      Add the p50 and p99 latencies to the -q output, "
+        "and\n"
+        "                    the p50, p99, p99.9 and max ones to the CSV "
+        "output\n"
         " -l                 Loop. Run the tests forever\n"
         " -t <tests>         Only run the comma separated list of tests. The "
         "test\n"
         "                    names are the same as the ones produced as "
         "output.\n"
         " -I                 Idle mode. Just open N idle connections and "
-        "wait.\n\n"
+        "wait.\n"
+        " --threads <num>    Spread the clients among <num> threads, each "
+        "running\n"
+        "                    its own event loop (default 1)\n"
+        " --ratio <r>:<w>    Run the 'mixed' test: random GET and SET "
+        "commands\n"
+        "                    in the r:w proportion (default 1:1)\n"
+        " --keydist <dist>   Distribution of the keys generated with -r: "
+        "uniform\n"
+        "                    (default), zipf[:<theta>] (default theta 0.99) "
+        "or\n"
+        "                    hotspot[:<keys%%>:<ops%%>], sending ops%% of the\n"
+        "                    requests to keys%% of the keyspace (default "
+        "20:80)\n"
+        " --rps <num>        Open loop mode: send <num> requests per second "
+        "and\n"
+        "                    measure latencies from the time each request "
+        "was\n"
+        "                    supposed to be sent\n\n"
         "Examples:\n\n"
         " Run the benchmark with the default configuration against "
         "127.0.0.1:6379:\n"
@@ -652,6 +1139,11 @@ usage:
         "   $ redis-benchmark -t set -n 1000000 -r 100000000\n\n"
         " Benchmark 127.0.0.1:6379 for a few commands producing CSV output:\n"
         "   $ redis-benchmark -t ping,set,get -n 100000 --csv\n\n"
+        " Run 90%% reads and 10%% writes over 1M keys with a zipfian access "
+        "pattern\n"
+        " using 4 threads:\n"
+        "   $ redis-benchmark --threads 4 -t mixed --ratio 9:1 -r 1000000 "
+        "--keydist zipf\n\n"
         " Benchmark a specific command line:\n"
         "   $ redis-benchmark -r 10000 -n 10000 eval 'return "
         "redis.call(\"ping\")' 0\n\n"
@@ -671,19 +1163,19 @@ int showThroughput(struct aeEventLoop *eventLoop,
     UNUSED(id);
     UNUSED(clientData);
 
-    if (config.liveclients == 0) {
+    if (atomicGet(config.liveclients) == 0) {
         fprintf(stderr, "All clients disconnected... aborting.\n");
         exit(1);
     }
     if (config.csv)
         return 250;
     if (config.idlemode == 1) {
-        printf("clients: %d\r", config.liveclients);
+        printf("clients: %d\r", atomicGet(config.liveclients));
         fflush(stdout);
         return 250;
     }
     float dt = (float) (mstime() - config.start) / 1000.0;
-    float rps = (float) config.requests_finished / dt;
+    float rps = (float) atomicGet(config.requests_finished) / dt;
     printf("%s: %.2f\r", config.title, rps);
     fflush(stdout);
     return 250; /* every 250ms */
@@ -720,20 +1212,28 @@ int main(int argc, const char **argv)
     config.numclients = 50;
     config.requests = 100000;
     config.liveclients = 0;
-    config.el = aeCreateEventLoop(1024 * 10);
-    aeCreateTimeEvent(config.el, 1, showThroughput, NULL, NULL);
     config.keepalive = 1;
     config.datasize = 3;
+    config.datasize_max = 0;
     config.pipeline = 1;
     config.showerrors = 0;
     config.randomkeys = 0;
     config.randomkeys_keyspacelen = 0;
+    config.keydist = KEYDIST_UNIFORM;
+    config.zipf_theta = 0.99;
+    config.hot_keys = 0.2;
+    config.hot_ops = 0.8;
+    config.mixed = 0;
+    config.mixed_running = 0;
+    config.read_fraction = 0.5;
+    config.rps = 0;
+    config.num_threads = 1;
     config.quiet = 0;
     config.csv = 0;
+    config.percentiles = 0;
     config.loop = 0;
     config.idlemode = 0;
     config.latency = NULL;
-    config.clients = listCreate();
     config.hostip = "127.0.0.1";
     config.hostport = 6379;
     config.hostsocket = NULL;
@@ -745,7 +1245,25 @@ int main(int argc, const char **argv)
     argc -= i;
     argv += i;
 
-    config.latency = zmalloc(sizeof(long long) * config.requests);
+    /* Idle connections don't need more than one event loop. */
+    if (config.idlemode)
+        config.num_threads = 1;
+    if (config.num_threads > 1)
+        zmalloc_enable_thread_safeness();
+    config.threads = zmalloc(sizeof(benchmarkThread *) * config.num_threads);
+    for (i = 0; i < config.num_threads; i++)
+        config.threads[i] = createBenchmarkThread(i);
+    config.el = config.threads[0]->el;
+    if (config.num_threads == 1)
+        aeCreateTimeEvent(config.el, 1, showThroughput, NULL, NULL);
+    config.latency = zmalloc(sizeof(latencyHistogram));
+
+    if (config.keydist == KEYDIST_ZIPF && config.randomkeys_keyspacelen > 0)
+        zipfInit();
+    if (config.datasize_max < config.datasize)
+        config.datasize_max = config.datasize;
+    config.value = zmalloc(config.datasize_max);
+    memset(config.value, 'x', config.datasize_max);
 
     if (config.keepalive == 0) {
         printf(
@@ -760,7 +1278,8 @@ int main(int argc, const char **argv)
             "Creating %d idle connections and waiting forever (Ctrl+C when "
             "done)\n",
             config.numclients);
-        c = createClient("", 0, NULL); /* will never receive a reply */
+        c = createClient("", 0, NULL,
+                         config.threads[0]); /* will never receive a reply */
         createMissingClients(c);
         aeMain(config.el);
         /* and will wait for every */
@@ -903,6 +1422,19 @@ int main(int argc, const char **argv)
             free(cmd);
         }
 
+        /* The mixed workload only runs when explicitly requested. */
+        if ((config.tests && test_is_selected("mixed")) ||
+            (!config.tests && config.mixed)) {
+            char title[64];
+            int reads = (int) (config.read_fraction * 100 + 0.5);
+
+            snprintf(title, sizeof(title), "MIXED (%d%% GET, %d%% SET)", reads,
+                     100 - reads);
+            config.mixed_running = 1;
+            benchmark(title, "", 0);
+            config.mixed_running = 0;
+        }
+
         if (!config.csv)
             printf("\n");
     } while (config.loop);
@@ -201,7 +201,7 @@ int redis_check_rdb(char *rdbfilename)
         return 1;
     }
 
-    startLoading(fp);
+    startLoadingFile(fp);
     while (1) {
         robj *key, *val;
         expiretime = -1;
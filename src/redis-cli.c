@@ -37,6 +37,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <math.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,6 +51,7 @@
 #include <sds.h> /* use sds.h from hiredis, so that only one set of sds functions will be present in the binary */
 #include "ae.h"
 #include "anet.h"
+#include "crc64.h"
 #include "help.h"
 #include "linenoise.h"
 #include "zmalloc.h"
@@ -102,6 +104,8 @@ static struct config {
     int slave_mode;
     int pipe_mode;
     int pipe_timeout;
+    int parallel;   /* Connections used by --pipe, --bigkeys and --memkeys. */
+    int scan_count; /* SCAN COUNT used by --bigkeys and --memkeys. */
     int getrdb_mode;
     int stat_mode;
     int scan_mode;
@@ -110,6 +114,7 @@ static struct config {
     char *pattern;
     char *rdb_filename;
     int bigkeys;
+    int memkeys;
     int stdinarg; /* get last arg from stdin. (-x option) */
     char *auth;
     int output; /* output mode, see OUTPUT_* defines */
@@ -588,6 +593,20 @@ static int cliConnect(int force)
     return REDIS_OK;
 }
 
+/* Open one more connection, authenticated and with the right DB selected,
+ * for the modes that work over several connections. */
+static redisContext *cliConnectParallel(void)
+{
+    redisContext *main = context, *c;
+
+    context = NULL;
+    if (cliConnect(0) == REDIS_ERR)
+        exit(1);
+    c = context;
+    context = main;
+    return c;
+}
+
 static void cliPrintContextError(void)
 {
     if (context == NULL)
@@ -1116,8 +1135,16 @@ static int parseOptions(int argc, char **argv)
             config.pipe_mode = 1;
         } else if (!strcmp(argv[i], "--pipe-timeout") && !lastarg) {
             config.pipe_timeout = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--parallel") && !lastarg) {
+            config.parallel = atoi(argv[++i]);
+            if (config.parallel < 1)
+                config.parallel = 1;
+        } else if (!strcmp(argv[i], "--count") && !lastarg) {
+            config.scan_count = atoi(argv[++i]);
         } else if (!strcmp(argv[i], "--bigkeys")) {
             config.bigkeys = 1;
+        } else if (!strcmp(argv[i], "--memkeys")) {
+            config.memkeys = 1;
         } else if (!strcmp(argv[i], "--eval") && !lastarg) {
             config.eval = argv[++i];
         } else if (!strcmp(argv[i], "--ldb")) {
@@ -1231,7 +1258,17 @@ static void usage(void)
         "sending all data.\n"
         "                     no reply is received within <n> seconds.\n"
         "                     Default timeout: %d. Use 0 to wait forever.\n"
+        "  --parallel <n>     Use <n> connections. With --pipe requests are "
+        "split\n"
+        "                     among them by key hash (RESP input only), with\n"
+        "                     --bigkeys and --memkeys the per key probes are\n"
+        "                     pipelined over them. Default: 1.\n"
+        "  --count <n>        Keys requested to every SCAN call by --bigkeys "
+        "and\n"
+        "                     --memkeys (SCAN COUNT).\n"
         "  --bigkeys          Sample Redis keys looking for big keys.\n"
+        "  --memkeys          Sample Redis keys looking for keys using a lot "
+        "of memory.\n"
         "  --scan             List all keys using the SCAN command.\n"
         "  --pattern <pat>    Useful with --scan to specify a SCAN pattern.\n"
         "  --intrinsic-latency <sec> Run a test to measure intrinsic system "
@@ -1251,6 +1288,7 @@ static void usage(void)
         "\n"
         "Examples:\n"
         "  cat /etc/passwd | redis-cli -x set mypasswd\n"
+        "  cat data.resp | redis-cli --pipe --parallel 8\n"
         "  redis-cli get mypasswd\n"
         "  redis-cli -r 100 lpush mylist x\n"
         "  redis-cli -r 100 -i 1 info | grep used_memory_human:\n"
@@ -2078,6 +2116,278 @@ static void pipeMode(void)
         exit(0);
 }
 
+/*------------------------------------------------------------------------------
+ * Parallel pipe mode
+ *--------------------------------------------------------------------------- */
+
+/* Stop reading the standard input while a connection has more than this
+ * amount of protocol waiting to be written. */
+#define PIPEMODE_PARALLEL_MAX_BUFFER (1024 * 1024)
+
+typedef struct pipeConn {
+    redisContext *context;
+    redisReader *reader;
+    sds obuf;        /* Requests routed to this connection. */
+    size_t obuf_pos; /* Bytes of obuf already written. */
+    char magic[20];  /* Payload of the final ECHO. */
+    int done;        /* Final ECHO reply received. */
+} pipeConn;
+
+/* Parse the multi bulk request at 'p', with 'len' bytes available. Returns
+ * the request length, 0 if the request is not complete yet, or -1 if it is
+ * not a multi bulk request. The first argument after the command name is
+ * returned in 'key' and 'keylen' (NULL if the command has no arguments). */
+static long long pipeParseRequest(char *p,
+                                  size_t len,
+                                  char **key,
+                                  size_t *keylen)
+{
+    char *start = p, *end = p + len, *nl;
+    long long argc, arglen, j;
+
+    *key = NULL;
+    *keylen = 0;
+    /* Empty lines are ignored by the server, just forward them. */
+    while (p < end && (*p == '\r' || *p == '\n'))
+        p++;
+    if (p == end)
+        return 0;
+    if (*p != '*')
+        return -1;
+    if ((nl = memchr(p, '\n', end - p)) == NULL)
+        return 0;
+    argc = strtoll(p + 1, NULL, 10);
+    if (argc <= 0)
+        return -1;
+    p = nl + 1;
+    for (j = 0; j < argc; j++) {
+        if (p == end)
+            return 0;
+        if (*p != '$')
+            return -1;
+        if ((nl = memchr(p, '\n', end - p)) == NULL)
+            return 0;
+        arglen = strtoll(p + 1, NULL, 10);
+        if (arglen < 0)
+            return -1;
+        p = nl + 1;
+        if (end - p < arglen + 2)
+            return 0;
+        if (j == 1) {
+            *key = p;
+            *keylen = arglen;
+        }
+        p += arglen + 2;
+    }
+    return p - start;
+}
+
+/* Route the complete requests in 'ibuf' to the connections, so that all the
+ * requests about the same key are served, in order, by the same connection.
+ * The incomplete tail of the buffer is left in 'ibuf'. */
+static void pipeRouteRequests(pipeConn *conns, int numconns, sds *ibuf)
+{
+    size_t pos = 0, len = sdslen(*ibuf);
+
+    while (pos < len) {
+        char *key;
+        size_t keylen;
+        long long reqlen =
+            pipeParseRequest(*ibuf + pos, len - pos, &key, &keylen);
+        int target = 0;
+
+        if (reqlen == 0)
+            break;
+        if (reqlen == -1) {
+            fprintf(stderr,
+                    "Invalid protocol in the input: --parallel requires "
+                    "multi bulk requests.\n");
+            exit(1);
+        }
+        if (key)
+            target = crc64(0, (unsigned char *) key, keylen) % numconns;
+        conns[target].obuf =
+            sdscatlen(conns[target].obuf, *ibuf + pos, reqlen);
+        pos += reqlen;
+    }
+    sdsrange(*ibuf, pos, -1);
+}
+
+/* Like pipeMode() but over config.parallel connections. */
+static void pipeModeParallel(void)
+{
+    int numconns = config.parallel, eof = 0, j;
+    pipeConn *conns = zcalloc(sizeof(pipeConn) * numconns);
+    struct pollfd *pfd = zmalloc(sizeof(struct pollfd) * (numconns + 1));
+    long long errors = 0, replies = 0;
+    char ibuf[1024 * 16], aneterr[ANET_ERR_LEN];
+    sds input = sdsempty();
+    time_t last_read_time = time(NULL);
+
+    srand(time(NULL));
+    for (j = 0; j < numconns; j++) {
+        conns[j].context = j == 0 ? context : cliConnectParallel();
+        conns[j].reader = redisReaderCreate();
+        conns[j].obuf = sdsempty();
+        if (anetNonBlock(aneterr, conns[j].context->fd) == ANET_ERR) {
+            fprintf(stderr, "Can't set the socket in non blocking mode: %s\n",
+                    aneterr);
+            exit(1);
+        }
+    }
+
+    while (1) {
+        size_t maxpending = 0;
+        int pending_conns = 0;
+
+        for (j = 0; j < numconns; j++) {
+            pipeConn *c = conns + j;
+            size_t pending = sdslen(c->obuf) - c->obuf_pos;
+
+            if (!c->done)
+                pending_conns++;
+            if (pending > maxpending)
+                maxpending = pending;
+            pfd[j].fd = c->context->fd;
+            pfd[j].events = POLLIN | (pending ? POLLOUT : 0);
+            pfd[j].revents = 0;
+        }
+        if (pending_conns == 0) {
+            printf("Last reply received from server.\n");
+            break;
+        }
+        pfd[numconns].fd = STDIN_FILENO;
+        pfd[numconns].events =
+            (!eof && maxpending < PIPEMODE_PARALLEL_MAX_BUFFER) ? POLLIN : 0;
+        pfd[numconns].revents = 0;
+
+        if (poll(pfd, numconns + 1, 1000) == -1 && errno != EINTR) {
+            fprintf(stderr, "poll() error: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        /* Read from stdin and route the requests. */
+        if (pfd[numconns].revents) {
+            ssize_t nread = read(STDIN_FILENO, ibuf, sizeof(ibuf));
+
+            if (nread == -1 && errno != EAGAIN && errno != EINTR) {
+                fprintf(stderr, "Error reading from stdin: %s\n",
+                        strerror(errno));
+                exit(1);
+            } else if (nread == 0) {
+                eof = 1;
+                /* Only empty lines may be left. */
+                if (sdslen(input) != strspn(input, "\r\n")) {
+                    fprintf(stderr, "Incomplete request at end of input.\n");
+                    exit(1);
+                }
+                /* Queue the final ECHO on every connection. */
+                for (j = 0; j < numconns; j++) {
+                    char echo[] =
+                        "\r\n*2\r\n$4\r\nECHO\r\n$"
+                        "20\r\n01234567890123456789\r\n";
+                    int k;
+
+                    for (k = 0; k < 20; k++)
+                        conns[j].magic[k] = rand() & 0xff;
+                    memcpy(echo + 21, conns[j].magic, 20);
+                    conns[j].obuf =
+                        sdscatlen(conns[j].obuf, echo, sizeof(echo) - 1);
+                }
+                printf("All data transferred. Waiting for the last reply...\n");
+            } else if (nread > 0) {
+                input = sdscatlen(input, ibuf, nread);
+                pipeRouteRequests(conns, numconns, &input);
+            }
+        }
+
+        for (j = 0; j < numconns; j++) {
+            pipeConn *c = conns + j;
+            int fd = c->context->fd;
+            redisReply *reply;
+
+            /* Read and consume the replies. */
+            if (pfd[j].revents & (POLLIN | POLLERR | POLLHUP)) {
+                ssize_t nread;
+
+                do {
+                    nread = read(fd, ibuf, sizeof(ibuf));
+                    if (nread == 0 ||
+                        (nread == -1 && errno != EAGAIN && errno != EINTR)) {
+                        fprintf(stderr, "Error reading from the server: %s\n",
+                                nread == 0 ? "connection closed"
+                                           : strerror(errno));
+                        exit(1);
+                    }
+                    if (nread > 0) {
+                        redisReaderFeed(c->reader, ibuf, nread);
+                        last_read_time = time(NULL);
+                    }
+                } while (nread > 0);
+
+                do {
+                    if (redisReaderGetReply(c->reader, (void **) &reply) ==
+                        REDIS_ERR) {
+                        fprintf(stderr, "Error reading replies from server\n");
+                        exit(1);
+                    }
+                    if (reply) {
+                        if (reply->type == REDIS_REPLY_ERROR) {
+                            fprintf(stderr, "%s\n", reply->str);
+                            errors++;
+                        } else if (eof && reply->type == REDIS_REPLY_STRING &&
+                                   reply->len == 20 &&
+                                   memcmp(reply->str, c->magic, 20) == 0) {
+                            c->done = 1;
+                            replies--;
+                        }
+                        replies++;
+                        freeReplyObject(reply);
+                    }
+                } while (reply);
+            }
+
+            /* Write the pending requests. */
+            if (pfd[j].revents & POLLOUT) {
+                ssize_t nwritten = write(fd, c->obuf + c->obuf_pos,
+                                         sdslen(c->obuf) - c->obuf_pos);
+
+                if (nwritten == -1) {
+                    if (errno != EAGAIN && errno != EINTR) {
+                        fprintf(stderr, "Error writing to the server: %s\n",
+                                strerror(errno));
+                        exit(1);
+                    }
+                } else {
+                    c->obuf_pos += nwritten;
+                    if (c->obuf_pos == sdslen(c->obuf)) {
+                        sdsclear(c->obuf);
+                        c->obuf_pos = 0;
+                    }
+                }
+            }
+        }
+
+        if (eof && config.pipe_timeout > 0 &&
+            time(NULL) - last_read_time > config.pipe_timeout) {
+            fprintf(stderr, "No replies for %d seconds: exiting.\n",
+                    config.pipe_timeout);
+            errors++;
+            break;
+        }
+    }
+
+    for (j = 0; j < numconns; j++) {
+        redisReaderFree(conns[j].reader);
+        sdsfree(conns[j].obuf);
+    }
+    zfree(conns);
+    zfree(pfd);
+    sdsfree(input);
+    printf("errors: %lld, replies: %lld\n", errors, replies);
+    exit(errors ? 1 : 0);
+}
+
 /*------------------------------------------------------------------------------
  * Find big keys
  *--------------------------------------------------------------------------- */
@@ -2089,9 +2399,48 @@ static void pipeMode(void)
 #define TYPE_ZSET 4
 #define TYPE_NONE 5
 
+/* Connections used to pipeline the per key probes, probes[0] is the main
+ * context. Key 'i' of every SCAN batch is probed on probes[i % numprobes]. */
+static redisContext **probes;
+static int numprobes;
+
+static void createProbes(void)
+{
+    int j;
+
+    numprobes = config.parallel;
+    probes = zmalloc(sizeof(redisContext *) * numprobes);
+    probes[0] = context;
+    for (j = 1; j < numprobes; j++)
+        probes[j] = cliConnectParallel();
+}
+
+/* Send the commands appended to every probe connection, so that the server
+ * processes them in parallel while we wait for the first replies. */
+static void flushProbes(void)
+{
+    int j, done;
+
+    for (j = 0; j < numprobes; j++) {
+        do {
+            if (redisBufferWrite(probes[j], &done) == REDIS_ERR) {
+                fprintf(stderr, "Error writing to the server: %s\n",
+                        probes[j]->errstr);
+                exit(1);
+            }
+        } while (!done);
+    }
+}
+
 static redisReply *sendScan(unsigned long long *it)
 {
-    redisReply *reply = redisCommand(context, "SCAN %llu", *it);
+    redisReply *reply;
+
+    if (config.scan_count > 0)
+        reply = redisCommand(context, "SCAN %llu COUNT %d", *it,
+                             config.scan_count);
+    else
+        reply = redisCommand(context, "SCAN %llu", *it);
 
     /* Handle any error conditions */
     if (reply == NULL) {
@@ -2164,14 +2513,19 @@ static void getKeyTypes(redisReply *keys, int *types)
 
     /* Pipeline TYPE commands */
     for (i = 0; i < keys->elements; i++) {
-        redisAppendCommand(context, "TYPE %s", keys->element[i]->str);
+        redisAppendCommand(probes[i % numprobes], "TYPE %b",
+                           keys->element[i]->str,
+                           (size_t) keys->element[i]->len);
     }
+    flushProbes();
 
     /* Retrieve types */
     for (i = 0; i < keys->elements; i++) {
-        if (redisGetReply(context, (void **) &reply) != REDIS_OK) {
+        redisContext *c = probes[i % numprobes];
+
+        if (redisGetReply(c, (void **) &reply) != REDIS_OK) {
             fprintf(stderr, "Error getting type for key '%s' (%d: %s)\n",
-                    keys->element[i]->str, context->err, context->errstr);
+                    keys->element[i]->str, c->err, c->errstr);
             exit(1);
         } else if (reply->type != REDIS_REPLY_STATUS) {
             if (reply->type == REDIS_REPLY_ERROR) {
@@ -2189,7 +2543,12 @@ static void getKeyTypes(redisReply *keys, int *types)
     }
 }
 
-static void getKeySizes(redisReply *keys, int *types, unsigned long long *sizes)
+/* Get the size of the keys: the number of elements (or the length of
+ * strings), or the memory used by the key if 'memkeys' is true. */
+static void getKeySizes(redisReply *keys,
+                        int *types,
+                        unsigned long long *sizes,
+                        int memkeys)
 {
     redisReply *reply;
     char *sizecmds[] = {"STRLEN", "LLEN", "SCARD", "HLEN", "ZCARD"};
@@ -2201,9 +2560,16 @@ static void getKeySizes(redisReply *keys, int *types, unsigned long long *sizes)
         if (types[i] == TYPE_NONE)
             continue;
 
-        redisAppendCommand(context, "%s %s", sizecmds[types[i]],
-                           keys->element[i]->str);
+        if (memkeys)
+            redisAppendCommand(probes[i % numprobes], "MEMORY USAGE %b",
+                               keys->element[i]->str,
+                               (size_t) keys->element[i]->len);
+        else
+            redisAppendCommand(probes[i % numprobes], "%s %b",
+                               sizecmds[types[i]], keys->element[i]->str,
+                               (size_t) keys->element[i]->len);
     }
+    flushProbes();
 
     /* Retreive sizes */
     for (i = 0; i < keys->elements; i++) {
@@ -2214,10 +2580,18 @@ static void getKeySizes(redisReply *keys, int *types, unsigned long long *sizes)
         }
 
         /* Retreive size */
-        if (redisGetReply(context, (void **) &reply) != REDIS_OK) {
+        if (redisGetReply(probes[i % numprobes], (void **) &reply) !=
+            REDIS_OK) {
             fprintf(stderr, "Error getting size for key '%s' (%d: %s)\n",
-                    keys->element[i]->str, context->err, context->errstr);
+                    keys->element[i]->str, probes[i % numprobes]->err,
+                    probes[i % numprobes]->errstr);
             exit(1);
+        } else if (memkeys && reply->type == REDIS_REPLY_ERROR) {
+            fprintf(stderr, "MEMORY USAGE failed: %s\n", reply->str);
+            exit(1);
+        } else if (reply->type == REDIS_REPLY_NIL) {
+            /* The key was deleted after TYPE. */
+            sizes[i] = 0;
         } else if (reply->type != REDIS_REPLY_INTEGER) {
             /* Theoretically the key could have been removed and
              * added as a different type between TYPE and SIZE */
@@ -2233,7 +2607,7 @@ static void getKeySizes(redisReply *keys, int *types, unsigned long long *sizes)
     }
 }
 
-static void findBigKeys(void)
+static void findBigKeys(int memkeys)
 {
     unsigned long long biggest[5] = {0}, counts[5] = {0}, totalsize[5] = {0};
     unsigned long long sampled = 0, total_keys, totlen = 0, *sizes = NULL,
@@ -2241,6 +2615,7 @@ static void findBigKeys(void)
     sds maxkeys[5] = {0};
     char *typename[] = {"string", "list", "set", "hash", "zset"};
     char *typeunit[] = {"bytes", "items", "members", "fields", "members"};
+    char *memunit[] = {"bytes", "bytes", "bytes", "bytes", "bytes"};
     redisReply *reply, *keys;
     unsigned int arrsize = 0, i;
     int type, *types = NULL;
@@ -2248,10 +2623,13 @@ static void findBigKeys(void)
 
     /* Total keys pre scanning */
     total_keys = getDbSize();
+    createProbes();
+    if (memkeys)
+        memcpy(typeunit, memunit, sizeof(typeunit));
 
     /* Status message */
-    printf(
-        "\n# Scanning the entire keyspace to find biggest keys as well as\n");
+    printf("\n# Scanning the entire keyspace to find %s keys as well as\n",
+           memkeys ? "the most memory hungry" : "biggest");
     printf(
         "# average sizes per key type.  You can use -i 0.1 to sleep 0.1 sec\n");
     printf("# per 100 SCAN commands (not usually needed).\n\n");
@@ -2291,7 +2669,7 @@ static void findBigKeys(void)
 
         /* Retreive types and then sizes */
         getKeyTypes(keys, types);
-        getKeySizes(keys, types, sizes);
+        getKeySizes(keys, types, sizes, memkeys);
 
         /* Now update our stats */
         for (i = 0; i < keys->elements; i++) {
@@ -2367,6 +2745,9 @@ static void findBigKeys(void)
     for (i = 0; i < TYPE_NONE; i++) {
         sdsfree(maxkeys[i]);
     }
+    for (i = 1; i < (unsigned int) numprobes; i++)
+        redisFree(probes[i]);
+    zfree(probes);
 
     /* Success! */
     exit(0);
@@ -2766,6 +3147,9 @@ int main(int argc, char **argv)
     config.pipe_mode = 0;
     config.pipe_timeout = REDIS_CLI_DEFAULT_PIPE_TIMEOUT;
     config.bigkeys = 0;
+    config.memkeys = 0;
+    config.parallel = 1;
+    config.scan_count = 0;
     config.stdinarg = 0;
     config.auth = NULL;
     config.eval = NULL;
@@ -2822,14 +3206,16 @@ int main(int argc, char **argv)
     if (config.pipe_mode) {
         if (cliConnect(0) == REDIS_ERR)
             exit(1);
+        if (config.parallel > 1)
+            pipeModeParallel();
         pipeMode();
     }
 
     /* Find big keys */
-    if (config.bigkeys) {
+    if (config.bigkeys || config.memkeys) {
         if (cliConnect(0) == REDIS_ERR)
             exit(1);
-        findBigKeys();
+        findBigKeys(config.memkeys);
     }
 
     /* Stat mode */
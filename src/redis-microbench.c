@@ -0,0 +1,810 @@
+/*
+ * Microbenchmarks for the core data structures.
+ *
+ * Like the "redis-server test <name>" hooks, the benchmarks are part of the
+ * Redis executable and run when it is invoked with the redis-microbench alias,
+ * so that they exercise exactly the code linked in the server:
+ *
+ *   redis-microbench [--sizes 1000,100000] [--threads 1,2,4,8]
+ *                    [--duration <ms>] [--csv] [<benchmark> ...]
+ *
+ * Every line reports the time per operation and the number of zmalloc
+ * allocations per operation for a given benchmark, data set size and number
+ * of threads.
+ */
+
+#include "server.h"
+#include "lzf.h"
+
+#include <pthread.h>
+
+void createSharedObjects(void);
+
+#define MB_DEFAULT_DURATION 500 /* ms, for the concurrent benchmarks. */
+#define MB_MAX_THREADS 64
+
+static struct {
+    unsigned long sizes[16];
+    int numsizes;
+    int threads[16];
+    int numthreads;
+    long long duration;
+    int csv;
+} mb;
+
+/* ----------------------------- Reporting --------------------------------- */
+
+typedef struct mbTimer {
+    long long start;
+    size_t allocs;
+} mbTimer;
+
+static void mbStart(mbTimer *t)
+{
+    t->allocs = zmalloc_allocation_count();
+    t->start = ustime();
+}
+
+/* Report a result, allocs < 0 means the allocations can't be attributed. */
+static void mbReport(const char *name,
+                     unsigned long size,
+                     int threads,
+                     unsigned long ops,
+                     long long elapsed_us,
+                     double allocs)
+{
+    double nsop = ops ? (double) elapsed_us * 1000 / ops : 0;
+
+    if (mb.csv) {
+        if (allocs < 0)
+            printf("\"%s\",%lu,%d,%.2f,\n", name, size, threads, nsop);
+        else
+            printf("\"%s\",%lu,%d,%.2f,%.2f\n", name, size, threads, nsop,
+                   allocs);
+    } else {
+        if (allocs < 0)
+            printf("%-24s %10lu %7d %12.2f %10s\n", name, size, threads, nsop,
+                   "-");
+        else
+            printf("%-24s %10lu %7d %12.2f %10.2f\n", name, size, threads,
+                   nsop, allocs);
+    }
+    fflush(stdout);
+}
+
+static void mbStop(mbTimer *t,
+                   const char *name,
+                   unsigned long size,
+                   unsigned long ops)
+{
+    long long elapsed = ustime() - t->start;
+    size_t allocs = zmalloc_allocation_count() - t->allocs;
+
+    mbReport(name, size, 1, ops, elapsed, ops ? (double) allocs / ops : 0);
+}
+
+static uint64_t mbRandom(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static sds *mbCreateKeys(unsigned long n)
+{
+    sds *keys = zmalloc(sizeof(sds) * n);
+    unsigned long j;
+
+    for (j = 0; j < n; j++)
+        keys[j] = sdscatprintf(sdsempty(), "key:%lu", j);
+    return keys;
+}
+
+static void mbFreeKeys(sds *keys, unsigned long n)
+{
+    unsigned long j;
+
+    for (j = 0; j < n; j++)
+        sdsfree(keys[j]);
+    zfree(keys);
+}
+
+/* Values are never shared: the refcount of shared objects isn't atomic. */
+static robj *mbCreateValue(void)
+{
+    return createObject(OBJ_STRING, sdsnew("value"));
+}
+
+/* ----------------------------- q_dict / dict ----------------------------- */
+
+static void mbEmptyCallback(void *privdata)
+{
+    UNUSED(privdata);
+}
+
+static q_dict *mbCreateQDict(void)
+{
+    q_dict *d = zmalloc(sizeof(*d));
+
+    d->table =
+        cds_lfht_new(1, 1, 0, CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
+    d->size = 0;
+    d->type = NULL;
+    d->privdata = NULL;
+    d->keyindex = NULL;
+    return d;
+}
+
+static void mbReleaseQDict(q_dict *d)
+{
+    q_dictEmpty(d, mbEmptyCallback, false);
+    rcu_barrier();
+    cds_lfht_destroy(d->table, NULL);
+    zfree(d);
+}
+
+static void mbQDict(unsigned long n)
+{
+    sds *keys = mbCreateKeys(n);
+    q_dict *d = mbCreateQDict();
+    q_dictIterator *di;
+    unsigned long j, found = 0;
+    mbTimer t;
+
+    mbStart(&t);
+    for (j = 0; j < n; j++)
+        q_dictAdd(d, sdsdup(keys[j]), mbCreateValue());
+    mbStop(&t, "qdict_insert", n, n);
+
+    mbStart(&t);
+    for (j = 0; j < n; j++) {
+        rcu_read_lock();
+        if (q_dictFind(d, keys[j]))
+            found++;
+        rcu_read_unlock();
+    }
+    mbStop(&t, "qdict_lookup", n, n);
+    serverAssert(found == n);
+
+    mbStart(&t);
+    rcu_read_lock();
+    di = q_dictGetIterator(d);
+    for (j = 0; q_dictNext(di) != NULL; j++)
+        ;
+    q_dictReleaseIterator(di);
+    rcu_read_unlock();
+    mbStop(&t, "qdict_iterate", n, j);
+
+    mbStart(&t);
+    for (j = 0; j < n; j++)
+        q_dictDelete(d, keys[j], false);
+    mbStop(&t, "qdict_delete", n, n);
+
+    /* Entries are reclaimed by the RCU threads, outside of the timing. */
+    mbReleaseQDict(d);
+    mbFreeKeys(keys, n);
+}
+
+static void mbDict(unsigned long n)
+{
+    sds *keys = mbCreateKeys(n);
+    dict *d = dictCreate(&dbDictType, NULL);
+    dictIterator *di;
+    unsigned long j, found = 0;
+    mbTimer t;
+
+    mbStart(&t);
+    for (j = 0; j < n; j++)
+        dictAdd(d, sdsdup(keys[j]), mbCreateValue());
+    mbStop(&t, "dict_insert", n, n);
+
+    mbStart(&t);
+    for (j = 0; j < n; j++)
+        if (dictFind(d, keys[j]))
+            found++;
+    mbStop(&t, "dict_lookup", n, n);
+    serverAssert(found == n);
+
+    mbStart(&t);
+    di = dictGetIterator(d);
+    for (j = 0; dictNext(di) != NULL; j++)
+        ;
+    dictReleaseIterator(di);
+    mbStop(&t, "dict_iterate", n, j);
+
+    mbStart(&t);
+    for (j = 0; j < n; j++)
+        dictDelete(d, keys[j]);
+    mbStop(&t, "dict_delete", n, n);
+
+    dictRelease(d);
+    mbFreeKeys(keys, n);
+}
+
+/* ----------------------------- Concurrent q_dict ------------------------- */
+
+typedef struct mbRcuThread {
+    pthread_t thread;
+    q_dict *d;
+    sds *keys;
+    unsigned long n;
+    uint64_t seed;
+    unsigned long ops;
+} mbRcuThread;
+
+static volatile int mb_rcu_stop;
+
+static void *mbRcuReader(void *arg)
+{
+    mbRcuThread *t = arg;
+
+    rcu_register_thread();
+    while (!mb_rcu_stop) {
+        int j;
+
+        /* Check the stop flag every few lookups only. */
+        for (j = 0; j < 64; j++) {
+            q_dictEntry *de;
+
+            rcu_read_lock();
+            de = q_dictFind(t->d, t->keys[mbRandom(&t->seed) % t->n]);
+            serverAssert(de != NULL && de->v.val != NULL);
+            rcu_read_unlock();
+        }
+        t->ops += 64;
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* The writer replaces random keys, so the readers always find them while
+ * the replaced entries go through call_rcu(). */
+static void *mbRcuWriter(void *arg)
+{
+    mbRcuThread *t = arg;
+
+    rcu_register_thread();
+    while (!mb_rcu_stop) {
+        sds key = t->keys[mbRandom(&t->seed) % t->n];
+
+        q_dictAdd(t->d, sdsdup(key), mbCreateValue());
+        t->ops++;
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void mbQDictConcurrent(unsigned long n, int readers, int writer)
+{
+    sds *keys = mbCreateKeys(n);
+    q_dict *d = mbCreateQDict();
+    mbRcuThread threads[MB_MAX_THREADS + 1];
+    unsigned long j, reads = 0;
+    long long start, elapsed;
+    size_t allocs;
+    int nthreads = readers + (writer ? 1 : 0);
+
+    for (j = 0; j < n; j++)
+        q_dictAdd(d, sdsdup(keys[j]), mbCreateValue());
+
+    mb_rcu_stop = 0;
+    allocs = zmalloc_allocation_count();
+    start = ustime();
+    for (j = 0; j < (unsigned long) nthreads; j++) {
+        mbRcuThread *t = threads + j;
+
+        t->d = d;
+        t->keys = keys;
+        t->n = n;
+        t->seed = 0x9E3779B97F4A7C15ULL * (j + 1);
+        t->ops = 0;
+        pthread_create(&t->thread, NULL,
+                       (int) j < readers ? mbRcuReader : mbRcuWriter, t);
+    }
+    usleep(mb.duration * 1000);
+    mb_rcu_stop = 1;
+    for (j = 0; j < (unsigned long) nthreads; j++)
+        pthread_join(threads[j].thread, NULL);
+    elapsed = ustime() - start;
+    allocs = zmalloc_allocation_count() - allocs;
+
+    /* Time per lookup as seen by every reader thread. */
+    for (j = 0; j < (unsigned long) readers; j++)
+        reads += threads[j].ops;
+    mbReport(writer ? "qdict_rcu_read" : "qdict_mt_lookup", n, readers,
+             reads / readers, elapsed, writer ? -1 : (double) allocs / reads);
+    if (writer)
+        mbReport("qdict_rcu_write", n, readers, threads[readers].ops, elapsed,
+                 (double) allocs / threads[readers].ops);
+
+    mbReleaseQDict(d);
+    mbFreeKeys(keys, n);
+}
+
+static void mbQDictMt(unsigned long n)
+{
+    int j;
+
+    for (j = 0; j < mb.numthreads; j++)
+        mbQDictConcurrent(n, mb.threads[j], 0);
+}
+
+static void mbQDictRcu(unsigned long n)
+{
+    int j;
+
+    for (j = 0; j < mb.numthreads; j++)
+        mbQDictConcurrent(n, mb.threads[j], 1);
+}
+
+/* ----------------------------- zskiplist --------------------------------- */
+
+static void mbZskiplist(unsigned long n)
+{
+    zskiplist *zsl = zslCreate();
+    robj **objs = zmalloc(sizeof(robj *) * n);
+    double *scores = zmalloc(sizeof(double) * n);
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    unsigned long j, found = 0, ranged = 0;
+    mbTimer t;
+
+    for (j = 0; j < n; j++) {
+        sds ele = sdscatprintf(sdsempty(), "element:%lu", j);
+
+        objs[j] = createObject(OBJ_STRING, ele);
+        scores[j] = (double) (mbRandom(&seed) % (n * 10));
+    }
+
+    /* The skiplist takes a reference, keep ours to delete the nodes later. */
+    mbStart(&t);
+    for (j = 0; j < n; j++) {
+        incrRefCount(objs[j]);
+        zslInsert(zsl, scores[j], objs[j]);
+    }
+    mbStop(&t, "zsl_insert", n, n);
+
+    mbStart(&t);
+    for (j = 0; j < n; j++)
+        if (zslGetRank(zsl, scores[j], objs[j]))
+            found++;
+    mbStop(&t, "zsl_rank", n, n);
+    serverAssert(found == n);
+
+    /* ZRANGEBYSCORE <score> +inf LIMIT 0 10 */
+    mbStart(&t);
+    for (j = 0; j < n; j++) {
+        zrangespec range = {scores[j], (double) n * 10, 0, 0};
+        zskiplistNode *ln = zslFirstInRange(zsl, &range);
+        int k;
+
+        for (k = 0; ln && k < 10; k++) {
+            ranged++;
+            ln = ln->level[0].forward;
+        }
+    }
+    mbStop(&t, "zsl_range_10", n, n);
+    serverAssert(ranged >= n);
+
+    mbStart(&t);
+    for (j = 0; j < n; j++)
+        zslDelete(zsl, scores[j], objs[j]);
+    mbStop(&t, "zsl_delete", n, n);
+
+    for (j = 0; j < n; j++)
+        decrRefCount(objs[j]);
+    zfree(objs);
+    zfree(scores);
+    zslFree(zsl);
+}
+
+/* ----------------------------- Hash functions ---------------------------- */
+
+/* The 32 bit MurmurHash2 the dicts used before SipHash, for comparison. */
+static uint64_t mbMurmurHash2(const void *key, int len)
+{
+    const uint32_t m = 0x5bd1e995;
+    const unsigned char *data = key;
+    uint32_t h = 5381 ^ len;
+
+    while (len >= 4) {
+        uint32_t k;
+
+        memcpy(&k, data, sizeof(k));
+        k *= m;
+        k ^= k >> 24;
+        k *= m;
+        h *= m;
+        h ^= k;
+        data += 4;
+        len -= 4;
+    }
+    switch (len) {
+    case 3:
+        h ^= data[2] << 16;
+        /* fall through */
+    case 2:
+        h ^= data[1] << 8;
+        /* fall through */
+    case 1:
+        h ^= data[0];
+        h *= m;
+    }
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+static uint64_t mbSipHash(const void *key, int len)
+{
+    return dictGenHashFunction(key, len);
+}
+
+#define MB_HASH_CHUNK 65536        /* Keys generated, then hashed, at once. */
+#define MB_HASH_MAX_BUCKET_BITS 26 /* Up to 64M counters per distribution. */
+
+/* Chi-square of the distribution over the buckets divided by its degrees of
+ * freedom: close to 1 for a uniform hash whatever the number of keys. */
+static double mbHashChi2(uint32_t *counts, unsigned long buckets, unsigned long n)
+{
+    double expected = (double) n / buckets, chi2 = 0;
+    unsigned long j;
+
+    for (j = 0; j < buckets; j++) {
+        double d = counts[j] - expected;
+
+        chi2 += d * d / expected;
+    }
+    return chi2 / (buckets - 1);
+}
+
+/* Hash the names "key:0" ... "key:<n-1>", as a keyspace filled with
+ * DEBUG POPULATE, and count where they fall among as many buckets as keys
+ * (up to 2^MB_HASH_MAX_BUCKET_BITS): with the low bits of the hash, the
+ * index of a dict bucket, and with the high ones, that order the
+ * split-ordered lists of q_dict. Only the hashing is timed, so sizes of
+ * 100M to 1G keys only take time, not memory. */
+static void mbHashFunction(const char *name,
+                           uint64_t (*hash)(const void *key, int len),
+                           unsigned long n)
+{
+    char(*keys)[24] = zmalloc(sizeof(*keys) * MB_HASH_CHUNK);
+    int *lens = zmalloc(sizeof(int) * MB_HASH_CHUNK);
+    uint64_t *hashes = zmalloc(sizeof(uint64_t) * MB_HASH_CHUNK);
+    unsigned long j, k, chunk, maxlow = 0, maxhigh = 0;
+    unsigned long buckets;
+    uint32_t *low, *high;
+    long long elapsed = 0, start;
+    int bits = 1;
+
+    while (bits < MB_HASH_MAX_BUCKET_BITS && (1UL << bits) < n)
+        bits++;
+    buckets = 1UL << bits;
+    low = zcalloc(sizeof(uint32_t) * buckets);
+    high = zcalloc(sizeof(uint32_t) * buckets);
+
+    for (j = 0; j < n; j += chunk) {
+        chunk = (n - j < MB_HASH_CHUNK) ? n - j : MB_HASH_CHUNK;
+        for (k = 0; k < chunk; k++) {
+            memcpy(keys[k], "key:", 4);
+            lens[k] = 4 + ll2string(keys[k] + 4, 20, (long long) (j + k));
+        }
+
+        start = ustime();
+        for (k = 0; k < chunk; k++)
+            hashes[k] = hash(keys[k], lens[k]);
+        elapsed += ustime() - start;
+
+        for (k = 0; k < chunk; k++) {
+            low[hashes[k] & (buckets - 1)]++;
+            high[hashes[k] >> (64 - bits)]++;
+        }
+    }
+    for (j = 0; j < buckets; j++) {
+        if (low[j] > maxlow)
+            maxlow = low[j];
+        if (high[j] > maxhigh)
+            maxhigh = high[j];
+    }
+
+    mbReport(name, n, 1, n, elapsed, -1);
+    printf("%s  2^%d buckets, %.2f keys per bucket: low bits chi2/df %.3f "
+           "max %lu, high bits chi2/df %.3f max %lu\n",
+           mb.csv ? "#" : "", bits, (double) n / buckets,
+           mbHashChi2(low, buckets, n), maxlow, mbHashChi2(high, buckets, n),
+           maxhigh);
+    fflush(stdout);
+
+    zfree(keys);
+    zfree(lens);
+    zfree(hashes);
+    zfree(low);
+    zfree(high);
+}
+
+static void mbHash(unsigned long n)
+{
+    mbHashFunction("hash_siphash", mbSipHash, n);
+    mbHashFunction("hash_murmur2_32", mbMurmurHash2, n);
+}
+
+/* ----------------------------- crc64 / lzf ------------------------------- */
+
+/* Buffer sizes are fixed: these benchmarks don't depend on --sizes. */
+static unsigned long mb_buffer_sizes[] = {64, 1024, 16384, 262144};
+
+/* Somewhat compressible data: random words from a small dictionary. */
+static unsigned char *mbCreateBuffer(size_t len)
+{
+    static const char *words[] = {"redis ", "key ", "value ", "thread ",
+                                  "worker ", "slot ", "12345 ", "cluster "};
+    unsigned char *buf = zmalloc(len);
+    uint64_t seed = 88172645463325252ULL;
+    size_t j = 0;
+
+    while (j < len) {
+        const char *w = words[mbRandom(&seed) % 8];
+        size_t l = strlen(w);
+
+        if (l > len - j)
+            l = len - j;
+        memcpy(buf + j, w, l);
+        j += l;
+    }
+    return buf;
+}
+
+static unsigned long mbIterations(size_t len)
+{
+    unsigned long iter = (64 * 1024 * 1024) / len;
+
+    return iter < 100 ? 100 : iter;
+}
+
+static void mbCrc64(unsigned long n)
+{
+    size_t k;
+    UNUSED(n);
+
+    for (k = 0; k < sizeof(mb_buffer_sizes) / sizeof(unsigned long); k++) {
+        size_t len = mb_buffer_sizes[k];
+        unsigned char *buf = mbCreateBuffer(len);
+        unsigned long j, iter = mbIterations(len);
+        uint64_t crc = 0;
+        mbTimer t;
+
+        mbStart(&t);
+        for (j = 0; j < iter; j++)
+            crc = crc64(crc, buf, len);
+        mbStop(&t, "crc64", len, iter);
+        zfree(buf);
+        if (crc == 0)
+            printf("(crc64 is zero)\n"); /* Keep the loop alive. */
+    }
+}
+
+static void mbLzf(unsigned long n)
+{
+    size_t k;
+    UNUSED(n);
+
+    for (k = 0; k < sizeof(mb_buffer_sizes) / sizeof(unsigned long); k++) {
+        size_t len = mb_buffer_sizes[k];
+        unsigned char *buf = mbCreateBuffer(len);
+        unsigned char *comp = zmalloc(len);
+        unsigned char *out = zmalloc(len);
+        unsigned long j, iter = mbIterations(len);
+        unsigned int clen = 0;
+        mbTimer t;
+
+        mbStart(&t);
+        for (j = 0; j < iter; j++)
+            clen = lzf_compress(buf, len, comp, len - 1);
+        mbStop(&t, "lzf_compress", len, iter);
+
+        if (clen != 0) {
+            mbStart(&t);
+            for (j = 0; j < iter; j++)
+                serverAssert(lzf_decompress(comp, clen, out, len) == len);
+            mbStop(&t, "lzf_decompress", len, iter);
+        }
+        zfree(buf);
+        zfree(comp);
+        zfree(out);
+    }
+}
+
+/* ----------------------------- Reply building ---------------------------- */
+
+/* A client without a connection that accumulates replies like the Lua one. */
+static client *mbCreateReplyClient(void)
+{
+    client *c = zcalloc(sizeof(*c));
+
+    c->flags = CLIENT_LUA;
+    c->reply = listCreate();
+    listSetFreeMethod(c->reply, decrRefCountVoid);
+    listSetDupMethod(c->reply, dupClientReplyValue);
+    return c;
+}
+
+static void mbResetReplyClient(client *c)
+{
+    while (listLength(c->reply))
+        listDelNode(c->reply, listFirst(c->reply));
+    c->reply_bytes = 0;
+    c->bufpos = 0;
+}
+
+/* Replies are built like the ones of LRANGE/MGET: a multi bulk header and
+ * 'n' bulk strings, so large replies move from the static buffer to the
+ * reply list. */
+static void mbReply(unsigned long n)
+{
+    client *c = mbCreateReplyClient();
+    unsigned long j, k, iter = 1000000 / n;
+    char value[16];
+    mbTimer t;
+
+    memset(value, 'x', sizeof(value));
+    if (iter < 10)
+        iter = 10;
+
+    mbStart(&t);
+    for (j = 0; j < iter; j++) {
+        addReplyMultiBulkLen(c, n);
+        for (k = 0; k < n; k++)
+            addReplyBulkCBuffer(c, value, sizeof(value));
+        mbResetReplyClient(c);
+    }
+    mbStop(&t, "reply_bulk", n, iter * n);
+
+    mbStart(&t);
+    for (j = 0; j < iter; j++) {
+        addReplyMultiBulkLen(c, n);
+        for (k = 0; k < n; k++)
+            addReplyLongLong(c, (long long) (k * 1000003));
+        mbResetReplyClient(c);
+    }
+    mbStop(&t, "reply_longlong", n, iter * n);
+
+    mbResetReplyClient(c);
+    listRelease(c->reply);
+    zfree(c);
+}
+
+/* ----------------------------- Main -------------------------------------- */
+
+static struct mbBenchmark {
+    char *name;
+    void (*proc)(unsigned long size);
+    int sized; /* Run once for every --sizes value. */
+} mbBenchmarks[] = {{"qdict", mbQDict, 1},
+                    {"dict", mbDict, 1},
+                    {"qdict-mt", mbQDictMt, 1},
+                    {"qdict-rcu", mbQDictRcu, 1},
+                    {"zskiplist", mbZskiplist, 1},
+                    {"hash", mbHash, 1},
+                    {"crc64", mbCrc64, 0},
+                    {"lzf", mbLzf, 0},
+                    {"reply", mbReply, 1},
+                    {NULL, NULL, 0}};
+
+static void mbUsage(char *prog)
+{
+    struct mbBenchmark *b;
+
+    fprintf(stderr,
+            "Usage: %s [--sizes <n,n,...>] [--threads <n,n,...>] "
+            "[--duration <ms>]\n"
+            "          [--csv] [<benchmark> ...]\n\n"
+            "Benchmarks:",
+            prog);
+    for (b = mbBenchmarks; b->name; b++)
+        fprintf(stderr, " %s", b->name);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static int mbParseList(const char *arg, unsigned long *out, int max)
+{
+    int count = 0;
+    char *p = (char *) arg;
+
+    while (*p && count < max) {
+        char *end;
+        unsigned long v = strtoul(p, &end, 10);
+
+        if (end == p || v == 0)
+            return -1;
+        out[count++] = v;
+        p = (*end == ',') ? end + 1 : end;
+        if (*end && *end != ',')
+            return -1;
+    }
+    return count ? count : -1;
+}
+
+/* Called from main() when the executable is named redis-microbench. */
+int redis_microbench_main(int argc, char **argv)
+{
+    unsigned long threads[16];
+    struct mbBenchmark *b;
+    int j, k, selected = 0;
+
+    mb.sizes[0] = 1000;
+    mb.sizes[1] = 100000;
+    mb.sizes[2] = 1000000;
+    mb.numsizes = 3;
+    mb.threads[0] = 1;
+    mb.threads[1] = 2;
+    mb.threads[2] = 4;
+    mb.threads[3] = 8;
+    mb.numthreads = 4;
+    mb.duration = MB_DEFAULT_DURATION;
+    mb.csv = 0;
+
+    for (j = 1; j < argc; j++) {
+        int lastarg = (j == argc - 1);
+
+        if (!strcmp(argv[j], "--sizes") && !lastarg) {
+            mb.numsizes = mbParseList(argv[++j], mb.sizes, 16);
+            if (mb.numsizes < 0)
+                mbUsage(argv[0]);
+        } else if (!strcmp(argv[j], "--threads") && !lastarg) {
+            mb.numthreads = mbParseList(argv[++j], threads, 16);
+            if (mb.numthreads < 0)
+                mbUsage(argv[0]);
+            for (k = 0; k < mb.numthreads; k++) {
+                if (threads[k] > MB_MAX_THREADS)
+                    mbUsage(argv[0]);
+                mb.threads[k] = threads[k];
+            }
+        } else if (!strcmp(argv[j], "--duration") && !lastarg) {
+            mb.duration = strtoll(argv[++j], NULL, 10);
+            if (mb.duration <= 0)
+                mbUsage(argv[0]);
+        } else if (!strcmp(argv[j], "--csv")) {
+            mb.csv = 1;
+        } else if (argv[j][0] == '-') {
+            mbUsage(argv[0]);
+        } else {
+            for (b = mbBenchmarks; b->name; b++)
+                if (!strcasecmp(b->name, argv[j]))
+                    break;
+            if (b->name == NULL)
+                mbUsage(argv[0]);
+            selected = 1;
+        }
+    }
+
+    createSharedObjects();
+    rcu_register_thread();
+    zmalloc_enable_allocation_count(1);
+
+    if (mb.csv)
+        printf("benchmark,size,threads,ns_per_op,allocs_per_op\n");
+    else
+        printf("%-24s %10s %7s %12s %10s\n", "benchmark", "size", "threads",
+               "ns/op", "allocs/op");
+
+    for (b = mbBenchmarks; b->name; b++) {
+        if (selected) {
+            for (j = 1; j < argc; j++)
+                if (!strcasecmp(b->name, argv[j]))
+                    break;
+            if (j == argc)
+                continue;
+        }
+        if (!b->sized) {
+            b->proc(0);
+            continue;
+        }
+        for (k = 0; k < mb.numsizes; k++)
+            b->proc(mb.sizes[k]);
+    }
+    exit(0);
+}
@@ -966,6 +966,54 @@ class RedisTrib
         end
     end
 
+    # Move the slots listed in 'moves' (hashes with :source and :slot) to
+    # 'target' using CLUSTER MIGRATESLOT: the source node streams the whole
+    # slot to the target by itself, without a round trip for every batch of
+    # keys. Up to 'parallel' slots are moved at the same time.
+    def move_slots_streaming(moves,target,parallel,o={})
+        parallel = 1 if parallel < 1
+        moves.each_slice(parallel){|batch|
+            batch.each{|e|
+                slot = e[:slot]
+                target.r.cluster("setslot",slot,"importing",e[:source].info[:name])
+                e[:source].r.cluster("setslot",slot,"migrating",target.info[:name])
+                args = ["migrateslot",slot,"timeout",@timeout]
+                e[:source].r.cluster(*args)
+            }
+
+            pending = batch.dup
+            while pending.length > 0
+                sleep 0.1
+                pending.reject!{|e|
+                    status = e[:source].r.cluster("migrateslot","status").find{|s|
+                        s.start_with?("slot=#{e[:slot]} ")
+                    }
+                    if !status || status =~ / state=failed/
+                        puts ""
+                        xputs "[ERR] Moving slot #{e[:slot]}: #{status}"
+                        exit 1
+                    end
+                    status =~ / state=done/
+                }
+            end
+
+            # Set the new node as the owner of the slots in all the known nodes.
+            batch.each{|e|
+                @nodes.each{|n|
+                    next if n.has_flag?("slave")
+                    n.r.cluster("setslot",e[:slot],"node",target.info[:name])
+                }
+                if o[:update]
+                    e[:source].info[:slots].delete(e[:slot])
+                    target.info[:slots][e[:slot]] = true
+                end
+                print "#" if o[:dots]
+            }
+            STDOUT.flush
+        }
+        puts if o[:dots]
+    end
+
     # redis-trib subcommands implementations.
 
     def check_cluster_cmd(argv,opt)
@@ -1110,6 +1158,11 @@ class RedisTrib
                 end
                 if opt['simulate']
                     print "#"*reshard_table.length
+                elsif opt['stream']
+                    move_slots_streaming(reshard_table,dst,opt['stream'].to_i,
+                        :update=>true)
+                    print "#"*reshard_table.length
+                    STDOUT.flush
                 else
                     reshard_table.each{|e|
                         move_slot(e[:source],dst,e[:slot],
@@ -1254,6 +1307,11 @@ class RedisTrib
             yesno = STDIN.gets.chop
             exit(1) if (yesno != "yes")
         end
+        if opt['stream']
+            move_slots_streaming(reshard_table,target,opt['stream'].to_i,
+                :dots=>true)
+            return
+        end
         reshard_table.each{|e|
             move_slot(e[:source],target,e[:slot],
                 :dots=>true,
@@ -1661,8 +1719,8 @@ ALLOWED_OPTIONS={
     "create" => {"replicas" => true},
     "add-node" => {"slave" => false, "master-id" => true},
     "import" => {"from" => :required, "copy" => false, "replace" => false},
-    "reshard" => {"from" => true, "to" => true, "slots" => true, "yes" => false, "timeout" => true, "pipeline" => true},
-    "rebalance" => {"weight" => [], "auto-weights" => false, "use-empty-masters" => false, "timeout" => true, "simulate" => false, "pipeline" => true, "threshold" => true},
+    "reshard" => {"from" => true, "to" => true, "slots" => true, "yes" => false, "timeout" => true, "pipeline" => true, "stream" => true},
+    "rebalance" => {"weight" => [], "auto-weights" => false, "use-empty-masters" => false, "timeout" => true, "simulate" => false, "pipeline" => true, "threshold" => true, "stream" => true},
     "fix" => {"timeout" => MigrateDefaultTimeout},
 }
 
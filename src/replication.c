@@ -75,12 +75,27 @@ char *replicationGetSlaveName(client *c)
 
 /* ---------------------------------- MASTER -------------------------------- */
 
+/* The replication stream is written once into server.repl_buffer_blocks, a
+ * list of replBufBlock. The backlog references its first block and every
+ * slave references the block it is sending, so that a slave is fed, or
+ * served a partial resync, without copying the stream into its own output
+ * buffer: writeToClient() sends straight from the blocks.
+ *
+ * A block is only referenced by the backlog while it is the head of the
+ * list, and the blocks after a referenced one are implicitly retained, so
+ * the head is trimmed when the backlog grew larger than repl-backlog-size
+ * and no slave still has to send it. */
+
+/* Blocks trimmed at most in a single call from the hot paths, the rest is
+ * left to the next ones and to replicationCron(). */
+#define REPL_BACKLOG_TRIM_BLOCKS_PER_CALL 16
+
 void createReplicationBacklog(void)
 {
     serverAssert(server.repl_backlog == NULL);
-    server.repl_backlog = zmalloc(server.repl_backlog_size);
-    server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
+    server.repl_backlog = zmalloc(sizeof(replBacklog));
+    server.repl_backlog->ref_repl_buf_node = NULL;
+    server.repl_backlog->histlen = 0;
     /* When a new backlog buffer is created, we increment the replication
      * offset by one to make sure we'll not be able to PSYNC with any
      * previous slave. This is needed because we avoid incrementing the
@@ -90,15 +105,12 @@ void createReplicationBacklog(void)
     /* We don't have any data inside our buffer, but virtually the first
      * byte we have is the next byte that will be generated for the
      * replication stream. */
-    server.repl_backlog_off = server.master_repl_offset + 1;
+    server.repl_backlog->offset = server.master_repl_offset + 1;
 }
 
 /* This function is called when the user modifies the replication backlog
- * size at runtime. It is up to the function to both update the
- * server.repl_backlog_size and to resize the buffer and setup it so that
- * it contains the same data as the previous one (possibly less data, but
- * the most recent bytes, or the same data and more free space in case the
- * buffer is enlarged). */
+ * size at runtime. The blocks are shared with the slaves, so the backlog is
+ * not flushed: it is just trimmed, or let grow, to the new size. */
 void resizeReplicationBacklog(long long newsize)
 {
     if (newsize < CONFIG_REPL_BACKLOG_MIN_SIZE)
@@ -107,62 +119,154 @@ void resizeReplicationBacklog(long long newsize)
         return;
 
     server.repl_backlog_size = newsize;
-    if (server.repl_backlog != NULL) {
-        /* What we actually do is to flush the old buffer and realloc a new
-         * empty one. It will refill with new data incrementally.
-         * The reason is that copying a few gigabytes adds latency and even
-         * worse often we need to alloc additional space before freeing the
-         * old buffer. */
-        zfree(server.repl_backlog);
-        server.repl_backlog = zmalloc(server.repl_backlog_size);
-        server.repl_backlog_histlen = 0;
-        server.repl_backlog_idx = 0;
-        /* Next byte we have is... the next since the buffer is empty. */
-        server.repl_backlog_off = server.master_repl_offset + 1;
-    }
+    if (server.repl_backlog != NULL)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
 }
 
 void freeReplicationBacklog(void)
 {
     serverAssert(listLength(server.slaves) == 0);
+    if (server.repl_backlog == NULL)
+        return;
+    /* Without slaves the backlog is the only one holding blocks. */
+    while (listLength(server.repl_buffer_blocks))
+        listDelNode(server.repl_buffer_blocks,
+                    listFirst(server.repl_buffer_blocks));
+    server.repl_buffer_mem = 0;
     zfree(server.repl_backlog);
     server.repl_backlog = NULL;
 }
 
-/* Add data to the replication backlog.
+/* Free blocks from the head of the replication buffer, at most 'max_blocks',
+ * as long as the backlog stays at least repl-backlog-size bytes long and no
+ * slave is still sending them. */
+void incrementalTrimReplicationBacklog(size_t max_blocks)
+{
+    replBacklog *bl = server.repl_backlog;
+    size_t trimmed = 0;
+
+    serverAssert(bl != NULL);
+    while (bl->histlen > server.repl_backlog_size && trimmed < max_blocks) {
+        listNode *first = listFirst(server.repl_buffer_blocks);
+        replBufBlock *fo = listNodeValue(first);
+
+        /* The last block is always kept, it is where we write. */
+        if (first == listLast(server.repl_buffer_blocks))
+            break;
+        /* A slave still has to send it. */
+        if (fo->refcount != 1)
+            break;
+        if (bl->histlen - (long long) fo->used < server.repl_backlog_size)
+            break;
+
+        serverAssert(bl->ref_repl_buf_node == first);
+        bl->ref_repl_buf_node = listNextNode(first);
+        ((replBufBlock *) listNodeValue(bl->ref_repl_buf_node))->refcount++;
+        bl->histlen -= fo->used;
+        server.repl_buffer_mem -= zmalloc_size(fo) + sizeof(listNode);
+        listDelNode(server.repl_buffer_blocks, first);
+        trimmed++;
+    }
+    /* Set the offset of the first byte we have in the backlog. */
+    bl->offset = server.master_repl_offset - bl->histlen + 1;
+}
+
+/* Drop the reference of the slave 'c' to the replication buffer, when it is
+ * freed. */
+void unrefReplicationBuffer(client *c)
+{
+    replBufBlock *o;
+
+    if (c->ref_repl_buf_node == NULL)
+        return;
+    o = listNodeValue(c->ref_repl_buf_node);
+    o->refcount--;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+    incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Append data to the replication buffer, for the backlog and the slaves.
  * This function also increments the global replication offset stored at
  * server.master_repl_offset, because there is no case where we want to feed
- * the backlog without incrementing the buffer. */
-void feedReplicationBacklog(void *ptr, size_t len)
+ * the backlog without incrementing the buffer.
+ *
+ * The slaves that can receive the stream and don't reference the buffer yet
+ * start at the first byte added here. They must have been prepared for
+ * writing with prepareClientToWrite() by the caller. */
+static void feedReplicationBuffer(const char *p, size_t len)
 {
-    unsigned char *p = ptr;
+    listNode *start_node = NULL;
+    size_t start_pos = 0;
+    int add_new_block = 0;
+    listNode *ln;
+    listIter li;
 
     server.master_repl_offset += len;
+    server.repl_backlog->histlen += len;
+
+    ln = listLast(server.repl_buffer_blocks);
+    if (ln) {
+        replBufBlock *tail = listNodeValue(ln);
+        size_t avail = tail->size - tail->used;
+        size_t copy = avail < len ? avail : len;
+
+        if (copy) {
+            start_node = ln;
+            start_pos = tail->used;
+            memcpy(tail->buf + tail->used, p, copy);
+            tail->used += copy;
+            p += copy;
+            len -= copy;
+        }
+    }
+    if (len) {
+        size_t size = len > PROTO_REPLY_CHUNK_BYTES ? len
+                                                    : PROTO_REPLY_CHUNK_BYTES;
+        replBufBlock *tail = zmalloc(sizeof(replBufBlock) + size);
+
+        tail->refcount = 0;
+        tail->repl_offset = server.master_repl_offset - len + 1;
+        tail->size = size;
+        tail->used = len;
+        memcpy(tail->buf, p, len);
+        listAddNodeTail(server.repl_buffer_blocks, tail);
+        server.repl_buffer_mem += zmalloc_size(tail) + sizeof(listNode);
+        add_new_block = 1;
+        if (start_node == NULL) {
+            start_node = listLast(server.repl_buffer_blocks);
+            start_pos = 0;
+        }
+    }
 
-    /* This is a circular buffer, so write as much data we can at every
-     * iteration and rewind the "idx" index if we reach the limit. */
-    while (len) {
-        size_t thislen = server.repl_backlog_size - server.repl_backlog_idx;
-        if (thislen > len)
-            thislen = len;
-        memcpy(server.repl_backlog + server.repl_backlog_idx, p, thislen);
-        server.repl_backlog_idx += thislen;
-        if (server.repl_backlog_idx == server.repl_backlog_size)
-            server.repl_backlog_idx = 0;
-        len -= thislen;
-        p += thislen;
-        server.repl_backlog_histlen += thislen;
-    }
-    if (server.repl_backlog_histlen > server.repl_backlog_size)
-        server.repl_backlog_histlen = server.repl_backlog_size;
-    /* Set the offset of the first byte we have in the backlog. */
-    server.repl_backlog_off =
-        server.master_repl_offset - server.repl_backlog_histlen + 1;
+    if (server.repl_backlog->ref_repl_buf_node == NULL) {
+        server.repl_backlog->ref_repl_buf_node = start_node;
+        ((replBufBlock *) listNodeValue(start_node))->refcount++;
+    }
+    listRewind(server.slaves, &li);
+    while ((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        /* Don't feed slaves that are still waiting for BGSAVE to start */
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START)
+            continue;
+        if (slave->ref_repl_buf_node == NULL) {
+            slave->ref_repl_buf_node = start_node;
+            slave->ref_block_pos = start_pos;
+            ((replBufBlock *) listNodeValue(start_node))->refcount++;
+        }
+    }
+
+    if (add_new_block)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+    else
+        server.repl_backlog->offset =
+            server.master_repl_offset - server.repl_backlog->histlen + 1;
 }
 
-/* Wrapper for feedReplicationBacklog() that takes Redis string objects
+/* Wrapper for feedReplicationBuffer() that takes Redis string objects
  * as input. */
-void feedReplicationBacklogWithObject(robj *o)
+static void feedReplicationBufferWithObject(robj *o)
 {
     char llstr[LONG_STR_SIZE];
     void *p;
@@ -175,7 +279,7 @@ void feedReplicationBacklogWithObject(robj *o)
         len = sdslen(o->ptr);
         p = o->ptr;
     }
-    feedReplicationBacklog(p, len);
+    feedReplicationBuffer(p, len);
 }
 
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc)
@@ -184,6 +288,7 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc)
     listIter li;
     int j, len;
     char llstr[LONG_STR_SIZE];
+    char aux[LONG_STR_SIZE + 3];
 
     /* If there aren't slaves, and there is no backlog buffer to populate,
      * we can return ASAP. */
@@ -193,6 +298,17 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc)
     /* We can't have slaves attached and no backlog. */
     serverAssert(!(listLength(slaves) != 0 && server.repl_backlog == NULL));
 
+    /* The slaves send straight from the replication buffer, make sure the
+     * ones that can receive the stream will be written to. */
+    listRewind(slaves, &li);
+    while ((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START)
+            continue;
+        prepareClientToWrite(slave);
+    }
+
     /* Send SELECT command to every slave if needed. */
     if (server.slaveseldb != dictid) {
         robj *selectcmd;
@@ -210,71 +326,45 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc)
                              dictid_len, llstr));
         }
 
-        /* Add the SELECT command into the backlog. */
-        if (server.repl_backlog)
-            feedReplicationBacklogWithObject(selectcmd);
-
-        /* Send it to slaves. */
-        listRewind(slaves, &li);
-        while ((ln = listNext(&li))) {
-            client *slave = ln->value;
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START)
-                continue;
-            addReply(slave, selectcmd);
-        }
+        /* Add the SELECT command into the replication buffer. */
+        feedReplicationBufferWithObject(selectcmd);
 
         if (dictid < 0 || dictid >= PROTO_SHARED_SELECT_CMDS)
             decrRefCount(selectcmd);
     }
     server.slaveseldb = dictid;
 
-    /* Write the command to the replication backlog if any. */
-    if (server.repl_backlog) {
-        char aux[LONG_STR_SIZE + 3];
+    /* Write the command to the replication buffer. */
+
+    /* Add the multi bulk reply length. */
+    aux[0] = '*';
+    len = ll2string(aux + 1, sizeof(aux) - 1, argc);
+    aux[len + 1] = '\r';
+    aux[len + 2] = '\n';
+    feedReplicationBuffer(aux, len + 3);
+
+    for (j = 0; j < argc; j++) {
+        long objlen = stringObjectLen(argv[j]);
 
-        /* Add the multi bulk reply length. */
-        aux[0] = '*';
-        len = ll2string(aux + 1, sizeof(aux) - 1, argc);
+        /* We need to feed the buffer with the object as a bulk reply
+         * not just as a plain string, so create the $..CRLF payload len
+         * and add the final CRLF */
+        aux[0] = '$';
+        len = ll2string(aux + 1, sizeof(aux) - 1, objlen);
         aux[len + 1] = '\r';
         aux[len + 2] = '\n';
-        feedReplicationBacklog(aux, len + 3);
-
-        for (j = 0; j < argc; j++) {
-            long objlen = stringObjectLen(argv[j]);
-
-            /* We need to feed the buffer with the object as a bulk reply
-             * not just as a plain string, so create the $..CRLF payload len
-             * and add the final CRLF */
-            aux[0] = '$';
-            len = ll2string(aux + 1, sizeof(aux) - 1, objlen);
-            aux[len + 1] = '\r';
-            aux[len + 2] = '\n';
-            feedReplicationBacklog(aux, len + 3);
-            feedReplicationBacklogWithObject(argv[j]);
-            feedReplicationBacklog(aux + len + 1, 2);
-        }
+        feedReplicationBuffer(aux, len + 3);
+        feedReplicationBufferWithObject(argv[j]);
+        feedReplicationBuffer(aux + len + 1, 2);
     }
 
-    /* Write the command to every slave. */
-    listRewind(server.slaves, &li);
+    /* The slaves that fall too much behind are disconnected. */
+    listRewind(slaves, &li);
     while ((ln = listNext(&li))) {
         client *slave = ln->value;
 
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START)
-            continue;
-
-        /* Feed slaves that are waiting for the initial SYNC (so these commands
-         * are queued in the output buffer until the initial SYNC completes),
-         * or are already in sync with the master. */
-
-        /* Add the multi bulk length. */
-        addReplyMultiBulkLen(slave, argc);
-
-        /* Finally any additional argument that was not stored inside the
-         * static buffer if any (from j to argc). */
-        for (j = 0; j < argc; j++)
-            addReplyBulk(slave, argv[j]);
+        if (slave->ref_repl_buf_node)
+            asyncCloseClientOnOutputBufferLimitReached(slave);
     }
 }
 
@@ -325,53 +415,47 @@ void replicationFeedMonitors(client *c,
 }
 
 /* Feed the slave 'c' with the replication backlog starting from the
- * specified 'offset' up to the end of the backlog. */
+ * specified 'offset' up to the end of the backlog. Nothing is copied: the
+ * slave references the block holding 'offset' and is written to from there.
+ * The number of bytes the slave will be sent is returned. */
 long long addReplyReplicationBacklog(client *c, long long offset)
 {
-    long long j, skip, len;
+    replBacklog *bl = server.repl_backlog;
+    long long skip;
+    listNode *node;
+    replBufBlock *o;
 
     serverLog(LL_DEBUG, "[PSYNC] Slave request offset: %lld", offset);
 
-    if (server.repl_backlog_histlen == 0) {
+    if (bl->histlen == 0) {
         serverLog(LL_DEBUG, "[PSYNC] Backlog history len is zero");
         return 0;
     }
 
     serverLog(LL_DEBUG, "[PSYNC] Backlog size: %lld", server.repl_backlog_size);
-    serverLog(LL_DEBUG, "[PSYNC] First byte: %lld", server.repl_backlog_off);
-    serverLog(LL_DEBUG, "[PSYNC] History len: %lld",
-              server.repl_backlog_histlen);
-    serverLog(LL_DEBUG, "[PSYNC] Current index: %lld", server.repl_backlog_idx);
+    serverLog(LL_DEBUG, "[PSYNC] First byte: %lld", bl->offset);
+    serverLog(LL_DEBUG, "[PSYNC] History len: %lld", bl->histlen);
 
     /* Compute the amount of bytes we need to discard. */
-    skip = offset - server.repl_backlog_off;
+    skip = offset - bl->offset;
     serverLog(LL_DEBUG, "[PSYNC] Skipping: %lld", skip);
 
-    /* Point j to the oldest byte, that is actaully our
-     * server.repl_backlog_off byte. */
-    j = (server.repl_backlog_idx +
-         (server.repl_backlog_size - server.repl_backlog_histlen)) %
-        server.repl_backlog_size;
-    serverLog(LL_DEBUG, "[PSYNC] Index of first byte: %lld", j);
-
-    /* Discard the amount of data to seek to the specified 'offset'. */
-    j = (j + skip) % server.repl_backlog_size;
-
-    /* Feed slave with data. Since it is a circular buffer we have to
-     * split the reply in two parts if we are cross-boundary. */
-    len = server.repl_backlog_histlen - skip;
-    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld", len);
-    while (len) {
-        long long thislen = ((server.repl_backlog_size - j) < len)
-                                ? (server.repl_backlog_size - j)
-                                : len;
-
-        serverLog(LL_DEBUG, "[PSYNC] addReply() length: %lld", thislen);
-        addReplySds(c, sdsnewlen(server.repl_backlog + j, thislen));
-        len -= thislen;
-        j = 0;
-    }
-    return server.repl_backlog_histlen - skip;
+    /* Seek to the block holding 'offset'. */
+    node = bl->ref_repl_buf_node;
+    o = listNodeValue(node);
+    while (skip >= (long long) o->used && listNextNode(node)) {
+        skip -= o->used;
+        node = listNextNode(node);
+        o = listNodeValue(node);
+    }
+
+    prepareClientToWrite(c);
+    c->ref_repl_buf_node = node;
+    c->ref_block_pos = skip;
+    o->refcount++;
+    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld",
+              bl->histlen - (offset - bl->offset));
+    return bl->histlen - (offset - bl->offset);
 }
 
 /* Return the offset to provide as reply to the PSYNC command received
@@ -463,9 +547,9 @@ int masterTryPartialResynchronization(client *c)
     if (getLongLongFromObjectOrReply(c, c->argv[2], &psync_offset, NULL) !=
         C_OK)
         goto need_full_resync;
-    if (!server.repl_backlog || psync_offset < server.repl_backlog_off ||
+    if (!server.repl_backlog || psync_offset < server.repl_backlog->offset ||
         psync_offset >
-            (server.repl_backlog_off + server.repl_backlog_histlen)) {
+            (server.repl_backlog->offset + server.repl_backlog->histlen)) {
         serverLog(LL_NOTICE,
                   "Unable to partial resync with slave %s for lack of backlog "
                   "(Slave request was: %lld).",
@@ -1034,6 +1118,7 @@ void replicationCreateMasterClient(int fd)
     server.master->authenticated = 1;
     server.repl_state = REPL_STATE_CONNECTED;
     server.master->reploff = server.repl_master_initial_offset;
+    server.master->read_reploff = server.master->reploff;
     memcpy(server.master->replrunid, server.repl_master_runid,
            sizeof(server.repl_master_runid));
     /* If master offset is set to -1, this master is old and is not
@@ -1042,6 +1127,150 @@ void replicationCreateMasterClient(int fd)
         server.master->flags |= CLIENT_PRE_PSYNC;
 }
 
+/* Final setup of the connected slave <- master link, once the dataset of
+ * the master was loaded. */
+static void replicationFinishSync(void)
+{
+    replicationCreateMasterClient(server.repl_transfer_s);
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
+    /* Restart the AOF subsystem now that we finished the sync. This
+     * will trigger an AOF rewrite, and when done will start appending
+     * to the new file. */
+    if (server.aof_state != AOF_OFF) {
+        int retry = 10;
+
+        stopAppendOnly();
+        while (retry-- && startAppendOnly() == C_ERR) {
+            serverLog(LL_WARNING,
+                      "Failed enabling the AOF after successful master "
+                      "synchronization! Trying it again in one second.");
+            sleep(1);
+        }
+        if (!retry) {
+            serverLog(LL_WARNING,
+                      "FATAL: this slave instance finished the "
+                      "synchronization with its master, but the AOF can't "
+                      "be turned on. Exiting now.");
+            exit(1);
+        }
+    }
+}
+
+/* Return true if the RDB of the master should be loaded straight from the
+ * socket, see repl-diskless-load. */
+static int useDisklessLoad(void)
+{
+    int j;
+
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB)
+        return 1;
+    if (server.repl_diskless_load != REPL_DISKLESS_LOAD_WHEN_DB_EMPTY)
+        return 0;
+    for (j = 0; j < server.dbnum; j++) {
+        if (q_dictSize(server.db[j].dict))
+            return 0;
+    }
+    return 1;
+}
+
+/* Load the payload of the master straight from the socket. The socket is
+ * switched to blocking mode with a repl-timeout receive timeout, and the
+ * load runs like rdbLoad() does, serving events from time to time.
+ * 'eofmark' is the delimiter of an EOF-marked transfer, or NULL when the
+ * master announced repl_transfer_size bytes.
+ *
+ * With repl-diskless-load swapdb the payload is loaded into temporary dbs
+ * while the current dataset keeps serving reads, and swapped in once the
+ * transfer succeeded. In cluster mode, where the slot lists can only index
+ * one keyspace, the current dataset is kept aside instead and put back if
+ * the transfer fails. Otherwise it is flushed first. */
+static void readSyncBulkPayloadDiskless(int fd, char *eofmark)
+{
+    dbBackup *backup = NULL;
+    redisDb *tempDb = NULL;
+    rio rdb;
+    int loaded;
+
+    /* Before loading the DB into memory we need to delete the readable
+     * handler, otherwise it will get called recursively since
+     * rdbLoadRio() will call the event loop to process events from time to
+     * time for non blocking loading. */
+    aeDeleteFileEvent(server.el, fd, AE_READABLE);
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB &&
+        !server.cluster_enabled) {
+        serverLog(LL_NOTICE,
+                  "MASTER <-> SLAVE sync: Serving reads from old data");
+        tempDb = createTempDb();
+    } else if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB) {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Backing up old data");
+        backup = backupDb();
+    } else {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
+        signalFlushedDb(-1);
+        emptyDb(replicationEmptyDbCallback);
+    }
+
+    serverLog(LL_NOTICE,
+              "MASTER <-> SLAVE sync: Loading DB in memory from socket");
+    anetBlock(NULL, fd);
+    anetRecvTimeout(NULL, fd, server.repl_timeout * 1000);
+    rioInitWithConn(&rdb, fd, eofmark ? 0 : server.repl_transfer_size);
+    startLoading(eofmark ? 0 : server.repl_transfer_size);
+    server.async_loading = tempDb != NULL;
+    loaded = rdbLoadRio(&rdb, RDBFLAGS_REPLICATION,
+                        tempDb ? tempDb : server.db) == C_OK;
+    stopLoading();
+
+    /* The delimiter follows the payload of an EOF-marked transfer. */
+    if (loaded && eofmark) {
+        char buf[CONFIG_RUN_ID_SIZE];
+
+        rdb.update_cksum = NULL;
+        if (rioRead(&rdb, buf, CONFIG_RUN_ID_SIZE) == 0 ||
+            memcmp(buf, eofmark, CONFIG_RUN_ID_SIZE) != 0) {
+            serverLog(LL_WARNING,
+                      "Replication stream EOF marker is broken");
+            loaded = 0;
+        }
+    }
+    server.repl_transfer_read = rioTell(&rdb);
+    server.stat_net_input_bytes += rdb.io.conn.read_so_far;
+    /* Nothing follows the payload: an EOF-marked transfer is followed by
+     * the stream only once we ACK, and the other is read up to its size. */
+    rioFreeConn(&rdb, NULL);
+
+    if (!loaded) {
+        serverLog(LL_WARNING,
+                  "Failed trying to load the MASTER synchronization DB "
+                  "from socket");
+        if (tempDb) {
+            serverLog(LL_NOTICE,
+                      "MASTER <-> SLAVE sync: Discarding the loaded data");
+            discardTempDb(tempDb, replicationEmptyDbCallback);
+        } else if (backup) {
+            serverLog(LL_NOTICE,
+                      "MASTER <-> SLAVE sync: Restoring the old data");
+            restoreDbBackup(backup, replicationEmptyDbCallback);
+        } else {
+            /* The partial dataset is of no use. */
+            emptyDb(replicationEmptyDbCallback);
+        }
+        cancelReplicationHandshake();
+        return;
+    }
+    if (tempDb) {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Swapping in the new data");
+        swapTempDb(tempDb, replicationEmptyDbCallback);
+    } else if (backup) {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Discarding the old data");
+        discardDbBackup(backup, replicationEmptyDbCallback);
+    }
+
+    anetRecvTimeout(NULL, fd, 0);
+    anetNonBlock(NULL, fd);
+    replicationFinishSync();
+}
+
 /* Asynchronously read the SYNC payload we receive from a master */
 #define REPL_MAX_WRITTEN_BEFORE_FSYNC (1024 * 1024 * 8) /* 8 MB */
 void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask)
@@ -1058,6 +1287,8 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask)
     static char eofmark[CONFIG_RUN_ID_SIZE];
     static char lastbytes[CONFIG_RUN_ID_SIZE];
     static int usemark = 0;
+    /* No temp file was created by syncWithMaster() for a diskless load. */
+    int use_diskless_load = server.repl_transfer_fd == -1;
 
     /* If repl_transfer_size == -1 we still have to read the bulk length
      * from the master reply. */
@@ -1117,6 +1348,12 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask)
                       "MASTER <-> SLAVE sync: receiving %lld bytes from master",
                       (long long) server.repl_transfer_size);
         }
+        if (!use_diskless_load)
+            return;
+    }
+
+    if (use_diskless_load) {
+        readSyncBulkPayloadDiskless(fd, usemark ? eofmark : NULL);
         return;
     }
 
@@ -1220,32 +1457,9 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask)
             cancelReplicationHandshake();
             return;
         }
-        /* Final setup of the connected slave <- master link */
         zfree(server.repl_transfer_tmpfile);
         close(server.repl_transfer_fd);
-        replicationCreateMasterClient(server.repl_transfer_s);
-        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
-        /* Restart the AOF subsystem now that we finished the sync. This
-         * will trigger an AOF rewrite, and when done will start appending
-         * to the new file. */
-        if (server.aof_state != AOF_OFF) {
-            int retry = 10;
-
-            stopAppendOnly();
-            while (retry-- && startAppendOnly() == C_ERR) {
-                serverLog(LL_WARNING,
-                          "Failed enabling the AOF after successful master "
-                          "synchronization! Trying it again in one second.");
-                sleep(1);
-            }
-            if (!retry) {
-                serverLog(LL_WARNING,
-                          "FATAL: this slave instance finished the "
-                          "synchronization with its master, but the AOF can't "
-                          "be turned on. Exiting now.");
-                exit(1);
-            }
-        }
+        replicationFinishSync();
     }
 
     return;
@@ -1718,21 +1932,24 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask)
         }
     }
 
-    /* Prepare a suitable temp file for bulk transfer */
-    while (maxtries--) {
-        snprintf(tmpfile, 256, "temp-%d.%ld.rdb", (int) server.unixtime,
-                 (long int) getpid());
-        dfd = open(tmpfile, O_CREAT | O_WRONLY | O_EXCL, 0644);
-        if (dfd != -1)
-            break;
-        sleep(1);
-    }
-    if (dfd == -1) {
-        serverLog(LL_WARNING,
-                  "Opening the temp file needed for MASTER <-> SLAVE "
-                  "synchronization: %s",
-                  strerror(errno));
-        goto error;
+    /* Prepare a suitable temp file for bulk transfer, unless the payload is
+     * loaded straight from the socket. */
+    if (!useDisklessLoad()) {
+        while (maxtries--) {
+            snprintf(tmpfile, 256, "temp-%d.%ld.rdb", (int) server.unixtime,
+                     (long int) getpid());
+            dfd = open(tmpfile, O_CREAT | O_WRONLY | O_EXCL, 0644);
+            if (dfd != -1)
+                break;
+            sleep(1);
+        }
+        if (dfd == -1) {
+            serverLog(LL_WARNING,
+                      "Opening the temp file needed for MASTER <-> SLAVE "
+                      "synchronization: %s",
+                      strerror(errno));
+            goto error;
+        }
     }
 
     /* Setup the non blocking download of the bulk file. */
@@ -1750,7 +1967,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask)
     server.repl_transfer_last_fsync_off = 0;
     server.repl_transfer_fd = dfd;
     server.repl_transfer_lastio = server.unixtime;
-    server.repl_transfer_tmpfile = zstrdup(tmpfile);
+    server.repl_transfer_tmpfile = dfd != -1 ? zstrdup(tmpfile) : NULL;
     return;
 
 error:
@@ -1814,9 +2031,13 @@ void replicationAbortSyncTransfer(void)
 {
     serverAssert(server.repl_state == REPL_STATE_TRANSFER);
     undoConnectWithMaster();
-    close(server.repl_transfer_fd);
-    unlink(server.repl_transfer_tmpfile);
-    zfree(server.repl_transfer_tmpfile);
+    if (server.repl_transfer_fd != -1) {
+        close(server.repl_transfer_fd);
+        unlink(server.repl_transfer_tmpfile);
+        zfree(server.repl_transfer_tmpfile);
+        server.repl_transfer_fd = -1;
+        server.repl_transfer_tmpfile = NULL;
+    }
 }
 
 /* This function aborts a non blocking replication attempt if there is one
@@ -2067,6 +2288,15 @@ void replicationCacheMaster(client *c)
     /* Unlink the client from the server structures. */
     unlinkClient(c);
 
+    /* Drop what was read but not applied, including a transaction in
+     * progress: the master sends it again from reploff. */
+    sdsclear(c->querybuf);
+    c->qb_pos = 0;
+    c->read_reploff = c->reploff;
+    if (c->flags & CLIENT_MULTI)
+        discardTransaction(c);
+    resetClient(c);
+
     /* Save the master. Server.master will be set to null later by
      * replicationHandleMasterDisconnection(). */
     server.cached_master = server.master;
@@ -2113,7 +2343,7 @@ void replicationResurrectCachedMaster(int newfd)
     server.repl_state = REPL_STATE_CONNECTED;
 
     /* Re-add to the list of clients. */
-    listAddNodeTail(server.clients, server.master);
+    listAddNodeTail(server.master->qel->clients, server.master);
     if (aeCreateFileEvent(server.el, newfd, AE_READABLE, readQueryFromClient,
                           server.master)) {
         serverLog(LL_WARNING,
@@ -2514,6 +2744,12 @@ void replicationCron(void)
         }
     }
 
+    /* Trim what the slaves no longer retain from the replication buffer,
+     * in case the hot paths left blocks behind. */
+    if (server.repl_backlog)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL *
+                                          10);
+
     /* If we have no attached slaves and there is a replication backlog
      * using memory, free it after some (configured) time. */
     if (listLength(server.slaves) == 0 && server.repl_backlog_time_limit &&
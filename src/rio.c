@@ -304,6 +304,122 @@ void rioFreeFdset(rio *r)
     sdsfree(r->io.fdset.buf);
 }
 
+/* ------------------------ Socket source implementation ---------------------
+ */
+
+/* Reads from a blocking socket, with SO_RCVTIMEO set by the caller so that a
+ * stalled master makes the read fail. Data is read in chunks of at least
+ * PROTO_IOBUF_LEN bytes, but never past read_limit: the master may send the
+ * replication stream right after the payload, and that belongs to the master
+ * client. Returns 1 or 0 for success/failure. */
+static size_t rioConnRead(rio *r, void *buf, size_t len)
+{
+    size_t avail = sdslen(r->io.conn.buf) - r->io.conn.pos;
+
+    /* Start from the beginning of the buffer once it was all consumed, or
+     * when what is missing would not fit after what is buffered. */
+    if (avail == 0) {
+        sdsclear(r->io.conn.buf);
+        r->io.conn.pos = 0;
+    } else if (len > avail && sdsavail(r->io.conn.buf) < len - avail) {
+        sdsrange(r->io.conn.buf, r->io.conn.pos, -1);
+        r->io.conn.pos = 0;
+    }
+    if (sdslen(r->io.conn.buf) + sdsavail(r->io.conn.buf) <
+        r->io.conn.pos + len)
+        r->io.conn.buf = sdsMakeRoomFor(r->io.conn.buf, len - avail);
+
+    while (sdslen(r->io.conn.buf) - r->io.conn.pos < len) {
+        size_t toread = sdsavail(r->io.conn.buf);
+        ssize_t retval;
+
+        if (toread < PROTO_IOBUF_LEN) {
+            r->io.conn.buf = sdsMakeRoomFor(r->io.conn.buf, PROTO_IOBUF_LEN);
+            toread = sdsavail(r->io.conn.buf);
+        }
+        if (r->io.conn.read_limit) {
+            if (r->io.conn.read_so_far == r->io.conn.read_limit) {
+                /* Asked for more than the master announced. */
+                errno = EOVERFLOW;
+                return 0;
+            }
+            if (toread > r->io.conn.read_limit - r->io.conn.read_so_far)
+                toread = r->io.conn.read_limit - r->io.conn.read_so_far;
+        }
+        retval = read(r->io.conn.fd,
+                      r->io.conn.buf + sdslen(r->io.conn.buf), toread);
+        if (retval <= 0) {
+            /* EWOULDBLOCK is returned only because of SO_RCVTIMEO. */
+            if (retval == -1 && errno == EWOULDBLOCK)
+                errno = ETIMEDOUT;
+            else if (retval == 0)
+                errno = ECONNRESET;
+            return 0;
+        }
+        sdsIncrLen(r->io.conn.buf, retval);
+        r->io.conn.read_so_far += retval;
+    }
+
+    memcpy(buf, r->io.conn.buf + r->io.conn.pos, len);
+    r->io.conn.pos += len;
+    return 1;
+}
+
+static size_t rioConnWrite(rio *r, const void *buf, size_t len)
+{
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0; /* Error, this target does not support writing. */
+}
+
+/* Returns the number of bytes consumed so far. */
+static off_t rioConnTell(rio *r)
+{
+    return r->io.conn.read_so_far - (sdslen(r->io.conn.buf) - r->io.conn.pos);
+}
+
+static int rioConnFlush(rio *r)
+{
+    UNUSED(r);
+    return 1; /* Nothing to flush. */
+}
+
+static const rio rioConnIO = {
+    rioConnRead,
+    rioConnWrite,
+    rioConnTell,
+    rioConnFlush,
+    NULL,       /* update_checksum */
+    0,          /* current checksum */
+    0,          /* bytes read or written */
+    0,          /* read/write chunk size */
+    {{NULL, 0}} /* union for io-specific vars */
+};
+
+void rioInitWithConn(rio *r, int fd, size_t read_limit)
+{
+    *r = rioConnIO;
+    r->io.conn.fd = fd;
+    r->io.conn.pos = 0;
+    r->io.conn.buf = sdsempty();
+    r->io.conn.read_limit = read_limit;
+    r->io.conn.read_so_far = 0;
+}
+
+/* Release the rio stream. If 'remaining' is not NULL, it is set to a new sds
+ * with the bytes read from the socket but not consumed, otherwise they are
+ * discarded. */
+void rioFreeConn(rio *r, sds *remaining)
+{
+    if (remaining) {
+        *remaining = sdsnewlen(r->io.conn.buf + r->io.conn.pos,
+                               sdslen(r->io.conn.buf) - r->io.conn.pos);
+    }
+    sdsfree(r->io.conn.buf);
+    r->io.conn.buf = NULL;
+}
+
 /* ---------------------------- Generic functions ----------------------------
  */
 
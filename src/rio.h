@@ -81,6 +81,14 @@ struct _rio {
             off_t pos;
             sds buf;
         } fdset;
+        /* Socket source (used to load the RDB sent by a master). */
+        struct {
+            int fd;
+            off_t pos;         /* Bytes of buf already consumed. */
+            sds buf;           /* Bytes read from the socket, not consumed. */
+            size_t read_limit; /* Don't read more than this, 0: no limit. */
+            size_t read_so_far; /* Bytes read from the socket. */
+        } conn;
     } io;
 };
 
@@ -139,8 +147,10 @@ static inline int rioFlush(rio *r)
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
 void rioInitWithFdset(rio *r, int *fds, int numfds);
+void rioInitWithConn(rio *r, int fd, size_t read_limit);
 
 void rioFreeFdset(rio *r);
+void rioFreeConn(rio *r, sds *remaining);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
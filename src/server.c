@@ -137,6 +137,7 @@ struct redisCommand redisCommandTable[] = {
     {"append", appendCommand, 3, "wm", 0, NULL, 1, 1, 1, 0, 0},
     {"strlen", strlenCommand, 2, "rF", 0, NULL, 1, 1, 1, 0, 0},
     {"del", delCommand, -2, "w", 0, NULL, 1, -1, 1, 0, 0},
+    {"delprefix", delprefixCommand, 2, "w", 0, NULL, 1, 1, 1, 0, 0},
     {"exists", existsCommand, -2, "rF", 0, NULL, 1, -1, 1, 0, 0},
     {"setbit", setbitCommand, 4, "wm", 0, NULL, 1, 1, 1, 0, 0},
     {"getbit", getbitCommand, 3, "rF", 0, NULL, 1, 1, 1, 0, 0},
@@ -284,6 +285,8 @@ struct redisCommand redisCommandTable[] = {
     {"readwrite", readwriteCommand, 1, "F", 0, NULL, 0, 0, 0, 0, 0},
     {"dump", dumpCommand, 2, "r", 0, NULL, 1, 1, 1, 0, 0},
     {"object", objectCommand, 3, "r", 0, NULL, 2, 2, 2, 0, 0},
+    {"memory", memoryCommand, -2, "rd", 0, memoryGetKeys, 0, 0, 0, 0, 0},
+    {"hotkeys", hotkeysCommand, -1, "lt", 0, NULL, 0, 0, 0, 0, 0},
     {"client", clientCommand, -2, "as", 0, NULL, 0, 0, 0, 0, 0},
     {"eval", evalCommand, -3, "s", 0, evalGetKeys, 0, 0, 0, 0, 0},
     {"evalsha", evalShaCommand, -3, "s", 0, evalGetKeys, 0, 0, 0, 0, 0},
@@ -518,18 +521,18 @@ int dictObjKeyCompare(void *privdata, const void *key1, const void *key2)
     return dictSdsKeyCompare(privdata, o1->ptr, o2->ptr);
 }
 
-unsigned int dictObjHash(const void *key)
+uint64_t dictObjHash(const void *key)
 {
     const robj *o = key;
     return dictGenHashFunction(o->ptr, sdslen((sds) o->ptr));
 }
 
-unsigned int dictSdsHash(const void *key)
+uint64_t dictSdsHash(const void *key)
 {
     return dictGenHashFunction((unsigned char *) key, sdslen((char *) key));
 }
 
-unsigned int dictSdsCaseHash(const void *key)
+uint64_t dictSdsCaseHash(const void *key)
 {
     return dictGenCaseHashFunction((unsigned char *) key, sdslen((char *) key));
 }
@@ -550,7 +553,7 @@ int dictEncObjKeyCompare(void *privdata, const void *key1, const void *key2)
     return cmp;
 }
 
-unsigned int dictEncObjHash(const void *key)
+uint64_t dictEncObjHash(const void *key)
 {
     robj *o = (robj *) key;
 
@@ -564,7 +567,7 @@ unsigned int dictEncObjHash(const void *key)
             len = ll2string(buf, 32, (long) o->ptr);
             return dictGenHashFunction((unsigned char *) buf, len);
         } else {
-            unsigned int hash;
+            uint64_t hash;
 
             o = getDecodedObject(o);
             hash = dictGenHashFunction(o->ptr, sdslen((sds) o->ptr));
@@ -783,6 +786,7 @@ int activeExpireCycleTryExpire(redisDb *db, q_dictEntry *de, long long now)
         propagateExpire(db, keyobj);
         dbDelete(db, keyobj);
         notifyKeyspaceEvent(NOTIFY_EXPIRED, "expired", keyobj, db->id);
+        q_trackingInvalidateKey(keyobj);
         decrRefCount(keyobj);
         server.stat_expiredkeys++;
         return 1;
@@ -987,6 +991,17 @@ long long getInstantaneousMetric(int metric)
     return sum / STATS_METRIC_SAMPLES;
 }
 
+/* Same as getInstantaneousMetric() for the samples of an event loop. */
+long long getEventloopInstantaneousMetric(q_eventloop *qel, int metric)
+{
+    int j;
+    long long sum = 0;
+
+    for (j = 0; j < STATS_METRIC_SAMPLES; j++)
+        sum += qel->stats.inst_metric[metric].samples[j];
+    return sum / STATS_METRIC_SAMPLES;
+}
+
 /* Check for timeouts. Returns non-zero if the client was terminated.
  * The function gets the current time in milliseconds as argument since
  * it gets called multiple times in a loop, so calling gettimeofday() for
@@ -1050,14 +1065,16 @@ int clientsCronResizeQueryBuffer(client *c)
 }
 
 #define CLIENTS_CRON_MIN_ITERATIONS 5
-void clientsCron(void)
+/* Called 'hz' times per second for the clients of the server thread, by
+ * clientsCron(), and of every worker, by worker_cron(). */
+void clientsCronList(list *clients, int hz)
 {
-    /* Make sure to process at least numclients/server.hz of clients
-     * per call. Since this function is called server.hz times per second
+    /* Make sure to process at least numclients/hz of clients
+     * per call. Since this function is called hz times per second
      * we are sure that in the worst case we process all the clients in 1
      * second. */
-    int numclients = listLength(server.clients);
-    int iterations = numclients / server.hz;
+    int numclients = listLength(clients);
+    int iterations = numclients / hz;
     mstime_t now = mstime();
 
     /* Process at least a few clients while we are at it, even if we need
@@ -1068,15 +1085,15 @@ void clientsCron(void)
                          ? numclients
                          : CLIENTS_CRON_MIN_ITERATIONS;
 
-    while (listLength(server.clients) && iterations--) {
+    while (listLength(clients) && iterations--) {
         client *c;
         listNode *head;
 
         /* Rotate the list, take the current head, process.
          * This way if the client must be removed from the list it's the
          * first element and we don't incur into O(N) computation. */
-        listRotate(server.clients);
-        head = listFirst(server.clients);
+        listRotate(clients);
+        head = listFirst(clients);
         c = listNodeValue(head);
         /* The following functions do different service checks on the client.
          * The protocol is that they return non-zero if the client was
@@ -1088,15 +1105,21 @@ void clientsCron(void)
     }
 }
 
+void clientsCron(void)
+{
+    clientsCronList(server.clients, server.hz);
+}
+
 /* This function handles 'background' operations we are required to do
  * incrementally in Redis databases, such as active key expiring, resizing,
  * rehashing. */
 void databasesCron(void)
 {
     /* Expire keys by random sampling. Not required for slaves
-     * as master will synthesize DELs for us. */
-    /* if (server.active_expire_enabled && server.masterhost == NULL) */
-    /* activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW); */
+     * as master will synthesize DELs for us. The workers scan the expires
+     * tables in the background (see q_expireCycle()), here we only delete
+     * what they found in case the server thread was not woken up. */
+    q_expireProcessBatches();
 
     /* Perform hash tables rehashing if needed, but only if there are no
      * other processes saving the DB on disk. Otherwise rehashing is bad
@@ -1213,6 +1236,9 @@ void unlinkClientFromEventloop(client *c)
     if (qel->current_client == c)
         qel->current_client = NULL;
 
+    /* The shared read buffer stays with the worker. */
+    returnSharedQueryBuffer(c);
+
     /* Certain operations must be done only if the client has an active socket.
      * If the client was already unlinked or if it's a "fake client" the
      * fd is already set to -1. */
@@ -1261,6 +1287,10 @@ int dispatch_to_worker(client *c, int workerId)
     q_worker *worker;
     char buf;
 
+    // the worker may have been removed by CONFIG SET threads_num meanwhile
+    if (workerId >= server.threads_num) {
+        workerId = (int) (c->id % server.threads_num);
+    }
     worker = darray_get(&workers, (uint32_t) workerId);
     struct connswapunit *su = csui_new();
     if (su == NULL) {
@@ -1326,6 +1356,7 @@ static void keep_slave_to_server_thread(client *c, int from)
 
     listAddNodeTail(server.qel.clients, c);
     c->qel = &server.qel;
+    q_trackingClientArrived(c);
 
     if (clientHasPendingReplies(c)) {
         if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE, sendReplyToClient,
@@ -1384,7 +1415,10 @@ void server_event_process(struct aeEventLoop *eventLoop,
         q_freeCommandRequest(r);
 
         server_processCommand(c);
-        if (c->flags & CLIENT_SLAVE || c->cmd->flags & CMD_ADMIN) {
+        /* CLIENT only changes the state of the connection, the client can
+         * go back to its worker. */
+        if (c->flags & CLIENT_SLAVE ||
+            (c->cmd->flags & CMD_ADMIN && c->cmd->proc != clientCommand)) {
             keep_slave_to_server_thread(c, from);
         } else {
             dispatch_to_worker(c, from);
@@ -1392,6 +1426,9 @@ void server_event_process(struct aeEventLoop *eventLoop,
         qnode = __cds_wfcq_dequeue_blocking(&server.command_requests_head,
                                             &server.command_requests_tail);
     }
+
+    /* Delete the keys the workers found expired. */
+    q_expireProcessBatches();
 }
 
 int countTotalClients()
@@ -1515,6 +1552,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData)
     /* We need to do a few operations on clients asynchronously. */
     clientsCron();
 
+    /* Keep the keys tracked for client side caching under the limit. */
+    q_trackingCron();
+
     /* Handle background operations on Redis databases. */
     databasesCron();
 
@@ -1615,6 +1655,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData)
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue(&server.qel);
 
+    /* Reap the worker threads removed by CONFIG SET threads_num. */
+    q_workers_cron();
+
     /* Clear the paused clients flag if needed. */
     clientsArePaused(); /* Don't check return value, just use the side effect.
                          */
@@ -1643,6 +1686,14 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData)
         migrateCloseTimedoutSockets();
     }
 
+    /* Return to the system the pages freed long enough ago by this thread
+     * and the replication one, the workers do it for their arenas. */
+    run_with_period(1000)
+    {
+        zmalloc_arena_decay(server.qel.arena);
+        zmalloc_arena_decay(master.qel.arena);
+    }
+
     /* Start a scheduled BGSAVE if the corresponding flag is set. This is
      * useful when we are forced to postpone a BGSAVE because an AOF
      * rewrite is in progress.
@@ -1709,6 +1760,9 @@ void beforeSleep(struct aeEventLoop *eventLoop, void *private_data)
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
 
+    /* Send the invalidations of client side caching to our clients. */
+    q_trackingServe(&server.qel);
+
     /* Handle writes with pending output buffers. */
     handleClientsWithPendingWrites(&server.qel);
 }
@@ -1802,7 +1856,8 @@ void createSharedObjects(void)
     shared.lpop = createStringObject("LPOP", 4);
     shared.lpush = createStringObject("LPUSH", 5);
     for (j = 0; j < OBJ_SHARED_INTEGERS; j++) {
-        shared.integers[j] = createObject(OBJ_STRING, (void *) (long) j);
+        shared.integers[j] =
+            makeObjectShared(createObject(OBJ_STRING, (void *) (long) j));
         shared.integers[j]->encoding = OBJ_ENCODING_INT;
     }
     for (j = 0; j < OBJ_SHARED_BULKHDR_LEN; j++) {
@@ -1846,6 +1901,7 @@ void initServerConfig(void)
     server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
     server.saveparams = NULL;
     server.loading = 0;
+    server.async_loading = 0;
     server.logfile = zstrdup(CONFIG_DEFAULT_LOGFILE);
     server.syslog_enabled = CONFIG_DEFAULT_SYSLOG_ENABLED;
     server.syslog_ident = zstrdup(CONFIG_DEFAULT_SYSLOG_IDENT);
@@ -1886,6 +1942,9 @@ void initServerConfig(void)
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
+    server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
+    server.rcu_reclaim_max_memory = CONFIG_DEFAULT_RCU_RECLAIM_MAX_MEMORY;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
     server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
@@ -1908,7 +1967,9 @@ void initServerConfig(void)
     server.cluster_configfile = zstrdup(CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
     server.migrate_cached_sockets = dictCreate(&migrateCacheDictType, NULL);
     server.next_client_id = 1; /* Client IDs, start from 1 .*/
-    server.loading_process_events_interval_bytes = (1024 * 1024 * 2);
+    server.loading_process_events_interval_bytes =
+        CONFIG_DEFAULT_LOADING_PROCESS_EVENTS_INTERVAL_BYTES;
+    server.key_load_delay = CONFIG_DEFAULT_KEY_LOAD_DELAY;
     server.lua_time_limit = LUA_SCRIPT_TIME_LIMIT;
 
     server.lruclock = getLRUClock();
@@ -1933,6 +1994,15 @@ void initServerConfig(void)
     server.repl_disable_tcp_nodelay = CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY;
     server.repl_diskless_sync = CONFIG_DEFAULT_REPL_DISKLESS_SYNC;
     server.repl_diskless_sync_delay = CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY;
+    server.repl_diskless_load = CONFIG_DEFAULT_REPL_DISKLESS_LOAD;
+    server.repl_apply_threads = CONFIG_DEFAULT_REPL_APPLY_THREADS;
+    server.tracking_table_max_keys = CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS;
+    server.hotkeys_sample_rate = CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE;
+    server.key_prefix_index = CONFIG_DEFAULT_KEY_PREFIX_INDEX;
+    server.keys_threads = CONFIG_DEFAULT_KEYS_THREADS;
+    server.jemalloc_thread_arenas = CONFIG_DEFAULT_JEMALLOC_THREAD_ARENAS;
+    server.jemalloc_dirty_decay_ms = CONFIG_DEFAULT_JEMALLOC_DIRTY_DECAY_MS;
+    server.jemalloc_muzzy_decay_ms = CONFIG_DEFAULT_JEMALLOC_MUZZY_DECAY_MS;
     server.slave_priority = CONFIG_DEFAULT_SLAVE_PRIORITY;
     server.slave_announce_ip = CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP;
     server.slave_announce_port = CONFIG_DEFAULT_SLAVE_ANNOUNCE_PORT;
@@ -1941,9 +2011,7 @@ void initServerConfig(void)
     /* Replication partial resync backlog */
     server.repl_backlog = NULL;
     server.repl_backlog_size = CONFIG_DEFAULT_REPL_BACKLOG_SIZE;
-    server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
-    server.repl_backlog_off = 0;
+    server.repl_buffer_mem = 0;
     server.repl_backlog_time_limit = CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT;
     server.repl_no_slaves_since = time(NULL);
 
@@ -2256,6 +2324,10 @@ void resetServerStats(void)
     server.stat_sync_full = 0;
     server.stat_sync_partial_ok = 0;
     server.stat_sync_partial_err = 0;
+    server.stat_rcu_throttled = 0;
+    server.stat_rcu_throttle_usec = 0;
+    server.stat_repl_apply_parallel = 0;
+    server.stat_repl_apply_barriers = 0;
     for (j = 0; j < STATS_METRIC_COUNT; j++) {
         server.inst_metric[j].idx = 0;
         server.inst_metric[j].last_sample_time = mstime();
@@ -2286,6 +2358,8 @@ void initServer(void)
     server.clients = listCreate();
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
+    server.repl_buffer_blocks = listCreate();
+    listSetFreeMethod(server.repl_buffer_blocks, zfree);
     server.monitors = listCreate();
     // server.clients_pending_write = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
@@ -2295,6 +2369,7 @@ void initServer(void)
     pthread_mutex_init(&server.command_request_lock, NULL);
     server.command_requests = listCreate();
     cds_wfcq_init(&server.command_requests_head, &server.command_requests_tail);
+    cds_wfcq_init(&server.expire_batches_head, &server.expire_batches_tail);
     server.get_ack_from_slaves = 0;
     server.clients_paused = 0;
     server.system_memory_size = zmalloc_get_memory_size();
@@ -2303,6 +2378,11 @@ void initServer(void)
     adjustOpenFilesLimit();
     q_eventloop_init(&server.qel, server.maxclients + CONFIG_FDSET_INCR);
     server.el = server.qel.el;
+    /* Bind the arena before loading the dataset, so that the keys loaded
+     * are allocated there like the ones written later. */
+    zmalloc_set_decay(server.jemalloc_dirty_decay_ms,
+                      server.jemalloc_muzzy_decay_ms);
+    q_eventloop_bind_thread(&server.qel);
     server.db = zmalloc(sizeof(redisDb) * server.dbnum);
 
     if (socketpair(AF_LOCAL, SOCK_STREAM, 0, server.socketpairs) < 0) {
@@ -2344,6 +2424,11 @@ void initServer(void)
         exit(1);
     }
 
+    /* Entries released by the server thread are reclaimed by a call_rcu
+     * thread of its own, so that its backlog doesn't delay the workers'. */
+    server.call_rcu_data = create_call_rcu_data(0, -1);
+    set_thread_call_rcu_data(server.call_rcu_data);
+
     /* Create the Redis databases, and initialize other internal state. */
     for (j = 0; j < server.dbnum; j++) {
         // server.db[j].dict = dictCreate(&dbDictType,NULL);
@@ -2353,6 +2438,10 @@ void initServer(void)
         server.db[j].dict->table = cds_lfht_new(
             1, 1, 0, CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
         server.db[j].dict->size = 0;
+        server.db[j].dict->type = &keyspaceDictType;
+        server.db[j].dict->privdata = NULL;
+        server.db[j].dict->keyindex =
+            server.key_prefix_index ? q_keyIndexCreate() : NULL;
         // server.db[j].expires = dictCreate(&keyptrDictType,NULL);
         server.db[j].expires = zmalloc(sizeof(q_dict));
         // server.db[j].expires->table = cds_lfht_new(1024*1024, 1024*512, 0,
@@ -2360,10 +2449,14 @@ void initServer(void)
         server.db[j].expires->table = cds_lfht_new(
             1, 1, 0, CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
         server.db[j].expires->size = 0;
+        server.db[j].expires->type = NULL;
+        server.db[j].expires->privdata = NULL;
+        server.db[j].expires->keyindex = NULL;
         server.db[j].blocking_keys = dictCreate(&keylistDictType, NULL);
         server.db[j].ready_keys = dictCreate(&setDictType, NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType, NULL);
         server.db[j].eviction_pool = evictionPoolAlloc();
+        server.db[j].eviction_cursor = NULL;
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
     }
@@ -2371,6 +2464,7 @@ void initServer(void)
     server.pubsub_patterns = listCreate();
     listSetFreeMethod(server.pubsub_patterns, freePubsubPattern);
     listSetMatchMethod(server.pubsub_patterns, listMatchPubsubPattern);
+    q_trackingInit();
     server.cronloops = 0;
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
@@ -2449,6 +2543,14 @@ void initServer(void)
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    if (q_applyResize(server.repl_apply_threads) != C_OK) {
+        serverLog(LL_WARNING, "Init apply threads failed.");
+        exit(1);
+    }
+    if (q_matchResize(server.keys_threads) != C_OK) {
+        serverLog(LL_WARNING, "Init keys threads failed.");
+        exit(1);
+    }
 }
 
 /* Populates the Redis Command Table starting from the hard coded list
@@ -2753,6 +2855,16 @@ void call(client *c, int flags)
     c->flags &= ~(CLIENT_FORCE_AOF | CLIENT_FORCE_REPL | CLIENT_PREVENT_PROP);
     redisOpArrayInit(&server.also_propagate);
 
+    /* Remember the keys read by clients doing client side caching. It is done
+     * before the read, so a write racing with it in the server thread is sent
+     * as an invalidation. */
+    if (c->flags & CLIENT_TRACKING && c->cmd->flags & CMD_READONLY)
+        q_trackingRememberKeys(c);
+
+    /* Count the keys of one command every hotkeys-sample-rate. */
+    if (server.hotkeys_sample_rate)
+        q_hotkeysSample(c);
+
     /* Call the command. */
     dirty = server.dirty;
     start = ustime();
@@ -2886,11 +2998,10 @@ int server_processCommand(client *c)
      * keys in the dataset). If there are not the only thing we can do
      * is returning an error. */
     if (server.maxmemory) {
+        /* The client came from a worker thread, so it is not one of the
+         * slaves freeMemoryIfNeeded() may free flushing their output
+         * buffers, and server.current_client is not set for it. */
         int retval = freeMemoryIfNeeded();
-        /* freeMemoryIfNeeded may flush slave output buffers. This may result
-         * into a slave, that may be the active client, to be freed. */
-        if (server.current_client == NULL)
-            return C_ERR;
 
         /* It was impossible to free enough memory, and the command the client
          * is trying to execute is denied during OOM conditions? Error. */
@@ -2901,6 +3012,11 @@ int server_processCommand(client *c)
         }
     }
 
+    /* Throttle writers while too much memory waits for the end of an RCU
+     * grace period. */
+    if (server.rcu_reclaim_max_memory && (c->cmd->flags & CMD_WRITE))
+        rcuReclaimThrottleIfNeeded();
+
     /* Don't accept write commands if there are problems persisting on disk
      * and if this is a master instance. */
     if (((server.stop_writes_on_bgsave_err && server.saveparamslen > 0 &&
@@ -2960,8 +3076,10 @@ int server_processCommand(client *c)
     }
 
     /* Loading DB? Return an error if the command has not the
-     * CMD_LOADING flag. */
-    if (server.loading && !(c->cmd->flags & CMD_LOADING)) {
+     * CMD_LOADING flag. Reads are still served by the old keyspace while
+     * the RDB of the master is loaded aside, see swapTempDb(). */
+    if (server.loading && !(c->cmd->flags & CMD_LOADING) &&
+        !(server.async_loading && c->cmd->flags & CMD_READONLY)) {
         addReply(c, shared.loadingerr);
         return C_OK;
     }
@@ -3037,6 +3155,10 @@ int worker_processCommand(client *c)
 
     if ((c->cmd->flags & CMD_READONLY) &&
         !(c->cmd->flags & CMD_SERVER_THREAD)) {
+        /* Redirect using the routing snapshot published by the server
+         * thread, clusterState is not safe to access from workers. */
+        if (server.cluster_enabled && clusterWorkerRedirectIfNeeded(c))
+            return C_OK;
         call(c, CMD_CALL_STATS);  // worker thread only handle READONLY command,
                                   // so do not use CMD_CALL_PROPAGATE here
         c->woff = server.master_repl_offset;
@@ -3162,6 +3284,11 @@ int processCommand(client *c)
         }
     }
 
+    /* Throttle writers while too much memory waits for the end of an RCU
+     * grace period. */
+    if (server.rcu_reclaim_max_memory && (c->cmd->flags & CMD_WRITE))
+        rcuReclaimThrottleIfNeeded();
+
     /* Don't accept write commands if there are problems persisting on disk
      * and if this is a master instance. */
     if (((server.stop_writes_on_bgsave_err && server.saveparamslen > 0 &&
@@ -3221,8 +3348,10 @@ int processCommand(client *c)
     }
 
     /* Loading DB? Return an error if the command has not the
-     * CMD_LOADING flag. */
-    if (server.loading && !(c->cmd->flags & CMD_LOADING)) {
+     * CMD_LOADING flag. Reads are still served by the old keyspace while
+     * the RDB of the master is loaded aside, see swapTempDb(). */
+    if (server.loading && !(c->cmd->flags & CMD_LOADING) &&
+        !(server.async_loading && c->cmd->flags & CMD_READONLY)) {
         addReply(c, shared.loadingerr);
         return C_OK;
     }
@@ -3246,7 +3375,10 @@ int processCommand(client *c)
         queueMultiCommand(c);
         addReply(c, shared.queued);
     } else {
-        call(c, CMD_CALL_FULL);
+        /* With repl-apply-threads the commands of our master may run in
+         * the apply threads instead, see q_apply.c. */
+        if (!(c->flags & CLIENT_MASTER) || q_applyDispatch(c) == C_ERR)
+            call(c, CMD_CALL_FULL);
         c->woff = server.master_repl_offset;
         if (listLength(server.ready_keys))
             handleClientsBlockedOnLists();
@@ -3576,6 +3708,22 @@ void bytesToHuman(char *s, unsigned long long n)
     }
 }
 
+/* Append the INFO line of the allocator arena of a thread. The fragmentation
+ * is the ratio of the pages in use by the arena to the bytes allocated in
+ * them, the resident pages also count the ones freed but not yet returned. */
+static sds genArenaInfoString(sds info, const char *name, int arena)
+{
+    size_t allocated, active, resident;
+
+    if (!zmalloc_get_arena_info(arena, &allocated, &active, &resident))
+        return info;
+    return sdscatprintf(info,
+                        "mem_arena_%s:arena=%d,allocated=%zu,active=%zu,"
+                        "resident=%zu,frag_ratio=%.2f\r\n",
+                        name, arena, allocated, active, resident,
+                        allocated ? (double) active / allocated : 0);
+}
+
 /* Create the string returned by the INFO command. This is decoupled
  * by the INFO command itself as we need to report the same information
  * on memory corruption problems. */
@@ -3667,9 +3815,11 @@ sds genRedisInfoString(char *section)
                          "connected_clients:%lu\r\n"
                          "client_longest_output_list:%lu\r\n"
                          "client_biggest_input_buf:%lu\r\n"
-                         "blocked_clients:%d\r\n",
+                         "blocked_clients:%d\r\n"
+                         "tracking_clients:%d\r\n",
                          listLength(server.clients) - listLength(server.slaves),
-                         lol, bib, server.bpop_blocked_clients);
+                         lol, bib, server.bpop_blocked_clients,
+                         q_trackingClients());
     }
 
     /* Memory */
@@ -3680,6 +3830,10 @@ sds genRedisInfoString(char *section)
         char used_memory_lua_hmem[64];
         char used_memory_rss_hmem[64];
         char maxmemory_hmem[64];
+        char rcu_pending_hmem[64];
+        size_t rcu_pending_entries, rcu_pending_bytes;
+        size_t arena_allocated, arena_active, arena_resident, arena_mapped,
+            arena_retained;
         size_t zmalloc_used = zmalloc_used_memory();
         size_t total_system_mem = server.system_memory_size;
         const char *evict_policy = evictPolicyToString();
@@ -3727,6 +3881,36 @@ sds genRedisInfoString(char *section)
             evict_policy,
             zmalloc_get_fragmentation_ratio(server.resident_set_size),
             ZMALLOC_LIB);
+
+        /* Memory released by writers and waiting for an RCU grace period. */
+        q_dictGetPendingReclaim(&rcu_pending_entries, &rcu_pending_bytes);
+        bytesToHuman(rcu_pending_hmem, rcu_pending_bytes);
+        info = sdscatprintf(info,
+                            "rcu_pending_entries:%zu\r\n"
+                            "rcu_pending_bytes:%zu\r\n"
+                            "rcu_pending_bytes_human:%s\r\n"
+                            "rcu_reclaim_max_memory:%llu\r\n"
+                            "rcu_reclaim_throttled:%lld\r\n"
+                            "rcu_reclaim_throttle_usec:%lld\r\n",
+                            rcu_pending_entries, rcu_pending_bytes,
+                            rcu_pending_hmem, server.rcu_reclaim_max_memory,
+                            server.stat_rcu_throttled,
+                            server.stat_rcu_throttle_usec);
+
+        /* Allocator arenas of the threads, refreshing the statistics. */
+        if (zmalloc_get_allocator_info(&arena_allocated, &arena_active,
+                                       &arena_resident, &arena_mapped,
+                                       &arena_retained)) {
+            info = genArenaInfoString(info, "server", server.qel.arena);
+            info = genArenaInfoString(info, "master", master.qel.arena);
+            for (j = 0; j < (int) darray_n(&workers); j++) {
+                q_worker *worker = darray_get(&workers, (uint32_t) j);
+                char name[32];
+
+                snprintf(name, sizeof(name), "worker%d", j);
+                info = genArenaInfoString(info, name, worker->qel.arena);
+            }
+        }
     }
 
     /* Persistence */
@@ -3737,6 +3921,7 @@ sds genRedisInfoString(char *section)
             info,
             "# Persistence\r\n"
             "loading:%d\r\n"
+            "async_loading:%d\r\n"
             "rdb_changes_since_last_save:%lld\r\n"
             "rdb_bgsave_in_progress:%d\r\n"
             "rdb_last_save_time:%jd\r\n"
@@ -3750,7 +3935,8 @@ sds genRedisInfoString(char *section)
             "aof_current_rewrite_time_sec:%jd\r\n"
             "aof_last_bgrewrite_status:%s\r\n"
             "aof_last_write_status:%s\r\n",
-            server.loading, server.dirty, server.rdb_child_pid != -1,
+            server.loading, server.async_loading, server.dirty,
+            server.rdb_child_pid != -1,
             (intmax_t) server.lastsave,
             (server.lastbgsave_status == C_OK) ? "ok" : "err",
             (intmax_t) server.rdb_save_time_last,
@@ -3841,7 +4027,9 @@ sds genRedisInfoString(char *section)
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
             "latest_fork_usec:%lld\r\n"
-            "migrate_cached_sockets:%ld\r\n",
+            "migrate_cached_sockets:%ld\r\n"
+            "tracking_total_keys:%llu\r\n"
+            "hotkeys_sampled:%llu\r\n",
             server.stat_numconnections, server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
             server.stat_net_input_bytes, server.stat_net_output_bytes,
@@ -3853,7 +4041,23 @@ sds genRedisInfoString(char *section)
             server.stat_keyspace_hits, server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns), server.stat_fork_time,
-            dictSize(server.migrate_cached_sockets));
+            dictSize(server.migrate_cached_sockets), q_trackingTotalKeys(),
+            q_hotkeysSampled());
+
+        /* Background active expiry, one line per worker thread. */
+        for (j = 0; j < (int) darray_n(&workers); j++) {
+            q_worker *worker = darray_get(&workers, (uint32_t) j);
+
+            info = sdscatprintf(
+                info,
+                "expire_worker%d:expired=%lld,expired_per_sec=%lld,"
+                "backlog=%lld,avg_ttl=%lld,scanned=%lld\r\n",
+                j, worker->expire.expired,
+                getEventloopInstantaneousMetric(&worker->qel,
+                                                STATS_METRIC_EXPIRED),
+                __atomic_load_n(&worker->expire.backlog, __ATOMIC_RELAXED),
+                worker->expire.avg_ttl, worker->expire.scanned);
+        }
     }
 
     /* Replication */
@@ -3904,8 +4108,14 @@ sds genRedisInfoString(char *section)
             }
             info = sdscatprintf(info,
                                 "slave_priority:%d\r\n"
-                                "slave_read_only:%d\r\n",
-                                server.slave_priority, server.repl_slave_ro);
+                                "slave_read_only:%d\r\n"
+                                "slave_apply_threads:%d\r\n"
+                                "slave_apply_parallel_cmds:%lld\r\n"
+                                "slave_apply_barriers:%lld\r\n",
+                                server.slave_priority, server.repl_slave_ro,
+                                server.repl_apply_threads,
+                                server.stat_repl_apply_parallel,
+                                server.stat_repl_apply_barriers);
         }
 
         info = sdscatprintf(info, "connected_slaves:%lu\r\n",
@@ -3969,10 +4179,13 @@ sds genRedisInfoString(char *section)
                          "repl_backlog_active:%d\r\n"
                          "repl_backlog_size:%lld\r\n"
                          "repl_backlog_first_byte_offset:%lld\r\n"
-                         "repl_backlog_histlen:%lld\r\n",
+                         "repl_backlog_histlen:%lld\r\n"
+                         "repl_buffer_mem:%zu\r\n",
                          server.master_repl_offset, server.repl_backlog != NULL,
-                         server.repl_backlog_size, server.repl_backlog_off,
-                         server.repl_backlog_histlen);
+                         server.repl_backlog_size,
+                         server.repl_backlog ? server.repl_backlog->offset : 0,
+                         server.repl_backlog ? server.repl_backlog->histlen : 0,
+                         server.repl_buffer_mem);
     }
 
     /* CPU */
@@ -4126,16 +4339,24 @@ struct evictionPoolEntry *evictionPoolAlloc(void)
  *
  * We insert keys on place in ascending order, so keys with the smaller
  * idle time are on the left, and keys with the higher idle time on the
- * right. */
-
+ * right.
+ *
+ * With an LFU policy the idle time is the inverse of the access counter,
+ * so that the least accessed keys are on the right as well.
+ *
+ * The sampled entries may be deleted by other threads, so they are only
+ * looked at inside the RCU read-side section, and the pool keeps a copy
+ * of their keys. 'cursor' is where the next sampling of 'sampledict'
+ * resumes, see q_dictGetSomeKeys(). */
 #define EVICTION_SAMPLES_ARRAY_SIZE 16
-void evictionPoolPopulate(dict *sampledict,
-                          dict *keydict,
+void evictionPoolPopulate(q_dict *sampledict,
+                          q_dict *keydict,
+                          sds *cursor,
                           struct evictionPoolEntry *pool)
 {
     int j, k, count;
-    dictEntry *_samples[EVICTION_SAMPLES_ARRAY_SIZE];
-    dictEntry **samples;
+    q_dictEntry *_samples[EVICTION_SAMPLES_ARRAY_SIZE];
+    q_dictEntry **samples;
 
     /* Try to use a static buffer: this function is a big hit...
      * Note: it was actually measured that this helps. */
@@ -4145,22 +4366,27 @@ void evictionPoolPopulate(dict *sampledict,
         samples = zmalloc(sizeof(samples[0]) * server.maxmemory_samples);
     }
 
-    count = dictGetSomeKeys(sampledict, samples, server.maxmemory_samples);
+    rcu_read_lock();
+    count = q_dictGetSomeKeys(sampledict, cursor, samples,
+                              server.maxmemory_samples);
     for (j = 0; j < count; j++) {
         unsigned long long idle;
         sds key;
         robj *o;
-        dictEntry *de;
+        q_dictEntry *de;
 
         de = samples[j];
         key = dictGetKey(de);
         /* If the dictionary we are sampling from is not the main
          * dictionary (but the expires one) we need to lookup the key
          * again in the key dictionary to obtain the value object. */
-        if (sampledict != keydict)
-            de = dictFind(keydict, key);
+        if (sampledict != keydict && (de = q_dictFind(keydict, key)) == NULL)
+            continue;
         o = dictGetVal(de);
-        idle = estimateObjectIdleTime(o);
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU)
+            idle = 255 - LFUDecrAndReturn(o);
+        else
+            idle = estimateObjectIdleTime(o);
 
         /* Insert the element inside the pool.
          * First, find the first empty bucket or the first populated
@@ -4196,13 +4422,41 @@ void evictionPoolPopulate(dict *sampledict,
         pool[k].key = sdsdup(key);
         pool[k].idle = idle;
     }
+    rcu_read_unlock();
     if (samples != _samples)
         zfree(samples);
 }
 
+/* Memory in use, not counting what deleted keys keep alive until the end of
+ * an RCU grace period: it is what evicting a key frees. */
+static size_t evictionMemoryUsed(void)
+{
+    size_t mem_used = zmalloc_used_memory(), entries, bytes;
+
+    q_dictGetPendingReclaim(&entries, &bytes);
+    return mem_used > bytes ? mem_used - bytes : 0;
+}
+
+/* Wait for the memory deleted keys keep alive to be reclaimed, if any. Must
+ * be called from the server thread outside any RCU read side critical
+ * section. */
+static void evictionWaitReclaim(void)
+{
+    size_t entries, bytes;
+    mstime_t latency;
+
+    q_dictGetPendingReclaim(&entries, &bytes);
+    if (entries == 0)
+        return;
+    latencyStartMonitor(latency);
+    rcu_barrier();
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("eviction-reclaim", latency);
+}
+
 int freeMemoryIfNeeded(void)
 {
-    size_t mem_used, mem_tofree, mem_freed;
+    size_t mem_used, mem_tofree, mem_freed, overhead = 0;
     int slaves = listLength(server.slaves);
     mstime_t latency, eviction_latency;
 
@@ -4213,34 +4467,48 @@ int freeMemoryIfNeeded(void)
         return C_OK;
 
     /* Remove the size of slaves output buffers and AOF buffer from the
-     * count of used memory. */
-    mem_used = zmalloc_used_memory();
+     * count of used memory. The replication buffer the slaves share with
+     * the backlog only counts once, for what they retain past the backlog
+     * size. */
     if (slaves) {
         listIter li;
         listNode *ln;
+        size_t obuf_bytes = 0;
 
         listRewind(server.slaves, &li);
         while ((ln = listNext(&li))) {
             client *slave = listNodeValue(ln);
-            unsigned long obuf_bytes = getClientOutputBufferMemoryUsage(slave);
-            if (obuf_bytes > mem_used)
-                mem_used = 0;
-            else
-                mem_used -= obuf_bytes;
+            obuf_bytes += slave->reply_bytes;
         }
+        if (server.repl_buffer_mem > (size_t) server.repl_backlog_size)
+            obuf_bytes += server.repl_buffer_mem - server.repl_backlog_size;
+        overhead += obuf_bytes;
     }
     if (server.aof_state != AOF_OFF) {
-        mem_used -= sdslen(server.aof_buf);
-        mem_used -= aofRewriteBufferSize();
+        overhead += sdslen(server.aof_buf);
+        overhead += aofRewriteBufferSize();
     }
 
-    /* Check if we are over the memory limit. */
+    /* Check if we are over the memory limit. The memory deleted keys keep
+     * alive until the end of an RCU grace period counts as used, as it does
+     * in used_memory, but it is freed by waiting for the reclaim rather than
+     * by evicting more keys. */
+    mem_used = zmalloc_used_memory();
+    mem_used = mem_used > overhead ? mem_used - overhead : 0;
+    if (mem_used <= server.maxmemory)
+        return C_OK;
+    evictionWaitReclaim();
+    mem_used = zmalloc_used_memory();
+    mem_used = mem_used > overhead ? mem_used - overhead : 0;
     if (mem_used <= server.maxmemory)
         return C_OK;
 
     if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
         return C_ERR; /* We need to free memory, but policy forbids. */
 
+    /* Don't evict keys the apply threads may be writing. */
+    q_applyDrain();
+
     /* Compute how much memory we need to free. */
     mem_tofree = mem_used - server.maxmemory;
     mem_freed = 0;
@@ -4255,8 +4523,7 @@ int freeMemoryIfNeeded(void)
             redisDb *db = server.db + j;
             q_dict *dict;
 
-            if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) {
+            if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
                 dict = server.db[j].dict;
             } else {
                 dict = server.db[j].expires;
@@ -4268,45 +4535,49 @@ int freeMemoryIfNeeded(void)
             if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
                 server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM) {
                 de = q_dictGetRandomKey(dict);
-                if (!de) {
+                if (de) {
                     bestkey = dictGetKey(de);
                 }
             }
 
-            /* volatile-lru and allkeys-lru policy */
-            else if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_LRU ||
-                     server.maxmemory_policy == MAXMEMORY_VOLATILE_LRU) {
-                // ToDo:
-                /* struct evictionPoolEntry *pool = db->eviction_pool; */
-
-                /* while(bestkey == NULL) { */
-                /* evictionPoolPopulate(dict, db->dict, db->eviction_pool); */
-                /* [> Go backward from best to worst element to evict. <] */
-                /* for (k = MAXMEMORY_EVICTION_POOL_SIZE-1; k >= 0; k--) { */
-                /* if (pool[k].key == NULL) continue; */
-                /* de = q_dictFind(dict,pool[k].key); */
-
-                /* [> Remove the entry from the pool. <] */
-                /* sdsfree(pool[k].key); */
-                /* [> Shift all elements on its right to left. <] */
-                /* memmove(pool+k,pool+k+1, */
-                /* sizeof(pool[0])*(MAXMEMORY_EVICTION_POOL_SIZE-k-1)); */
-                /* Clear the element on the right which is empty
-                 * since we shifted one position to the left.  */
-                /* pool[MAXMEMORY_EVICTION_POOL_SIZE-1].key = NULL; */
-                /* pool[MAXMEMORY_EVICTION_POOL_SIZE-1].idle = 0; */
-
-                /* If the key exists, is our pick. Otherwise it is
-                 * a ghost and we need to try the next element. */
-                /* if (de) { */
-                /* bestkey = dictGetKey(de); */
-                /* break; */
-                /* } else { */
-                /* [> Ghost... <] */
-                /* continue; */
-                /* } */
-                /* } */
-                /* } */
+            /* volatile-lru, allkeys-lru, volatile-lfu and allkeys-lfu */
+            else if (server.maxmemory_policy &
+                     (MAXMEMORY_FLAG_LRU | MAXMEMORY_FLAG_LFU)) {
+                struct evictionPoolEntry *pool = db->eviction_pool;
+
+                while (bestkey == NULL) {
+                    evictionPoolPopulate(dict, db->dict,
+                                         &db->eviction_cursor, pool);
+                    if (pool[0].key == NULL)
+                        break; /* Nothing could be sampled. */
+                    /* Go backward from best to worst element to evict. */
+                    for (k = MAXMEMORY_EVICTION_POOL_SIZE - 1; k >= 0; k--) {
+                        if (pool[k].key == NULL)
+                            continue;
+                        de = q_dictFind(dict, pool[k].key);
+
+                        /* Remove the entry from the pool. */
+                        sdsfree(pool[k].key);
+                        /* Shift all elements on its right to left. */
+                        memmove(pool + k, pool + k + 1,
+                                sizeof(pool[0]) *
+                                    (MAXMEMORY_EVICTION_POOL_SIZE - k - 1));
+                        /* Clear the element on the right which is empty
+                         * since we shifted one position to the left.  */
+                        pool[MAXMEMORY_EVICTION_POOL_SIZE - 1].key = NULL;
+                        pool[MAXMEMORY_EVICTION_POOL_SIZE - 1].idle = 0;
+
+                        /* If the key exists, is our pick. Otherwise it is
+                         * a ghost and we need to try the next element. */
+                        if (de) {
+                            bestkey = dictGetKey(de);
+                            break;
+                        } else {
+                            /* Ghost... */
+                            continue;
+                        }
+                    }
+                }
             }
 
             /* volatile-ttl */
@@ -4342,16 +4613,17 @@ int freeMemoryIfNeeded(void)
                  *
                  * AOF and Output buffer memory will be freed eventually so
                  * we only care about memory used by the key space. */
-                delta = (long long) zmalloc_used_memory();
+                delta = (long long) evictionMemoryUsed();
                 latencyStartMonitor(eviction_latency);
                 dbDelete(db, keyobj);
                 latencyEndMonitor(eviction_latency);
                 latencyAddSampleIfNeeded("eviction-del", eviction_latency);
                 latencyRemoveNestedEvent(latency, eviction_latency);
-                delta -= (long long) zmalloc_used_memory();
+                delta -= (long long) evictionMemoryUsed();
                 mem_freed += delta;
                 server.stat_evictedkeys++;
                 notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted", keyobj, db->id);
+                q_trackingInvalidateKey(keyobj);
                 decrRefCount(keyobj);
                 keys_freed++;
 
@@ -4364,16 +4636,47 @@ int freeMemoryIfNeeded(void)
             }
         }
         if (!keys_freed) {
+            evictionWaitReclaim();
             latencyEndMonitor(latency);
             latencyAddSampleIfNeeded("eviction-cycle", latency);
             return C_ERR; /* nothing to free... */
         }
     }
+    /* The evicted keys are only freed after a grace period. */
+    evictionWaitReclaim();
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("eviction-cycle", latency);
     return C_OK;
 }
 
+/* Overwritten and deleted keys are freed by call_rcu() only after a grace
+ * period, so a burst of writes against big values can pile up a lot of
+ * memory that the server is no longer using. When the backlog is bigger
+ * than 'rcu-reclaim-max-memory', writers are throttled: rcu_barrier() waits
+ * for all the callbacks queued so far to run before the next write command
+ * is executed.
+ *
+ * Must be called from the server thread outside any RCU read side critical
+ * section. */
+void rcuReclaimThrottleIfNeeded(void)
+{
+    size_t entries, bytes;
+    mstime_t latency;
+    long long start;
+
+    q_dictGetPendingReclaim(&entries, &bytes);
+    if (bytes <= server.rcu_reclaim_max_memory)
+        return;
+
+    latencyStartMonitor(latency);
+    start = ustime();
+    rcu_barrier();
+    server.stat_rcu_throttled++;
+    server.stat_rcu_throttle_usec += ustime() - start;
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("rcu-reclaim", latency);
+}
+
 /* =================================== Main! ================================ */
 
 #ifdef __linux__
@@ -4730,7 +5033,7 @@ int redisIsSupervised(int mode)
 
 int main(int argc, char **argv)
 {
-    struct timeval tv;
+    uint8_t hashseed[16];
     int j;
 
 #ifdef REDIS_TEST
@@ -4753,6 +5056,8 @@ int main(int argc, char **argv)
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "siphash")) {
+            return siphashTest(argc, argv);
         }
 
         return -1; /* test not found */
@@ -4767,8 +5072,8 @@ int main(int argc, char **argv)
     zmalloc_enable_thread_safeness();
     zmalloc_set_oom_handler(redisOutOfMemoryHandler);
     srand(time(NULL) ^ getpid());
-    gettimeofday(&tv, NULL);
-    dictSetHashFunctionSeed(tv.tv_sec ^ tv.tv_usec ^ getpid());
+    getRandomBytes(hashseed, sizeof(hashseed));
+    dictSetHashFunctionSeed(hashseed);
     server.sentinel_mode = checkForSentinelMode(argc, argv);
     initServerConfig();
 
@@ -4794,6 +5099,11 @@ int main(int argc, char **argv)
     if (strstr(argv[0], "redis-check-rdb") != NULL)
         redis_check_rdb_main(argc, argv);
 
+    /* Same for the redis-microbench alias, that runs the data structures
+     * microbenchmarks against the code linked in the server. */
+    if (strstr(argv[0], "redis-microbench") != NULL)
+        redis_microbench_main(argc, argv);
+
     if (argc >= 2) {
         j = 1; /* First option to parse in argv[] */
         sds options = sdsempty();
@@ -69,6 +69,10 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "q_eventloop.h"
 #include "q_thread.h"
 #include "q_dict.h"
+#include "q_keyindex.h"
+#include "q_apply.h"
+#include "q_match.h"
+#include "q_tracking.h"
 
 /* Following includes allow test functions to be called from Redis main() */
 #include "crc64.h"
@@ -123,6 +127,17 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
+#define CONFIG_DEFAULT_REPL_DISKLESS_LOAD REPL_DISKLESS_LOAD_DISABLED
+#define CONFIG_DEFAULT_REPL_APPLY_THREADS 0
+#define CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS 1000000
+#define CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE 0
+#define CONFIG_DEFAULT_KEY_PREFIX_INDEX 0
+#define CONFIG_DEFAULT_KEYS_THREADS 4
+#define CONFIG_DEFAULT_KEY_LOAD_DELAY 0
+#define CONFIG_DEFAULT_LOADING_PROCESS_EVENTS_INTERVAL_BYTES (1024 * 1024 * 2)
+#define CONFIG_DEFAULT_JEMALLOC_THREAD_ARENAS 1
+#define CONFIG_DEFAULT_JEMALLOC_DIRTY_DECAY_MS 10000
+#define CONFIG_DEFAULT_JEMALLOC_MUZZY_DECAY_MS 0
 #define CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define CONFIG_DEFAULT_SLAVE_READ_ONLY 1
 #define CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP NULL
@@ -130,6 +145,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
+#define CONFIG_DEFAULT_RCU_RECLAIM_MAX_MEMORY 0
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
@@ -141,6 +157,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_MIN_RESERVED_FDS 32
 #define CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
 #define CONFIG_DEFAULT_THREADS_NUM 7
+#define CONFIG_MAX_THREADS_NUM 256
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000  /* Microseconds */
@@ -154,7 +171,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define STATS_METRIC_COMMAND 0    /* Number of commands executed. */
 #define STATS_METRIC_NET_INPUT 1  /* Bytes read to network .*/
 #define STATS_METRIC_NET_OUTPUT 2 /* Bytes written to network. */
-#define STATS_METRIC_COUNT 3
+#define STATS_METRIC_EXPIRED 3    /* Keys found expired by active expiry. */
+#define STATS_METRIC_COUNT 4
 
 /* Protocol and I/O related defines */
 #define PROTO_MAX_QUERYBUF_LEN                                       \
@@ -289,6 +307,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG_SYNC (1 << 26) /* EVAL debugging without fork() */
 
 #define CLIENT_JUMP (1 << 27)
+#define CLIENT_TRACKING (1 << 28) /* Keys read are tracked, CLIENT TRACKING. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -349,6 +368,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define SLAVE_CAPA_NONE 0
 #define SLAVE_CAPA_EOF (1 << 0) /* Can parse the RDB EOF streaming format. */
 
+/* Slave side: load the RDB received from the master straight from the
+ * socket instead of going through a temp file (repl-diskless-load). */
+#define REPL_DISKLESS_LOAD_DISABLED 0
+#define REPL_DISKLESS_LOAD_WHEN_DB_EMPTY 1 /* Only if nothing can be lost. */
+#define REPL_DISKLESS_LOAD_SWAPDB 2 /* Keep the old keys until it succeeds. */
+
 /* Synchronous read timeout - slave side */
 #define CONFIG_REPL_SYNCIO_TIMEOUT 5
 
@@ -393,15 +418,35 @@ typedef long long mstime_t; /* millisecond time type. */
 #define SET_OP_DIFF 1
 #define SET_OP_INTER 2
 
-/* Redis maxmemory strategies */
-#define MAXMEMORY_VOLATILE_LRU 0
-#define MAXMEMORY_VOLATILE_TTL 1
-#define MAXMEMORY_VOLATILE_RANDOM 2
-#define MAXMEMORY_ALLKEYS_LRU 3
-#define MAXMEMORY_ALLKEYS_RANDOM 4
-#define MAXMEMORY_NO_EVICTION 5
+/* Redis maxmemory strategies. Instead of using just incremental number
+ * for this defines, we use a set of flags so that testing for certain
+ * properties common to multiple policies is faster. */
+#define MAXMEMORY_FLAG_LRU (1 << 0)
+#define MAXMEMORY_FLAG_LFU (1 << 1)
+#define MAXMEMORY_FLAG_ALLKEYS (1 << 2)
+#define MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
+    (MAXMEMORY_FLAG_LRU | MAXMEMORY_FLAG_LFU)
+
+#define MAXMEMORY_VOLATILE_LRU ((0 << 8) | MAXMEMORY_FLAG_LRU)
+#define MAXMEMORY_VOLATILE_LFU ((1 << 8) | MAXMEMORY_FLAG_LFU)
+#define MAXMEMORY_VOLATILE_TTL (2 << 8)
+#define MAXMEMORY_VOLATILE_RANDOM (3 << 8)
+#define MAXMEMORY_ALLKEYS_LRU \
+    ((4 << 8) | MAXMEMORY_FLAG_LRU | MAXMEMORY_FLAG_ALLKEYS)
+#define MAXMEMORY_ALLKEYS_LFU \
+    ((5 << 8) | MAXMEMORY_FLAG_LFU | MAXMEMORY_FLAG_ALLKEYS)
+#define MAXMEMORY_ALLKEYS_RANDOM ((6 << 8) | MAXMEMORY_FLAG_ALLKEYS)
+#define MAXMEMORY_NO_EVICTION (7 << 8)
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
+/* LFU policies keep in the 24 bits of robj->lru the last time the access
+ * counter was decremented, in minutes (16 bits), and a logarithmic access
+ * counter (8 bits) starting at LFU_INIT_VAL, so that new keys get a chance
+ * to be accessed before being evicted. */
+#define LFU_INIT_VAL 5
+#define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
+#define CONFIG_DEFAULT_LFU_DECAY_TIME 1
+
 /* Scripting */
 #define LUA_SCRIPT_TIME_LIMIT 5000 /* milliseconds */
 
@@ -488,6 +533,10 @@ typedef struct redisObject {
     void *ptr;
 } robj;
 
+/* Objects with this refcount are never freed and their refcount is never
+ * changed, so several threads can share them (see makeObjectShared()). */
+#define OBJ_SHARED_REFCOUNT INT_MAX
+
 /* Macro used to obtain the current LRU clock.
  * If the current resolution is lower than the frequency we refresh the
  * LRU clock (as it should be in production servers) we return the
@@ -533,10 +582,14 @@ typedef struct redisDb {
     dict *ready_keys;    /* Blocked keys that received a PUSH */
     dict *watched_keys;  /* WATCHED keys for MULTI/EXEC CAS */
     struct evictionPoolEntry *eviction_pool; /* Eviction pool of keys */
+    sds eviction_cursor;                     /* Last key sampled for it */
     int id;                                  /* Database ID */
     long long avg_ttl;                       /* Average TTL, just for stats */
 } redisDb;
 
+/* Keyspace kept aside by backupDb(), opaque outside db.c. */
+typedef struct dbBackup dbBackup;
+
 /* Client MULTI/EXEC state */
 typedef struct multiCmd {
     robj **argv;
@@ -585,6 +638,25 @@ typedef struct readyList {
     robj *key;
 } readyList;
 
+/* The replication stream is stored once, in a list of blocks that the
+ * backlog and the slaves reference instead of keeping their own copy of the
+ * bytes. A block is freed when it leaves the backlog and no slave still has
+ * to send it, see feedReplicationBuffer(). */
+typedef struct replBufBlock {
+    int refcount;          /* Backlog and slaves pointing to this block. */
+    long long repl_offset; /* Replication offset of buf[0]. */
+    size_t size, used;
+    char buf[];
+} replBufBlock;
+
+/* The replication backlog is the head of the replication buffer, trimmed
+ * to about repl-backlog-size bytes. */
+typedef struct replBacklog {
+    listNode *ref_repl_buf_node; /* First block of the backlog. */
+    long long histlen;           /* Backlog actual data length. */
+    long long offset; /* Replication offset of first byte in the backlog. */
+} replBacklog;
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a linked list. */
 typedef struct client {
@@ -597,6 +669,7 @@ typedef struct client {
     int dictid;           /* ID of the currently SELECTed DB. */
     robj *name;           /* As set by CLIENT SETNAME. */
     sds querybuf;         /* Buffer we use to accumulate client queries. */
+    size_t qb_pos;        /* The position we have read in querybuf. */
     size_t querybuf_peak; /* Recent (100ms or more) peak of querybuf size. */
     int argc;             /* Num of arguments of current command. */
     robj **argv;          /* Arguments of current command. */
@@ -619,12 +692,16 @@ typedef struct client {
     off_t repldboff;            /* Replication DB file offset. */
     off_t repldbsize;           /* Replication DB file size. */
     sds replpreamble;           /* Replication DB preamble. */
-    long long reploff;          /* Replication offset if this is our master. */
+    long long read_reploff; /* Read replication offset if this is a master. */
+    long long reploff; /* Applied replication offset if this is a master. */
     long long repl_ack_off;  /* Replication ack offset, if this is a slave. */
     long long repl_ack_time; /* Replication ack time, if this is a slave. */
     long long psync_initial_offset; /* FULLRESYNC reply offset other slaves
                                        copying this slave output buffer
                                        should use. */
+    listNode *ref_repl_buf_node; /* Replication buffer block the slave is
+                                    sending, NULL if none yet. */
+    size_t ref_block_pos;        /* Bytes of that block already sent. */
     char replrunid[CONFIG_RUN_ID_SIZE + 1]; /* Master run id if is a master. */
     int slave_listening_port; /* As configured with: REPLCONF listening-port */
     char slave_ip[NET_IP_STR_LEN]; /* Optionally given by REPLCONF ip-address */
@@ -638,6 +715,13 @@ typedef struct client {
     list *pubsub_patterns; /* patterns a client is interested in (SUBSCRIBE) */
     sds peerid;            /* Cached peer ID. */
 
+    /* Client side caching, see q_tracking.c */
+    uint64_t client_tracking_redirection; /* Invalidations go there if set. */
+    int tracking_target;   /* Subscribed to __redis__:invalidate. */
+    int tracking_notified; /* Owner was told about the inbox. */
+    struct cds_wfcq_head tracking_head; /* Inbox of invalidations. */
+    struct cds_wfcq_tail tracking_tail;
+
     /* Response buffer */
     int bufpos;
     char buf[PROTO_REPLY_CHUNK_BYTES];
@@ -774,10 +858,13 @@ struct redisServer {
     int protected_mode;              /* Don't accept external connections. */
     /* RDB / AOF loading information */
     int loading; /* We are loading data from disk if true */
+    int async_loading; /* The old keyspace serves reads meanwhile */
     off_t loading_total_bytes;
     off_t loading_loaded_bytes;
     time_t loading_start_time;
     off_t loading_process_events_interval_bytes;
+    int key_load_delay; /* Microseconds to sleep after every key loaded, to
+                           test what happens during a long load. */
     /* Fast pointers to often looked up command */
     struct redisCommand *delCommand, *multiCommand, *lpushCommand, *lpopCommand,
         *rpopCommand, *sremCommand, *execCommand, *expireCommand,
@@ -797,6 +884,10 @@ struct redisServer {
     long long stat_sync_full;       /* Number of full resyncs with slaves. */
     long long stat_sync_partial_ok; /* Number of accepted PSYNC requests. */
     long long stat_sync_partial_err; /* Number of unaccepted PSYNC requests. */
+    long long stat_rcu_throttled;      /* Writes delayed by an rcu_barrier() */
+    long long stat_rcu_throttle_usec;  /* Time spent in those rcu_barrier() */
+    long long stat_repl_apply_parallel; /* Master commands of apply threads */
+    long long stat_repl_apply_barriers; /* Waits for the apply threads */
     list *slowlog;                   /* SLOWLOG list of commands */
     long long slowlog_entry_id;      /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
@@ -890,12 +981,11 @@ struct redisServer {
     int slaveseldb;                 /* Last SELECTed DB in replication output */
     long long master_repl_offset;   /* Global replication offset */
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
-    char *repl_backlog;             /* Replication backlog for partial syncs */
-    long long repl_backlog_size;    /* Backlog circular buffer size */
-    long long repl_backlog_histlen; /* Backlog actual data length */
-    long long repl_backlog_idx;     /* Backlog circular buffer current offset */
-    long long repl_backlog_off;     /* Replication offset of first byte in the
-                                       backlog buffer. */
+    replBacklog *repl_backlog;      /* Replication backlog for partial syncs */
+    long long repl_backlog_size;    /* Backlog size */
+    list *repl_buffer_blocks;       /* Replication stream, shared by the
+                                       backlog and the slaves: replBufBlock */
+    size_t repl_buffer_mem;         /* Memory used by repl_buffer_blocks */
     time_t repl_backlog_time_limit; /* Time without slaves after the backlog
                                        gets released. */
     time_t repl_no_slaves_since;    /* We have no slaves since that time.
@@ -905,6 +995,8 @@ struct redisServer {
     int repl_good_slaves_count;     /* Number of slaves with lag <= max_lag. */
     int repl_diskless_sync;         /* Send RDB to slaves sockets directly. */
     int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */
+    int repl_diskless_load; /* Slave: load the RDB from the socket, see
+                               REPL_DISKLESS_LOAD_* */
     /* Replication (slave) */
     char *masterauth;        /* AUTH with this password with master */
     char *masterhost;        /* Hostname of master */
@@ -923,6 +1015,8 @@ struct redisServer {
     time_t repl_transfer_lastio; /* Unix time of the latest read, for timeout */
     int repl_serve_stale_data;   /* Serve stale data when link is down? */
     int repl_slave_ro;           /* Slave is read only? */
+    int repl_apply_threads; /* Threads applying the master stream, 0 to apply
+                               it in the server thread. */
     time_t repl_down_since; /* Unix time at which link with master went down */
     int repl_disable_tcp_nodelay; /* Disable TCP_NODELAY after SYNC? */
     int slave_priority;           /* Reported in INFO and used by Sentinel. */
@@ -943,6 +1037,15 @@ struct redisServer {
     unsigned long long maxmemory; /* Max number of memory bytes to use */
     int maxmemory_policy;         /* Policy for key eviction */
     int maxmemory_samples;        /* Pricision of random sampling */
+    int lfu_log_factor;           /* LFU logarithmic counter factor. */
+    int lfu_decay_time;           /* LFU counter decay factor. */
+    int jemalloc_thread_arenas;   /* One allocator arena per thread. */
+    long long jemalloc_dirty_decay_ms; /* Time before returning the freed */
+    long long jemalloc_muzzy_decay_ms; /* pages to the system, -1 never. */
+    unsigned long long rcu_reclaim_max_memory; /* Max bytes waiting for an
+                                                  RCU grace period */
+    struct call_rcu_data *call_rcu_data; /* Reclaims the server thread's
+                                            call_rcu() callbacks */
     /* Blocked clients */
     unsigned int bpop_blocked_clients; /* Number of clients blocked by lists */
     list *unblocked_clients; /* list of clients to unblock before next loop */
@@ -971,6 +1074,17 @@ struct redisServer {
     list *pubsub_patterns;      /* A list of pubsub_patterns */
     int notify_keyspace_events; /* Events to propagate via Pub/Sub. This is an
                                    xor of NOTIFY_... flags. */
+    /* Client side caching */
+    long long tracking_table_max_keys; /* Keys tracked before evicting some,
+                                          0 for no limit. */
+    /* Hot keys, see q_hotkeys.c */
+    int hotkeys_sample_rate; /* Count the keys of one command every N,
+                                0 to disable the sampling. */
+    /* Key index, see q_keyindex.c */
+    int key_prefix_index; /* Keep the key names of every db ordered. */
+    /* KEYS, see q_match.c */
+    int keys_threads; /* Threads matching the keys against the pattern, 0 to
+                         match them in the thread running KEYS. */
     /* Cluster */
     int cluster_enabled;           /* Is cluster enabled? */
     mstime_t cluster_node_timeout; /* Cluster node timeout. */
@@ -1016,6 +1130,9 @@ struct redisServer {
     list *command_requests;
     struct cds_wfcq_head command_requests_head;
     struct cds_wfcq_tail command_requests_tail;
+    /* Keys found expired by the workers, see q_expire.c */
+    struct cds_wfcq_head expire_batches_head;
+    struct cds_wfcq_tail expire_batches_tail;
     int socketpairs[2];
     q_eventloop qel;
 };
@@ -1114,10 +1231,13 @@ extern dictType zsetDictType;
 extern dictType clusterNodesDictType;
 extern dictType clusterNodesBlackListDictType;
 extern dictType dbDictType;
+extern dictType keyptrDictType;
+extern dictType keylistDictType;
 extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
+extern q_dictType keyspaceDictType;
 
 /*-----------------------------------------------------------------------------
  * Functions prototypes
@@ -1127,6 +1247,7 @@ extern dictType replScriptCacheDictType;
 long long ustime(void);
 long long mstime(void);
 void getRandomHexChars(char *p, unsigned int len);
+void getRandomBytes(unsigned char *p, size_t len);
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 void exitFromChild(int retcode);
 size_t redisPopcount(void *s, long count);
@@ -1142,6 +1263,8 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addDeferredMultiBulkLength(client *c);
 void setDeferredMultiBulkLength(client *c, void *node, long length);
 void processInputBuffer(client *c);
+void returnSharedQueryBuffer(client *c);
+void trimClientQueryBuffer(client *c);
 int worker_processInputBuffer(client *c);
 void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
@@ -1165,6 +1288,7 @@ void addReplyHumanLongDouble(client *c, long double d);
 void addReplyLongLong(client *c, long long ll);
 void addReplyMultiBulkLen(client *c, long length);
 void copyClientOutputBuffer(client *dst, client *src);
+int prepareClientToWrite(client *c);
 void *dupClientReplyValue(void *o);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
@@ -1189,7 +1313,10 @@ int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(q_eventloop *qel);
 int clientHasPendingReplies(client *c);
 void unlinkClient(client *c);
+void unlinkClientFromEventloop(client *c);
+void clientsCronList(list *clients, int hz);
 int writeToClient(int fd, client *c, int handler_installed);
+void streamClientReplies(client *c);
 
 #ifdef __GNUC__
 void addReplyErrorFormat(client *c, const char *fmt, ...)
@@ -1243,6 +1370,7 @@ void freeSetObject(robj *o);
 void freeZsetObject(robj *o);
 void freeHashObject(robj *o);
 robj *createObject(int type, void *ptr);
+robj *makeObjectShared(robj *o);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
@@ -1281,6 +1409,10 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+unsigned int objectNewLRU(void);
+unsigned long LFUDecrAndReturn(robj *o);
+void updateObjectAccess(robj *o);
+size_t objectComputeSize(robj *o, size_t sample_size);
 #define sdsEncodedObject(objptr)             \
     (objptr->encoding == OBJ_ENCODING_RAW || \
      objptr->encoding == OBJ_ENCODING_EMBSTR)
@@ -1302,6 +1434,8 @@ void replicationCron(void);
 void replicationHandleMasterDisconnection(void);
 void replicationCacheMaster(client *c);
 void resizeReplicationBacklog(long long newsize);
+void incrementalTrimReplicationBacklog(size_t max_blocks);
+void unrefReplicationBuffer(client *c);
 void replicationSetMaster(char *ip, int port);
 void replicationUnsetMaster(void);
 void refreshGoodSlavesCount(void);
@@ -1319,7 +1453,8 @@ long long getPsyncInitialOffset(void);
 int replicationSetupSlaveForFullResync(client *slave, long long offset);
 
 /* Generic persistence functions */
-void startLoading(FILE *fp);
+void startLoading(size_t size);
+void startLoadingFile(FILE *fp);
 void loadingProgress(off_t pos);
 void stopLoading(void);
 
@@ -1374,6 +1509,7 @@ unsigned long zslGetRank(zskiplist *zsl, double score, robj *o);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
+void rcuReclaimThrottleIfNeeded(void);
 int processCommand(client *c);
 int worker_processCommand(client *c);
 int server_processCommand(client *c);
@@ -1479,6 +1615,7 @@ int rewriteConfig(char *path);
 /* db.c -- Keyspace access API */
 int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key);
+int activeExpireCycleTryExpire(redisDb *db, q_dictEntry *de, long long now);
 int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(redisDb *db, robj *key, long long when);
@@ -1497,7 +1634,20 @@ int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
+robj *dbCopyStringValue(robj *o, size_t minlen);
+robj *dbWriteStringValue(redisDb *db,
+                         robj *key,
+                         robj *o,
+                         size_t offset,
+                         const char *p,
+                         size_t len);
 long long emptyDb(void(callback)(void *));
+dbBackup *backupDb(void);
+void restoreDbBackup(dbBackup *backup, void(callback)(void *));
+void discardDbBackup(dbBackup *backup, void(callback)(void *));
+redisDb *createTempDb(void);
+void swapTempDb(redisDb *tempDb, void(callback)(void *));
+void discardTempDb(redisDb *tempDb, void(callback)(void *));
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
@@ -1530,6 +1680,10 @@ int *georadiusGetKeys(struct redisCommand *cmd,
                       robj **argv,
                       int argc,
                       int *numkeys);
+int *memoryGetKeys(struct redisCommand *cmd,
+                   robj **argv,
+                   int argc,
+                   int *numkeys);
 
 /* Cluster */
 void clusterInit(void);
@@ -1551,6 +1705,9 @@ void sentinelIsRunning(void);
 int redis_check_rdb(char *rdbfilename);
 int redis_check_rdb_main(int argc, char **argv);
 
+/* redis-microbench */
+int redis_microbench_main(int argc, char **argv);
+
 /* Scripting */
 void scriptingInit(int setup);
 int ldbRemoveChild(pid_t pid);
@@ -1584,6 +1741,7 @@ void setexCommand(client *c);
 void psetexCommand(client *c);
 void getCommand(client *c);
 void delCommand(client *c);
+void delprefixCommand(client *c);
 void existsCommand(client *c);
 void setbitCommand(client *c);
 void getbitCommand(client *c);
@@ -1719,6 +1877,8 @@ void readonlyCommand(client *c);
 void readwriteCommand(client *c);
 void dumpCommand(client *c);
 void objectCommand(client *c);
+void memoryCommand(client *c);
+void hotkeysCommand(client *c);
 void clientCommand(client *c);
 void evalCommand(client *c);
 void evalShaCommand(client *c);
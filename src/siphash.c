@@ -0,0 +1,225 @@
+/* SipHash-1-2, the 64 bit hash function of the hash tables.
+ *
+ * SipHash (Jean-Philippe Aumasson and Daniel J. Bernstein) is a keyed hash:
+ * with a random 128 bit key chosen at startup, clients can't predict which
+ * of their keys collide, so they can't make the chains of a table grow on
+ * purpose. The reduced 1-2 variant (one compression round per 8 bytes, two
+ * finalization rounds, where the reference SipHash-2-4 has two and four) is
+ * fast enough for the short strings of a keyspace while still well
+ * distributed over the 64 bits, that the split-ordered lists of q_dict use
+ * entirely.
+ *
+ * The result doesn't depend on the endianness nor on the alignment of the
+ * input. siphashNocase() hashes the ASCII lower case version of the input,
+ * for the tables comparing their keys with strcasecmp(). */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "dict.h"
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND             \
+    do {                     \
+        v0 += v1;            \
+        v1 = ROTL(v1, 13);   \
+        v1 ^= v0;            \
+        v0 = ROTL(v0, 32);   \
+        v2 += v3;            \
+        v3 = ROTL(v3, 16);   \
+        v3 ^= v2;            \
+        v0 += v3;            \
+        v3 = ROTL(v3, 21);   \
+        v3 ^= v0;            \
+        v2 += v1;            \
+        v1 = ROTL(v1, 17);   \
+        v1 ^= v2;            \
+        v2 = ROTL(v2, 32);   \
+    } while (0)
+
+/* Little endian load of 8 bytes, compiled to a single load where possible. */
+static inline uint64_t load64(const uint8_t *p, int nocase)
+{
+    if (nocase) {
+        return (uint64_t) tolower(p[0]) | ((uint64_t) tolower(p[1]) << 8) |
+               ((uint64_t) tolower(p[2]) << 16) |
+               ((uint64_t) tolower(p[3]) << 24) |
+               ((uint64_t) tolower(p[4]) << 32) |
+               ((uint64_t) tolower(p[5]) << 40) |
+               ((uint64_t) tolower(p[6]) << 48) |
+               ((uint64_t) tolower(p[7]) << 56);
+    }
+    return (uint64_t) p[0] | ((uint64_t) p[1] << 8) | ((uint64_t) p[2] << 16) |
+           ((uint64_t) p[3] << 24) | ((uint64_t) p[4] << 32) |
+           ((uint64_t) p[5] << 40) | ((uint64_t) p[6] << 48) |
+           ((uint64_t) p[7] << 56);
+}
+
+/* SipHash-c-d, 'crounds' and 'drounds' being constants once inlined. */
+static inline uint64_t siphashGeneric(const uint8_t *in,
+                                      size_t inlen,
+                                      const uint8_t *k,
+                                      int nocase,
+                                      int crounds,
+                                      int drounds)
+{
+    uint64_t k0 = load64(k, 0);
+    uint64_t k1 = load64(k + 8, 0);
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+    uint64_t b = ((uint64_t) inlen) << 56;
+    const uint8_t *end = in + inlen - (inlen % 8);
+    uint64_t m;
+    int i;
+
+    for (; in != end; in += 8) {
+        m = load64(in, nocase);
+        v3 ^= m;
+        for (i = 0; i < crounds; i++)
+            SIPROUND;
+        v0 ^= m;
+    }
+
+#define TAILBYTE(i) \
+    ((uint64_t) (nocase ? tolower(in[i]) : in[i]) << (8 * (i)))
+    switch (inlen % 8) {
+    case 7:
+        b |= TAILBYTE(6);
+        /* fall through */
+    case 6:
+        b |= TAILBYTE(5);
+        /* fall through */
+    case 5:
+        b |= TAILBYTE(4);
+        /* fall through */
+    case 4:
+        b |= TAILBYTE(3);
+        /* fall through */
+    case 3:
+        b |= TAILBYTE(2);
+        /* fall through */
+    case 2:
+        b |= TAILBYTE(1);
+        /* fall through */
+    case 1:
+        b |= TAILBYTE(0);
+        break;
+    case 0:
+        break;
+    }
+#undef TAILBYTE
+
+    v3 ^= b;
+    for (i = 0; i < crounds; i++)
+        SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    for (i = 0; i < drounds; i++)
+        SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Hash 'inlen' bytes of 'in' with the 16 bytes key 'k'. */
+uint64_t siphash(const uint8_t *in, size_t inlen, const uint8_t *k)
+{
+    return siphashGeneric(in, inlen, k, 0, 1, 2);
+}
+
+uint64_t siphashNocase(const uint8_t *in, size_t inlen, const uint8_t *k)
+{
+    return siphashGeneric(in, inlen, k, 1, 1, 2);
+}
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <string.h>
+
+/* SipHash-2-4 of the messages 00, 00 01, ... of 0 to 63 bytes with the key
+ * 00 01 ... 0f, from the reference implementation. */
+static const uint64_t vectors24[64] = {
+    0x726fdb47dd0e0e31ULL, 0x74f839c593dc67fdULL, 0x0d6c8009d9a94f5aULL,
+    0x85676696d7fb7e2dULL, 0xcf2794e0277187b7ULL, 0x18765564cd99a68dULL,
+    0xcbc9466e58fee3ceULL, 0xab0200f58b01d137ULL, 0x93f5f5799a932462ULL,
+    0x9e0082df0ba9e4b0ULL, 0x7a5dbbc594ddb9f3ULL, 0xf4b32f46226bada7ULL,
+    0x751e8fbc860ee5fbULL, 0x14ea5627c0843d90ULL, 0xf723ca908e7af2eeULL,
+    0xa129ca6149be45e5ULL, 0x3f2acc7f57c29bdbULL, 0x699ae9f52cbe4794ULL,
+    0x4bc1b3f0968dd39cULL, 0xbb6dc91da77961bdULL, 0xbed65cf21aa2ee98ULL,
+    0xd0f2cbb02e3b67c7ULL, 0x93536795e3a33e88ULL, 0xa80c038ccd5ccec8ULL,
+    0xb8ad50c6f649af94ULL, 0xbce192de8a85b8eaULL, 0x17d835b85bbb15f3ULL,
+    0x2f2e6163076bcfadULL, 0xde4daaaca71dc9a5ULL, 0xa6a2506687956571ULL,
+    0xad87a3535c49ef28ULL, 0x32d892fad841c342ULL, 0x7127512f72f27cceULL,
+    0xa7f32346f95978e3ULL, 0x12e0b01abb051238ULL, 0x15e034d40fa197aeULL,
+    0x314dffbe0815a3b4ULL, 0x027990f029623981ULL, 0xcadcd4e59ef40c4dULL,
+    0x9abfd8766a33735cULL, 0x0e3ea96b5304a7d0ULL, 0xad0c42d6fc585992ULL,
+    0x187306c89bc215a9ULL, 0xd4a60abcf3792b95ULL, 0xf935451de4f21df2ULL,
+    0xa9538f0419755787ULL, 0xdb9acddff56ca510ULL, 0xd06c98cd5c0975ebULL,
+    0xe612a3cb9ecba951ULL, 0xc766e62cfcadaf96ULL, 0xee64435a9752fe72ULL,
+    0xa192d576b245165aULL, 0x0a8787bf8ecb74b2ULL, 0x81b3e73d20b49b6fULL,
+    0x7fa8220ba3b2eceaULL, 0x245731c13ca42499ULL, 0xb78dbfaf3a8d83bdULL,
+    0xea1ad565322a1a0bULL, 0x60e61c23a3795013ULL, 0x6606d7e446282b93ULL,
+    0x6ca4ecb15c5f91e1ULL, 0x9f626da15c9625f3ULL, 0xe51b38608ef25f57ULL,
+    0x958a324ceb064572ULL};
+
+/* The same with SipHash-1-2, the reference implementation with cROUNDS 1
+ * and dROUNDS 2. */
+static const uint64_t vectors12[64] = {
+    0xcea28b51565c12e2ULL, 0x94aaf38c34ce7ba6ULL, 0xfe7a42c2c5fab434ULL,
+    0x1c0d255229c3364cULL, 0x8be7847a474dfdf5ULL, 0x2858f0420f752296ULL,
+    0xe61a8a7d8ac52626ULL, 0xf03c4cbcf492b05aULL, 0x606845b4d093af74ULL,
+    0xe304e78271c74a56ULL, 0xc936e00e33b32633ULL, 0x226212e5f29ab45cULL,
+    0xa4377b74fbbfe0daULL, 0x624317667190806fULL, 0x4a72ad78e3e197d7ULL,
+    0xec8f61bc1c8966a6ULL, 0x1311f4dfe747a751ULL, 0x899c7b292c85339cULL,
+    0xa3b20ae95368b5ddULL, 0xb613412ee70eefceULL, 0xe4247448e02aa65aULL,
+    0x7e041ab05b9fee13ULL, 0x871bc8cc515684feULL, 0x436662cf8cde1a76ULL,
+    0xd5fd6251d879f3a2ULL, 0x82c424b8c1744fe7ULL, 0x967028a3aba506d5ULL,
+    0xf2179336b1ddbf10ULL, 0xdef90e3211d9aa84ULL, 0xa33e74ba1d89ae41ULL,
+    0xed0920815dc55e0eULL, 0x3d9450fef5eaa3b3ULL, 0x8bd10d4a226548bcULL,
+    0xb0dfbbd1a243bfa1ULL, 0x365f27632baf7303ULL, 0x545100bc1366dcf9ULL,
+    0x611b500c069bb1b4ULL, 0xc7bc320c00c54c5aULL, 0x5e0af95633715151ULL,
+    0x1443529b74c90453ULL, 0x1634523d495d5230ULL, 0x75958e88d02999f2ULL,
+    0x1295663c11127d2bULL, 0xcdb2696d6a9bd60dULL, 0x36712f75aaf32cefULL,
+    0xae62d7408dc29d3fULL, 0xd8eb27deb0abba06ULL, 0xc24d440279e9ed9fULL,
+    0x327d416c3fb96508ULL, 0x84bc07d711537949ULL, 0xc480fb0251dbfaceULL,
+    0xff513fb91356eb67ULL, 0x9cd4dc2c38a39e31ULL, 0x3cbd87ea4988b51aULL,
+    0x7b735caca5b1397bULL, 0x1f2319ee309ba4e1ULL, 0x5834e51f881c96f9ULL,
+    0x1a8588a92b5770d7ULL, 0xd437a8e6ded16e58ULL, 0xf51e09a0226ae839ULL,
+    0xfebb93e58a6cca86ULL, 0xa31e05072d42c065ULL, 0xad7b019fe5fc8b4cULL,
+    0xff6d07afacbad6d9ULL};
+
+#define UNUSED(x) (void) (x)
+int siphashTest(int argc, char **argv)
+{
+    uint8_t key[16], in[64];
+    int j, failed = 0;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    for (j = 0; j < 16; j++)
+        key[j] = j;
+    for (j = 0; j < 64; j++)
+        in[j] = j;
+
+    for (j = 0; j < 64; j++) {
+        uint64_t h24 = siphashGeneric(in, j, key, 0, 2, 4);
+        uint64_t h12 = siphash(in, j, key);
+
+        if (h24 != vectors24[j] || h12 != vectors12[j]) {
+            printf("siphash of %d bytes: 2-4 %016llx, 1-2 %016llx\n", j,
+                   (unsigned long long) h24, (unsigned long long) h12);
+            failed = 1;
+        }
+    }
+    if (siphashNocase((uint8_t *) "Hello World!", 12, key) !=
+        siphash((uint8_t *) "hello world!", 12, key)) {
+        printf("siphashNocase differs from siphash of the lower case\n");
+        failed = 1;
+    }
+    printf("siphash: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
+#endif
@@ -153,11 +153,10 @@ void setCommand(client *c)
         }
     }
 
-    // c->argv[2] = tryObjectEncoding(c->argv[2]);
     // copy key and val string, instead using original c->argv, as ref increment
     // in server thread may not be seen in worker thread, which can result in
-    // panic or memory leak.
-    val = dupStringObject(c->argv[2]);
+    // panic or memory leak. The private copy of val can be encoded.
+    val = tryObjectEncoding(dupStringObject(c->argv[2]));
     key = dupStringObject(c->argv[1]);
     setGenericCommand(c, flags, key, val, expire, unit, NULL, NULL);
     decrRefCount(val);
@@ -170,8 +169,7 @@ void setnxCommand(client *c)
     robj *val = NULL;
 
     key = dupStringObject(c->argv[1]);
-    val = dupStringObject(c->argv[2]);
-    // c->argv[2] = tryObjectEncoding(c->argv[2]);
+    val = tryObjectEncoding(dupStringObject(c->argv[2]));
     setGenericCommand(c, OBJ_SET_NX, key, val, NULL, 0, shared.cone,
                       shared.czero);
     decrRefCount(key);
@@ -184,10 +182,9 @@ void setexCommand(client *c)
     robj *val = NULL;
 
     key = dupStringObject(c->argv[1]);
-    val = dupStringObject(c->argv[3]);
-    // c->argv[3] = tryObjectEncoding(c->argv[3]);
-    setGenericCommand(c, OBJ_SET_NO_FLAGS, c->argv[1], c->argv[3], c->argv[2],
-                      UNIT_SECONDS, NULL, NULL);
+    val = tryObjectEncoding(dupStringObject(c->argv[3]));
+    setGenericCommand(c, OBJ_SET_NO_FLAGS, key, val, c->argv[2], UNIT_SECONDS,
+                      NULL, NULL);
     decrRefCount(key);
     decrRefCount(val);
 }
@@ -198,9 +195,8 @@ void psetexCommand(client *c)
     robj *val = NULL;
 
     key = dupStringObject(c->argv[1]);
-    val = dupStringObject(c->argv[3]);
-    // c->argv[3] = tryObjectEncoding(c->argv[3]);
-    setGenericCommand(c, OBJ_SET_NO_FLAGS, c->argv[1], c->argv[3], c->argv[2],
+    val = tryObjectEncoding(dupStringObject(c->argv[3]));
+    setGenericCommand(c, OBJ_SET_NO_FLAGS, key, val, c->argv[2],
                       UNIT_MILLISECONDS, NULL, NULL);
     decrRefCount(key);
     decrRefCount(val);
@@ -239,9 +235,8 @@ void getsetCommand(client *c)
 
     if (getGenericCommand(c) == C_ERR)
         return;
-    // c->argv[2] = tryObjectEncoding(c->argv[2]);
     key = dupStringObject(c->argv[1]);
-    val = dupStringObject(c->argv[2]);
+    val = tryObjectEncoding(dupStringObject(c->argv[2]));
     setKey(c->db, key, val);
     notifyKeyspaceEvent(NOTIFY_STRING, "set", key, c->db->id);
     server.dirty++;
@@ -275,7 +270,9 @@ void setrangeCommand(client *c)
         if (checkStringLength(c, offset + sdslen(value)) != C_OK)
             return;
 
+        /* Written before being added, workers could read it right away. */
         o = createObject(OBJ_STRING, sdsnewlen(NULL, offset + sdslen(value)));
+        memcpy((char *) o->ptr + offset, value, sdslen(value));
         dbAdd(c->db, c->argv[1], o);
     } else {
         size_t olen;
@@ -295,20 +292,12 @@ void setrangeCommand(client *c)
         if (checkStringLength(c, offset + sdslen(value)) != C_OK)
             return;
 
-        /* Create a copy when the object is shared or encoded. */
-        o = dbUnshareStringValue(c->db, c->argv[1], o);
+        /* Copy on write unless a single byte is overwritten. */
+        o = dbWriteStringValue(c->db, c->argv[1], o, offset, value,
+                               sdslen(value));
     }
 
     if (sdslen(value) > 0) {
-        sds oc = NULL;
-        sds nc = NULL;
-        oc = o->ptr;
-        nc = sdsdup(o->ptr);
-        nc = sdsgrowzero(nc, offset + sdslen(value));
-        memcpy((char *) nc + offset, value, sdslen(value));
-        rcu_assign_pointer(o->ptr, nc);
-        synchronize_rcu();
-        sdsfree(oc);
         signalModifiedKey(c->db, c->argv[1]);
         notifyKeyspaceEvent(NOTIFY_STRING, "setrange", c->argv[1], c->db->id);
         server.dirty++;
@@ -420,8 +409,7 @@ void msetGenericCommand(client *c, int nx)
 
     for (j = 1; j < c->argc; j += 2) {
         robj *key = dupStringObject(c->argv[j]);
-        robj *val = dupStringObject(c->argv[j + 1]);
-        // c->argv[j+1] = tryObjectEncoding(c->argv[j+1]);
+        robj *val = tryObjectEncoding(dupStringObject(c->argv[j + 1]));
         setKey(c->db, key, val);
         notifyKeyspaceEvent(NOTIFY_STRING, "set", key, c->db->id);
         decrRefCount(key);
@@ -460,19 +448,16 @@ void incrDecrCommand(client *c, long long incr)
     }
     value += incr;
 
-    if (o && o->refcount == 1 && o->encoding == OBJ_ENCODING_INT &&
-        (value < 0 || value >= OBJ_SHARED_INTEGERS) && value >= LONG_MIN &&
-        value <= LONG_MAX) {
-        new = o;
-        // o->ptr = (void*)((long)value);
-        rcu_assign_pointer(o->ptr, (void *) ((long) value));
+    /* The value isn't updated in place even when the object isn't shared:
+     * a worker replying with it reads it twice, for the length and for the
+     * digits. The new object takes the LRU/LFU data of the old one. */
+    new = createStringObjectFromLongLong(value);
+    if (o) {
+        if (o->refcount == 1 && new->refcount == 1)
+            new->lru = o->lru;
+        dbOverwrite(c->db, c->argv[1], new);
     } else {
-        new = createStringObjectFromLongLong(value);
-        if (o) {
-            dbOverwrite(c->db, c->argv[1], new);
-        } else {
-            dbAdd(c->db, c->argv[1], new);
-        }
+        dbAdd(c->db, c->argv[1], new);
     }
     signalModifiedKey(c->db, c->argv[1]);
     notifyKeyspaceEvent(NOTIFY_STRING, "incrby", c->argv[1], c->db->id);
@@ -562,12 +547,12 @@ void appendCommand(client *c)
         incrRefCount(val);
         totlen = stringObjectLen(val);
     } else {
-        sds oc = NULL;
-        sds nc = NULL;
-
         /* Key exists, check type */
-        if (checkType(c, o, OBJ_STRING))
+        if (checkType(c, o, OBJ_STRING)) {
+            decrRefCount(key);
+            decrRefCount(val);
             return;
+        }
 
         /* "append" is an argument, so always an sds */
         append = val;
@@ -578,14 +563,9 @@ void appendCommand(client *c)
             return;
         }
 
-        /* Append the value */
-        o = dbUnshareStringValue(c->db, key, o);
-        // o->ptr = sdscatlen(o->ptr,append->ptr,sdslen(append->ptr));
-        nc = sdscatlen(o->ptr, append->ptr, sdslen(append->ptr));
-        oc = o->ptr;
-        rcu_assign_pointer(o->ptr, nc);
-        synchronize_rcu();
-        sdsfree(oc);
+        /* Append the value to a copy, see dbWriteStringValue() */
+        o = dbWriteStringValue(c->db, key, o, stringObjectLen(o), append->ptr,
+                               sdslen(append->ptr));
         totlen = sdslen(o->ptr);
     }
     signalModifiedKey(c->db, key);
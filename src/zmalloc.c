@@ -103,6 +103,8 @@ void zlibc_free(void *ptr)
         } else {                                            \
             used_memory += _n;                              \
         }                                                   \
+        if (zmalloc_count_allocations)                      \
+            __sync_add_and_fetch(&zmalloc_allocations, 1);  \
     } while (0)
 
 #define update_zmalloc_stat_free(__n)                       \
@@ -119,6 +121,9 @@ void zlibc_free(void *ptr)
 
 static size_t used_memory = 0;
 static int zmalloc_thread_safe = 0;
+/* Number of allocations, only tracked when enabled (used by benchmarks). */
+static int zmalloc_count_allocations = 0;
+static size_t zmalloc_allocations = 0;
 pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static void zmalloc_default_oom(size_t size)
@@ -260,6 +265,16 @@ size_t zmalloc_used_memory(void)
     return um;
 }
 
+void zmalloc_enable_allocation_count(int enable)
+{
+    zmalloc_count_allocations = enable;
+}
+
+size_t zmalloc_allocation_count(void)
+{
+    return __sync_add_and_fetch(&zmalloc_allocations, 0);
+}
+
 void zmalloc_enable_thread_safeness(void)
 {
     zmalloc_thread_safe = 1;
@@ -270,6 +285,164 @@ void zmalloc_set_oom_handler(void (*oom_handler)(size_t))
     zmalloc_oom_handler = oom_handler;
 }
 
+/* Fill the global allocator statistics. Returns 1 on success, 0 when the
+ * allocator does not provide them (everything but jemalloc), in which case
+ * all the fields are set to zero. */
+int zmalloc_get_allocator_info(size_t *allocated,
+                               size_t *active,
+                               size_t *resident,
+                               size_t *mapped,
+                               size_t *retained)
+{
+    *allocated = *active = *resident = *mapped = *retained = 0;
+#if defined(USE_JEMALLOC)
+    uint64_t epoch = 1;
+    size_t sz = sizeof(epoch);
+
+    /* Update the statistics cached by mallctl. */
+    je_mallctl("epoch", &epoch, &sz, &epoch, sz);
+    sz = sizeof(size_t);
+    je_mallctl("stats.allocated", allocated, &sz, NULL, 0);
+    je_mallctl("stats.active", active, &sz, NULL, 0);
+    je_mallctl("stats.resident", resident, &sz, NULL, 0);
+    je_mallctl("stats.mapped", mapped, &sz, NULL, 0);
+    je_mallctl("stats.retained", retained, &sz, NULL, 0);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Return in *allocatedp and *deallocatedp the addresses of the counters of
+ * bytes allocated and freed by the calling thread, so that other threads can
+ * read them later. Both are set to NULL when the allocator does not keep
+ * per thread counters. */
+void zmalloc_get_thread_counters(uint64_t **allocatedp, uint64_t **deallocatedp)
+{
+    *allocatedp = *deallocatedp = NULL;
+#if defined(USE_JEMALLOC)
+    size_t sz = sizeof(uint64_t *);
+
+    if (je_mallctl("thread.allocatedp", allocatedp, &sz, NULL, 0) ||
+        je_mallctl("thread.deallocatedp", deallocatedp, &sz, NULL, 0))
+        *allocatedp = *deallocatedp = NULL;
+#endif
+}
+
+/* Bind the calling thread to an arena of its own, so that the objects it
+ * creates are allocated there and it doesn't contend with the other threads
+ * on the arena locks. 'reuse' is an arena left by a thread that exited, or
+ * -1 to create a new one. Returns the arena, or -1 when the allocator has no
+ * arenas (everything but jemalloc). */
+int zmalloc_thread_arena_create(int reuse)
+{
+#if defined(USE_JEMALLOC)
+    unsigned arena = reuse;
+    size_t sz = sizeof(arena);
+
+    if (reuse < 0 && je_mallctl("arenas.create", &arena, &sz, NULL, 0))
+        return -1;
+    if (je_mallctl("thread.arena", NULL, NULL, &arena, sz))
+        return -1;
+    return (int) arena;
+#else
+    ((void) reuse);
+    return -1;
+#endif
+}
+
+/* Set how long the dirty and muzzy pages freed by the program stay in the
+ * arenas before being returned to the system, for all the arenas, including
+ * the ones created later. -1 disables their return. */
+void zmalloc_set_decay(long dirty_ms, long muzzy_ms)
+{
+#if defined(USE_JEMALLOC)
+    ssize_t dirty = dirty_ms, muzzy = muzzy_ms;
+    unsigned narenas, j;
+    size_t sz = sizeof(narenas);
+    char name[64];
+
+    je_mallctl("arenas.dirty_decay_ms", NULL, NULL, &dirty, sizeof(dirty));
+    je_mallctl("arenas.muzzy_decay_ms", NULL, NULL, &muzzy, sizeof(muzzy));
+    if (je_mallctl("arenas.narenas", &narenas, &sz, NULL, 0))
+        return;
+    /* Arenas not initialized yet fail, they get the defaults set above. */
+    for (j = 0; j < narenas; j++) {
+        snprintf(name, sizeof(name), "arena.%u.dirty_decay_ms", j);
+        je_mallctl(name, NULL, NULL, &dirty, sizeof(dirty));
+        snprintf(name, sizeof(name), "arena.%u.muzzy_decay_ms", j);
+        je_mallctl(name, NULL, NULL, &muzzy, sizeof(muzzy));
+    }
+#else
+    ((void) dirty_ms);
+    ((void) muzzy_ms);
+#endif
+}
+
+/* Return to the system the pages of an arena whose decay time elapsed. The
+ * allocator only does it while the arena is in use otherwise, so the threads
+ * call it periodically for their arena in case they are idle. */
+void zmalloc_arena_decay(int arena)
+{
+#if defined(USE_JEMALLOC)
+    char name[64];
+
+    if (arena < 0)
+        return;
+    snprintf(name, sizeof(name), "arena.%d.decay", arena);
+    je_mallctl(name, NULL, NULL, NULL, 0);
+#else
+    ((void) arena);
+#endif
+}
+
+/* Return to the system all the unused pages of all the arenas now. */
+void zmalloc_purge(void)
+{
+#if defined(USE_JEMALLOC)
+    char name[64];
+
+    snprintf(name, sizeof(name), "arena.%d.purge", MALLCTL_ARENAS_ALL);
+    je_mallctl(name, NULL, NULL, NULL, 0);
+#endif
+}
+
+/* Fill the statistics of an arena, as of the last zmalloc_get_allocator_info()
+ * call: bytes allocated by the program, in the pages it uses, and resident.
+ * Returns 1 on success, 0 when the arena or the statistics are missing. */
+int zmalloc_get_arena_info(int arena,
+                           size_t *allocated,
+                           size_t *active,
+                           size_t *resident)
+{
+    *allocated = *active = *resident = 0;
+#if defined(USE_JEMALLOC)
+    size_t small, large, pactive, page, sz = sizeof(size_t);
+    char name[64];
+
+    if (arena < 0 || je_mallctl("arenas.page", &page, &sz, NULL, 0))
+        return 0;
+    snprintf(name, sizeof(name), "stats.arenas.%d.small.allocated", arena);
+    if (je_mallctl(name, &small, &sz, NULL, 0))
+        return 0;
+    snprintf(name, sizeof(name), "stats.arenas.%d.large.allocated", arena);
+    if (je_mallctl(name, &large, &sz, NULL, 0))
+        return 0;
+    snprintf(name, sizeof(name), "stats.arenas.%d.pactive", arena);
+    if (je_mallctl(name, &pactive, &sz, NULL, 0))
+        return 0;
+    snprintf(name, sizeof(name), "stats.arenas.%d.resident", arena);
+    if (je_mallctl(name, resident, &sz, NULL, 0))
+        return 0;
+    *allocated = small + large;
+    *active = pactive * page;
+    return 1;
+#else
+    ((void) arena);
+    return 0;
+#endif
+}
+
 /* Get the RSS information in an OS-specific way.
  *
  * WARNING: the function zmalloc_get_rss() is not designed to be fast
@@ -31,6 +31,8 @@
 #ifndef __ZMALLOC_H
 #define __ZMALLOC_H
 
+#include <stdint.h>
+
 /* Double expansion needed for stringification of macro values. */
 #define __xstr(s) __str(s)
 #define __str(s) #s
@@ -69,12 +71,28 @@ void zfree(void *ptr);
 char *zstrdup(const char *s);
 size_t zmalloc_used_memory(void);
 void zmalloc_enable_thread_safeness(void);
+void zmalloc_enable_allocation_count(int enable);
+size_t zmalloc_allocation_count(void);
 void zmalloc_set_oom_handler(void (*oom_handler)(size_t));
 float zmalloc_get_fragmentation_ratio(size_t rss);
 size_t zmalloc_get_rss(void);
 size_t zmalloc_get_private_dirty(void);
 size_t zmalloc_get_smap_bytes_by_field(char *field);
 size_t zmalloc_get_memory_size(void);
+int zmalloc_get_allocator_info(size_t *allocated,
+                               size_t *active,
+                               size_t *resident,
+                               size_t *mapped,
+                               size_t *retained);
+void zmalloc_get_thread_counters(uint64_t **allocatedp, uint64_t **deallocatedp);
+int zmalloc_thread_arena_create(int reuse);
+void zmalloc_set_decay(long dirty_ms, long muzzy_ms);
+void zmalloc_arena_decay(int arena);
+void zmalloc_purge(void);
+int zmalloc_get_arena_info(int arena,
+                           size_t *allocated,
+                           size_t *active,
+                           size_t *resident);
 void zlibc_free(void *ptr);
 
 #ifndef HAVE_MALLOC_SIZE
@@ -0,0 +1,61 @@
+# Check the CLUSTER MIGRATESLOT streaming slot migration.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 2 nodes cluster" {
+    create_cluster 2 0
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+set slot [R 0 cluster keyslot "{migr}"]
+# The slot is served by one of the two masters, move it to the other.
+set src 0
+if {[catch {R 0 set "{migr}probe" 1}]} {set src 1}
+set dst [expr {1-$src}]
+R $src del "{migr}probe"
+
+test "Fill the slot to migrate" {
+    for {set j 0} {$j < 20000} {incr j} {
+        R $src rpush "{migr}list:$j" $j
+    }
+    R $src set "{migr}volatile" foo
+    R $src expire "{migr}volatile" 1000
+    assert {[R $src cluster countkeysinslot $slot] == 20001}
+}
+
+test "MIGRATESLOT requires the slot to be in migrating state" {
+    catch {R $src cluster migrateslot $slot} e
+    assert_match {*not in migrating state*} $e
+}
+
+test "MIGRATESLOT moves all the keys of the slot" {
+    set src_id [R $src cluster myid]
+    set dst_id [R $dst cluster myid]
+    R $dst cluster setslot $slot importing $src_id
+    R $src cluster setslot $slot migrating $dst_id
+    R $src cluster migrateslot $slot
+
+    wait_for_condition 1000 50 {
+        [string match "*state=done*" [R $src cluster migrateslot status]]
+    } else {
+        fail "Slot migration not completed: [R $src cluster migrateslot status]"
+    }
+    assert {[R $src cluster countkeysinslot $slot] == 0}
+    assert {[R $dst cluster countkeysinslot $slot] == 20001}
+}
+
+test "Migrated keys keep their value and TTL" {
+    R $dst cluster setslot $slot node $dst_id
+    R $src cluster setslot $slot node $dst_id
+    assert {[R $dst lrange "{migr}list:1234" 0 -1] eq {1234}}
+    set ttl [R $dst ttl "{migr}volatile"]
+    assert {$ttl > 900 && $ttl <= 1000}
+}
+
+test "MIGRATESLOT CANCEL removes the job" {
+    R $src cluster migrateslot cancel $slot
+    assert {[R $src cluster migrateslot status] eq {}}
+}
@@ -0,0 +1,47 @@
+# Check that read only commands, executed by the worker threads, are
+# redirected like the commands executed by the server thread.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 2 nodes cluster" {
+    create_cluster 2 0
+}
+
+test "Cluster is up" {
+    assert_cluster_state ok
+}
+
+set slot [R 0 cluster keyslot "{wr}"]
+set owner 0
+if {[catch {R 0 set "{wr}key" foo}]} {set owner 1}
+set other [expr {1-$owner}]
+R $owner set "{wr}key" foo
+
+test "Reads against a slot served by another node get MOVED" {
+    catch {R $other get "{wr}key"} e
+    assert_match "MOVED $slot *:[get_instance_attrib redis $owner port]" $e
+    catch {R $other strlen "{wr}missing"} e
+    assert_match "MOVED $slot *" $e
+    assert {[R $owner get "{wr}key"] eq {foo}}
+}
+
+test "Reads of missing keys in a migrating slot get ASK" {
+    set owner_id [R $owner cluster myid]
+    set other_id [R $other cluster myid]
+    R $other cluster setslot $slot importing $owner_id
+    R $owner cluster setslot $slot migrating $other_id
+    catch {R $owner get "{wr}missing"} e
+    assert_match "ASK $slot *:[get_instance_attrib redis $other port]" $e
+    assert {[R $owner get "{wr}key"] eq {foo}}
+    catch {R $other get "{wr}missing"} e
+    assert_match "MOVED $slot *" $e
+    R $other asking
+    assert {[R $other get "{wr}missing"] eq {}}
+    R $owner cluster setslot $slot stable
+    R $other cluster setslot $slot stable
+}
+
+test "Multi keys reads across slots get CROSSSLOT" {
+    catch {R $owner mget "{wr}key" "{other}key"} e
+    assert_match {CROSSSLOT*} $e
+}
@@ -151,5 +151,38 @@ start_server {tags {"repl"}} {
                 fail "SPOP replication inconsistency"
             }
         }
+
+        test {Replication: the slave offset follows pipelined commands} {
+            # One write of many commands, inline and multibulk, that the
+            # master propagates back to back.
+            set proto "SELECT 9\r\n"
+            for {set j 0} {$j < 1000} {incr j} {
+                append proto "INCR pipelined\r\n"
+                append proto "*3\r\n\$4\r\nSADD\r\n\$5\r\npiped\r\n"
+                append proto "\$[string length $j]\r\n$j\r\n"
+            }
+            set fd [socket [srv -1 host] [srv -1 port]]
+            fconfigure $fd -translation binary
+            puts -nonewline $fd $proto
+            flush $fd
+            for {set j 0} {$j <= 2000} {incr j} {
+                gets $fd
+            }
+            close $fd
+
+            wait_for_condition 50 100 {
+                [status $slave slave_repl_offset] ==
+                [status $master master_repl_offset]
+            } else {
+                fail "The slave offset doesn't match the master's"
+            }
+            wait_for_condition 50 100 {
+                [string match "*offset=[status $master master_repl_offset],*" \
+                     [$master info replication]]
+            } else {
+                fail "The slave didn't acknowledge the master's offset"
+            }
+            list [$slave get pipelined] [$slave scard piped]
+        } {1000 1000}
     }
 }
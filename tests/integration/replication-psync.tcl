@@ -126,3 +126,91 @@ foreach diskless {no yes} {
         assert {[s -1 sync_partial_err] > 0}
     } $diskless 1
 }
+
+# The backlog and the slaves share the blocks of the replication stream.
+# Make the stream wrap a small backlog many times, then check that a PSYNC
+# is served from the blocks and that a lagging slave going away releases
+# the ones it holds. The link is broken by letting the master time out a
+# slave that sleeps, so the slave holds its blocks until it is dropped.
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master config set repl-diskless-sync yes
+    $master config set repl-diskless-sync-delay 0
+    $master config set repl-backlog-size 64kb
+    start_server {} {
+        set slave [srv 0 client]
+
+        test {PSYNC is served from the shared blocks after the backlog wrapped} {
+            $slave slaveof $master_host $master_port
+            wait_for_condition 50 100 {
+                [lindex [$slave role] 3] eq {connected}
+            } else {
+                fail "Slave not connected after some time"
+            }
+            set payload [string repeat x 100]
+            for {set j 0} {$j < 5000} {incr j} {
+                $master set key:$j $payload
+            }
+            set partial [status $master sync_partial_ok]
+
+            # Write to the master while the slave sleeps: the master drops
+            # it, and the slave asks for what it missed when it wakes up.
+            $master config set repl-timeout 1
+            set rd [redis_deferring_client]
+            $rd debug sleep 4
+            wait_for_condition 50 100 {
+                [status $master connected_slaves] == 0
+            } else {
+                fail "The master didn't drop the sleeping slave"
+            }
+            for {set j 0} {$j < 200} {incr j} {
+                $master set missed:$j $payload
+            }
+            assert_equal OK [$rd read]
+            $rd close
+
+            wait_for_condition 50 100 {
+                [status $master sync_partial_ok] > $partial &&
+                [lindex [$slave role] 3] eq {connected}
+            } else {
+                fail "The slave didn't partially resync"
+            }
+            $master config set repl-timeout 60
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Different dataset after the partial resync"
+            }
+        }
+
+        test {A lagging slave going away releases the blocks it holds} {
+            # The slave doesn't read while it sleeps, so its output keeps a
+            # reference to blocks the backlog alone would have released.
+            set payload [string repeat x 1000]
+            set rd [redis_deferring_client]
+            $rd debug sleep 6
+            for {set j 0} {$j < 5000} {incr j} {
+                $master set lagging:$j $payload
+            }
+            assert {[status $master repl_buffer_mem] > 1024*1024}
+            $master config set repl-timeout 1
+            wait_for_condition 50 100 {
+                [status $master repl_buffer_mem] < 128*1024
+            } else {
+                fail "The blocks of the slave were not released"
+            }
+            assert_equal OK [$rd read]
+            $rd close
+
+            $master config set repl-timeout 60
+            wait_for_condition 50 100 {
+                [lindex [$slave role] 3] eq {connected} &&
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "The slave didn't resync after being dropped"
+            }
+        }
+    }
+}
@@ -266,3 +266,144 @@ foreach dl {no yes} {
         }
     }
 }
+
+foreach mdl {no yes} {
+    foreach sdl {disabled swapdb} {
+        start_server {tags {"repl"}} {
+            set master [srv 0 client]
+            $master config set repl-diskless-sync $mdl
+            $master config set repl-diskless-sync-delay 1
+            set master_host [srv 0 host]
+            set master_port [srv 0 port]
+            $master debug populate 10000 master
+            $master set volatile 1
+            $master expire volatile 1000
+            start_server {} {
+                set slave [srv 0 client]
+                $slave config set repl-diskless-load $sdl
+                $slave set slave-only-key 1
+
+                test "Slave loads the RDB of the master, diskless=$mdl, repl-diskless-load=$sdl" {
+                    $slave slaveof $master_host $master_port
+                    wait_for_condition 500 100 {
+                        [lindex [$slave role] 3] eq {connected}
+                    } else {
+                        fail "Slave not connected after some time"
+                    }
+                    assert_equal [$master dbsize] [$slave dbsize]
+                    assert_equal [$master debug digest] [$slave debug digest]
+                    assert_equal 0 [$slave exists slave-only-key]
+                    assert {[$slave ttl volatile] > 0}
+                    assert_equal 0 [status $slave async_loading]
+
+                    # The stream of the master follows the payload.
+                    $master set after-sync 1
+                    wait_for_condition 50 100 {
+                        [$slave get after-sync] eq {1}
+                    } else {
+                        fail "Slave didn't get the writes after the sync"
+                    }
+                }
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    $master config set repl-diskless-sync yes
+    $master config set repl-diskless-sync-delay 0
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master debug populate 2000 master
+    $master set mykey new
+    start_server {} {
+        set slave [srv 0 client]
+        $slave config set repl-diskless-load swapdb
+        $slave config set loading-process-events-interval-bytes 1024
+        $slave config set key-load-delay 1000
+        $slave set mykey old
+
+        test {Slave serves reads from the old dataset during a swapdb load} {
+            $slave slaveof $master_host $master_port
+            wait_for_condition 100 50 {
+                [status $slave async_loading] eq 1
+            } else {
+                fail "Slave didn't start loading the RDB of the master"
+            }
+            assert_equal old [$slave get mykey]
+            assert_equal 0 [$slave exists master:0]
+            assert_equal 1 [$slave dbsize]
+
+            wait_for_condition 100 100 {
+                [status $slave async_loading] eq 0
+            } else {
+                fail "Slave didn't finish loading the RDB of the master"
+            }
+            assert_equal new [$slave get mykey]
+            assert_equal 2001 [$slave dbsize]
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    start_server {} {
+        set slave [srv 0 client]
+        $slave config set repl-apply-threads 4
+
+        test {Slave applies the stream of the master with repl-apply-threads} {
+            $slave slaveof $master_host $master_port
+            wait_for_condition 50 100 {
+                [lindex [$slave role] 3] eq {connected}
+            } else {
+                fail "Slave not connected after some time"
+            }
+
+            # Commands on single keys run on the apply threads, the others
+            # (SELECT, MULTI/EXEC, multi key DEL...) are barriers.
+            for {set j 0} {$j < 5000} {incr j} {
+                set k [expr {$j % 500}]
+                $master set key:$k $j
+                $master incr counter:$k
+                $master rpush list:$k $j
+                $master hincrby hash:$k field:[expr {$j % 7}] 1
+                $master zadd zset:$k [expr {$j % 97}] member:[expr {$j % 13}]
+                if {$j % 100 == 0} {
+                    $master select [expr {$j % 3}]
+                    $master multi
+                    $master incr counter:$k
+                    $master set key:$k multi
+                    $master exec
+                    $master del key:$k counter:[expr {$k + 1}]
+                }
+            }
+            $master select 9
+            wait_for_condition 50 100 {
+                [status $master master_repl_offset] eq
+                [status $slave slave_repl_offset]
+            } else {
+                fail "Slave didn't catch up with the master"
+            }
+            assert_equal [$master debug digest] [$slave debug digest]
+            assert {[status $slave slave_apply_parallel_cmds] > 0}
+            assert {[status $slave slave_apply_barriers] > 0}
+        }
+
+        test {repl-apply-threads can be changed at runtime} {
+            $slave config set repl-apply-threads 2
+            $master incr counter:0
+            $master set last 1
+            wait_for_condition 50 100 {
+                [$slave get last] eq {1}
+            } else {
+                fail "Slave didn't get the writes after the resize"
+            }
+            $slave config set repl-apply-threads 0
+            assert_equal 0 [status $slave slave_apply_threads]
+            assert_equal [$master debug digest] [$slave debug digest]
+        }
+    }
+}
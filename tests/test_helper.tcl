@@ -42,6 +42,7 @@ set ::all_tests {
     integration/convert-zipmap-hash-on-load
     integration/logging
     unit/pubsub
+    unit/tracking
     unit/slowlog
     unit/scripting
     unit/maxmemory
@@ -185,6 +185,16 @@ start_server {tags {"bitops"}} {
         }
     }
 
+    test {BITFIELD ops within a single byte of an existing value} {
+        r del bits
+        r setrange bits 1 [binary format c 0]
+        assert_equal {0} [r bitfield bits set u8 8 200]
+        assert_equal {11 203} [r bitfield bits incrby u4 12 3 get u8 8]
+        assert_equal {{}} [r bitfield bits overflow fail incrby u8 8 100]
+        assert_equal {203 204} [r bitfield bits get u16 0 incrby u16 0 1]
+        r strlen bits
+    } {2}
+
     test {BITFIELD regression for #3221} {
         r set bits 1
         r bitfield bits get u1 0
@@ -160,6 +160,24 @@ start_server {tags {"expire"}} {
         list $size1 $size2
     } {3 0}
 
+    test {Worker threads report the keys they actively expire} {
+        r flushdb
+        for {set j 0} {$j < 1000} {incr j} {
+            r psetex key:$j 100 a
+        }
+        wait_for_condition 50 100 {
+            [r dbsize] == 0
+        } else {
+            fail "Keys were not actively expired"
+        }
+        set expired 0
+        foreach {- n} [regexp -all -inline {expire_worker\d+:expired=(\d+)} \
+                           [r info stats]] {
+            incr expired $n
+        }
+        assert {$expired >= 1000}
+    }
+
     test {Redis should lazy expire keys} {
         r flushdb
         r debug set-active-expire 0
@@ -20,4 +20,139 @@ start_server {tags {"introspection"}} {
         r set key2 2
         r touch key0 key1 key2 key3
     } 2
+
+    test {OBJECT FREQ reports the LFU counter of a key} {
+        r config set maxmemory-policy allkeys-lfu
+        r set foo bar
+        assert_equal 5 [r object freq foo]
+        # With a log factor of 0 every access increments the counter.
+        r config set lfu-log-factor 0
+        for {set j 0} {$j < 100} {incr j} {
+            r get foo
+        }
+        r config set lfu-log-factor 10
+        assert_equal 105 [r object freq foo]
+        catch {r object idletime foo} e
+        assert_match {*LFU maxmemory policy is selected*} $e
+        r config set maxmemory-policy noeviction
+        catch {r object freq foo} e
+        set e
+    } {*LFU maxmemory policy is not selected*}
+}
+
+start_server {tags {"introspection threads"} overrides {threads_num 2}} {
+    test {CONFIG SET threads_num grows and shrinks the worker pool} {
+        r config set threads_num 4
+        assert_equal {threads_num 4} [r config get threads_num]
+        set clients {}
+        for {set j 0} {$j < 8} {incr j} {
+            set rd [redis [srv 0 host] [srv 0 port]]
+            $rd set key:$j $j
+            lappend clients $rd
+        }
+
+        # Clients of the removed workers move to the remaining one.
+        r config set threads_num 1
+        foreach rd $clients {$rd ping}
+        wait_for_condition 50 100 {
+            ![catch {r config set threads_num 2}]
+        } else {
+            fail "Removed worker threads didn't stop"
+        }
+        set j 0
+        foreach rd $clients {
+            assert_equal $j [$rd get key:$j]
+            $rd close
+            incr j
+        }
+        r config get threads_num
+    } {threads_num 2}
+
+    test {CONFIG SET threads_num closes clients stuck in a request} {
+        r config set threads_num 4
+        # Requests that never complete, on every worker.
+        set fds {}
+        for {set j 0} {$j < 4} {incr j} {
+            set fd [socket [srv 0 host] [srv 0 port]]
+            fconfigure $fd -translation binary -blocking 0
+            puts -nonewline $fd "*2\r\n\$3\r\nGET\r\n"
+            flush $fd
+            lappend fds $fd
+        }
+        after 100
+        r config set threads_num 1
+        wait_for_condition 100 100 {
+            ![catch {r config set threads_num 2}]
+        } else {
+            fail "Removed worker threads waited for their clients forever"
+        }
+        # Only the client of the remaining worker is still connected.
+        after 100
+        set open 0
+        foreach fd $fds {
+            read $fd
+            if {![eof $fd]} {incr open}
+            close $fd
+        }
+        set open
+    } {1}
+
+    test {CONFIG SET threads_num rejects out of range values} {
+        catch {r config set threads_num 0} e
+        assert_match {*Invalid argument*} $e
+        catch {r config set threads_num 257} e
+        assert_match {*Invalid argument*} $e
+        r config get threads_num
+    } {threads_num 2}
+
+    test {Commands spanning several reads are parsed by the worker threads} {
+        set fd [socket [srv 0 host] [srv 0 port]]
+        fconfigure $fd -translation binary
+        set cmd "*3\r\n\$3\r\nSET\r\n\$4\r\nspan\r\n\$5\r\nvalue\r\n"
+        for {set j 0} {$j < [string length $cmd]} {incr j 7} {
+            puts -nonewline $fd [string range $cmd $j [expr {$j+6}]]
+            flush $fd
+            after 20
+        }
+        gets $fd reply
+        assert_equal "+OK" [string trim $reply]
+        puts -nonewline $fd "*2\r\n\$3\r\nGET\r\n\$4\r\nspan\r\n"
+        flush $fd
+        gets $fd len
+        gets $fd reply
+        close $fd
+        string trim $reply
+    } {value}
+
+    test {Idle clients of the worker threads are closed on timeout} {
+        set rd [redis [srv 0 host] [srv 0 port]]
+        $rd ping
+        r config set timeout 1
+        # Keep our own client busy while the other one stays idle.
+        for {set j 0} {$j < 30} {incr j} {
+            r ping
+            after 100
+        }
+        r config set timeout 0
+        catch {$rd ping} e
+        $rd close
+        assert_match {*I/O error*} $e
+        r ping
+    } {PONG}
+
+    test {HOTKEYS reports the most accessed keys} {
+        r hotkeys reset
+        r config set hotkeys-sample-rate 1
+        for {set j 0} {$j < 100} {incr j} {
+            r get hotkey
+            if {$j % 4 == 0} {r set warmkey $j}
+            r get coldkey$j
+        }
+        r config set hotkeys-sample-rate 0
+        set top [r hotkeys count 2]
+        assert_equal {hotkey 100 warmkey 25} $top
+        assert {[s hotkeys_sampled] >= 225}
+        r hotkeys reset
+        r hotkeys
+    } {}
 }
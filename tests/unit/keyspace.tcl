@@ -24,6 +24,50 @@ start_server {tags {"keyspace"}} {
         lsort [r keys *]
     } {foo_a foo_b foo_c key_x key_y key_z}
 
+    test {KEYS with character classes, escapes and several stars} {
+        set res {}
+        foreach pattern {*_? ?ey_* *[xz] *[^a-x] foo_[a-b] *o*_* \\k*y_x
+                         key_x foo_c* *\\_*} {
+            lappend res [lsort [r keys $pattern]]
+        }
+        set res
+    } {{foo_a foo_b foo_c key_x key_y key_z} {key_x key_y key_z} {key_x key_z} {key_y key_z} {foo_a foo_b} {foo_a foo_b foo_c} key_x key_x foo_c {foo_a foo_b foo_c key_x key_y key_z}}
+
+    test {KEYS with and without keys-threads} {
+        r select 14
+        r flushdb
+        for {set j 0} {$j < 5000} {incr j} {
+            r set key:$j $j
+        }
+        set threaded [lsort [r keys key:*1?]]
+        r config set keys-threads 0
+        set inline [lsort [r keys key:*1?]]
+        r config set keys-threads 4
+        r flushdb
+        r select 9
+        list [llength $threaded] [expr {$threaded eq $inline}]
+    } {500 1}
+
+    test {KEYS walks a large keyspace by chunks while keys are deleted} {
+        r select 14
+        r flushdb
+        r debug populate 40000 stay
+        r debug populate 20000 gone
+        set rd [redis_deferring_client]
+        $rd select 14
+        $rd read
+        $rd keys *
+        for {set j 0} {$j < 20000} {incr j} {
+            r del gone:$j
+        }
+        set res [$rd read]
+        $rd close
+        r flushdb
+        r select 9
+        list [expr {[llength [lsort -unique $res]] == [llength $res]}] \
+             [llength [lsearch -all -inline $res stay:*]]
+    } {1 40000}
+
     test {DBSIZE} {
         r dbsize
     } {6}
@@ -41,6 +85,17 @@ start_server {tags {"keyspace"}} {
         r debug set-active-expire 1
     }
 
+    test {DELPREFIX deletes the keys starting with the prefix} {
+        r mset user:1 a user:2 b user:10 c users d use e other f
+        assert_equal 3 [r delprefix user:]
+        assert_equal {other use users} [lsort [r keys *]]
+        assert_equal 0 [r delprefix user:]
+        assert_error {*non empty*} {r delprefix ""}
+        assert_equal 2 [r delprefix use]
+        assert_equal 1 [r delprefix o]
+        r dbsize
+    } {0}
+
     test {EXISTS} {
         set res {}
         r set newkey test
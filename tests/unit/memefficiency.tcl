@@ -35,3 +35,86 @@ start_server {tags {"memefficiency"}} {
         }
     }
 }
+
+start_server {tags {"memefficiency"}} {
+    test {MEMORY USAGE of a missing key is nil} {
+        r del foo
+        r memory usage foo
+    } {}
+
+    test {MEMORY USAGE grows with the value size} {
+        r set small x
+        r set big [string repeat x 10000]
+        set small [r memory usage small]
+        set big [r memory usage big]
+        assert {$small > 0 && $small < 200}
+        assert {$big >= 10000 && $big < 11000}
+    }
+
+    test {MEMORY USAGE accounts every element with SAMPLES 0} {
+        r del myset
+        for {set j 0} {$j < 1000} {incr j} {
+            r sadd myset element:$j
+        }
+        assert_encoding hashtable myset
+        set usage [r memory usage myset samples 0]
+        assert {$usage > 1000*[string length element:000]}
+    }
+
+    test {MEMORY USAGE reports its key for the cluster redirection} {
+        list [r command getkeys memory usage small samples 5] \
+             [r command getkeys memory stats]
+    } {small {}}
+
+    test {MEMORY USAGE syntax errors} {
+        catch {r memory usage small samples -1} e1
+        catch {r memory usage small foo} e2
+        list $e1 $e2
+    } {{ERR syntax error} {ERR syntax error}}
+
+    test {MEMORY STATS reports keys, RCU backlog and threads} {
+        set stats [r memory stats]
+        assert {[dict get $stats keys.count] >= 3}
+        assert {[dict get $stats total.allocated] > 0}
+        assert {[dict exists $stats rcu.pending.bytes]}
+        assert {[dict exists $stats db.9]}
+        assert {[dict exists [dict get $stats db.9] lfht.buckets.main]}
+        assert {[dict exists [dict get $stats thread.server] clients.querybuf]}
+    }
+}
+
+start_server {tags {"memefficiency"}} {
+    test {INFO memory reports the RCU reclamation backlog} {
+        set info [r info memory]
+        assert_match {*rcu_pending_entries:*} $info
+        assert_match {*rcu_pending_bytes:*} $info
+        assert_match {*rcu_reclaim_throttled:*} $info
+    }
+
+    test {rcu-reclaim-max-memory bounds the RCU reclamation backlog} {
+        r config set rcu-reclaim-max-memory 100kb
+        set val [string repeat x 10000]
+        for {set j 0} {$j < 500} {incr j} {
+            r set key:[expr {$j % 10}] $val
+        }
+        assert {[s rcu_pending_bytes] < 200*1024}
+        assert {[s rcu_reclaim_throttled] > 0}
+        r config set rcu-reclaim-max-memory 0
+        r config get rcu-reclaim-max-memory
+    } {rcu-reclaim-max-memory 0}
+
+    test {INFO memory reports the allocator arena of every thread} {
+        if {[string match {*jemalloc*} [s mem_allocator]]} {
+            set info [r info memory]
+            assert_match {*mem_arena_server:arena=*frag_ratio=*} $info
+            assert_match {*mem_arena_worker0:arena=*} $info
+        }
+    }
+
+    test {MEMORY PURGE and the decay settings} {
+        r config set jemalloc-dirty-decay-ms 1000
+        catch {r config set jemalloc-muzzy-decay-ms -2} e
+        assert_match {*Invalid argument*} $e
+        r memory purge
+    } {OK}
+}
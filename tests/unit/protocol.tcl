@@ -68,6 +68,40 @@ start_server {tags {"protocol"}} {
         assert_error "*unbalanced*" {r read}
     }
 
+    test "Inline and multibulk commands pipelined in one write" {
+        reconnect
+        r write "SET pk1 a\r\n*3\r\n\$3\r\nSET\r\n\$3\r\npk2\r\n\$1\r\nb\r\n"
+        r write "GET pk1\r\n*2\r\n\$3\r\nGET\r\n\$3\r\npk2\r\nPING\r\n"
+        r flush
+        list [r read] [r read] [r read] [r read] [r read]
+    } {OK OK a b PONG}
+
+    test "Inline commands ending with a bare newline" {
+        reconnect
+        r write "SET pk3 c\nGET pk3\n*1\r\n\$4\r\nPING\r\nECHO d\n"
+        r flush
+        list [r read] [r read] [r read] [r read]
+    } {OK c PONG d}
+
+    test "Big argument after pipelined commands in the same buffer" {
+        reconnect
+        set big [string repeat x 100000]
+        set set "*3\r\n\$3\r\nSET\r\n\$5\r\npkbig\r\n\$100000\r\n$big\r\n"
+        r write "PING\r\nPING\r\n${set}STRLEN pkbig\r\n"
+        r flush
+        assert_equal {PONG PONG OK 100000} \
+            [list [r read] [r read] [r read] [r read]]
+
+        # The same with the big argument split over several reads.
+        r del pkbig
+        r write "PING\r\nPING\r\n[string range $set 0 50000]"
+        r flush
+        after 100
+        r write "[string range $set 50001 end]STRLEN pkbig\r\n"
+        r flush
+        list [r read] [r read] [r read] [r read] [r get pkbig]
+    } [list PONG PONG OK 100000 [string repeat x 100000]]
+
     set c 0
     foreach seq [list "\x00" "*\x00" "$\x00"] {
         incr c
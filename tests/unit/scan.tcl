@@ -237,3 +237,68 @@ start_server {tags {"scan"}} {
         assert {$first_score != 0}
     }
 }
+
+start_server {tags {"scan"} overrides {key-prefix-index yes}} {
+    test "SCAN MATCH with a literal prefix uses the key index" {
+        r flushdb
+        r debug populate 1000
+        r mset user:1 a user:2 b user:3 c
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r scan $cur match key:1* count 10]
+            set cur [lindex $res 0]
+            set page [lindex $res 1]
+            assert {[llength $page] <= 10}
+            lappend keys {*}$page
+            if {$cur == 0} break
+        }
+        # key:1, key:10..key:19, key:100..key:199, in order and once each
+        assert_equal 111 [llength $keys]
+        assert_equal [lsort $keys] $keys
+        assert_equal [lsort [r keys key:1*]] $keys
+    }
+
+    test "SCAN MATCH with the key index still matches the whole pattern" {
+        set res [r scan 0 match key:1?5 count 1000]
+        assert_equal 0 [lindex $res 0]
+        lsort [lindex $res 1]
+    } {key:105 key:115 key:125 key:135 key:145 key:155 key:165 key:175 key:185 key:195}
+
+    test "The key index follows deleted, expired and flushed keys" {
+        r del key:100
+        r debug set-active-expire 0
+        r psetex key:101 1 x
+        after 10
+        assert_equal {key:102 key:103 key:104 key:105 key:106 key:107 key:108 key:109} [lsort [r keys key:10?]]
+        r debug set-active-expire 1
+        assert_equal 3 [r delprefix user:]
+        assert_equal {} [r keys user:*]
+        r flushdb
+        r set key:1 x
+        assert_equal {0 key:1} [r scan 0 match key:* count 10]
+    }
+
+    test "KEYS and DELPREFIX walk the key index by chunks" {
+        r flushdb
+        for {set j 0} {$j < 3000} {incr j} {
+            r set big:$j x
+        }
+        r mset bif x bih x
+        assert_equal 3000 [llength [r keys big:*]]
+        assert_equal 300 [llength [r keys big:*5]]
+        r debug set-active-expire 0
+        r psetex big:x 1 x
+        after 10
+        assert_equal 3001 [r delprefix big:]
+        r debug set-active-expire 1
+        lsort [r keys *]
+    } {bif bih}
+
+    test "KEYS and SCAN without a literal prefix don't need the key index" {
+        r flushdb
+        r mset a1 x b1 x c2 x
+        assert_equal {a1 b1} [lsort [r keys *1]]
+        lsort [lindex [r scan 0 match *1 count 100] 1]
+    } {a1 b1}
+}
@@ -0,0 +1,62 @@
+start_server {tags {"tracking"}} {
+    # The invalidation messages are published on __redis__:invalidate, so
+    # the tracking client redirects them to a subscribed connection.
+    set rd [redis_deferring_client]
+    $rd client id
+    set redir [$rd read]
+    $rd subscribe __redis__:invalidate
+    $rd read ; # Consume the SUBSCRIBE reply.
+
+    test {Clients are able to enable tracking and redirect it} {
+        r CLIENT TRACKING on REDIRECT $redir
+    } {OK}
+
+    test {The other connection is able to get invalidations} {
+        r SET a 1
+        r GET a
+        r INCR a
+        r INCR b ; # This key should not be notified, since it wasn't fetched.
+        set keys [lindex [$rd read] 2]
+        assert {[llength $keys] == 1}
+        assert {[lindex $keys 0] eq {a}}
+    }
+
+    test {The client is now able to disable tracking} {
+        # Make sure to add a few more keys in the tracking list
+        # so that we can check for leaks, as a side effect.
+        r MGET a b c d e f g
+        r CLIENT TRACKING off
+    } {OK}
+
+    test {Invalidations are still sent for keys fetched before disabling} {
+        r SET c 1
+        set keys [lindex [$rd read] 2]
+        assert {[lindex $keys 0] eq {c}}
+    }
+
+    test {FLUSHALL sends a null invalidation} {
+        r CLIENT TRACKING on REDIRECT $redir
+        r GET a
+        r FLUSHALL
+        set msg [$rd read]
+        assert {[lindex $msg 0] eq {message}}
+        assert {[lindex $msg 2] eq {}}
+        r CLIENT TRACKING off
+    } {OK}
+
+    test {Tracking redirect to a client not subscribed is refused} {
+        set id [r CLIENT ID]
+        catch {r CLIENT TRACKING on REDIRECT $id} e
+        set e
+    } {*does not exist*}
+
+    test {Tracking keys are reported by INFO} {
+        r CLIENT TRACKING on REDIRECT $redir
+        r GET x
+        assert {[s tracking_total_keys] >= 1}
+        assert {[s tracking_clients] == 1}
+        r CLIENT TRACKING off
+    } {OK}
+
+    $rd close
+}
@@ -65,7 +65,7 @@ start_server {tags {"incr"}} {
         assert {[r object refcount foo] == 1}
     }
 
-    test {INCR can modify objects in-place} {
+    test {INCR replaces the object instead of modifying it in-place} {
         r set foo 20000
         r incr foo
         assert {[r object refcount foo] == 1}
@@ -74,8 +74,9 @@ start_server {tags {"incr"}} {
         set new [lindex [split [r debug object foo]] 1]
         assert {[string range $old 0 2] eq "at:"}
         assert {[string range $new 0 2] eq "at:"}
-        assert {$old eq $new}
-    }
+        assert {$old ne $new}
+        r get foo
+    } {20002}
 
     test {INCRBYFLOAT against non existing key} {
         r del novar
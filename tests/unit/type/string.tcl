@@ -337,6 +337,54 @@ start_server {tags {"string"}} {
         assert_error "*maximum allowed size*" {r setrange mykey [expr 512*1024*1024-4] world}
     }
 
+    test "APPEND against non-existing, string and integer-encoded keys" {
+        r del mykey
+        assert_equal 3 [r append mykey foo]
+        assert_equal 6 [r append mykey bar]
+        assert_equal "foobar" [r get mykey]
+
+        r set mykey 1234
+        assert_equal 7 [r append mykey 567]
+        assert_equal "1234567" [r get mykey]
+    }
+
+    test "Readers never see a partially written string" {
+        r del mykey
+        r setrange mykey 0 [string repeat a 4096]
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 1000} {incr j} {
+            $rd append mykey abcd
+            $rd setrange mykey 0 [string repeat [expr {$j % 2 ? "a" : "b"}] 4096]
+        }
+        for {set j 0} {$j < 200} {incr j} {
+            set val [r get mykey]
+            set head [string range $val 0 4095]
+            assert {$head eq [string repeat a 4096] ||
+                    $head eq [string repeat b 4096]}
+            assert {[regexp {^(abcd)*$} [string range $val 4096 end]]}
+        }
+        for {set j 0} {$j < 2000} {incr j} {
+            $rd read
+        }
+        $rd close
+        r strlen mykey
+    } [expr {4096 + 4000}]
+
+    test "APPEND to a large value is mostly done in place" {
+        r del mykey
+        r setrange mykey 0 [string repeat a 100000]
+        set addrs {}
+        for {set j 0} {$j < 1000} {incr j} {
+            r append mykey [string repeat b 100]
+            dict set addrs [lindex [split [r debug object mykey]] 1] 1
+        }
+        assert_equal 200000 [r strlen mykey]
+        assert_equal [string repeat b 100] [r getrange mykey -100 -1]
+        # A value is only copied when it runs out of room, and a copy
+        # doubles the room, so a handful of copies are enough.
+        assert {[dict size $addrs] <= 3}
+    }
+
     test "GETRANGE against non-existing key" {
         r del mykey
         assert_equal "" [r getrange mykey 0 -1]
@@ -0,0 +1,198 @@
+#!/usr/bin/env tclsh8.5
+# Thread scaling regression suite.
+#
+# Starts redis-server with different threads_num values and runs the same set
+# of workloads against every configuration using redis-benchmark. Results are
+# printed as CSV, one line per (threads_num, workload), so that two runs (for
+# instance before and after a change to the worker threads or to q_dict) can
+# be compared with --compare.
+#
+# Usage: tclsh utils/thread-scaling.tcl [options] (or: make bench-scaling)
+
+set ::srcdir [file normalize [file join [file dirname [info script]] .. src]]
+source [file join $::srcdir .. tests support redis.tcl]
+
+set ::port 12124
+set ::threads {1 2 4 8 16}
+set ::workloads {get set mixed pipeline mget}
+set ::requests 200000
+set ::clients 64
+set ::bench_threads 4
+set ::keyspace 100000
+set ::datasize 16
+set ::pipeline 16
+set ::output {}
+set ::compare {}
+
+# Workload name -> redis-benchmark arguments. Every workload uses random keys
+# in the preloaded keyspace, so reads always hit.
+proc workload-args name {
+    set common [list -r $::keyspace -d $::datasize]
+    switch $name {
+        get {return [concat $common -t get]}
+        set {return [concat $common -t set]}
+        mixed {return [concat $common -t mixed --ratio 9:1]}
+        pipeline {return [concat $common -t get -P $::pipeline]}
+        mget {
+            set cmd {mget}
+            for {set j 0} {$j < 10} {incr j} {lappend cmd key:__rand_int__}
+            return [concat $common $cmd]
+        }
+        default {error "Unknown workload $name"}
+    }
+}
+
+proc start-server threads_num {
+    set pid [exec $::srcdir/redis-server --port $::port \
+        --threads_num $threads_num --save "" --appendonly no \
+        --loglevel warning > /dev/null 2> /dev/null &]
+    for {set retry 0} {$retry < 100} {incr retry} {
+        if {![catch {
+            set r [redis 127.0.0.1 $::port]
+            $r ping
+            $r close
+        }]} {
+            return $pid
+        }
+        after 100
+    }
+    catch {exec kill -9 $pid}
+    error "Server with threads_num $threads_num didn't start"
+}
+
+proc stop-server pid {
+    catch {exec kill -9 $pid}
+    # Wait for the port to be free before starting the next server.
+    for {set retry 0} {$retry < 50} {incr retry} {
+        if {[catch {redis 127.0.0.1 $::port} r]} return
+        catch {$r close}
+        after 100
+    }
+}
+
+proc benchmark args {
+    exec $::srcdir/redis-benchmark -p $::port -c $::clients \
+        --threads $::bench_threads -n $::requests --csv --percentiles {*}$args
+}
+
+# Parse the last CSV line produced by redis-benchmark: title, requests per
+# second, p50, p99, p99.9 and max latency in milliseconds.
+proc parse-csv output {
+    set line [lindex [split [string trim $output] "\n"] end]
+    set fields {}
+    foreach f [lrange [split $line ","] end-4 end] {
+        lappend fields [string trim $f \"]
+    }
+    return $fields
+}
+
+# Set every key of the keyspace, in order, with the names redis-benchmark -r
+# uses, so that read workloads never hit an empty key.
+proc preload {} {
+    set r [redis 127.0.0.1 $::port]
+    set value [string repeat x $::datasize]
+    for {set j 0} {$j < $::keyspace} {incr j 1000} {
+        set args {}
+        for {set k $j} {$k < $j + 1000 && $k < $::keyspace} {incr k} {
+            lappend args [format key:%012d $k] $value
+        }
+        $r mset {*}$args
+    }
+    $r close
+}
+
+proc run-suite {} {
+    set results {}
+    foreach t $::threads {
+        puts stderr "threads_num $t: starting server"
+        set pid [start-server $t]
+        preload
+        foreach w $::workloads {
+            puts stderr "threads_num $t: running $w"
+            set fields [parse-csv [benchmark {*}[workload-args $w]]]
+            lappend results [concat $t $w $fields]
+        }
+        stop-server $pid
+    }
+    return $results
+}
+
+proc load-csv file {
+    set res {}
+    set fd [open $file]
+    foreach line [split [read $fd] "\n"] {
+        if {$line eq {} || [string match threads_num* $line]} continue
+        set f [split $line ","]
+        dict set res [lindex $f 0],[lindex $f 1] $f
+    }
+    close $fd
+    return $res
+}
+
+proc main {} {
+    set results [run-suite]
+    set csv "threads_num,workload,rps,p50_ms,p99_ms,p999_ms,max_ms\n"
+    foreach r $results {append csv [join $r ","] "\n"}
+    puts -nonewline $csv
+    if {$::output ne {}} {
+        set fd [open $::output w]
+        puts -nonewline $fd $csv
+        close $fd
+    }
+
+    if {$::compare ne {}} {
+        set old [load-csv $::compare]
+        puts "\n# Compared with $::compare (rps and p99 change)"
+        foreach r $results {
+            lassign $r t w rps p50 p99
+            if {![dict exists $old $t,$w]} continue
+            lassign [dict get $old $t,$w] - - orps - op99
+            puts [format "%-3s %-10s rps %10.2f -> %10.2f (%+6.1f%%)  p99 %7.3f -> %7.3f" \
+                $t $w $orps $rps [expr {($rps-$orps)*100.0/$orps}] $op99 $p99]
+        }
+    }
+}
+
+# Make sure there is not already a server running on our port.
+if {![catch {redis 127.0.0.1 $::port} r]} {
+    puts stderr "Sorry, you have a running server on port $::port"
+    exit 1
+}
+
+for {set j 0} {$j < [llength $argv]} {incr j} {
+    set opt [lindex $argv $j]
+    set arg [lindex $argv [expr $j+1]]
+    if {$opt eq {--threads}} {
+        set ::threads [split $arg ,]
+    } elseif {$opt eq {--workloads}} {
+        set ::workloads [split $arg ,]
+    } elseif {$opt eq {--requests}} {
+        set ::requests $arg
+    } elseif {$opt eq {--clients}} {
+        set ::clients $arg
+    } elseif {$opt eq {--bench-threads}} {
+        set ::bench_threads $arg
+    } elseif {$opt eq {--keyspace}} {
+        set ::keyspace $arg
+    } elseif {$opt eq {--datasize}} {
+        set ::datasize $arg
+    } elseif {$opt eq {--pipeline}} {
+        set ::pipeline $arg
+    } elseif {$opt eq {--port}} {
+        set ::port $arg
+    } elseif {$opt eq {--output}} {
+        set ::output $arg
+    } elseif {$opt eq {--compare}} {
+        set ::compare $arg
+    } else {
+        puts "Wrong argument: $opt"
+        puts "Options: --threads 1,2,4 --workloads get,set,mixed,pipeline,mget"
+        puts "         --requests <n> --clients <n> --bench-threads <n>"
+        puts "         --keyspace <n> --datasize <bytes> --pipeline <n>"
+        puts "         --port <port> --output <file.csv> --compare <old.csv>"
+        exit 1
+    }
+    incr j
+}
+
+main